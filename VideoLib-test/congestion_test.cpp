@@ -0,0 +1,209 @@
+#include "pch.h"
+
+#include "../VideoLib/network.h"
+#include "../VideoLib/congestion.h"
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+using namespace net;
+
+constexpr uint32_t testMediaSsrc = 0x1234'5678;
+constexpr uint32_t testFeedbackSsrc = 0x0BAD'F00D;
+constexpr uint32_t testPacketSize = 1200;
+constexpr uint64_t testPacketIntervalNs = 1'000'000;
+constexpr uint64_t testFeedbackIntervalNs = 50'000'000;
+constexpr uint64_t testPropagationNs = 20'000'000;
+
+// Sender following controller's target, one bottleneck and receiver reporting every 50 ms, all on simulated clock.
+// Bottleneck serves packets in order at its capacity, so queueing delay grows whenever sender is faster. Which
+// packets get lost is chosen by the test, they are dropped before the bottleneck.
+class SyntheticLink {
+public:
+	explicit SyntheticLink(CongestionController& controller) :
+		controller(controller) {}
+
+	// Every 'lossEvery'-th packet is lost, 0 loses none
+	void run(const uint64_t durationNs, const uint64_t capacity, const uint32_t lossEvery = 0) {
+		uint64_t end = now + durationNs;
+		while (now < end) {
+			uint64_t intervalNs = testPacketSize * 8'000'000'000ull / controller.targetBitrate();
+			for (; nextSendNs < now + testFeedbackIntervalNs; nextSendNs += intervalNs) {
+				if (lossEvery > 0 && ++sent % lossEvery == 0) {
+					inFlight.push_back(PacketResult{ nextSendNs, 0, testPacketSize, false });
+					continue;
+				}
+				linkFreeNs = (std::max)(linkFreeNs, nextSendNs) + testPacketSize * 8'000'000'000ull / capacity;
+				inFlight.push_back(PacketResult{ nextSendNs, static_cast<int64_t>(linkFreeNs + testPropagationNs), testPacketSize, true });
+			}
+			now += testFeedbackIntervalNs;
+			// Receiver reports what arrived so far, lost packets once the next one shows up
+			std::vector<PacketResult> results;
+			while (!inFlight.empty() && inFlight.front().arrivalNs <= static_cast<int64_t>(now)) {
+				results.push_back(inFlight.front());
+				inFlight.pop_front();
+			}
+			controller.onPacketResults(std::move(results), now, 2 * testPropagationNs);
+			if (controller.usage() == BandwidthUsage::overusing) {
+				overuseSeen = true;
+			}
+		}
+	}
+
+	uint64_t now = 1'000'000'000;
+	bool overuseSeen = false;
+private:
+	CongestionController& controller;
+	std::deque<PacketResult> inFlight;
+	uint64_t nextSendNs = now;
+	uint64_t linkFreeNs = 0;
+	uint64_t sent = 0;
+};
+
+static std::vector<char> rtpPacket(const uint16_t seqNum) {
+	std::vector<char> packet(testPacketSize, 0);
+	RTPHeader header{ .payloadType = 96, .seqNum = seqNum, .timestamp = seqNum * 90u, .ssrc = testMediaSsrc };
+	writeRTPHeader(header, packet.data());
+	return packet;
+}
+
+TEST(CongestionTests, FeedbackRoundTrip) {
+	CongestionController controller{ CongestionSettings{ .startBitrate = 5'000'000 } };
+	CongestionFeedback feedback{ testFeedbackSsrc };
+	std::vector<char> report;
+	constexpr uint64_t start = 1'000'000'000;
+	EXPECT_FALSE(feedback.build(report, start));
+
+	// 40 packets 1 ms apart across seqnum wrap, every 4th lost (never the last, receiver would not know about it),
+	// all the others take 10 ms
+	for (uint16_t i = 0; i < 40; i++) {
+		auto seqNum = static_cast<uint16_t>(65'520 + i);
+		auto packet = rtpPacket(seqNum);
+		uint64_t sentNs = start + i * testPacketIntervalNs;
+		controller.onPacketSent(packet.data(), static_cast<int>(packet.size()), sentNs);
+		if (i % 4 != 1) {
+			feedback.onPacket(testMediaSsrc, seqNum, sentNs + 10'000'000);
+		}
+	}
+	uint64_t reportNs = start + 39 * testPacketIntervalNs + 10'000'000 + 5'000'000;
+	ASSERT_TRUE(feedback.build(report, reportNs));
+	std::vector<char> empty;
+	EXPECT_FALSE(feedback.build(empty, reportNs));
+	// Header, media SSRC block with 40 metrics and report timestamp, RTCP length is in words less one
+	ASSERT_EQ(report.size(), 8 + 8 + 40 * 2 + 4);
+	EXPECT_EQ(static_cast<uint8_t>(report[0]), 0x80 | congestionFeedbackFormat);
+	EXPECT_EQ(static_cast<uint8_t>(report[1]), rtcpFeedbackType);
+	EXPECT_EQ(((static_cast<uint8_t>(report[2]) << 8) | static_cast<uint8_t>(report[3])), static_cast<int>(report.size() / 4 - 1));
+	EXPECT_TRUE(isRTCPPacket(report.data(), static_cast<int>(report.size())));
+
+	// Feedback leaves receiver 10 ms after it was built
+	ASSERT_TRUE(controller.onFeedback(report.data(), static_cast<int>(report.size()), reportNs + 10'000'000));
+	EXPECT_NEAR(controller.lossFraction(), 0.25, 1e-9);
+	EXPECT_LT(controller.lossBasedBitrate(), 5'000'000);
+	// Round trip is 10 ms there and 10 ms back, arrival offsets are rounded down to 1/1024 s
+	EXPECT_GE(controller.rttNs(), 20'000'000);
+	EXPECT_LE(controller.rttNs(), 21'000'000);
+
+	// Same packets are not counted twice
+	uint64_t lossBased = controller.lossBasedBitrate();
+	EXPECT_TRUE(controller.onFeedback(report.data(), static_cast<int>(report.size()), reportNs + 300'000'000));
+	EXPECT_EQ(controller.lossBasedBitrate(), lossBased);
+}
+
+TEST(CongestionTests, FeedbackParserRejectsOtherPackets) {
+	CongestionController controller{};
+	auto media = rtpPacket(1);
+	EXPECT_FALSE(controller.onFeedback(media.data(), static_cast<int>(media.size()), 0));
+
+	std::vector<char> receiverReport;
+	int size = writeRTCPReport(RTCPReport{ .ssrc = testFeedbackSsrc, .blocks = { RTCPReportBlock{ .ssrc = testMediaSsrc } } }, receiverReport);
+	EXPECT_FALSE(controller.onFeedback(receiverReport.data(), size, 0));
+
+	CongestionFeedback feedback{ testFeedbackSsrc };
+	feedback.onPacket(testMediaSsrc, 7, 1'000'000'000);
+	std::vector<char> report;
+	ASSERT_TRUE(feedback.build(report, 1'000'000'000));
+	// Length field promising more than datagram holds
+	EXPECT_FALSE(controller.onFeedback(report.data(), static_cast<int>(report.size()) - 4, 1'000'000'000));
+	// Metric block claiming more reports than there are
+	auto truncated = report;
+	truncated[15] = 100;
+	EXPECT_FALSE(controller.onFeedback(truncated.data(), static_cast<int>(truncated.size()), 1'000'000'000));
+	EXPECT_EQ(controller.targetBitrate(), CongestionSettings{}.startBitrate);
+}
+
+TEST(CongestionTests, FeedbackReportsReorderedPacketsLost) {
+	CongestionFeedback feedback{ testFeedbackSsrc };
+	std::vector<char> report;
+	feedback.onPacket(testMediaSsrc, 10, 1'000'000'000);
+	feedback.onPacket(testMediaSsrc, 12, 1'001'000'000);
+	ASSERT_TRUE(feedback.build(report, 1'002'000'000));
+	// Three metrics, 11 reported lost, padded to whole word
+	ASSERT_EQ(report.size(), 8 + 8 + 4 * 2 + 4);
+	EXPECT_NE(static_cast<uint8_t>(report[16]) & 0x80, 0);
+	EXPECT_EQ(static_cast<uint8_t>(report[18]) & 0x80, 0);
+	EXPECT_NE(static_cast<uint8_t>(report[20]) & 0x80, 0);
+
+	// Late packet 11 is not reported again
+	feedback.onPacket(testMediaSsrc, 11, 1'003'000'000);
+	EXPECT_FALSE(feedback.build(report, 1'004'000'000));
+}
+
+TEST(CongestionTests, DelayGrowthLowersRateAndItRecovers) {
+	CongestionController controller{ CongestionSettings{ .startBitrate = 5'000'000 } };
+	SyntheticLink link{ controller };
+
+	link.run(3'000'000'000, 20'000'000);
+	uint64_t steady = controller.delayBasedBitrate();
+	EXPECT_GT(steady, 5'000'000);
+	EXPECT_FALSE(link.overuseSeen);
+
+	// Bottleneck drops to 3 Mbit/s, queue grows until sender backs off below it
+	link.run(2'000'000'000, 3'000'000);
+	uint64_t congested = controller.delayBasedBitrate();
+	EXPECT_TRUE(link.overuseSeen);
+	EXPECT_LT(congested, 3'000'000);
+	EXPECT_EQ(controller.targetBitrate(), congested);
+
+	// Capacity comes back, once queue drained estimate probes upwards again and passes old bottleneck
+	link.run(5'000'000'000, 20'000'000);
+	EXPECT_NE(controller.usage(), BandwidthUsage::overusing);
+	EXPECT_GT(controller.delayBasedBitrate(), congested * 12 / 10);
+	EXPECT_GT(controller.delayBasedBitrate(), 3'000'000);
+}
+
+TEST(CongestionTests, LossLowersRateAndItRecovers) {
+	CongestionController controller{ CongestionSettings{ .startBitrate = 5'000'000 } };
+	SyntheticLink link{ controller };
+
+	// Every 4th packet lost, well above 10%
+	link.run(1'000'000'000, 100'000'000, 4);
+	uint64_t lossy = controller.lossBasedBitrate();
+	EXPECT_NEAR(controller.lossFraction(), 0.25, 0.01);
+	EXPECT_LT(lossy, 5'000'000 * 8 / 10);
+	EXPECT_EQ(controller.targetBitrate(), lossy);
+
+	// 5% loss is between both thresholds, loss based estimate holds once window holds no older losses
+	link.run(300'000'000, 100'000'000, 20);
+	lossy = controller.lossBasedBitrate();
+	link.run(1'000'000'000, 100'000'000, 20);
+	EXPECT_GT(controller.lossFraction(), 0.02);
+	EXPECT_LT(controller.lossFraction(), 0.1);
+	EXPECT_EQ(controller.lossBasedBitrate(), lossy);
+
+	link.run(2'000'000'000, 100'000'000);
+	EXPECT_EQ(controller.lossFraction(), 0.0);
+	EXPECT_GT(controller.targetBitrate(), lossy * 12 / 10);
+}
+
+TEST(CongestionTests, RateStaysWithinSettings) {
+	CongestionSettings settings{ .startBitrate = 300'000, .minBitrate = 200'000, .maxBitrate = 400'000 };
+	CongestionController controller{ settings };
+	SyntheticLink link{ controller };
+
+	link.run(5'000'000'000, 100'000'000);
+	EXPECT_EQ(controller.targetBitrate(), settings.maxBitrate);
+	link.run(2'000'000'000, 100'000'000, 2);
+	EXPECT_EQ(controller.targetBitrate(), settings.minBitrate);
+}
@@ -0,0 +1,164 @@
+#include "pch.h"
+
+#include "../VideoLib/network.h"
+
+#include <vector>
+
+using namespace net;
+
+constexpr uint32_t testSsrc = 0x1234'5678;
+// Arrival times are passed in, so clock starts far from zero like steady_clock does
+constexpr uint64_t testBaseNs = 1'000'000'000;
+constexpr uint32_t testFrameTicks = 3000;				// 30 fps on 90 kHz clock
+constexpr uint64_t testFrameNs = 33'333'333;
+
+static std::vector<char> makePacket(const uint16_t seqNum, const uint32_t timestamp, const uint32_t ssrc = testSsrc) {
+	RTPHeader header;
+	header.payloadType = 96;
+	header.ssrc = ssrc;
+	header.seqNum = seqNum;
+	header.timestamp = timestamp;
+	std::vector<char> packet(rtpHeaderSize + 4, 'p');
+	writeRTPHeader(header, packet.data());
+	return packet;
+}
+
+static bool push(JitterBuffer& buffer, const uint16_t seqNum, const uint32_t timestamp, const uint64_t arrivalNs, const uint32_t ssrc = testSsrc) {
+	auto packet = makePacket(seqNum, timestamp, ssrc);
+	return buffer.push(packet.data(), static_cast<int>(packet.size()), arrivalNs);
+}
+
+// Returns seqnum of popped packet or -1 when nothing is due
+static int pop(JitterBuffer& buffer, const uint64_t nowNs) {
+	std::vector<char> packet;
+	if (!buffer.pop(packet, nowNs)) {
+		return -1;
+	}
+	RTPHeader header;
+	int payloadSize = 0;
+	EXPECT_NE(readRTPHeader(packet.data(), static_cast<int>(packet.size()), header, payloadSize), 0);
+	return header.seqNum;
+}
+
+TEST(JitterBufferTests, SteadyStreamPlaysAfterMinimumDelay) {
+	JitterBuffer buffer;
+	const uint64_t transit = testBaseNs + 10'000'000;
+	ASSERT_TRUE(push(buffer, 10, 0, transit));
+	ASSERT_TRUE(push(buffer, 11, testFrameTicks, transit + testFrameNs));
+
+	uint64_t minDelay = JitterBufferSettings{}.minDelayNs;
+	EXPECT_EQ(pop(buffer, transit + minDelay - 1), -1);
+	EXPECT_EQ(pop(buffer, transit + minDelay), 10);
+	EXPECT_EQ(pop(buffer, transit + testFrameNs + minDelay - 1), -1);
+	EXPECT_EQ(pop(buffer, transit + testFrameNs + minDelay), 11);
+	EXPECT_EQ(buffer.jitterNs(), 0u);
+	EXPECT_EQ(buffer.delayNs(), minDelay);
+	EXPECT_EQ(buffer.stats().packetsPlayed, 2u);
+	EXPECT_EQ(buffer.size(), 0u);
+}
+
+TEST(JitterBufferTests, DelayFollowsJitterUpToMaximum) {
+	JitterBuffer unbounded;
+	JitterBuffer bounded{ JitterBufferSettings{ .maxDelayNs = 20'000'000 } };
+	for (uint16_t i = 0; i < 100; i++) {
+		// Every other packet is 8 ms late
+		uint64_t arrival = testBaseNs + i * testFrameNs + ((i % 2) ? 8'000'000 : 0);
+		push(unbounded, i, i * testFrameTicks, arrival);
+		push(bounded, i, i * testFrameTicks, arrival);
+	}
+	EXPECT_GT(unbounded.jitterNs(), 7'000'000u);
+	EXPECT_LE(unbounded.jitterNs(), 8'000'000u);
+	EXPECT_GE(unbounded.delayNs(), 4 * 7'000'000u);
+	EXPECT_EQ(bounded.delayNs(), 20'000'000u);
+}
+
+TEST(JitterBufferTests, LatePacketStretchesDelay) {
+	JitterBuffer buffer;
+	ASSERT_TRUE(push(buffer, 10, 0, testBaseNs));
+	ASSERT_EQ(pop(buffer, testBaseNs + 5'000'000), 10);
+
+	// Packet 9 of the same frame comes 50 ms after its frame, its slot is long gone
+	EXPECT_FALSE(push(buffer, 9, 0, testBaseNs + 50'000'000));
+	EXPECT_EQ(buffer.stats().late, 1u);
+	// Jitter 50/16 ms asks for 12.5 ms, packet missed that by 37.5 ms, so it would just make it now
+	EXPECT_EQ(buffer.delayNs(), 50'000'000u);
+}
+
+TEST(JitterBufferTests, ReorderedPacketIsPlayedInOrder) {
+	JitterBuffer buffer;
+	ASSERT_TRUE(push(buffer, 10, 0, testBaseNs));
+	ASSERT_TRUE(push(buffer, 12, 0, testBaseNs + 1'000'000));
+	ASSERT_TRUE(push(buffer, 11, 0, testBaseNs + 2'000'000));
+	EXPECT_FALSE(push(buffer, 11, 0, testBaseNs + 3'000'000));
+
+	uint64_t now = testBaseNs + 100'000'000;
+	EXPECT_EQ(pop(buffer, now), 10);
+	EXPECT_EQ(pop(buffer, now), 11);
+	EXPECT_EQ(pop(buffer, now), 12);
+	EXPECT_EQ(pop(buffer, now), -1);
+	EXPECT_EQ(buffer.stats().duplicates, 1u);
+	EXPECT_EQ(buffer.stats().lost, 0u);
+}
+
+TEST(JitterBufferTests, MissingPacketIsReleasedWhenNextIsDue) {
+	JitterBuffer buffer;
+	ASSERT_TRUE(push(buffer, 10, 0, testBaseNs));
+	ASSERT_TRUE(push(buffer, 12, 2 * testFrameTicks, testBaseNs + 2 * testFrameNs));
+	EXPECT_EQ(pop(buffer, testBaseNs + 5'000'000), 10);
+
+	// Packet 11 may still come until packet 12 is due
+	uint64_t due12 = testBaseNs + 2 * testFrameNs + 5'000'000;
+	EXPECT_EQ(pop(buffer, due12 - 1), -1);
+	EXPECT_EQ(buffer.stats().lost, 0u);
+	EXPECT_EQ(buffer.size(), 1u);
+	EXPECT_EQ(pop(buffer, due12), 12);
+	EXPECT_EQ(buffer.stats().lost, 1u);
+
+	EXPECT_FALSE(push(buffer, 11, testFrameTicks, due12 + 1));
+	EXPECT_EQ(buffer.stats().late, 1u);
+	EXPECT_EQ(buffer.stats().lost, 1u);
+}
+
+TEST(JitterBufferTests, LossIsCountedAcrossSeqNumWrap) {
+	JitterBuffer buffer;
+	ASSERT_TRUE(push(buffer, 65533, 0, testBaseNs));
+	ASSERT_TRUE(push(buffer, 0, 3 * testFrameTicks, testBaseNs + 3 * testFrameNs));
+	ASSERT_TRUE(push(buffer, 1, 4 * testFrameTicks, testBaseNs + 4 * testFrameNs));
+
+	EXPECT_EQ(pop(buffer, testBaseNs + 5'000'000), 65533);
+	EXPECT_EQ(pop(buffer, testBaseNs + 5'000'000), -1);
+	uint64_t now = testBaseNs + 4 * testFrameNs + 5'000'000;
+	EXPECT_EQ(pop(buffer, now), 0);
+	EXPECT_EQ(pop(buffer, now), 1);
+	EXPECT_EQ(buffer.stats().lost, 2u);
+	EXPECT_EQ(buffer.stats().resets, 0u);
+}
+
+TEST(JitterBufferTests, AheadWindowIsBoundedByCapacity) {
+	JitterBuffer buffer{ JitterBufferSettings{ .capacity = 16 } };
+	ASSERT_TRUE(push(buffer, 100, 0, testBaseNs));
+	ASSERT_TRUE(push(buffer, 115, 0, testBaseNs));
+	EXPECT_EQ(buffer.size(), 2u);
+	EXPECT_EQ(buffer.stats().resets, 0u);
+
+	// One past the ring restarts at the new packet, everything buffered would never be played in order
+	ASSERT_TRUE(push(buffer, 116, 0, testBaseNs));
+	EXPECT_EQ(buffer.stats().resets, 1u);
+	EXPECT_EQ(buffer.size(), 1u);
+
+	// Anything in the half of seqnum space behind head is late, not far ahead
+	EXPECT_FALSE(push(buffer, 115, 0, testBaseNs));
+	EXPECT_FALSE(push(buffer, static_cast<uint16_t>(116 + 0x8000), 0, testBaseNs));
+	EXPECT_EQ(buffer.stats().late, 2u);
+	EXPECT_EQ(buffer.stats().resets, 1u);
+	EXPECT_EQ(pop(buffer, testBaseNs + 5'000'000), 116);
+}
+
+TEST(JitterBufferTests, NewSsrcResetsBuffer) {
+	JitterBuffer buffer;
+	ASSERT_TRUE(push(buffer, 10, 0, testBaseNs));
+	ASSERT_TRUE(push(buffer, 500, 0, testBaseNs, testSsrc + 1));
+	EXPECT_EQ(buffer.stats().resets, 1u);
+	EXPECT_EQ(buffer.size(), 1u);
+	EXPECT_EQ(pop(buffer, testBaseNs + 5'000'000), 500);
+}
@@ -0,0 +1,161 @@
+#include "pch.h"
+
+#include "../VideoLib/network.h"
+
+#include <WS2tcpip.h>
+
+#include <vector>
+#include <cstring>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+using namespace net;
+
+// 8 Mbit/s is one byte per microsecond, so datagram sizes read as microseconds of pacing
+constexpr uint64_t testRate = 8'000'000;
+constexpr int testDatagramSize = 1000;
+
+struct SentDatagram {
+	uint32_t index;
+	uint64_t sentNs;
+};
+
+// Pacer sends through a session connected to a loopback socket nobody reads, the sent observer is what tests check
+class PacerTests : public testing::Test {
+protected:
+	void SetUp() override {
+		WSADATA wsaData;
+		ASSERT_EQ(WSAStartup(MAKEWORD(2, 2), &wsaData), 0);
+		sink = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		ASSERT_NE(sink, INVALID_SOCKET);
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		ASSERT_NE(bind(sink, reinterpret_cast<sockaddr*>(&address), sizeof(address)), SOCKET_ERROR);
+		int length = sizeof(address);
+		ASSERT_NE(getsockname(sink, reinterpret_cast<sockaddr*>(&address), &length), SOCKET_ERROR);
+		session = std::make_unique<PeerSession>("127.0.0.1", ntohs(address.sin_port));
+		ASSERT_TRUE(session->open());
+	}
+
+	void TearDown() override {
+		session.reset();
+		if (sink != INVALID_SOCKET) {
+			closesocket(sink);
+		}
+		WSACleanup();
+	}
+
+	void observe(Pacer& pacer) {
+		pacer.setSentObserver([this](const char* data, const int size, const uint64_t sentNs) {
+			uint32_t index = 0;
+			std::memcpy(&index, data, sizeof(index));
+			std::lock_guard lock(mutex);
+			sent.push_back({ index, sentNs });
+		});
+	}
+
+	static void enqueue(Pacer& pacer, const uint32_t count, const int size = testDatagramSize) {
+		std::vector<char> datagram(size);
+		for (uint32_t i = 0; i < count; i++) {
+			std::memcpy(datagram.data(), &i, sizeof(i));
+			ASSERT_TRUE(pacer.enqueue(datagram.data(), size));
+		}
+	}
+
+	std::vector<SentDatagram> waitSent(const size_t count, const std::chrono::milliseconds timeout = std::chrono::seconds(2)) {
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		while (std::chrono::steady_clock::now() < deadline) {
+			{
+				std::lock_guard lock(mutex);
+				if (sent.size() >= count) {
+					return sent;
+				}
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		std::lock_guard lock(mutex);
+		return sent;
+	}
+
+	SOCKET sink = INVALID_SOCKET;
+	std::unique_ptr<PeerSession> session;
+	std::mutex mutex;
+	std::vector<SentDatagram> sent;
+};
+
+TEST_F(PacerTests, QueueIsBoundedByCapacity) {
+	Pacer pacer{ *session, testRate, 15000, 4 };
+	enqueue(pacer, 4);
+	char datagram[testDatagramSize]{};
+	EXPECT_FALSE(pacer.enqueue(datagram, testDatagramSize));
+	EXPECT_EQ(pacer.queueDepth(), 4u);
+	EXPECT_EQ(pacer.queuedBytes(), 4u * testDatagramSize);
+	EXPECT_EQ(pacer.dropped(), 1u);
+}
+
+TEST_F(PacerTests, BacklogFollowsRate) {
+	Pacer pacer{ *session, testRate, 15000, 64 };
+	enqueue(pacer, 3);
+	EXPECT_EQ(pacer.backlogNs(), 3'000'000u);
+	pacer.setRate(2 * testRate);
+	EXPECT_EQ(pacer.backlogNs(), 1'500'000u);
+}
+
+TEST_F(PacerTests, SendsInQueueOrder) {
+	Pacer pacer{ *session, testRate, 15000, 64 };
+	observe(pacer);
+	enqueue(pacer, 50);
+	ASSERT_TRUE(pacer.start());
+	auto result = waitSent(50);
+	pacer.stop();
+	ASSERT_EQ(result.size(), 50u);
+	for (uint32_t i = 0; i < result.size(); i++) {
+		EXPECT_EQ(result[i].index, i);
+	}
+	EXPECT_EQ(pacer.queueDepth(), 0u);
+	EXPECT_EQ(pacer.backlogNs(), 0u);
+	EXPECT_EQ(pacer.dropped(), 0u);
+}
+
+TEST_F(PacerTests, AverageRateStaysWithinBudget) {
+	Pacer pacer{ *session, testRate, 1200, 256 };
+	observe(pacer);
+	enqueue(pacer, 100);
+	ASSERT_TRUE(pacer.start());
+	auto result = waitSent(100);
+	pacer.stop();
+	ASSERT_EQ(result.size(), 100u);
+	// First datagram leaves on full bucket, one more may go out on credit, the rest waits for tokens
+	uint64_t budgetNs = (100 - 2) * testDatagramSize * 1000ull - 1200 * 1000ull;
+	EXPECT_GE(result.back().sentNs - result.front().sentNs, budgetNs);
+}
+
+TEST_F(PacerTests, BurstIsCappedByBucket) {
+	Pacer pacer{ *session, testRate, 6000, 256 };
+	observe(pacer);
+	enqueue(pacer, 20);
+	ASSERT_TRUE(pacer.start());
+	auto result = waitSent(20);
+	pacer.stop();
+	ASSERT_EQ(result.size(), 20u);
+	// Full bucket pays for six datagrams and the seventh goes out on credit, the eighth waits for a millisecond
+	// of tokens counted from just before the first send
+	size_t burst = std::count_if(result.begin(), result.end(), [&](const SentDatagram& datagram) {
+		return datagram.sentNs - result.front().sentNs < 500'000;
+	});
+	EXPECT_LE(burst, 7u);
+	EXPECT_GE(result[7].sentNs - result.front().sentNs, 900'000u);
+}
+
+TEST_F(PacerTests, StopReturnsWithQueuedDatagrams) {
+	Pacer pacer{ *session, 8000, 1000, 64 };
+	enqueue(pacer, 10);
+	ASSERT_TRUE(pacer.start());
+	auto start = std::chrono::steady_clock::now();
+	pacer.stop();
+	EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(500));
+	EXPECT_GT(pacer.queueDepth(), 0u);
+}
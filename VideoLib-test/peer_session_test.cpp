@@ -0,0 +1,101 @@
+#include "pch.h"
+
+#include "../VideoLib/network.h"
+
+#include <WS2tcpip.h>
+
+#include <vector>
+#include <array>
+
+using namespace net;
+
+// Session is connected to a loopback sink, the sink answers from the address session accepts datagrams from
+class PeerSessionTests : public testing::Test {
+protected:
+	void SetUp() override {
+		WSADATA wsaData;
+		ASSERT_EQ(WSAStartup(MAKEWORD(2, 2), &wsaData), 0);
+		sink = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		ASSERT_NE(sink, INVALID_SOCKET);
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		ASSERT_NE(bind(sink, reinterpret_cast<sockaddr*>(&address), sizeof(address)), SOCKET_ERROR);
+		int length = sizeof(address);
+		ASSERT_NE(getsockname(sink, reinterpret_cast<sockaddr*>(&address), &length), SOCKET_ERROR);
+		session = std::make_unique<PeerSession>("127.0.0.1", ntohs(address.sin_port));
+		ASSERT_TRUE(session->open());
+	}
+
+	void TearDown() override {
+		session.reset();
+		if (sink != INVALID_SOCKET) {
+			closesocket(sink);
+		}
+		WSACleanup();
+	}
+
+	void sendFromSink(const char* data, const int size) {
+		sockaddr_in local = session->localAddress();
+		local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		ASSERT_EQ(sendto(sink, data, size, 0, reinterpret_cast<sockaddr*>(&local), sizeof(local)), size);
+	}
+
+	// Session socket is non-blocking, so wait for the datagram before reading it
+	bool waitReadable() {
+		WSAPOLLFD fd{};
+		fd.fd = session->socket();
+		fd.events = POLLRDNORM;
+		return WSAPoll(&fd, 1, 1000) == 1;
+	}
+
+	SOCKET sink = INVALID_SOCKET;
+	std::unique_ptr<PeerSession> session;
+};
+
+TEST_F(PeerSessionTests, EverySendIsOneDatagramWithoutSegmentSize) {
+	std::vector<char> datagram(1000, 'd');
+	for (int i = 0; i < 3; i++) {
+		ASSERT_EQ(session->send(datagram.data(), static_cast<int>(datagram.size())), 1000);
+	}
+	PeerStats stats = session->stats();
+	EXPECT_EQ(stats.packetsSent, 3u);
+	EXPECT_EQ(stats.bytesSent, 3000u);
+	EXPECT_EQ(stats.sendErrors, 0u);
+	EXPECT_NE(stats.lastSend, std::chrono::steady_clock::time_point{});
+}
+
+TEST_F(PeerSessionTests, OffloadedSendCountsEverySegment) {
+	std::vector<char> datagram(1000, 'd');
+	// Stack splits 1000 bytes on 300 byte boundaries into three full segments and one short one
+	session->setSegmentSize(300);
+	ASSERT_EQ(session->send(datagram.data(), 1000), 1000);
+	ASSERT_EQ(session->send(datagram.data(), 300), 300);
+	EXPECT_EQ(session->stats().packetsSent, 5u);
+
+	session->setSegmentSize(0);
+	ASSERT_EQ(session->send(datagram.data(), 1000), 1000);
+	EXPECT_EQ(session->stats().packetsSent, 6u);
+	EXPECT_EQ(session->stats().bytesSent, 2300u);
+}
+
+TEST_F(PeerSessionTests, EmptyQueueIsNotReceiveError) {
+	std::array<char, 16> buffer{};
+	EXPECT_EQ(session->recv(buffer.data(), static_cast<int>(buffer.size())), 0);
+	PeerStats stats = session->stats();
+	EXPECT_EQ(stats.packetsReceived, 0u);
+	EXPECT_EQ(stats.recvErrors, 0u);
+}
+
+TEST_F(PeerSessionTests, ReceiveCountsDatagramsFromPeer) {
+	const std::array<char, 4> payload = { 1, 2, 3, 4 };
+	sendFromSink(payload.data(), static_cast<int>(payload.size()));
+	ASSERT_TRUE(waitReadable());
+	std::array<char, 16> buffer{};
+	ASSERT_EQ(session->recv(buffer.data(), static_cast<int>(buffer.size())), 4);
+	EXPECT_EQ(buffer[3], 4);
+	PeerStats stats = session->stats();
+	EXPECT_EQ(stats.packetsReceived, 1u);
+	EXPECT_EQ(stats.bytesReceived, 4u);
+	EXPECT_EQ(stats.recvErrors, 0u);
+}
@@ -0,0 +1,244 @@
+#include "pch.h"
+
+#include "../VideoLib/network.h"
+
+#include <vector>
+#include <chrono>
+
+using namespace net;
+
+constexpr uint32_t testSenderSsrc = 0x1111'2222;
+constexpr uint32_t testMediaSsrc = 0x1234'5678;
+constexpr uint32_t testClockRate = 90000;
+constexpr uint64_t testBaseNs = 1'000'000'000;
+
+static RTPHeader makeHeader(const uint16_t seqNum, const uint32_t timestamp) {
+	RTPHeader header;
+	header.payloadType = 96;
+	header.ssrc = testMediaSsrc;
+	header.seqNum = seqNum;
+	header.timestamp = timestamp;
+	return header;
+}
+
+static RTCPReport roundTrip(const RTCPReport& report) {
+	std::vector<char> out;
+	int size = writeRTCPReport(report, out);
+	EXPECT_EQ(size, static_cast<int>(out.size()));
+	EXPECT_TRUE(isRTCPPacket(out.data(), size));
+	RTCPReport read;
+	EXPECT_TRUE(readRTCPReport(out.data(), size, read));
+	return read;
+}
+
+// Middle 32 bits of current NTP time, what receiver echoes back as LSR
+static uint32_t ntpMiddleNow() {
+	auto now = std::chrono::system_clock::now().time_since_epoch();
+	auto ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+	uint64_t seconds = ns / 1'000'000'000 + 2'208'988'800;
+	uint64_t fraction = ((ns % 1'000'000'000) << 32) / 1'000'000'000;
+	return static_cast<uint32_t>(((seconds << 32) | fraction) >> 16);
+}
+
+TEST(RTCPTests, SenderReportRoundTrip) {
+	RTCPReport report;
+	report.ssrc = testSenderSsrc;
+	report.hasSenderInfo = true;
+	report.senderInfo = { 0x1234'5678'9ABC'DEF0ull, 0xCAFE'BABE, 1000, 1'200'000 };
+	report.blocks.push_back({ testMediaSsrc, 51, -3, 0x0002'0010, 450, 0x5678'9ABC, 98304 });
+	report.blocks.push_back({ testMediaSsrc + 1, 255, 0x7F'FFFF, 0xFFFF'FFFF, 0, 0, 0 });
+
+	RTCPReport read = roundTrip(report);
+	EXPECT_TRUE(read.hasSenderInfo);
+	EXPECT_EQ(read.ssrc, testSenderSsrc);
+	EXPECT_EQ(read.senderInfo.ntpTimestamp, report.senderInfo.ntpTimestamp);
+	EXPECT_EQ(read.senderInfo.rtpTimestamp, report.senderInfo.rtpTimestamp);
+	EXPECT_EQ(read.senderInfo.packetCount, report.senderInfo.packetCount);
+	EXPECT_EQ(read.senderInfo.octetCount, report.senderInfo.octetCount);
+	ASSERT_EQ(read.blocks.size(), 2u);
+	for (size_t i = 0; i < read.blocks.size(); i++) {
+		EXPECT_EQ(read.blocks[i].ssrc, report.blocks[i].ssrc);
+		EXPECT_EQ(read.blocks[i].fractionLost, report.blocks[i].fractionLost);
+		EXPECT_EQ(read.blocks[i].cumulativeLost, report.blocks[i].cumulativeLost);
+		EXPECT_EQ(read.blocks[i].highestSeqNum, report.blocks[i].highestSeqNum);
+		EXPECT_EQ(read.blocks[i].jitter, report.blocks[i].jitter);
+		EXPECT_EQ(read.blocks[i].lastSR, report.blocks[i].lastSR);
+		EXPECT_EQ(read.blocks[i].delaySinceLastSR, report.blocks[i].delaySinceLastSR);
+	}
+}
+
+TEST(RTCPTests, ReceiverReportRoundTripKeepsAtMostMaxBlocks) {
+	RTCPReport report;
+	report.ssrc = testSenderSsrc;
+	for (uint32_t i = 0; i < maxReportBlocks + 5; i++) {
+		report.blocks.push_back({ .ssrc = i });
+	}
+	std::vector<char> out;
+	EXPECT_EQ(writeRTCPReport(report, out), 8 + static_cast<int>(maxReportBlocks) * 24);
+
+	RTCPReport read = roundTrip(report);
+	EXPECT_FALSE(read.hasSenderInfo);
+	ASSERT_EQ(read.blocks.size(), maxReportBlocks);
+	EXPECT_EQ(read.blocks.back().ssrc, maxReportBlocks - 1);
+}
+
+TEST(RTCPTests, CumulativeLossIsSigned24Bits) {
+	RTCPReport report;
+	report.blocks = { { .cumulativeLost = -1 }, { .cumulativeLost = -0x80'0000 }, { .cumulativeLost = 0x90'0000 },
+		{ .cumulativeLost = -0x90'0000 } };
+	RTCPReport read = roundTrip(report);
+	ASSERT_EQ(read.blocks.size(), 4u);
+	EXPECT_EQ(read.blocks[0].cumulativeLost, -1);
+	EXPECT_EQ(read.blocks[1].cumulativeLost, -0x80'0000);
+	// Out of range values are clamped, not wrapped into the other sign
+	EXPECT_EQ(read.blocks[2].cumulativeLost, 0x7F'FFFF);
+	EXPECT_EQ(read.blocks[3].cumulativeLost, -0x80'0000);
+}
+
+TEST(RTCPTests, ReportIsFoundInCompoundPacketAndTruncationIsRejected) {
+	RTCPReport report;
+	report.ssrc = testSenderSsrc;
+	report.blocks.push_back({ .ssrc = testMediaSsrc, .jitter = 7 });
+	std::vector<char> rr;
+	writeRTCPReport(report, rr);
+
+	// Empty SDES (type 202) ahead of the report
+	std::vector<char> compound = { static_cast<char>(0x80), static_cast<char>(202), 0, 1, 0, 0, 0, 0 };
+	compound.insert(compound.end(), rr.begin(), rr.end());
+	RTCPReport read;
+	ASSERT_TRUE(readRTCPReport(compound.data(), static_cast<int>(compound.size()), read));
+	ASSERT_EQ(read.blocks.size(), 1u);
+	EXPECT_EQ(read.blocks[0].jitter, 7u);
+
+	EXPECT_FALSE(readRTCPReport(rr.data(), static_cast<int>(rr.size()) - 4, read));
+}
+
+TEST(RTCPTests, HighestSeqNumIsExtendedWithCycles) {
+	RTCPReceiverStats stats{ testMediaSsrc, testClockRate };
+	uint16_t seqNum = 65530;
+	for (int i = 0; i < 10; i++) {
+		stats.onPacket(makeHeader(seqNum++, 0), testBaseNs);
+	}
+	RTCPReportBlock block = stats.reportBlock(testBaseNs);
+	EXPECT_EQ(block.highestSeqNum, 65536u + 3);
+	EXPECT_EQ(block.cumulativeLost, 0);
+	EXPECT_EQ(stats.packetsReceived(), 10u);
+
+	// Reordered packet from before the wrap must not count another cycle
+	stats.onPacket(makeHeader(65535, 0), testBaseNs);
+	EXPECT_EQ(stats.reportBlock(testBaseNs).highestSeqNum, 65536u + 3);
+}
+
+TEST(RTCPTests, FractionLostCoversInterval) {
+	RTCPReceiverStats stats{ testMediaSsrc, testClockRate };
+	for (uint16_t seqNum = 0; seqNum < 10; seqNum++) {
+		if (seqNum != 3 && seqNum != 7) {
+			stats.onPacket(makeHeader(seqNum, 0), testBaseNs);
+		}
+	}
+	RTCPReportBlock block = stats.reportBlock(testBaseNs);
+	EXPECT_EQ(block.fractionLost, 2 * 256 / 10);
+	EXPECT_EQ(block.cumulativeLost, 2);
+
+	for (uint16_t seqNum = 10; seqNum < 20; seqNum++) {
+		stats.onPacket(makeHeader(seqNum, 0), testBaseNs);
+	}
+	block = stats.reportBlock(testBaseNs);
+	EXPECT_EQ(block.fractionLost, 0);
+	EXPECT_EQ(block.cumulativeLost, 2);
+}
+
+TEST(RTCPTests, DuplicatesMakeLossNegative) {
+	RTCPReceiverStats stats{ testMediaSsrc, testClockRate };
+	stats.onPacket(makeHeader(0, 0), testBaseNs);
+	stats.onPacket(makeHeader(1, 0), testBaseNs);
+	stats.onPacket(makeHeader(1, 0), testBaseNs);
+	stats.onPacket(makeHeader(2, 0), testBaseNs);
+	RTCPReportBlock block = stats.reportBlock(testBaseNs);
+	EXPECT_EQ(block.cumulativeLost, -1);
+	EXPECT_EQ(block.fractionLost, 0);
+	EXPECT_EQ(stats.packetsLost(), -1);
+}
+
+TEST(RTCPTests, JitterIsSampledOnEveryPacket) {
+	RTCPReceiverStats stats{ testMediaSsrc, testClockRate };
+	// Two frames 3000 ticks apart arriving exactly on time
+	stats.onPacket(makeHeader(0, 0), testBaseNs);
+	stats.onPacket(makeHeader(1, 3000), testBaseNs + 33'333'333);
+	EXPECT_EQ(stats.reportBlock(testBaseNs).jitter, 0u);
+
+	// Second packet of that frame comes 10 ms (900 ticks) after the first one
+	stats.onPacket(makeHeader(2, 3000), testBaseNs + 43'333'333);
+	RTCPReportBlock block = stats.reportBlock(testBaseNs);
+	EXPECT_EQ(block.jitter, 900u / 16);
+	EXPECT_NEAR(static_cast<double>(stats.jitterNs()), 10'000'000.0 / 16, 1000.0);
+}
+
+TEST(RTCPTests, OtherSsrcIsIgnored) {
+	RTCPReceiverStats stats{ testMediaSsrc, testClockRate };
+	RTPHeader header = makeHeader(0, 0);
+	header.ssrc = testMediaSsrc + 1;
+	stats.onPacket(header, testBaseNs);
+	EXPECT_EQ(stats.packetsReceived(), 0u);
+}
+
+TEST(RTCPTests, LastSenderReportIsEchoed) {
+	RTCPReceiverStats stats{ testMediaSsrc, testClockRate };
+	stats.onPacket(makeHeader(0, 0), testBaseNs);
+	EXPECT_EQ(stats.reportBlock(testBaseNs).lastSR, 0u);
+	EXPECT_EQ(stats.reportBlock(testBaseNs).delaySinceLastSR, 0u);
+
+	RTCPReport sr;
+	sr.ssrc = testMediaSsrc;
+	sr.hasSenderInfo = true;
+	sr.senderInfo.ntpTimestamp = 0x1234'5678'9ABC'DEF0ull;
+	stats.onSenderReport(sr, testBaseNs);
+	RTCPReportBlock block = stats.reportBlock(testBaseNs + 1'500'000'000);
+	EXPECT_EQ(block.lastSR, 0x5678'9ABCu);
+	// 1.5 s in 1/65536 s
+	EXPECT_EQ(block.delaySinceLastSR, 98304u);
+}
+
+TEST(RTCPTests, RoundTripIsMeasuredFromEchoedReport) {
+	RTCPSenderStats stats{ testMediaSsrc, testClockRate };
+	EXPECT_EQ(stats.rttNs(), 0u);
+
+	// SR left 100 ms ago and waited 40 ms at receiver
+	RTCPReportBlock block{ .ssrc = testMediaSsrc, .fractionLost = 64, .cumulativeLost = 5, .jitter = 900 };
+	block.lastSR = ntpMiddleNow() - 65536 / 10;
+	block.delaySinceLastSR = 65536 * 4 / 100;
+	ASSERT_TRUE(stats.onReportBlock(block));
+	EXPECT_NEAR(static_cast<double>(stats.rttNs()), 60'000'000.0, 5'000'000.0);
+	EXPECT_DOUBLE_EQ(stats.fractionLost(), 0.25);
+	EXPECT_EQ(stats.packetsLost(), 5);
+	EXPECT_EQ(stats.jitterNs(), 10'000'000u);
+
+	// Delay claimed longer than the round trip itself would be negative, it is ignored
+	block.delaySinceLastSR = 65536;
+	ASSERT_TRUE(stats.onReportBlock(block));
+	EXPECT_NEAR(static_cast<double>(stats.rttNs()), 60'000'000.0, 5'000'000.0);
+
+	block.ssrc = testMediaSsrc + 1;
+	EXPECT_FALSE(stats.onReportBlock(block));
+}
+
+TEST(RTCPTests, SenderReportCountsSentPackets) {
+	RTCPSenderStats stats{ testMediaSsrc, testClockRate };
+	std::vector<char> packet(rtpHeaderSize + 100);
+	writeRTPHeader(makeHeader(0, 9000), packet.data());
+	stats.onPacketSent(packet.data(), static_cast<int>(packet.size()), testBaseNs);
+	stats.onPacketSent(packet.data(), static_cast<int>(packet.size()), testBaseNs);
+
+	RTPHeader other = makeHeader(1, 9000);
+	other.ssrc = testMediaSsrc + 1;
+	writeRTPHeader(other, packet.data());
+	stats.onPacketSent(packet.data(), static_cast<int>(packet.size()), testBaseNs);
+
+	RTCPReport report = stats.senderReport(testBaseNs + 1'000'000'000);
+	EXPECT_TRUE(report.hasSenderInfo);
+	EXPECT_EQ(report.ssrc, testMediaSsrc);
+	EXPECT_EQ(report.senderInfo.packetCount, 2u);
+	EXPECT_EQ(report.senderInfo.octetCount, 200u);
+	// One second after last packet in 90 kHz clock
+	EXPECT_EQ(report.senderInfo.rtpTimestamp, 9000u + testClockRate);
+}
@@ -0,0 +1,206 @@
+#include "pch.h"
+
+#include "../VideoLib/network.h"
+
+#include <vector>
+#include <string>
+
+using namespace net;
+
+constexpr uint8_t testPayloadType = 96;
+constexpr uint32_t testSsrc = 0x1234'5678;
+constexpr int testPacketSize = 100;
+
+// Builds single RTP packet with payload header the way RTPPacketizer does, so tests can pick seqnums freely
+static std::vector<char> makePacket(const uint16_t seqNum, const uint32_t timestamp, const bool marker, const bool frameStart,
+	const std::string& payload, const uint32_t ssrc = testSsrc) {
+	RTPHeader header;
+	header.payloadType = testPayloadType;
+	header.ssrc = ssrc;
+	header.seqNum = seqNum;
+	header.timestamp = timestamp;
+	header.marker = marker ? 1 : 0;
+	std::vector<char> packet(rtpHeaderSize + rtpPayloadHeaderSize + payload.size());
+	int headerSize = writeRTPHeader(header, packet.data());
+	packet[headerSize] = static_cast<char>(frameStart ? rtpFrameStart : 0);
+	std::copy(payload.begin(), payload.end(), packet.begin() + headerSize + rtpPayloadHeaderSize);
+	return packet;
+}
+
+static bool push(RTPDepacketizer& depacketizer, const std::vector<char>& packet) {
+	return depacketizer.push(packet.data(), static_cast<int>(packet.size()));
+}
+
+static std::string frameOf(const RTPDepacketizer& depacketizer) {
+	return std::string(depacketizer.frame().begin(), depacketizer.frame().end());
+}
+
+// Splits packetizer output, every packet but the last one is exactly 'packetSize' long
+static std::vector<std::vector<char>> splitPackets(const std::vector<char>& out, const int count, const int packetSize) {
+	std::vector<std::vector<char>> packets;
+	for (int i = 0; i < count; i++) {
+		auto begin = out.begin() + static_cast<ptrdiff_t>(i) * packetSize;
+		auto end = (i + 1 == count) ? out.end() : begin + packetSize;
+		packets.emplace_back(begin, end);
+	}
+	return packets;
+}
+
+static std::string makeFrame(const size_t size, const char seed) {
+	std::string frame(size, '\0');
+	for (size_t i = 0; i < size; i++) {
+		frame[i] = static_cast<char>(seed + i * 7);
+	}
+	return frame;
+}
+
+TEST(RTPTests, PacketizerSplitsFrameIntoSequentialPackets) {
+	RTPPacketizer packetizer{ testPayloadType, testSsrc };
+	std::string frame = makeFrame(250, 'a');
+	uint16_t firstSeq = packetizer.nextSeqNum();
+	std::vector<char> out;
+	int count = packetizer.packetize(frame.data(), static_cast<int>(frame.size()), 3000, testPacketSize, out);
+
+	int payloadSize = testPacketSize - rtpHeaderSize - rtpPayloadHeaderSize;
+	ASSERT_EQ(count, (250 + payloadSize - 1) / payloadSize);
+	EXPECT_EQ(out.size(), frame.size() + count * (rtpHeaderSize + rtpPayloadHeaderSize));
+	EXPECT_EQ(packetizer.nextSeqNum(), static_cast<uint16_t>(firstSeq + count));
+
+	auto packets = splitPackets(out, count, testPacketSize);
+	for (int i = 0; i < count; i++) {
+		RTPHeader header;
+		int size = 0;
+		int headerSize = readRTPHeader(packets[i].data(), static_cast<int>(packets[i].size()), header, size);
+		ASSERT_EQ(headerSize, rtpHeaderSize);
+		EXPECT_EQ(header.seqNum, static_cast<uint16_t>(firstSeq + i));
+		EXPECT_EQ(header.timestamp, 3000u);
+		EXPECT_EQ(header.ssrc, testSsrc);
+		EXPECT_EQ(header.marker, (i + 1 == count) ? 1 : 0);
+		EXPECT_EQ(static_cast<uint8_t>(packets[i][headerSize]), (i == 0) ? rtpFrameStart : 0);
+	}
+}
+
+TEST(RTPTests, PacketizerRejectsEmptyFrameAndTinyPackets) {
+	RTPPacketizer packetizer{ testPayloadType, testSsrc };
+	std::vector<char> out;
+	char byte = 'x';
+	EXPECT_EQ(packetizer.packetize(&byte, 0, 0, testPacketSize, out), 0);
+	EXPECT_EQ(packetizer.packetize(&byte, 1, 0, rtpHeaderSize + rtpPayloadHeaderSize, out), 0);
+	EXPECT_TRUE(out.empty());
+}
+
+TEST(RTPTests, FirstFrameIsDelivered) {
+	RTPPacketizer packetizer{ testPayloadType, testSsrc };
+	RTPDepacketizer depacketizer;
+	std::string frame = makeFrame(500, 'f');
+	std::vector<char> out;
+	int count = packetizer.packetize(frame.data(), static_cast<int>(frame.size()), 0, testPacketSize, out);
+
+	auto packets = splitPackets(out, count, testPacketSize);
+	for (int i = 0; i + 1 < count; i++) {
+		EXPECT_FALSE(push(depacketizer, packets[i]));
+	}
+	ASSERT_TRUE(push(depacketizer, packets.back()));
+	EXPECT_EQ(frameOf(depacketizer), frame);
+	EXPECT_EQ(depacketizer.payloadType(), testPayloadType);
+	EXPECT_EQ(depacketizer.stats().framesCompleted, 1u);
+	EXPECT_EQ(depacketizer.stats().framesLost, 0u);
+}
+
+TEST(RTPTests, JoiningMidFrameDropsOnlyThatFrame) {
+	RTPDepacketizer depacketizer;
+	EXPECT_FALSE(push(depacketizer, makePacket(10, 100, false, false, "bb")));
+	EXPECT_FALSE(push(depacketizer, makePacket(11, 100, true, false, "cc")));
+	EXPECT_EQ(depacketizer.stats().framesLost, 1u);
+
+	EXPECT_FALSE(push(depacketizer, makePacket(12, 200, false, true, "dd")));
+	ASSERT_TRUE(push(depacketizer, makePacket(13, 200, true, false, "ee")));
+	EXPECT_EQ(frameOf(depacketizer), "ddee");
+	EXPECT_EQ(depacketizer.frameTimestamp(), 200u);
+}
+
+TEST(RTPTests, FrameSpansSeqNumWrap) {
+	RTPDepacketizer depacketizer;
+	EXPECT_FALSE(push(depacketizer, makePacket(65534, 100, false, true, "aa")));
+	EXPECT_FALSE(push(depacketizer, makePacket(65535, 100, false, false, "bb")));
+	ASSERT_TRUE(push(depacketizer, makePacket(0, 100, true, false, "cc")));
+	EXPECT_EQ(frameOf(depacketizer), "aabbcc");
+	EXPECT_EQ(depacketizer.stats().packetsLost, 0u);
+
+	ASSERT_TRUE(push(depacketizer, makePacket(1, 200, true, true, "dd")));
+	EXPECT_EQ(frameOf(depacketizer), "dd");
+}
+
+TEST(RTPTests, LostMarkerDropsFrameAndKeepsNext) {
+	RTPDepacketizer depacketizer;
+	EXPECT_FALSE(push(depacketizer, makePacket(100, 100, false, true, "aa")));
+	// Marker packet 101 is lost, next frame starts at 102
+	EXPECT_FALSE(push(depacketizer, makePacket(102, 200, false, true, "bb")));
+	EXPECT_EQ(depacketizer.stats().framesLost, 1u);
+	EXPECT_EQ(depacketizer.stats().packetsLost, 1u);
+	ASSERT_TRUE(push(depacketizer, makePacket(103, 200, true, false, "cc")));
+	EXPECT_EQ(frameOf(depacketizer), "bbcc");
+}
+
+TEST(RTPTests, LostMarkerOfFrameWithSameTimestampIsCaughtByStartFlag) {
+	RTPDepacketizer depacketizer;
+	EXPECT_FALSE(push(depacketizer, makePacket(100, 100, false, true, "aa")));
+	// Sender reused timestamp, only start flag tells frames apart
+	ASSERT_TRUE(push(depacketizer, makePacket(102, 100, true, true, "bb")));
+	EXPECT_EQ(frameOf(depacketizer), "bb");
+	EXPECT_EQ(depacketizer.stats().framesLost, 1u);
+}
+
+TEST(RTPTests, LostMiddlePacketDropsFrame) {
+	RTPDepacketizer depacketizer;
+	EXPECT_FALSE(push(depacketizer, makePacket(7, 100, false, true, "aa")));
+	EXPECT_FALSE(push(depacketizer, makePacket(9, 100, true, false, "cc")));
+	EXPECT_EQ(depacketizer.stats().framesLost, 1u);
+	EXPECT_EQ(depacketizer.stats().framesCompleted, 0u);
+	EXPECT_EQ(depacketizer.stats().packetsLost, 1u);
+}
+
+TEST(RTPTests, ReorderedAndDuplicatePacketsAreRejected) {
+	RTPDepacketizer depacketizer;
+	EXPECT_FALSE(push(depacketizer, makePacket(50, 100, false, true, "aa")));
+	EXPECT_FALSE(push(depacketizer, makePacket(50, 100, false, true, "aa")));
+	EXPECT_FALSE(push(depacketizer, makePacket(52, 100, true, false, "cc")));
+	// Late arrival of 51 cannot repair frame, reordering belongs to jitter buffer
+	EXPECT_FALSE(push(depacketizer, makePacket(51, 100, false, false, "bb")));
+	EXPECT_EQ(depacketizer.stats().packetsInvalid, 2u);
+	EXPECT_EQ(depacketizer.stats().framesLost, 1u);
+
+	ASSERT_TRUE(push(depacketizer, makePacket(53, 200, true, true, "dd")));
+	EXPECT_EQ(frameOf(depacketizer), "dd");
+}
+
+TEST(RTPTests, PacketsOfOtherSsrcAreRejected) {
+	RTPDepacketizer depacketizer;
+	EXPECT_FALSE(push(depacketizer, makePacket(1, 100, false, true, "aa")));
+	EXPECT_FALSE(push(depacketizer, makePacket(2, 100, true, false, "xx", testSsrc + 1)));
+	ASSERT_TRUE(push(depacketizer, makePacket(2, 100, true, false, "bb")));
+	EXPECT_EQ(frameOf(depacketizer), "aabb");
+	EXPECT_EQ(depacketizer.stats().packetsInvalid, 1u);
+}
+
+TEST(RTPTests, OversizedFrameIsDropped) {
+	RTPDepacketizer depacketizer{ 5 };
+	EXPECT_FALSE(push(depacketizer, makePacket(1, 100, false, true, "aaa")));
+	EXPECT_FALSE(push(depacketizer, makePacket(2, 100, true, false, "bbb")));
+	EXPECT_EQ(depacketizer.stats().framesLost, 1u);
+	EXPECT_TRUE(depacketizer.frame().empty());
+
+	ASSERT_TRUE(push(depacketizer, makePacket(3, 200, true, true, "cccc")));
+	EXPECT_EQ(frameOf(depacketizer), "cccc");
+}
+
+TEST(RTPTests, PacketWithoutPayloadHeaderIsInvalid) {
+	RTPDepacketizer depacketizer;
+	RTPHeader header;
+	header.ssrc = testSsrc;
+	std::vector<char> packet(rtpHeaderSize);
+	writeRTPHeader(header, packet.data());
+	EXPECT_FALSE(push(depacketizer, packet));
+	EXPECT_EQ(depacketizer.stats().packetsInvalid, 1u);
+	EXPECT_EQ(depacketizer.stats().packetsReceived, 0u);
+}
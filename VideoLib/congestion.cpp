@@ -0,0 +1,463 @@
+#include "congestion.h"
+#include "network.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace net {
+	// Packets sent this close together form one group, delay variation is measured between groups
+	constexpr uint64_t burstTimeNs = 5'000'000;
+	constexpr size_t trendWindowSize = 20;
+	constexpr double trendSmoothing = 0.9;
+	constexpr double trendThresholdGain = 4.0;
+	constexpr double overuseTimeMs = 10.0;
+	constexpr double thresholdGainUp = 0.0087;
+	constexpr double thresholdGainDown = 0.039;
+	constexpr double decreaseFactor = 0.85;
+	constexpr uint64_t acknowledgedWindowNs = 500'000'000;
+	constexpr uint64_t lossUpdateIntervalNs = 200'000'000;
+	constexpr uint32_t lossMinPackets = 20;
+	// Per SSRC, at 10k packets per second it covers feedback arriving 800 ms late
+	constexpr size_t sendHistorySize = 8192;
+	constexpr double averagePacketBits = 1200 * 8;
+
+	static void writeU16(std::vector<char>& out, const uint16_t value) {
+		out.push_back(static_cast<char>(value >> 8));
+		out.push_back(static_cast<char>(value));
+	}
+
+	static void writeU32(std::vector<char>& out, const uint32_t value) {
+		writeU16(out, static_cast<uint16_t>(value >> 16));
+		writeU16(out, static_cast<uint16_t>(value));
+	}
+
+	static uint16_t readU16(const char* data) {
+		return static_cast<uint16_t>((static_cast<uint8_t>(data[0]) << 8) | static_cast<uint8_t>(data[1]));
+	}
+
+	static uint32_t readU32(const char* data) {
+		return (static_cast<uint32_t>(readU16(data)) << 16) | readU16(data + 2);
+	}
+
+	// Middle 32 bits of NTP timestamp (16.16 fixed point seconds), taken from steady clock
+	static uint32_t compactTimestamp(const uint64_t ns) {
+		uint64_t seconds = ns / 1'000'000'000;
+		uint64_t fraction = ((ns % 1'000'000'000) << 16) / 1'000'000'000;
+		return static_cast<uint32_t>((seconds << 16) | fraction);
+	}
+
+	CongestionFeedback::CongestionFeedback(const uint32_t ssrc) :
+		ssrc(ssrc) {}
+
+	void CongestionFeedback::onPacket(const uint32_t ssrc, const uint16_t seqNum, const uint64_t arrivalNs) {
+		auto& stream = streams[ssrc];
+		if (!stream.started) {
+			stream.started = true;
+			stream.beginSeq = seqNum;
+		}
+		auto index = static_cast<int16_t>(seqNum - stream.beginSeq);
+		if (index < 0) {
+			// Already reported as lost
+			return;
+		}
+		if (static_cast<size_t>(index) >= 0x4000) {
+			// Too far ahead to report as gap, start over from this packet
+			stream.arrivals.clear();
+			stream.beginSeq = seqNum;
+			index = 0;
+		}
+		if (stream.arrivals.size() <= static_cast<size_t>(index)) {
+			stream.arrivals.resize(index + 1, 0);
+		}
+		if (stream.arrivals[index] == 0) {
+			stream.arrivals[index] = arrivalNs;
+		}
+	}
+
+	bool CongestionFeedback::build(std::vector<char>& out, const uint64_t nowNs) {
+		out.clear();
+		out.push_back(static_cast<char>(0x80 | congestionFeedbackFormat));
+		out.push_back(static_cast<char>(rtcpFeedbackType));
+		writeU16(out, 0);
+		writeU32(out, ssrc);
+		size_t reportsLeft = maxFeedbackReports;
+		for (auto& [streamSsrc, stream] : streams) {
+			if (stream.arrivals.empty() || reportsLeft == 0) {
+				continue;
+			}
+			size_t count = (std::min)(stream.arrivals.size(), reportsLeft);
+			writeU32(out, streamSsrc);
+			writeU16(out, stream.beginSeq);
+			writeU16(out, static_cast<uint16_t>(count));
+			for (size_t i = 0; i < count; i++) {
+				uint64_t arrival = stream.arrivals[i];
+				if (arrival == 0) {
+					writeU16(out, 0);
+					continue;
+				}
+				// Arrival time offset before report timestamp in 1/1024 s, 0x1FFE stands for anything longer
+				uint64_t offset = (nowNs > arrival) ? (nowNs - arrival) * 1024 / 1'000'000'000 : 0;
+				writeU16(out, static_cast<uint16_t>(0x8000 | (std::min)(offset, uint64_t(0x1FFE))));
+			}
+			if (count % 2 != 0) {
+				writeU16(out, 0);
+			}
+			stream.arrivals.erase(stream.arrivals.begin(), stream.arrivals.begin() + count);
+			stream.beginSeq += static_cast<uint16_t>(count);
+			reportsLeft -= count;
+		}
+		if (reportsLeft == maxFeedbackReports) {
+			out.clear();
+			return false;
+		}
+		writeU32(out, compactTimestamp(nowNs));
+		uint16_t length = static_cast<uint16_t>(out.size() / 4 - 1);
+		out[2] = static_cast<char>(length >> 8);
+		out[3] = static_cast<char>(length);
+		return true;
+	}
+
+	CongestionController::CongestionController(const CongestionSettings& settings) :
+		settings(settings),
+		delayRate(static_cast<double>(settings.startBitrate)),
+		lossRate(static_cast<double>(settings.startBitrate)) {}
+
+	void CongestionController::onPacketSent(const char* data, const int size, const uint64_t sentNs) {
+		RTPHeader header;
+		int payloadSize = 0;
+		if (isRTCPPacket(data, size) || readRTPHeader(data, size, header, payloadSize) == 0) {
+			return;
+		}
+		std::lock_guard lock(mutex);
+		auto& packets = history[header.ssrc];
+		if (packets.empty()) {
+			packets.resize(sendHistorySize);
+		}
+		packets[header.seqNum & (sendHistorySize - 1)] = SentPacket{ sentNs, static_cast<uint32_t>(size), header.seqNum, true };
+	}
+
+	bool CongestionController::onFeedback(const char* data, const int size, const uint64_t nowNs) {
+		if (!isRTCPPacket(data, size) || (data[0] & 0x1F) != congestionFeedbackFormat || static_cast<uint8_t>(data[1]) != rtcpFeedbackType) {
+			return false;
+		}
+		int length = (readU16(data + 2) + 1) * 4;
+		if (length > size || length < 12) {
+			return false;
+		}
+		uint32_t reportTimestamp = readU32(data + length - 4);
+		std::vector<PacketResult> results;
+		uint64_t rttSample = 0;
+		{
+			std::lock_guard lock(mutex);
+			if (!reportClockStarted) {
+				reportClockStarted = true;
+				reportTicks = reportTimestamp;
+			}
+			else {
+				reportTicks += static_cast<int32_t>(reportTimestamp - lastReportTimestamp);
+			}
+			lastReportTimestamp = reportTimestamp;
+			int64_t reportNs = (reportTicks >> 16) * 1'000'000'000 + ((reportTicks & 0xFFFF) * 1'000'000'000 >> 16);
+
+			int offset = 8;
+			while (offset + 8 <= length - 4) {
+				uint32_t streamSsrc = readU32(data + offset);
+				uint16_t beginSeq = readU16(data + offset + 4);
+				int count = readU16(data + offset + 6);
+				offset += 8;
+				int blockSize = ((count + 1) / 2) * 4;
+				if (offset + blockSize > length - 4) {
+					return false;
+				}
+				auto packets = history.find(streamSsrc);
+				for (int i = 0; i < count && packets != history.end(); i++) {
+					uint16_t seqNum = beginSeq + static_cast<uint16_t>(i);
+					auto& sent = packets->second[seqNum & (sendHistorySize - 1)];
+					if (!sent.valid || sent.seqNum != seqNum) {
+						continue;
+					}
+					sent.valid = false;
+					uint16_t metric = readU16(data + offset + i * 2);
+					PacketResult result{ sent.sentNs, 0, sent.size, (metric & 0x8000) != 0 };
+					if (result.received) {
+						int64_t arrivalOffsetNs = static_cast<int64_t>(metric & 0x1FFF) * 1'000'000'000 / 1024;
+						result.arrivalNs = reportNs - arrivalOffsetNs;
+						// Time from sending to feedback less time packet waited at receiver for the report
+						uint64_t sample = (nowNs > sent.sentNs) ? nowNs - sent.sentNs : 0;
+						if (sample > static_cast<uint64_t>(arrivalOffsetNs)) {
+							sample -= arrivalOffsetNs;
+							rttSample = (rttSample == 0) ? sample : (std::min)(rttSample, sample);
+						}
+					}
+					results.push_back(result);
+				}
+				offset += blockSize;
+			}
+		}
+		onPacketResults(std::move(results), nowNs, rttSample);
+		return true;
+	}
+
+	void CongestionController::onPacketResults(std::vector<PacketResult> results, const uint64_t nowNs, const uint64_t rttNs) {
+		std::lock_guard lock(mutex);
+		if (rttNs > 0) {
+			rtt = (rtt == 0) ? rttNs : (rtt * 7 + rttNs) / 8;
+		}
+		if (results.empty()) {
+			return;
+		}
+		updateLossBased(results, nowNs);
+		updateAcknowledged(results);
+		std::sort(results.begin(), results.end(), [](const PacketResult& a, const PacketResult& b) { return a.sentNs < b.sentNs; });
+		for (const auto& packet : results) {
+			if (packet.received) {
+				addPacket(packet);
+			}
+		}
+		updateDelayBased(nowNs);
+	}
+
+	void CongestionController::addPacket(const PacketResult& packet) {
+		if (!groupStarted) {
+			groupStarted = true;
+			currentGroup = PacketGroup{ packet.sentNs, packet.sentNs, packet.arrivalNs };
+			return;
+		}
+		if (packet.sentNs < currentGroup.firstSentNs) {
+			// Belongs to group already measured
+			return;
+		}
+		if (packet.sentNs - currentGroup.firstSentNs > burstTimeNs) {
+			if (previousGroupValid) {
+				addDelaySample(previousGroup, currentGroup);
+			}
+			previousGroup = currentGroup;
+			previousGroupValid = true;
+			currentGroup = PacketGroup{ packet.sentNs, packet.sentNs, packet.arrivalNs };
+			return;
+		}
+		currentGroup.lastSentNs = (std::max)(currentGroup.lastSentNs, packet.sentNs);
+		currentGroup.lastArrivalNs = (std::max)(currentGroup.lastArrivalNs, packet.arrivalNs);
+	}
+
+	void CongestionController::addDelaySample(const PacketGroup& previous, const PacketGroup& current) {
+		double sendDeltaMs = static_cast<double>(current.lastSentNs - previous.lastSentNs) / 1e6;
+		double arrivalDeltaMs = static_cast<double>(current.lastArrivalNs - previous.lastArrivalNs) / 1e6;
+		if (arrivalDeltaMs < 0) {
+			// Groups reordered on the way, variation between them means nothing
+			return;
+		}
+		numDeltas = (std::min)(numDeltas + 1, 1000u);
+		accumulatedDelayMs += arrivalDeltaMs - sendDeltaMs;
+		smoothedDelayMs = trendSmoothing * smoothedDelayMs + (1 - trendSmoothing) * accumulatedDelayMs;
+		if (!firstArrivalValid) {
+			firstArrivalValid = true;
+			firstArrivalNs = current.lastArrivalNs;
+		}
+		trendWindow.emplace_back(static_cast<double>(current.lastArrivalNs - firstArrivalNs) / 1e6, smoothedDelayMs);
+		if (trendWindow.size() > trendWindowSize) {
+			trendWindow.pop_front();
+		}
+		double trend = previousTrend;
+		if (trendWindow.size() == trendWindowSize) {
+			// Least squares slope of smoothed delay over arrival time
+			double meanX = 0.0;
+			double meanY = 0.0;
+			for (const auto& [x, y] : trendWindow) {
+				meanX += x;
+				meanY += y;
+			}
+			meanX /= trendWindow.size();
+			meanY /= trendWindow.size();
+			double numerator = 0.0;
+			double denominator = 0.0;
+			for (const auto& [x, y] : trendWindow) {
+				numerator += (x - meanX) * (y - meanY);
+				denominator += (x - meanX) * (x - meanX);
+			}
+			if (denominator != 0.0) {
+				trend = numerator / denominator;
+			}
+		}
+		detect(trend, sendDeltaMs, current.lastArrivalNs);
+		previousTrend = trend;
+	}
+
+	void CongestionController::detect(const double trend, const double sendDeltaMs, const int64_t arrivalNs) {
+		if (numDeltas < 2) {
+			return;
+		}
+		double modifiedTrend = (std::min)(numDeltas, 60u) * trend * trendThresholdGain;
+		if (modifiedTrend > threshold) {
+			timeOverUsingMs = (timeOverUsingMs < 0) ? sendDeltaMs / 2 : timeOverUsingMs + sendDeltaMs;
+			overuseCounter++;
+			if (timeOverUsingMs > overuseTimeMs && overuseCounter > 1 && trend >= previousTrend) {
+				timeOverUsingMs = 0;
+				overuseCounter = 0;
+				hypothesis = BandwidthUsage::overusing;
+			}
+		}
+		else if (modifiedTrend < -threshold) {
+			timeOverUsingMs = -1;
+			overuseCounter = 0;
+			hypothesis = BandwidthUsage::underusing;
+		}
+		else {
+			timeOverUsingMs = -1;
+			overuseCounter = 0;
+			hypothesis = BandwidthUsage::normal;
+		}
+		updateThreshold(modifiedTrend, arrivalNs);
+	}
+
+	// Threshold follows trend slowly, so concurrent TCP flows do not starve delay based estimate
+	void CongestionController::updateThreshold(const double modifiedTrend, const int64_t arrivalNs) {
+		if (lastThresholdUpdateNs == 0) {
+			lastThresholdUpdateNs = arrivalNs;
+		}
+		double magnitude = std::abs(modifiedTrend);
+		if (magnitude > threshold + 15.0) {
+			// Sudden spikes (route change, cross traffic burst) are not allowed to drag threshold up
+			lastThresholdUpdateNs = arrivalNs;
+			return;
+		}
+		double gain = (magnitude < threshold) ? thresholdGainDown : thresholdGainUp;
+		double elapsedMs = (std::min)(static_cast<double>(arrivalNs - lastThresholdUpdateNs) / 1e6, 100.0);
+		threshold = std::clamp(threshold + gain * (magnitude - threshold) * elapsedMs, 6.0, 600.0);
+		lastThresholdUpdateNs = arrivalNs;
+	}
+
+	void CongestionController::updateAcknowledged(const std::vector<PacketResult>& results) {
+		for (const auto& packet : results) {
+			if (packet.received) {
+				acknowledged.emplace_back(packet.arrivalNs, packet.size);
+				acknowledgedBytes += packet.size;
+			}
+		}
+		if (acknowledged.empty()) {
+			return;
+		}
+		int64_t newest = std::max_element(acknowledged.begin(), acknowledged.end())->first;
+		while (!acknowledged.empty() && newest - acknowledged.front().first > static_cast<int64_t>(acknowledgedWindowNs)) {
+			acknowledgedBytes -= acknowledged.front().second;
+			acknowledged.pop_front();
+		}
+	}
+
+	double CongestionController::acknowledgedRate() const {
+		if (acknowledged.size() < 2) {
+			return 0;
+		}
+		auto [oldest, newest] = std::minmax_element(acknowledged.begin(), acknowledged.end());
+		int64_t span = newest->first - oldest->first;
+		// Too short span overestimates rate of first packets arriving in one burst
+		if (span < static_cast<int64_t>(acknowledgedWindowNs / 5)) {
+			return 0;
+		}
+		return acknowledgedBytes * 8e9 / span;
+	}
+
+	void CongestionController::updateDelayBased(const uint64_t nowNs) {
+		double ackedRate = acknowledgedRate();
+		double elapsed = (lastRateUpdateNs == 0) ? 0.0 : (std::min)(static_cast<double>(nowNs - lastRateUpdateNs) / 1e9, 1.0);
+		lastRateUpdateNs = nowNs;
+		uint64_t responseTimeNs = rtt + 100'000'000;
+
+		if (hypothesis == BandwidthUsage::overusing) {
+			if (nowNs - lastDecreaseNs >= responseTimeNs) {
+				double base = (ackedRate > 0) ? ackedRate : delayRate;
+				delayRate = (std::min)(delayRate, decreaseFactor * base);
+				if (ackedRate > 0) {
+					// Acknowledged rate at decrease estimates link capacity, variance is in kbit/s normalized by it and
+					// kept within bounds of the draft, so a few sharp drops do not leave additive increase stuck
+					averageMaxRate = (averageMaxRate < 0) ? ackedRate : 0.95 * averageMaxRate + 0.05 * ackedRate;
+					double normKbps = (std::max)(averageMaxRate / 1000, 1.0);
+					double errorKbps = (averageMaxRate - ackedRate) / 1000;
+					maxRateVariance = std::clamp(0.95 * maxRateVariance + 0.05 * errorKbps * errorKbps / normKbps, 0.4, 2.5);
+				}
+				lastDecreaseNs = nowNs;
+			}
+		}
+		else if (hypothesis == BandwidthUsage::normal) {
+			double deviation = 1000 * std::sqrt(maxRateVariance * (std::max)(averageMaxRate / 1000, 1.0));
+			if (averageMaxRate >= 0 && ackedRate > averageMaxRate + 3 * deviation) {
+				// Capacity went up, forget old estimate and probe multiplicatively again
+				averageMaxRate = -1.0;
+			}
+			bool nearMax = averageMaxRate >= 0 && std::abs(ackedRate - averageMaxRate) <= 3 * deviation;
+			if (nearMax) {
+				delayRate += (std::max)(1000.0, averagePacketBits * elapsed * 1e9 / responseTimeNs);
+			}
+			else {
+				delayRate *= std::pow(1.08, elapsed);
+			}
+		}
+		if (ackedRate > 0) {
+			// Never run far ahead of what actually gets through
+			delayRate = (std::min)(delayRate, 1.5 * ackedRate + 10'000);
+		}
+		delayRate = std::clamp(delayRate, static_cast<double>(settings.minBitrate), static_cast<double>(settings.maxBitrate));
+	}
+
+	void CongestionController::updateLossBased(const std::vector<PacketResult>& results, const uint64_t nowNs) {
+		for (const auto& packet : results) {
+			lossWindowTotal++;
+			lossWindowLost += packet.received ? 0 : 1;
+		}
+		if (lossWindowTotal < lossMinPackets || nowNs - lastLossUpdateNs < lossUpdateIntervalNs) {
+			return;
+		}
+		lastLossFraction = static_cast<double>(lossWindowLost) / lossWindowTotal;
+		double current = target();
+		if (lastLossFraction > 0.1) {
+			lossRate = current * (1 - 0.5 * lastLossFraction);
+		}
+		else if (lastLossFraction < 0.02) {
+			lossRate = (std::max)(lossRate, current * 1.08 + 1000);
+		}
+		lossRate = std::clamp(lossRate, static_cast<double>(settings.minBitrate), static_cast<double>(settings.maxBitrate));
+		lossWindowLost = 0;
+		lossWindowTotal = 0;
+		lastLossUpdateNs = nowNs;
+	}
+
+	double CongestionController::target() const {
+		return std::clamp((std::min)(delayRate, lossRate), static_cast<double>(settings.minBitrate), static_cast<double>(settings.maxBitrate));
+	}
+
+	uint64_t CongestionController::targetBitrate() const {
+		std::lock_guard lock(mutex);
+		return static_cast<uint64_t>(target());
+	}
+
+	uint64_t CongestionController::delayBasedBitrate() const {
+		std::lock_guard lock(mutex);
+		return static_cast<uint64_t>(delayRate);
+	}
+
+	uint64_t CongestionController::lossBasedBitrate() const {
+		std::lock_guard lock(mutex);
+		return static_cast<uint64_t>(lossRate);
+	}
+
+	uint64_t CongestionController::acknowledgedBitrate() const {
+		std::lock_guard lock(mutex);
+		return static_cast<uint64_t>(acknowledgedRate());
+	}
+
+	uint64_t CongestionController::rttNs() const {
+		std::lock_guard lock(mutex);
+		return rtt;
+	}
+
+	double CongestionController::lossFraction() const {
+		std::lock_guard lock(mutex);
+		return lastLossFraction;
+	}
+
+	BandwidthUsage CongestionController::usage() const {
+		std::lock_guard lock(mutex);
+		return hypothesis;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+namespace net {
+	// RTCP feedback for congestion control (RFC 8888), carries arrival time of every RTP packet in 1/1024 s
+	constexpr uint8_t rtcpFeedbackType = 205;
+	constexpr uint8_t congestionFeedbackFormat = 11;
+	// Keeps one feedback packet within 1200 byte segment
+	constexpr size_t maxFeedbackReports = 500;
+
+	// Receiver side, collects arrivals of all streams and turns them into feedback packets. Call build() every
+	// few tens of milliseconds, packets reordered past a report are reported lost.
+	class CongestionFeedback {
+	public:
+		explicit CongestionFeedback(uint32_t ssrc);
+		void onPacket(uint32_t ssrc, uint16_t seqNum, uint64_t arrivalNs);
+		// Reports packets seen since last call, returns false when nothing is left to report. With more than
+		// 'maxFeedbackReports' waiting, call again until it returns false.
+		bool build(std::vector<char>& out, uint64_t nowNs);
+	private:
+		struct Stream {
+			uint16_t beginSeq = 0;
+			std::vector<uint64_t> arrivals;		// indexed from 'beginSeq', 0 for packets not received
+			bool started = false;
+		};
+
+		uint32_t ssrc;
+		std::unordered_map<uint32_t, Stream> streams;
+	};
+
+	struct PacketResult {
+		uint64_t sentNs = 0;
+		int64_t arrivalNs = 0;					// receiver clock, only differences mean anything
+		uint32_t size = 0;
+		bool received = false;
+	};
+
+	enum class BandwidthUsage {
+		normal,
+		underusing,
+		overusing
+	};
+
+	struct CongestionSettings {
+		uint64_t startBitrate = 1'000'000;
+		uint64_t minBitrate = 100'000;
+		uint64_t maxBitrate = 200'000'000;
+	};
+
+	// Sender side bandwidth estimation after Google Congestion Control (draft-ietf-rmcat-gcc-02).
+	// Delay based part groups packets sent within 5 ms, fits trend line to one-way delay variation between groups
+	// and compares it with adaptive threshold. On overuse AIMD rate control falls back to 85% of acknowledged rate,
+	// otherwise it grows 8% per second, or by about one packet per round trip once close to last known capacity.
+	// Loss based part cuts rate when over 10% of packets are lost and lets it grow below 2%.
+	// Target bitrate is the lower of both, encoders and pacer follow it.
+	class CongestionController {
+	public:
+		explicit CongestionController(const CongestionSettings& settings = {});
+		// Thread safe, meant as sent observer of UDPConnection. Non RTP datagrams are ignored.
+		void onPacketSent(const char* data, int size, uint64_t sentNs);
+		// Parses RFC 8888 feedback, returns false when datagram is not one
+		bool onFeedback(const char* data, int size, uint64_t nowNs);
+		// Results carried by one feedback, 'rttNs' is 0 when unknown
+		void onPacketResults(std::vector<PacketResult> results, uint64_t nowNs, uint64_t rttNs);
+		uint64_t targetBitrate() const;
+		uint64_t delayBasedBitrate() const;
+		uint64_t lossBasedBitrate() const;
+		// Rate at which receiver got packets over last half second, 0 until known
+		uint64_t acknowledgedBitrate() const;
+		uint64_t rttNs() const;
+		double lossFraction() const;
+		BandwidthUsage usage() const;
+	private:
+		struct SentPacket {
+			uint64_t sentNs = 0;
+			uint32_t size = 0;
+			uint16_t seqNum = 0;
+			bool valid = false;
+		};
+
+		struct PacketGroup {
+			uint64_t firstSentNs = 0;
+			uint64_t lastSentNs = 0;
+			int64_t lastArrivalNs = 0;
+		};
+
+		void addPacket(const PacketResult& packet);
+		void addDelaySample(const PacketGroup& previous, const PacketGroup& current);
+		void detect(double trend, double sendDeltaMs, int64_t arrivalNs);
+		void updateThreshold(double modifiedTrend, int64_t arrivalNs);
+		void updateAcknowledged(const std::vector<PacketResult>& results);
+		double acknowledgedRate() const;
+		void updateDelayBased(uint64_t nowNs);
+		void updateLossBased(const std::vector<PacketResult>& results, uint64_t nowNs);
+		double target() const;
+
+		CongestionSettings settings;
+		mutable std::mutex mutex;
+		std::unordered_map<uint32_t, std::vector<SentPacket>> history;
+
+		// Feedback report clock unwrapped to nanoseconds
+		bool reportClockStarted = false;
+		uint32_t lastReportTimestamp = 0;
+		int64_t reportTicks = 0;
+
+		// Delay gradient
+		bool groupStarted = false;
+		bool previousGroupValid = false;
+		PacketGroup currentGroup;
+		PacketGroup previousGroup;
+		bool firstArrivalValid = false;
+		int64_t firstArrivalNs = 0;
+		uint32_t numDeltas = 0;
+		double accumulatedDelayMs = 0.0;
+		double smoothedDelayMs = 0.0;
+		std::deque<std::pair<double, double>> trendWindow;	// arrival ms and smoothed delay ms
+		double previousTrend = 0.0;
+		double threshold = 12.5;
+		int64_t lastThresholdUpdateNs = 0;
+		double timeOverUsingMs = -1.0;
+		int overuseCounter = 0;
+		BandwidthUsage hypothesis = BandwidthUsage::normal;
+
+		// Rate control
+		double delayRate;
+		double lossRate;
+		double averageMaxRate = -1.0;
+		double maxRateVariance = 0.4;			// kbit/s
+		uint64_t lastRateUpdateNs = 0;
+		uint64_t lastDecreaseNs = 0;
+		uint64_t rtt = 0;
+		std::deque<std::pair<int64_t, uint32_t>> acknowledged;	// arrival and size of received packets
+		uint64_t acknowledgedBytes = 0;
+		uint32_t lossWindowLost = 0;
+		uint32_t lossWindowTotal = 0;
+		uint64_t lastLossUpdateNs = 0;
+		double lastLossFraction = 0.0;
+	};
+}
\ No newline at end of file
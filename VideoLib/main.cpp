@@ -10,6 +10,8 @@
 #include "video.h"
 #include "audio.h"
 #include "network.h"
+#include "congestion.h"
+#include "network_metrics.h"
 
 #pragma comment (lib, "ole32.lib")
 #pragma comment (lib, "mf.lib")
@@ -20,6 +22,7 @@
 
 #include <locale>
 #include <locale.h>
+#include <random>
 
 #ifndef MS_STDLIB_BUGS
 #  if ( _MSC_VER || __MINGW32__ || __MSVCRT__ )
@@ -62,9 +65,15 @@ int main()
 
     net::ConnectionSettings settings{
         .ip = "127.0.0.1",
-        .port = 8888
+        .port = 8888,
+        .segmentSize = 1200,
+        .segmentationOffload = true,
+        .pacingRate = 20'000'000
     };
     net::UDPConnection connection{ settings };
+    // Pacer follows target bitrate, video frames are skipped while it is still backed up with earlier ones
+    net::CongestionController controller{ net::CongestionSettings{ .startBitrate = settings.pacingRate } };
+    std::vector<unsigned char> feedback;
     
 
 
@@ -122,6 +131,35 @@ int main()
     auto format = video::getMediaFormat(currentType);
     success(aggregateReader->SetCurrentMediaType(MF_SOURCE_READER_FIRST_AUDIO_STREAM, nullptr, mediaType.get()));
 
+    // RTP clocks, 90 kHz for video and sample rate for audio, sample times are in 100 ns units
+    UINT32 audioClockRate = 48000;
+    mediaType->GetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, &audioClockRate);
+    auto rtpTimestamp = [](long long sampleTime, UINT32 clockRate) {
+        return static_cast<uint32_t>(sampleTime * clockRate / 10'000'000);
+    };
+    std::random_device randomDevice;
+    net::RTPPacketizer audioPacketizer{ 97, randomDevice() };
+    net::RTPPacketizer videoPacketizer{ 96, randomDevice() };
+    // Sender reports go once a second, receiver answers with loss and jitter it sees and lets us measure round trip
+    net::RTCPSenderStats audioRtcp{ audioPacketizer.ssrc(), audioClockRate };
+    net::RTCPSenderStats videoRtcp{ videoPacketizer.ssrc(), 90000 };
+    std::vector<char> senderReport;
+    auto steadyNs = []() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    };
+    uint64_t reportTime = steadyNs();
+    // Written next to sender reports, scraper picks up socket, pacer and STUN metrics from one file
+    net::NetworkMetrics senderMetrics{ "videolib_sender" };
+    // Video frame interval comes from capture times, first frame and long capture gaps fall back to these
+    constexpr uint64_t defaultFrameIntervalNs = 33'333'333;
+    constexpr uint64_t maxFrameIntervalNs = 100'000'000;
+    long long lastVideoTime = -1;
+    connection.setSentObserver([&](const char* data, int size, uint64_t sentNs) {
+        controller.onPacketSent(data, size, sentNs);
+        audioRtcp.onPacketSent(data, size, sentNs);
+        videoRtcp.onPacketSent(data, size, sentNs);
+    });
+
     connection.connectServer();
     // AGGREGATE CAPTURE LOOP
     success(sinkWriter->BeginWriting());
@@ -139,12 +177,51 @@ int main()
 
         auto buffer = video::getContignousBuffer(audioSample.sample);
         video::runOnBufferData(buffer, [&](BYTE* data, DWORD size) {
-            connection.sendData(data, size);
+            connection.sendFrame(audioPacketizer, data, size, rtpTimestamp(audioSample.presentationTime, audioClockRate));
         });;
 
+        int feedbackSize = 0;
+        net::RTCPReport receiverReport;
+        while ((feedbackSize = connection.recvData(feedback)) > 0) {
+            auto packet = reinterpret_cast<const char*>(feedback.data());
+            if (controller.onFeedback(packet, feedbackSize, steadyNs()) || !net::readRTCPReport(packet, feedbackSize, receiverReport)) {
+                continue;
+            }
+            for (const auto& block : receiverReport.blocks) {
+                if (!audioRtcp.onReportBlock(block)) {
+                    videoRtcp.onReportBlock(block);
+                }
+            }
+        }
+        connection.setPacingRate(controller.targetBitrate());
+
+        uint64_t now = steadyNs();
+        if (now - reportTime >= 1'000'000'000) {
+            reportTime = now;
+            for (auto* rtcp : { &audioRtcp, &videoRtcp }) {
+                int reportSize = net::writeRTCPReport(rtcp->senderReport(now), senderReport);
+                connection.sendData(reinterpret_cast<BYTE*>(senderReport.data()), static_cast<DWORD>(reportSize));
+            }
+            std::wcout << L"Video: rtt " << videoRtcp.rttNs() / 1000 << L" us, lost " << videoRtcp.packetsLost() << L" ("
+                << videoRtcp.fractionLost() * 100 << L"%), jitter " << videoRtcp.jitterNs() / 1000 << L" us, target "
+                << controller.targetBitrate() / 1000 << L" kbit/s\n";
+            senderMetrics.publish(connection);
+            net::writeMetricsFile("videolib_sender.prom");
+        }
+
+        // Audio is cheap and always sent. Video frame is skipped while pacer holds more than one frame interval of
+        // data, so sender side queueing stays under a frame at whatever rate controller picked.
+        uint64_t frameIntervalNs = defaultFrameIntervalNs;
+        if (lastVideoTime >= 0 && videoSample.presentationTime > lastVideoTime) {
+            frameIntervalNs = (std::min)(static_cast<uint64_t>(videoSample.presentationTime - lastVideoTime) * 100, maxFrameIntervalNs);
+        }
+        lastVideoTime = videoSample.presentationTime;
+        if (connection.sendBacklogNs() > frameIntervalNs) {
+            continue;
+        }
         buffer = video::getContignousBuffer(videoSample.sample);
         video::runOnBufferData(buffer, [&](BYTE* data, DWORD size) {
-            connection.sendData(data, size);
+            connection.sendFrame(videoPacketizer, data, size, rtpTimestamp(videoSample.presentationTime, 90000));
             });;
     }
     success(sinkWriter->Finalize());
@@ -5,8 +5,33 @@
 #include <iostream>
 #include <format>
 #include <assert.h>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <random>
 
 namespace net {
+	// Upper bounds of one offloaded send and one coalesced receive
+	constexpr int maxOffloadSegments = 64;
+	constexpr int maxCoalescedSize = 65535;
+	// How long receive threads block before checking whether they were stopped
+	constexpr int shardPollTimeoutMs = 100;
+	// Sharded receiver runs its tick handler this often, also while no datagrams arrive
+	constexpr int shardTickMs = 10;
+	// Pacer wakes at most this often, and never sleeps longer than the cap so stop() is not held up
+	constexpr uint64_t pacerMinIntervalNs = 1'000'000;
+	constexpr uint64_t pacerMaxSleepNs = 50'000'000;
+	constexpr uint64_t pacerMinRate = 8000;
+	// RTCP sizes (RFC 3550, 6.4)
+	constexpr int rtcpHeaderSize = 8;
+	constexpr int senderInfoSize = 20;
+	constexpr int reportBlockSize = 24;
+	// Seqnum jumps sequence tracking treats as reordering or loss rather than restart (RFC 3550, A.1)
+	constexpr uint16_t maxDropout = 3000;
+	constexpr uint16_t maxMisorder = 100;
+	// Seconds between 1900 (NTP era 0) and 1970
+	constexpr uint64_t ntpUnixOffset = 2'208'988'800;
+
 	static void logWSAError(const char* msg) {
 		auto err = WSAGetLastError();
 		if (err == 10035) {
@@ -15,65 +40,1157 @@ namespace net {
 		std::wcout << "Error " << err << ": " << msg << '\n';
 	}
 
-	UDPConnection::UDPConnection(const ConnectionSettings& settings) :
-		settings(settings) {}
+	static uint64_t steadyClockNs() {
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+	}
 
-	bool UDPConnection::connectServer() {
-		sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	static void writeU16(char* out, const uint16_t value) {
+		uint16_t network = htons(value);
+		std::memcpy(out, &network, sizeof(network));
+	}
+
+	static void writeU32(char* out, const uint32_t value) {
+		uint32_t network = htonl(value);
+		std::memcpy(out, &network, sizeof(network));
+	}
+
+	static uint64_t ntpNow() {
+		auto now = std::chrono::system_clock::now().time_since_epoch();
+		auto ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+		uint64_t fraction = ((ns % 1'000'000'000) << 32) / 1'000'000'000;
+		return ((ns / 1'000'000'000 + ntpUnixOffset) << 32) | fraction;
+	}
+
+	static uint16_t readU16(const char* data) {
+		uint16_t network = 0;
+		std::memcpy(&network, data, sizeof(network));
+		return ntohs(network);
+	}
+
+	static uint32_t readU32(const char* data) {
+		uint32_t network = 0;
+		std::memcpy(&network, data, sizeof(network));
+		return ntohl(network);
+	}
+
+	// Padding and extension are never written, nothing here produces them
+	int writeRTPHeader(const RTPHeader& header, char* out) {
+		uint8_t csrcCount = header.csrcIdCount & 0x0F;
+		out[0] = static_cast<char>((header.version << 6) | csrcCount);
+		out[1] = static_cast<char>((header.marker ? 0x80 : 0) | (header.payloadType & 0x7F));
+		writeU16(out + 2, header.seqNum);
+		writeU32(out + 4, header.timestamp);
+		writeU32(out + 8, header.ssrc);
+		for (int i = 0; i < csrcCount; i++) {
+			writeU32(out + rtpHeaderSize + i * 4, header.csrcList[i]);
+		}
+		return rtpHeaderSize + csrcCount * 4;
+	}
+
+	int readRTPHeader(const char* data, const int size, RTPHeader& header, int& payloadSize) {
+		if (size < rtpHeaderSize) {
+			return 0;
+		}
+		auto first = static_cast<uint8_t>(data[0]);
+		auto second = static_cast<uint8_t>(data[1]);
+		header.version = first >> 6;
+		header.padding = (first >> 5) & 1;
+		header.extension = (first >> 4) & 1;
+		header.csrcIdCount = first & 0x0F;
+		header.marker = second >> 7;
+		header.payloadType = second & 0x7F;
+		if (header.version != 2) {
+			return 0;
+		}
+		header.seqNum = readU16(data + 2);
+		header.timestamp = readU32(data + 4);
+		header.ssrc = readU32(data + 8);
+		int headerSize = rtpHeaderSize + header.csrcIdCount * 4;
+		if (size < headerSize) {
+			return 0;
+		}
+		for (int i = 0; i < header.csrcIdCount; i++) {
+			header.csrcList[i] = readU32(data + rtpHeaderSize + i * 4);
+		}
+		if (header.extension) {
+			// Extension is skipped, its length is in 32 bit words after 16 bit profile id
+			if (size < headerSize + 4) {
+				return 0;
+			}
+			headerSize += 4 + readU16(data + headerSize + 2) * 4;
+			if (size < headerSize) {
+				return 0;
+			}
+		}
+		int paddingSize = header.padding ? static_cast<uint8_t>(data[size - 1]) : 0;
+		if (header.padding && (paddingSize == 0 || paddingSize > size - headerSize)) {
+			return 0;
+		}
+		payloadSize = size - headerSize - paddingSize;
+		return headerSize;
+	}
+
+	bool isRTCPPacket(const char* data, const int size) {
+		if (size < 8 || (static_cast<uint8_t>(data[0]) >> 6) != 2) {
+			return false;
+		}
+		auto packetType = static_cast<uint8_t>(data[1]);
+		return packetType >= 192 && packetType <= 223;
+	}
+
+	int writeRTCPReport(const RTCPReport& report, std::vector<char>& out) {
+		size_t blockCount = (std::min)(report.blocks.size(), maxReportBlocks);
+		int size = rtcpHeaderSize + (report.hasSenderInfo ? senderInfoSize : 0) + static_cast<int>(blockCount) * reportBlockSize;
+		out.resize(size);
+		char* data = out.data();
+		data[0] = static_cast<char>(0x80 | blockCount);
+		data[1] = static_cast<char>(report.hasSenderInfo ? rtcpSenderReport : rtcpReceiverReport);
+		writeU16(data + 2, static_cast<uint16_t>(size / 4 - 1));
+		writeU32(data + 4, report.ssrc);
+		int offset = rtcpHeaderSize;
+		if (report.hasSenderInfo) {
+			const auto& info = report.senderInfo;
+			writeU32(data + offset, static_cast<uint32_t>(info.ntpTimestamp >> 32));
+			writeU32(data + offset + 4, static_cast<uint32_t>(info.ntpTimestamp));
+			writeU32(data + offset + 8, info.rtpTimestamp);
+			writeU32(data + offset + 12, info.packetCount);
+			writeU32(data + offset + 16, info.octetCount);
+			offset += senderInfoSize;
+		}
+		for (size_t i = 0; i < blockCount; i++) {
+			const auto& block = report.blocks[i];
+			// Cumulative loss is 24 bit two's complement, clamped rather than wrapped
+			int32_t lost = std::clamp(block.cumulativeLost, -0x800000, 0x7FFFFF);
+			writeU32(data + offset, block.ssrc);
+			writeU32(data + offset + 4, (static_cast<uint32_t>(block.fractionLost) << 24) | (static_cast<uint32_t>(lost) & 0xFFFFFF));
+			writeU32(data + offset + 8, block.highestSeqNum);
+			writeU32(data + offset + 12, block.jitter);
+			writeU32(data + offset + 16, block.lastSR);
+			writeU32(data + offset + 20, block.delaySinceLastSR);
+			offset += reportBlockSize;
+		}
+		return size;
+	}
+
+	bool readRTCPReport(const char* data, const int size, RTCPReport& report) {
+		int offset = 0;
+		while (offset + rtcpHeaderSize <= size) {
+			const char* packet = data + offset;
+			if ((static_cast<uint8_t>(packet[0]) >> 6) != 2) {
+				return false;
+			}
+			int packetSize = (readU16(packet + 2) + 1) * 4;
+			if (offset + packetSize > size) {
+				return false;
+			}
+			offset += packetSize;
+			auto packetType = static_cast<uint8_t>(packet[1]);
+			if (packetType != rtcpSenderReport && packetType != rtcpReceiverReport) {
+				continue;
+			}
+			int blockCount = packet[0] & 0x1F;
+			report.hasSenderInfo = (packetType == rtcpSenderReport);
+			int position = rtcpHeaderSize;
+			if (packetSize < position + (report.hasSenderInfo ? senderInfoSize : 0) + blockCount * reportBlockSize) {
+				return false;
+			}
+			report.ssrc = readU32(packet + 4);
+			report.senderInfo = {};
+			if (report.hasSenderInfo) {
+				auto& info = report.senderInfo;
+				info.ntpTimestamp = (static_cast<uint64_t>(readU32(packet + position)) << 32) | readU32(packet + position + 4);
+				info.rtpTimestamp = readU32(packet + position + 8);
+				info.packetCount = readU32(packet + position + 12);
+				info.octetCount = readU32(packet + position + 16);
+				position += senderInfoSize;
+			}
+			report.blocks.resize(blockCount);
+			for (auto& block : report.blocks) {
+				uint32_t loss = readU32(packet + position + 4);
+				block.ssrc = readU32(packet + position);
+				block.fractionLost = static_cast<uint8_t>(loss >> 24);
+				// Sign extends 24 bit field
+				block.cumulativeLost = static_cast<int32_t>(loss << 8) >> 8;
+				block.highestSeqNum = readU32(packet + position + 8);
+				block.jitter = readU32(packet + position + 12);
+				block.lastSR = readU32(packet + position + 16);
+				block.delaySinceLastSR = readU32(packet + position + 20);
+				position += reportBlockSize;
+			}
+			return true;
+		}
+		return false;
+	}
+
+	RTCPReceiverStats::RTCPReceiverStats(const uint32_t ssrc, const uint32_t clockRate):
+		sourceSsrc(ssrc),
+		clockRate(clockRate) {}
+
+	void RTCPReceiverStats::restart(const uint16_t seqNum) {
+		maxSeq = seqNum;
+		cycles = 0;
+		baseSeq = seqNum;
+		badSeq = UINT32_MAX;
+		received = 0;
+		expectedPrior = 0;
+		receivedPrior = 0;
+	}
+
+	void RTCPReceiverStats::onPacket(const RTPHeader& header, const uint64_t arrivalNs) {
+		if (header.ssrc != sourceSsrc) {
+			return;
+		}
+		uint16_t seqNum = header.seqNum;
+		if (!started) {
+			started = true;
+			restart(seqNum);
+		}
+		else {
+			uint16_t delta = seqNum - maxSeq;
+			if (delta < maxDropout) {
+				if (seqNum < maxSeq) {
+					cycles += 65536;
+				}
+				maxSeq = seqNum;
+			}
+			else if (delta <= 65536 - maxMisorder) {
+				// Large jump, either sender restarted or packets got lost badly. Only next packet in sequence confirms it.
+				if (seqNum != badSeq) {
+					badSeq = static_cast<uint16_t>(seqNum + 1);
+					return;
+				}
+				restart(seqNum);
+			}
+			// Otherwise duplicate or reordered packet, it is counted but moves nothing
+		}
+		received++;
+
+		// Every packet is sampled as RFC 3550 A.8 asks, so packets of one frame that share timestamp add pacer's
+		// spread to jitter, same as any other receiver of this stream would report it
+		if (timingStarted) {
+			double arrivalTicks = static_cast<double>(static_cast<int64_t>(arrivalNs - lastArrivalNs)) * clockRate / 1e9;
+			double difference = arrivalTicks - static_cast<int32_t>(header.timestamp - lastTimestamp);
+			jitter += (std::abs(difference) - jitter) / 16.0;
+		}
+		timingStarted = true;
+		lastTimestamp = header.timestamp;
+		lastArrivalNs = arrivalNs;
+	}
+
+	void RTCPReceiverStats::onSenderReport(const RTCPReport& report, const uint64_t arrivalNs) {
+		if (!report.hasSenderInfo || report.ssrc != sourceSsrc) {
+			return;
+		}
+		lastSR = static_cast<uint32_t>(report.senderInfo.ntpTimestamp >> 16);
+		lastSRArrivalNs = arrivalNs;
+	}
+
+	uint64_t RTCPReceiverStats::expected() const {
+		return started ? static_cast<uint64_t>(cycles) + maxSeq - baseSeq + 1 : 0;
+	}
+
+	RTCPReportBlock RTCPReceiverStats::reportBlock(const uint64_t nowNs) {
+		RTCPReportBlock block;
+		block.ssrc = sourceSsrc;
+		block.cumulativeLost = static_cast<int32_t>(std::clamp<int64_t>(packetsLost(), -0x800000, 0x7FFFFF));
+		block.highestSeqNum = cycles + maxSeq;
+		block.jitter = static_cast<uint32_t>(jitter);
+		uint64_t expectedInterval = expected() - expectedPrior;
+		uint64_t receivedInterval = received - receivedPrior;
+		expectedPrior = expected();
+		receivedPrior = received;
+		if (expectedInterval > receivedInterval) {
+			block.fractionLost = static_cast<uint8_t>(((expectedInterval - receivedInterval) << 8) / expectedInterval);
+		}
+		if (lastSR != 0) {
+			block.lastSR = lastSR;
+			block.delaySinceLastSR = static_cast<uint32_t>((nowNs - lastSRArrivalNs) * 65536 / 1'000'000'000);
+		}
+		return block;
+	}
+
+	uint32_t RTCPReceiverStats::ssrc() const {
+		return sourceSsrc;
+	}
+
+	uint64_t RTCPReceiverStats::packetsReceived() const {
+		return received;
+	}
+
+	int64_t RTCPReceiverStats::packetsLost() const {
+		return static_cast<int64_t>(expected()) - static_cast<int64_t>(received);
+	}
+
+	uint64_t RTCPReceiverStats::jitterNs() const {
+		return static_cast<uint64_t>(jitter * 1e9 / clockRate);
+	}
+
+	RTCPSenderStats::RTCPSenderStats(const uint32_t ssrc, const uint32_t clockRate):
+		streamSsrc(ssrc),
+		clockRate(clockRate) {}
+
+	void RTCPSenderStats::onPacketSent(const char* data, const int size, const uint64_t sentNs) {
+		RTPHeader header;
+		int payloadSize = 0;
+		if (isRTCPPacket(data, size) || readRTPHeader(data, size, header, payloadSize) == 0 || header.ssrc != streamSsrc) {
+			return;
+		}
+		std::lock_guard lock(mutex);
+		packetCount++;
+		octetCount += payloadSize;
+		lastTimestamp = header.timestamp;
+		lastSentNs = sentNs;
+	}
+
+	RTCPReport RTCPSenderStats::senderReport(const uint64_t nowNs) const {
+		RTCPReport report;
+		report.ssrc = streamSsrc;
+		report.hasSenderInfo = true;
+		report.senderInfo.ntpTimestamp = ntpNow();
+		std::lock_guard lock(mutex);
+		// RTP timestamp of this instant is extrapolated from last packet sent, receivers use it to sync streams
+		auto elapsedTicks = (nowNs > lastSentNs && lastSentNs != 0) ? (nowNs - lastSentNs) * clockRate / 1'000'000'000 : 0;
+		report.senderInfo.rtpTimestamp = lastTimestamp + static_cast<uint32_t>(elapsedTicks);
+		report.senderInfo.packetCount = packetCount;
+		report.senderInfo.octetCount = octetCount;
+		return report;
+	}
+
+	bool RTCPSenderStats::onReportBlock(const RTCPReportBlock& block) {
+		if (block.ssrc != streamSsrc) {
+			return false;
+		}
+		std::lock_guard lock(mutex);
+		lastBlock = block;
+		if (block.lastSR != 0) {
+			// All in 1/65536 s, arrival minus time SR left minus time it waited at receiver
+			uint32_t roundTrip = static_cast<uint32_t>(ntpNow() >> 16) - block.lastSR - block.delaySinceLastSR;
+			if (roundTrip < 0x80000000) {
+				rtt = static_cast<uint64_t>(roundTrip) * 1'000'000'000 / 65536;
+			}
+		}
+		return true;
+	}
+
+	uint32_t RTCPSenderStats::ssrc() const {
+		return streamSsrc;
+	}
+
+	uint64_t RTCPSenderStats::rttNs() const {
+		std::lock_guard lock(mutex);
+		return rtt;
+	}
+
+	double RTCPSenderStats::fractionLost() const {
+		std::lock_guard lock(mutex);
+		return lastBlock.fractionLost / 256.0;
+	}
+
+	int64_t RTCPSenderStats::packetsLost() const {
+		std::lock_guard lock(mutex);
+		return lastBlock.cumulativeLost;
+	}
+
+	uint64_t RTCPSenderStats::jitterNs() const {
+		std::lock_guard lock(mutex);
+		return static_cast<uint64_t>(lastBlock.jitter) * 1'000'000'000 / clockRate;
+	}
+
+	RTPPacketizer::RTPPacketizer(const uint8_t payloadType, const uint32_t ssrc) {
+		header.payloadType = payloadType;
+		header.ssrc = ssrc;
+		// Random start makes known plaintext attacks on encrypted streams harder (RFC 3550, 5.1)
+		header.seqNum = static_cast<uint16_t>(std::random_device{}());
+	}
+
+	int RTPPacketizer::packetize(const char* data, const int size, const uint32_t timestamp, const int packetSize, std::vector<char>& out) {
+		out.clear();
+		int payloadSize = packetSize - rtpHeaderSize - rtpPayloadHeaderSize;
+		if (size <= 0 || payloadSize <= 0) {
+			return 0;
+		}
+		int count = (size + payloadSize - 1) / payloadSize;
+		out.resize(static_cast<size_t>(size) + static_cast<size_t>(count) * (rtpHeaderSize + rtpPayloadHeaderSize));
+		char* packet = out.data();
+		header.timestamp = timestamp;
+		for (int offset = 0; offset < size; offset += payloadSize) {
+			int chunk = (std::min)(payloadSize, size - offset);
+			header.marker = (offset + chunk == size) ? 1 : 0;
+			packet += writeRTPHeader(header, packet);
+			*packet++ = static_cast<char>((offset == 0) ? rtpFrameStart : 0);
+			std::memcpy(packet, data + offset, chunk);
+			packet += chunk;
+			header.seqNum++;
+		}
+		return count;
+	}
+
+	uint16_t RTPPacketizer::nextSeqNum() const {
+		return header.seqNum;
+	}
+
+	uint32_t RTPPacketizer::ssrc() const {
+		return header.ssrc;
+	}
+
+	RTPDepacketizer::RTPDepacketizer(const size_t maxFrameSize) :
+		maxFrameSize(maxFrameSize) {}
+
+	void RTPDepacketizer::dropFrame() {
+		counters.framesLost++;
+		assembled.clear();
+		inFrame = false;
+		broken = false;
+	}
+
+	bool RTPDepacketizer::push(const char* data, const int size) {
+		if (complete) {
+			assembled.clear();
+			complete = false;
+		}
+		RTPHeader header;
+		int payloadSize = 0;
+		int headerSize = readRTPHeader(data, size, header, payloadSize);
+		if (headerSize == 0 || payloadSize < rtpPayloadHeaderSize || (started && header.ssrc != last.ssrc)) {
+			counters.packetsInvalid++;
+			return false;
+		}
+		auto gap = static_cast<int16_t>(header.seqNum - static_cast<uint16_t>(last.seqNum + 1));
+		if (started && gap < 0) {
+			// Duplicate or reordered packet, its frame is already finished or dropped
+			counters.packetsInvalid++;
+			return false;
+		}
+		counters.packetsReceived++;
+		counters.packetsLost += started ? gap : 0;
+		bool frameStart = (static_cast<uint8_t>(data[headerSize]) & rtpFrameStart) != 0;
+		headerSize += rtpPayloadHeaderSize;
+		payloadSize -= rtpPayloadHeaderSize;
+
+		if (inFrame && (header.timestamp != last.timestamp || frameStart)) {
+			// Marker packet of unfinished frame was lost
+			dropFrame();
+		}
+		if (!inFrame) {
+			// Gap before frame start only cost earlier frames, this one is whole if nothing goes missing from here
+			inFrame = true;
+			broken = !frameStart;
+		}
+		else if (gap > 0) {
+			broken = true;
+		}
+		last = header;
+		started = true;
+
+		if (!broken && assembled.size() + payloadSize > maxFrameSize) {
+			broken = true;
+		}
+		if (!broken) {
+			assembled.insert(assembled.end(), data + headerSize, data + headerSize + payloadSize);
+		}
+		if (!header.marker) {
+			return false;
+		}
+		if (broken) {
+			dropFrame();
+			return false;
+		}
+		inFrame = false;
+		complete = true;
+		counters.framesCompleted++;
+		return true;
+	}
+
+	const std::vector<char>& RTPDepacketizer::frame() const {
+		return assembled;
+	}
+
+	uint32_t RTPDepacketizer::frameTimestamp() const {
+		return last.timestamp;
+	}
+
+	uint8_t RTPDepacketizer::payloadType() const {
+		return last.payloadType;
+	}
+
+	const RTPFrameStats& RTPDepacketizer::stats() const {
+		return counters;
+	}
+
+	PeerSession::PeerSession(const std::string& ip, const uint16_t port) :
+		ip(ip), port(port) {}
+
+	PeerSession::~PeerSession() {
+		close();
+	}
+
+	bool PeerSession::open() {
+		sock = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 		if (sock == INVALID_SOCKET) {
-			logWSAError("Creating UDP connection socket failed.");
+			logWSAError("Creating peer session socket failed.");
 			return false;
 		}
 
 		u_long mode = 1;
-		int result = ioctlsocket(sock, FIONBIO, &mode);
-		if (result != NO_ERROR) {
+		if (ioctlsocket(sock, FIONBIO, &mode) != NO_ERROR) {
 			logWSAError("Setting socket as non-blocking failed.");
+			close();
 			return false;
 		}
 
 		address.sin_family = AF_INET;
-		address.sin_port = htons(settings.port);
-		std::wstring ip{ settings.ip.cbegin(), settings.ip.cend() };
-		InetPton(AF_INET, ip.c_str(), &address.sin_addr.s_addr);
-		/*
-		if (connect(sock, reinterpret_cast<SOCKADDR*>(&address), sizeof(address))) {
-			logWSAError(std::format("Connecting to ip='{}', port= failed", settings.ip, settings.port).c_str());
+		address.sin_port = htons(port);
+		std::wstring wideIp{ ip.cbegin(), ip.cend() };
+		InetPton(AF_INET, wideIp.c_str(), &address.sin_addr.s_addr);
+		if (connect(sock, reinterpret_cast<SOCKADDR*>(&address), sizeof(address)) == SOCKET_ERROR) {
+			logWSAError(std::format("Connecting to ip='{}', port={} failed.", ip, port).c_str());
+			close();
 			return false;
-		}*/
+		}
+		return true;
+	}
+
+	void PeerSession::close() {
+		if (sock != INVALID_SOCKET) {
+			closesocket(sock);
+			sock = INVALID_SOCKET;
+		}
+	}
+
+	bool PeerSession::isOpen() const {
+		return sock != INVALID_SOCKET;
+	}
+
+	int PeerSession::send(const char* data, const int size) {
+		int sent = ::send(sock, data, size, 0);
+		if (sent == SOCKET_ERROR) {
+			if (WSAGetLastError() != WSAEWOULDBLOCK) {
+				std::lock_guard lock(statsMutex);
+				counters.sendErrors++;
+			}
+			return sent;
+		}
+		std::lock_guard lock(statsMutex);
+		counters.packetsSent += (segmentSize > 0 && sent > 0) ? (sent + segmentSize - 1) / segmentSize : 1;
+		counters.bytesSent += sent;
+		counters.lastSend = std::chrono::steady_clock::now();
+		return sent;
+	}
+
+	int PeerSession::recv(char* data, const int size) {
+		int received = ::recv(sock, data, size, 0);
+		if (received == SOCKET_ERROR) {
+			if (WSAGetLastError() == WSAEWOULDBLOCK) {
+				return 0;
+			}
+			std::lock_guard lock(statsMutex);
+			counters.recvErrors++;
+			return received;
+		}
+		std::lock_guard lock(statsMutex);
+		counters.packetsReceived++;
+		counters.bytesReceived += received;
+		counters.lastRecv = std::chrono::steady_clock::now();
+		return received;
+	}
+
+	void PeerSession::setSegmentSize(const int size) {
+		std::lock_guard lock(statsMutex);
+		segmentSize = size;
+	}
+
+	PeerStats PeerSession::stats() const {
+		std::lock_guard lock(statsMutex);
+		return counters;
+	}
+
+	SOCKET PeerSession::socket() const {
+		return sock;
+	}
+
+	const sockaddr_in& PeerSession::peerAddress() const {
+		return address;
+	}
+
+	sockaddr_in PeerSession::localAddress() const {
+		sockaddr_in local{};
+		int length = sizeof(local);
+		if (getsockname(sock, reinterpret_cast<SOCKADDR*>(&local), &length) == SOCKET_ERROR) {
+			logWSAError("Reading local address of peer session failed.");
+		}
+		return local;
+	}
+
+	// Time over which playout delay falls back to target once jitter drops, and over which base transit is tracked
+	constexpr uint64_t jitterDelayDecayNs = 2'000'000'000;
+	constexpr uint64_t jitterTransitWindowNs = 2'000'000'000;
+
+	JitterBuffer::JitterBuffer(const JitterBufferSettings& settings) :
+		settings(settings) {
+		size_t capacity = 1;
+		while (capacity < (std::min)(settings.capacity, size_t(32768))) {
+			capacity <<= 1;
+		}
+		slots.resize(capacity);
+		mask = capacity - 1;
+		delay = static_cast<double>(settings.minDelayNs);
+	}
+
+	void JitterBuffer::reset(const RTPHeader& header) {
+		for (auto& slot : slots) {
+			slot.filled = false;
+		}
+		buffered = 0;
+		started = true;
+		ssrc = header.ssrc;
+		head = header.seqNum;
+		referenceTimestamp = header.timestamp;
+		windowStartNs = 0;
+		jitter = 0.0;
+	}
+
+	int64_t JitterBuffer::mediaNs(const uint32_t timestamp) const {
+		return static_cast<int64_t>(static_cast<int32_t>(timestamp - referenceTimestamp)) * 1'000'000'000 / settings.clockRate;
+	}
+
+	void JitterBuffer::updateTiming(const uint32_t timestamp, const uint64_t arrivalNs) {
+		if (static_cast<int32_t>(timestamp - referenceTimestamp) > (1 << 30)) {
+			// Keeps timestamp differences away from 32 bit wrap on long sessions
+			constexpr uint32_t step = 1u << 29;
+			int64_t shift = static_cast<int64_t>(step) * 1'000'000'000 / settings.clockRate;
+			referenceTimestamp += step;
+			lastTransitNs += shift;
+			windowMinTransitNs += shift;
+			previousMinTransitNs += shift;
+		}
+		int64_t transit = static_cast<int64_t>(arrivalNs) - mediaNs(timestamp);
+		if (windowStartNs == 0) {
+			lastTransitNs = transit;
+			windowMinTransitNs = transit;
+			previousMinTransitNs = transit;
+			windowStartNs = arrivalNs;
+			lastArrivalNs = arrivalNs;
+			return;
+		}
+		// RFC 3550 6.4.1, transit difference smoothed with gain 1/16
+		jitter += (std::abs(static_cast<double>(transit - lastTransitNs)) - jitter) / 16.0;
+		lastTransitNs = transit;
+		if (arrivalNs - windowStartNs >= jitterTransitWindowNs) {
+			previousMinTransitNs = windowMinTransitNs;
+			windowMinTransitNs = transit;
+			windowStartNs = arrivalNs;
+		}
+		else {
+			windowMinTransitNs = (std::min)(windowMinTransitNs, transit);
+		}
+
+		double target = std::clamp(jitter * settings.jitterMultiplier, static_cast<double>(settings.minDelayNs), static_cast<double>(settings.maxDelayNs));
+		if (target > delay) {
+			delay = target;
+		}
+		else if (arrivalNs > lastArrivalNs) {
+			double elapsed = static_cast<double>(arrivalNs - lastArrivalNs);
+			delay -= (delay - target) * (std::min)(1.0, elapsed / jitterDelayDecayNs);
+		}
+		lastArrivalNs = (std::max)(lastArrivalNs, arrivalNs);
+	}
+
+	uint64_t JitterBuffer::playoutNs(const uint32_t timestamp) const {
+		int64_t playout = mediaNs(timestamp) + (std::min)(windowMinTransitNs, previousMinTransitNs) + static_cast<int64_t>(delay);
+		return (playout > 0) ? static_cast<uint64_t>(playout) : 0;
+	}
+
+	bool JitterBuffer::push(const char* data, const int size, const uint64_t arrivalNs) {
+		RTPHeader header;
+		int payloadSize = 0;
+		if (readRTPHeader(data, size, header, payloadSize) == 0) {
+			counters.packetsInvalid++;
+			return false;
+		}
+		if (!started || header.ssrc != ssrc) {
+			counters.resets += started ? 1 : 0;
+			reset(header);
+		}
+		updateTiming(header.timestamp, arrivalNs);
+
+		auto ahead = static_cast<int16_t>(header.seqNum - head);
+		if (ahead < 0) {
+			counters.late++;
+			// Delay was too short for this packet, stretch it so the next one this late is still played
+			uint64_t playout = playoutNs(header.timestamp);
+			if (arrivalNs > playout) {
+				delay = (std::min)(delay + static_cast<double>(arrivalNs - playout), static_cast<double>(settings.maxDelayNs));
+			}
+			return false;
+		}
+		if (static_cast<size_t>(ahead) > mask) {
+			// Sender skipped more than buffer holds, nothing buffered would ever be played in order
+			counters.resets++;
+			reset(header);
+		}
+		auto& slot = slots[header.seqNum & mask];
+		if (slot.filled) {
+			counters.duplicates++;
+			return false;
+		}
+		slot.data.assign(data, data + size);
+		slot.timestamp = header.timestamp;
+		slot.seqNum = header.seqNum;
+		slot.filled = true;
+		buffered++;
+		counters.packetsReceived++;
+		return true;
+	}
+
+	bool JitterBuffer::pop(std::vector<char>& packet, const uint64_t nowNs) {
+		while (buffered > 0) {
+			auto& slot = slots[head & mask];
+			if (slot.filled) {
+				if (playoutNs(slot.timestamp) > nowNs) {
+					return false;
+				}
+				// Caller's buffer goes into the slot, so buffers circulate instead of being reallocated
+				packet.swap(slot.data);
+				slot.filled = false;
+				buffered--;
+				head++;
+				counters.packetsPlayed++;
+				return true;
+			}
+			// Missing packet is given up once the packet after the gap is due
+			uint16_t next = head + 1;
+			while (!slots[next & mask].filled) {
+				next++;
+			}
+			if (playoutNs(slots[next & mask].timestamp) > nowNs) {
+				return false;
+			}
+			counters.lost += static_cast<uint16_t>(next - head);
+			head = next;
+		}
+		return false;
+	}
+
+	size_t JitterBuffer::size() const {
+		return buffered;
+	}
+
+	uint64_t JitterBuffer::jitterNs() const {
+		return static_cast<uint64_t>(jitter);
+	}
+
+	uint64_t JitterBuffer::delayNs() const {
+		return static_cast<uint64_t>(delay);
+	}
+
+	const JitterBufferStats& JitterBuffer::stats() const {
+		return counters;
+	}
+
+	Pacer::Pacer(PeerSession& session, const uint64_t bitsPerSecond, const uint32_t burstBytes, const size_t capacity) :
+		session(session),
+		bitsPerSecond((std::max)(bitsPerSecond, pacerMinRate)),
+		burstBytes(burstBytes),
+		capacity(capacity) {}
+
+	Pacer::~Pacer() {
+		stop();
+	}
+
+	bool Pacer::start() {
+		if (running) {
+			return false;
+		}
+#if defined(_WIN32) && defined(CREATE_WAITABLE_TIMER_HIGH_RESOLUTION)
+		// Default timer resolution is 15.6 ms, far coarser than gaps between paced packets
+		timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+		if (timer == nullptr) {
+			std::wcout << "High resolution timer not available, pacer sleeps with default resolution.\n";
+		}
+#endif
+		running = true;
+		worker = std::thread(&Pacer::run, this);
+		return true;
+	}
+
+	void Pacer::stop() {
+		{
+			std::lock_guard lock(mutex);
+			running = false;
+		}
+		ready.notify_all();
+		if (worker.joinable()) {
+			worker.join();
+		}
+#ifdef _WIN32
+		if (timer != nullptr) {
+			CloseHandle(timer);
+			timer = nullptr;
+		}
+#endif
+	}
+
+	bool Pacer::enqueue(const char* data, const int size) {
+		{
+			std::lock_guard lock(mutex);
+			if (queue.size() >= capacity) {
+				droppedCount++;
+				return false;
+			}
+			if (spare.empty()) {
+				queue.emplace_back(data, data + size);
+			}
+			else {
+				queue.push_back(std::move(spare.back()));
+				spare.pop_back();
+				queue.back().assign(data, data + size);
+			}
+			bytes += size;
+		}
+		ready.notify_one();
+		return true;
+	}
+
+	void Pacer::setRate(const uint64_t bitsPerSecond) {
+		this->bitsPerSecond = (std::max)(bitsPerSecond, pacerMinRate);
+	}
+
+	void Pacer::setSentObserver(SentObserver observer) {
+		onSent = std::move(observer);
+	}
+
+	uint64_t Pacer::rate() const {
+		return bitsPerSecond;
+	}
+
+	size_t Pacer::queueDepth() const {
+		std::lock_guard lock(mutex);
+		return queue.size();
+	}
+
+	size_t Pacer::queuedBytes() const {
+		std::lock_guard lock(mutex);
+		return bytes;
+	}
+
+	uint64_t Pacer::backlogNs() const {
+		std::lock_guard lock(mutex);
+		return static_cast<uint64_t>(bytes) * 8'000'000'000 / bitsPerSecond;
+	}
+
+	uint64_t Pacer::dropped() const {
+		return droppedCount;
+	}
+
+	void Pacer::sleepFor(const uint64_t ns) {
+#ifdef _WIN32
+		if (timer != nullptr) {
+			LARGE_INTEGER dueTime{};
+			dueTime.QuadPart = -static_cast<LONGLONG>(ns / 100);
+			if (SetWaitableTimer(timer, &dueTime, 0, nullptr, nullptr, FALSE)) {
+				WaitForSingleObject(timer, INFINITE);
+				return;
+			}
+		}
+#endif
+		std::this_thread::sleep_for(std::chrono::nanoseconds{ ns });
+	}
+
+	bool Pacer::sendOne(const std::vector<char>& datagram) {
+		while (running) {
+			if (session.send(datagram.data(), static_cast<int>(datagram.size())) != SOCKET_ERROR) {
+				if (onSent) {
+					onSent(datagram.data(), static_cast<int>(datagram.size()), steadyClockNs());
+				}
+				return true;
+			}
+			if (WSAGetLastError() != WSAEWOULDBLOCK) {
+				logWSAError("Sending paced datagram failed, dropping it.");
+				droppedCount++;
+				return false;
+			}
+			WSAPOLLFD fd{};
+			fd.fd = session.socket();
+			fd.events = POLLWRNORM;
+			WSAPoll(&fd, 1, shardPollTimeoutMs);
+		}
+		return false;
+	}
+
+	void Pacer::run() {
+		// Bucket starts full, first burst after start goes out at once
+		double tokens = burstBytes;
+		uint64_t lastRefill = steadyClockNs();
+		std::vector<char> datagram;
+		while (running) {
+			{
+				std::unique_lock lock(mutex);
+				ready.wait(lock, [&]() { return !queue.empty() || !running; });
+				if (!running) {
+					break;
+				}
+			}
+			double bytesPerNs = static_cast<double>(bitsPerSecond.load()) / 8e9;
+			double bucketSize = (std::max)(static_cast<double>(burstBytes), bytesPerNs * pacerMinIntervalNs);
+			uint64_t now = steadyClockNs();
+			tokens = (std::min)(bucketSize, tokens + (now - lastRefill) * bytesPerNs);
+			lastRefill = now;
+			if (tokens < 0) {
+				// Datagram larger than what was left went out on credit, wait until it is paid back
+				auto wait = static_cast<uint64_t>(-tokens / bytesPerNs);
+				sleepFor(std::clamp(wait, pacerMinIntervalNs, pacerMaxSleepNs));
+				continue;
+			}
+			while (tokens >= 0) {
+				{
+					std::lock_guard lock(mutex);
+					if (datagram.capacity() > 0) {
+						spare.push_back(std::move(datagram));
+						datagram = {};
+					}
+					if (queue.empty()) {
+						break;
+					}
+					datagram = std::move(queue.front());
+					queue.pop_front();
+					bytes -= datagram.size();
+				}
+				sendOne(datagram);
+				tokens -= static_cast<double>(datagram.size());
+			}
+		}
+	}
+
+	UDPConnection::UDPConnection(const ConnectionSettings& settings) :
+		settings(settings), session(settings.ip, settings.port) {}
+
+	bool UDPConnection::connectServer() {
+		// Connected socket skips route lookup on every send, which adds up with small segments
+		if (!session.open()) {
+			return false;
+		}
+		sock = session.socket();
 
 		int optLen = sizeof(int);
 		getsockopt(sock, SOL_SOCKET, SO_MAX_MSG_SIZE, reinterpret_cast<char*>(&maxPacketSize), &optLen);
 		assert(maxPacketSize > 0);
+
+		int requestedSize = (settings.segmentSize > 0) ? settings.segmentSize : defaultSegmentSize;
+		segmentSize = (std::min)(requestedSize, maxPacketSize);
+		if (settings.segmentationOffload && segmentSize < maxPacketSize) {
+			offloadEnabled = enableSendOffload();
+		}
+		if (settings.pacingRate > 0) {
+			pacer = std::make_unique<Pacer>(session, settings.pacingRate, settings.pacingBurst, settings.sendQueueCapacity);
+			pacer->setSentObserver(onSent);
+			pacer->start();
+		}
 		return true;
 	}
 
-	void UDPConnection::disconnect() const {
-		closesocket(sock);
+	bool UDPConnection::enableSendOffload() {
+#ifdef UDP_SEND_MSG_SIZE
+		DWORD msgSize = static_cast<DWORD>(segmentSize);
+		if (setsockopt(sock, IPPROTO_UDP, UDP_SEND_MSG_SIZE, reinterpret_cast<const char*>(&msgSize), sizeof(msgSize)) == SOCKET_ERROR) {
+			logWSAError("UDP send offload not available, segmenting in user space.");
+			return false;
+		}
+		session.setSegmentSize(segmentSize);
+		segmentsPerSend = (std::min)(maxOffloadSegments, maxPacketSize / segmentSize);
+		return segmentsPerSend > 1;
+#else
+		return false;
+#endif
+	}
+
+	bool UDPConnection::isOffloadEnabled() const {
+		return offloadEnabled;
+	}
+
+	void UDPConnection::disconnect() {
+		pacer.reset();
+		session.close();
+		sock = INVALID_SOCKET;
 	}
 
 	int UDPConnection::sendData(const std::vector<unsigned char>& buffer) {
-		return 0;
+		return sendData(const_cast<BYTE*>(buffer.data()), static_cast<DWORD>(buffer.size()));
 	}
 
-	int UDPConnection::sendData(BYTE* data, DWORD size) {
+	int UDPConnection::sendSegmented(const char* data, const int size, bool& wouldBlock) {
 		int allSent = 0;
 		while (allSent < size) {
-			int toSend = (std::min)(maxPacketSize, static_cast<int>(size) - allSent);
-			allSent += sendto(sock, reinterpret_cast<char*>(data) + allSent, toSend, 0, reinterpret_cast<SOCKADDR*>(&address), sizeof(address));
+			// With offload one call carries up to 'segmentsPerSend' datagrams, the stack splits it on 'segmentSize' boundaries
+			int chunkSize = offloadEnabled ? segmentSize * segmentsPerSend : segmentSize;
+			int toSend = (std::min)(chunkSize, size - allSent);
+			int sent = session.send(data + allSent, toSend);
+			if (sent == SOCKET_ERROR) {
+				int error = WSAGetLastError();
+				if (error == WSAEWOULDBLOCK) {
+					wouldBlock = true;
+					return allSent;
+				}
+#ifdef UDP_SEND_MSG_SIZE
+				// Socket accepted the option but the path cannot segment (e.g. driver without USO), continue without offload.
+				// Other errors (unreachable peer, no buffers) are not about offload and would hit plain sends too.
+				if (offloadEnabled && (error == WSAEINVAL || error == WSAEOPNOTSUPP)) {
+					logWSAError("Offloaded send failed, segmenting in user space.");
+					DWORD msgSize = 0;
+					setsockopt(sock, IPPROTO_UDP, UDP_SEND_MSG_SIZE, reinterpret_cast<const char*>(&msgSize), sizeof(msgSize));
+					session.setSegmentSize(0);
+					offloadEnabled = false;
+					continue;
+				}
+#endif
+				return (allSent > 0) ? allSent : SOCKET_ERROR;
+			}
+			notifySent(data + allSent, sent);
+			allSent += sent;
+		}
+		return allSent;
+	}
+
+	// Offloaded send carries several datagrams, observer gets each of them
+	void UDPConnection::notifySent(const char* data, const int size) {
+		if (!onSent) {
+			return;
 		}
-		
+		uint64_t now = steadyClockNs();
+		for (int offset = 0; offset < size; offset += segmentSize) {
+			onSent(data + offset, (std::min)(segmentSize, size - offset), now);
+		}
+	}
+
+	void UDPConnection::setSentObserver(SentObserver observer) {
+		onSent = std::move(observer);
+	}
+
+	void UDPConnection::enqueue(const char* data, const int size) {
+		// Parked data is kept as separate datagrams, so flushing never depends on offload being available
+		for (int offset = 0; offset < size; offset += segmentSize) {
+			if (sendQueue.size() >= settings.sendQueueCapacity) {
+				dropped++;
+				continue;
+			}
+			int datagramSize = (std::min)(segmentSize, size - offset);
+			sendQueue.emplace_back(data + offset, data + offset + datagramSize);
+			sendQueueBytes += datagramSize;
+		}
+	}
+
+	size_t UDPConnection::flushQueue() {
+		while (!sendQueue.empty()) {
+			const auto& datagram = sendQueue.front();
+			int sent = session.send(datagram.data(), static_cast<int>(datagram.size()));
+			if (sent == SOCKET_ERROR) {
+				if (WSAGetLastError() == WSAEWOULDBLOCK) {
+					break;
+				}
+				logWSAError("Sending queued datagram failed, dropping it.");
+				dropped++;
+			}
+			else {
+				notifySent(datagram.data(), sent);
+			}
+			sendQueueBytes -= datagram.size();
+			sendQueue.pop_front();
+		}
+		return sendQueue.size();
+	}
+
+	bool UDPConnection::waitWritable(const int timeoutMs) {
+		WSAPOLLFD fd{};
+		fd.fd = sock;
+		fd.events = POLLWRNORM;
+		if (WSAPoll(&fd, 1, timeoutMs) <= 0) {
+			return false;
+		}
+		flushQueue();
+		return true;
+	}
+
+	size_t UDPConnection::queueDepth() const {
+		return sendQueue.size() + (pacer ? pacer->queueDepth() : 0);
+	}
+
+	size_t UDPConnection::queuedBytes() const {
+		return sendQueueBytes + (pacer ? pacer->queuedBytes() : 0);
+	}
+
+	uint64_t UDPConnection::sendBacklogNs() const {
+		if (pacer) {
+			return pacer->backlogNs();
+		}
+		return sendQueue.empty() ? 0 : UINT64_MAX;
+	}
+
+	uint64_t UDPConnection::droppedDatagrams() const {
+		return dropped + (pacer ? pacer->dropped() : 0);
+	}
+
+	bool UDPConnection::setPacingRate(const uint64_t bitsPerSecond) {
+		if (!pacer) {
+			return false;
+		}
+		pacer->setRate(bitsPerSecond);
+		return true;
+	}
+
+	bool UDPConnection::isPacingEnabled() const {
+		return pacer != nullptr;
+	}
+
+	PeerStats UDPConnection::stats() const {
+		return session.stats();
+	}
+
+	int UDPConnection::sendData(BYTE* data, DWORD size) {
+		auto bytes = reinterpret_cast<const char*>(data);
+		int length = static_cast<int>(size);
+		if (pacer) {
+			// Pacer thread is the only sender, so nothing overtakes queued datagrams
+			for (int offset = 0; offset < length; offset += segmentSize) {
+				pacer->enqueue(bytes + offset, (std::min)(segmentSize, length - offset));
+			}
+			return length;
+		}
+		// Nothing new goes out directly while older datagrams are parked, receiver would see them reordered
+		if (flushQueue() > 0) {
+			enqueue(bytes, length);
+			return length;
+		}
+		bool wouldBlock = false;
+		int allSent = sendSegmented(bytes, length, wouldBlock);
 		if (allSent < 0) {
 			logWSAError("Sending data to receiver failed.");
+			return allSent;
 		}
-		else {
-			std::wcout << "Sent " << allSent << " bytes\n";
+		if (wouldBlock) {
+			enqueue(bytes + allSent, length - allSent);
+			return length;
 		}
 		return allSent;
 	}
 
-	void UDPConnection::recvData(std::vector<unsigned char>& buffer) {
+	int UDPConnection::sendFrame(RTPPacketizer& packetizer, const BYTE* data, const DWORD size, const uint32_t timestamp) {
+		// Packets are exactly segment size apart, so queueing and offload split them on packet boundaries
+		if (packetizer.packetize(reinterpret_cast<const char*>(data), static_cast<int>(size), timestamp, segmentSize, frameBuffer) == 0) {
+			return 0;
+		}
+		int sent = sendData(reinterpret_cast<BYTE*>(frameBuffer.data()), static_cast<DWORD>(frameBuffer.size()));
+		return (sent < 0) ? sent : static_cast<int>(size);
+	}
 
+	int UDPConnection::recvData(std::vector<unsigned char>& buffer) {
+		if (buffer.size() < static_cast<size_t>(maxPacketSize)) {
+			buffer.resize(maxPacketSize);
+		}
+		int received = session.recv(reinterpret_cast<char*>(buffer.data()), static_cast<int>(buffer.size()));
+		if (received == SOCKET_ERROR) {
+			logWSAError("Receiving data from receiver failed.");
+		}
+		return received;
 	}
 
 	UDPReceiver::UDPReceiver(const ConnectionSettings& settings):
@@ -108,6 +1225,13 @@ namespace net {
 		getsockopt(sock, SOL_SOCKET, SO_MAX_MSG_SIZE, reinterpret_cast<char*>(&maxPacketSize), &optLen);
 		assert(maxPacketSize > 0);
 
+		if (settings.segmentationOffload) {
+			offloadEnabled = enableRecvOffload();
+		}
+		if (settings.receiveTimestamps) {
+			timestampsEnabled = enableRecvTimestamps();
+		}
+
 		/*if (listen(sock, SOMAXCONN)) {
 			logWSAError("Starting listening on socket failed.");
 			disconnect();
@@ -130,13 +1254,325 @@ namespace net {
 	}
 
 	int UDPReceiver::recvData(std::vector<char>& buffer) {
-		int received = recvfrom(sock, buffer.data(), buffer.capacity(), 0, nullptr, nullptr);
+		// Writing past size() into reserved capacity is undefined, grow once so any datagram fits
+		if (buffer.size() < static_cast<size_t>(maxPacketSize)) {
+			buffer.resize(maxPacketSize);
+		}
+		int senderLength = sizeof(sender);
+		int received = recvfrom(sock, buffer.data(), static_cast<int>(buffer.size()), 0, reinterpret_cast<SOCKADDR*>(&sender), &senderLength);
 		if (received < 0) {
 			logWSAError("Receiving data failed.");
 		}
-		else {
-			std::wcout << "Recv " << received << " bytes\n";
-		}
+		countRecv(received, 0);
 		return received;
 	}
-}
\ No newline at end of file
+
+	const sockaddr_in& UDPReceiver::lastSender() const {
+		return sender;
+	}
+
+	int UDPReceiver::sendTo(const char* data, const int size, const sockaddr_in& to) {
+		int sent = sendto(sock, data, size, 0, reinterpret_cast<const SOCKADDR*>(&to), sizeof(to));
+		if (sent == SOCKET_ERROR) {
+			logWSAError("Sending data back to sender failed.");
+			return sent;
+		}
+		counters.packetsSent++;
+		counters.bytesSent += sent;
+		counters.lastSend = std::chrono::steady_clock::now();
+		return sent;
+	}
+
+	const PeerStats& UDPReceiver::stats() const {
+		return counters;
+	}
+
+	// Coalesced buffer counts as every datagram it holds
+	void UDPReceiver::countRecv(int received, int segmentSize) {
+		if (received < 0) {
+			// Drained non-blocking socket is not an error
+			if (WSAGetLastError() != WSAEWOULDBLOCK) {
+				counters.recvErrors++;
+			}
+			return;
+		}
+		counters.packetsReceived += (segmentSize > 0) ? (received + segmentSize - 1) / segmentSize : 1;
+		counters.bytesReceived += received;
+		counters.lastRecv = std::chrono::steady_clock::now();
+	}
+
+	bool UDPReceiver::loadRecvMsg() {
+		if (recvMsg) {
+			return true;
+		}
+		GUID recvMsgId = WSAID_WSARECVMSG;
+		DWORD bytes = 0;
+		if (WSAIoctl(sock, SIO_GET_EXTENSION_FUNCTION_POINTER, &recvMsgId, sizeof(recvMsgId), &recvMsg, sizeof(recvMsg), &bytes, nullptr, nullptr) == SOCKET_ERROR) {
+			logWSAError("Loading WSARecvMsg failed.");
+			recvMsg = nullptr;
+			return false;
+		}
+		return true;
+	}
+
+	bool UDPReceiver::enableRecvOffload() {
+#ifdef UDP_RECV_MAX_COALESCED_SIZE
+		if (!loadRecvMsg()) {
+			return false;
+		}
+		DWORD coalescedSize = maxCoalescedSize;
+		if (setsockopt(sock, IPPROTO_UDP, UDP_RECV_MAX_COALESCED_SIZE, reinterpret_cast<const char*>(&coalescedSize), sizeof(coalescedSize)) == SOCKET_ERROR) {
+			logWSAError("UDP receive offload not available.");
+			return false;
+		}
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	bool UDPReceiver::isOffloadEnabled() const {
+		return offloadEnabled;
+	}
+
+	int UDPReceiver::recvData(std::vector<char>& buffer, int& segmentSize) {
+		if (!offloadEnabled) {
+			int received = recvData(buffer);
+			segmentSize = received;
+			return received;
+		}
+#ifdef UDP_RECV_MAX_COALESCED_SIZE
+		if (buffer.size() < static_cast<size_t>(maxCoalescedSize)) {
+			buffer.resize(maxCoalescedSize);
+		}
+		WSABUF data{ static_cast<ULONG>(buffer.size()), buffer.data() };
+		std::array<char, WSA_CMSG_SPACE(sizeof(DWORD))> control{};
+		WSAMSG msg{};
+		msg.name = reinterpret_cast<SOCKADDR*>(&sender);
+		msg.namelen = sizeof(sender);
+		msg.lpBuffers = &data;
+		msg.dwBufferCount = 1;
+		msg.Control = WSABUF{ static_cast<ULONG>(control.size()), control.data() };
+		DWORD received = 0;
+		if (recvMsg(sock, &msg, &received, nullptr, nullptr) == SOCKET_ERROR) {
+			logWSAError("Receiving data failed.");
+			countRecv(SOCKET_ERROR, 0);
+			return SOCKET_ERROR;
+		}
+		segmentSize = static_cast<int>(received);
+		for (auto cmsg = WSA_CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = WSA_CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_COALESCED_INFO) {
+				segmentSize = static_cast<int>(*reinterpret_cast<const DWORD*>(WSA_CMSG_DATA(cmsg)));
+			}
+		}
+		countRecv(static_cast<int>(received), segmentSize);
+		return static_cast<int>(received);
+#else
+		return SOCKET_ERROR;
+#endif
+	}
+
+	bool UDPReceiver::enableRecvTimestamps() {
+#ifdef SIO_TIMESTAMPING
+		if (!loadRecvMsg()) {
+			return false;
+		}
+		TIMESTAMPING_CONFIG config{};
+		config.Flags = TIMESTAMPING_FLAG_RX;
+		DWORD bytes = 0;
+		if (WSAIoctl(sock, SIO_TIMESTAMPING, &config, sizeof(config), nullptr, 0, &bytes, nullptr, nullptr) == SOCKET_ERROR) {
+			logWSAError("Receive timestamps not available, using time of recv call.");
+			return false;
+		}
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	bool UDPReceiver::isTimestampingEnabled() const {
+		return timestampsEnabled;
+	}
+
+	int UDPReceiver::recvData(std::vector<char>& buffer, RecvInfo& info) {
+		info = RecvInfo{};
+		if (!timestampsEnabled) {
+			int received = recvData(buffer);
+			info.timestampNs = steadyClockNs();
+			return received;
+		}
+#ifdef SIO_TIMESTAMPING
+		if (buffer.size() < static_cast<size_t>(maxPacketSize)) {
+			buffer.resize(maxPacketSize);
+		}
+		WSABUF data{ static_cast<ULONG>(buffer.size()), buffer.data() };
+		std::array<char, WSA_CMSG_SPACE(sizeof(UINT64))> control{};
+		WSAMSG msg{};
+		msg.name = reinterpret_cast<SOCKADDR*>(&sender);
+		msg.namelen = sizeof(sender);
+		msg.lpBuffers = &data;
+		msg.dwBufferCount = 1;
+		msg.Control = WSABUF{ static_cast<ULONG>(control.size()), control.data() };
+		DWORD received = 0;
+		if (recvMsg(sock, &msg, &received, nullptr, nullptr) == SOCKET_ERROR) {
+			logWSAError("Receiving data failed.");
+			countRecv(SOCKET_ERROR, 0);
+			return SOCKET_ERROR;
+		}
+		for (auto cmsg = WSA_CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = WSA_CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMP) {
+				// Stamp is in QueryPerformanceCounter ticks, which is also what steady_clock counts
+				UINT64 ticks = 0;
+				std::memcpy(&ticks, WSA_CMSG_DATA(cmsg), sizeof(ticks));
+				LARGE_INTEGER frequency{};
+				QueryPerformanceFrequency(&frequency);
+				uint64_t perSecond = static_cast<uint64_t>(frequency.QuadPart);
+				info.timestampNs = (ticks / perSecond) * 1'000'000'000 + (ticks % perSecond) * 1'000'000'000 / perSecond;
+				info.kernelTimestamp = true;
+			}
+		}
+		if (!info.kernelTimestamp) {
+			info.timestampNs = steadyClockNs();
+		}
+		countRecv(static_cast<int>(received), 0);
+		return static_cast<int>(received);
+#else
+		return SOCKET_ERROR;
+#endif
+	}
+
+	static void pinCurrentThread(const unsigned core) {
+		if (SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (core % (sizeof(DWORD_PTR) * 8))) == 0) {
+			std::wcout << "Pinning receiver shard to core " << core << " failed.\n";
+		}
+	}
+
+	static bool waitReadable(const SOCKET sock, const int timeoutMs) {
+		WSAPOLLFD fd{};
+		fd.fd = sock;
+		fd.events = POLLRDNORM;
+		return WSAPoll(&fd, 1, timeoutMs) > 0;
+	}
+
+	ShardedUDPReceiver::ShardedUDPReceiver(const ConnectionSettings& settings) :
+		settings(settings) {}
+
+	ShardedUDPReceiver::~ShardedUDPReceiver() {
+		stop();
+	}
+
+	SOCKET ShardedUDPReceiver::openSocket(const uint16_t port) const {
+		SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (sock == INVALID_SOCKET) {
+			logWSAError("Creating UDP receiver socket failed.");
+			return INVALID_SOCKET;
+		}
+		u_long mode = 1;
+		if (ioctlsocket(sock, FIONBIO, &mode) != NO_ERROR) {
+			logWSAError("Setting socket as non-blocking failed.");
+			closesocket(sock);
+			return INVALID_SOCKET;
+		}
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		std::wstring ip{ settings.ip.cbegin(), settings.ip.cend() };
+		InetPton(AF_INET, ip.c_str(), &address.sin_addr.s_addr);
+		if (bind(sock, reinterpret_cast<SOCKADDR*>(&address), sizeof(address)) == SOCKET_ERROR) {
+			logWSAError(std::format("Binding to ip='{}', port='{}' failed", settings.ip, port).c_str());
+			closesocket(sock);
+			return INVALID_SOCKET;
+		}
+		return sock;
+	}
+
+	bool ShardedUDPReceiver::start(PacketHandler handler, TickHandler tick) {
+		if (running) {
+			return false;
+		}
+		this->handler = std::move(handler);
+		this->tick = std::move(tick);
+		unsigned count = (settings.receiveShards > 0) ? settings.receiveShards : (std::max)(1u, std::thread::hardware_concurrency());
+		count = (std::min)(count, 65536u - settings.port);
+		shards.clear();
+		for (unsigned i = 0; i < count; i++) {
+			auto shard = std::make_unique<Shard>();
+			shard->sock = openSocket(static_cast<uint16_t>(settings.port + i));
+			if (shard->sock == INVALID_SOCKET) {
+				stop();
+				return false;
+			}
+			shards.emplace_back(std::move(shard));
+		}
+		int optLen = sizeof(int);
+		getsockopt(shards[0]->sock, SOL_SOCKET, SO_MAX_MSG_SIZE, reinterpret_cast<char*>(&maxPacketSize), &optLen);
+		assert(maxPacketSize > 0);
+
+		running = true;
+		for (unsigned i = 0; i < count; i++) {
+			shards[i]->worker = std::thread(&ShardedUDPReceiver::runShard, this, i);
+		}
+		return true;
+	}
+
+	void ShardedUDPReceiver::stop() {
+		running = false;
+		for (auto& shard : shards) {
+			if (shard->worker.joinable()) {
+				shard->worker.join();
+			}
+			if (shard->sock != INVALID_SOCKET) {
+				closesocket(shard->sock);
+				shard->sock = INVALID_SOCKET;
+			}
+		}
+		shards.clear();
+	}
+
+	int ShardedUDPReceiver::sendTo(const unsigned shard, const char* data, const int size, const sockaddr_in& to) {
+		int sent = sendto(shards[shard]->sock, data, size, 0, reinterpret_cast<const SOCKADDR*>(&to), sizeof(to));
+		if (sent == SOCKET_ERROR) {
+			logWSAError("Sending data back to sender failed.");
+		}
+		return sent;
+	}
+
+	unsigned ShardedUDPReceiver::shardCount() const {
+		return static_cast<unsigned>(shards.size());
+	}
+
+	uint16_t ShardedUDPReceiver::shardPort(const unsigned shard) const {
+		return static_cast<uint16_t>(settings.port + shard);
+	}
+
+	uint64_t ShardedUDPReceiver::packetsReceived(const unsigned shard) const {
+		return (shard < shards.size()) ? shards[shard]->packets.load() : 0;
+	}
+
+	void ShardedUDPReceiver::runShard(const unsigned index) {
+		pinCurrentThread(index);
+		auto& shard = *shards[index];
+		std::vector<char> buffer(maxPacketSize);
+		auto nextTick = std::chrono::steady_clock::now();
+		while (running) {
+			if (waitReadable(shard.sock, tick ? shardTickMs : shardPollTimeoutMs)) {
+				sockaddr_in from{};
+				int fromLength = sizeof(from);
+				int received = 0;
+				while ((received = recvfrom(shard.sock, buffer.data(), static_cast<int>(buffer.size()), 0, reinterpret_cast<SOCKADDR*>(&from), &fromLength)) >= 0) {
+					shard.packets++;
+					handler(index, buffer.data(), received, from);
+					fromLength = sizeof(from);
+				}
+				if (WSAGetLastError() != WSAEWOULDBLOCK) {
+					logWSAError("Receiving data on receiver shard failed.");
+				}
+			}
+			auto now = std::chrono::steady_clock::now();
+			if (tick && now >= nextTick) {
+				tick(index);
+				nextTick = now + std::chrono::milliseconds(shardTickMs);
+			}
+		}
+	}
+}
@@ -1,9 +1,18 @@
 #include <cstdint>
 #include <array>
 #include <vector>
+#include <deque>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <chrono>
 
 #include <WinSock2.h>
+#include <MSWSock.h>
 
 namespace net {
 	struct RTPHeader {
@@ -19,24 +28,404 @@ namespace net {
 		std::array<uint32_t, 15> csrcList{};// 32 bits each
 	};
 
+	// Fixed part of RTP header, CSRCs and extension follow it
+	constexpr int rtpHeaderSize = 12;
+	// Datagram size that passes 1500 byte Ethernet MTU with IPv6 and tunnel overhead, so no packet is fragmented
+	constexpr uint16_t defaultSegmentSize = 1200;
+
+	// Writes header in network order, returns its size (12 + 4 per CSRC)
+	int writeRTPHeader(const RTPHeader& header, char* out);
+	// Returns header size including CSRCs and extension, or 0 when 'data' is not a RTP version 2 packet.
+	// 'payloadSize' excludes header and padding.
+	int readRTPHeader(const char* data, int size, RTPHeader& header, int& payloadSize);
+	// RTP and RTCP share port (RFC 5761), RTCP packet types 192-223 fall where RTP has marker and no payload type
+	bool isRTCPPacket(const char* data, int size);
+
+	// RTCP packet types (RFC 3550, 12.1)
+	constexpr uint8_t rtcpSenderReport = 200;
+	constexpr uint8_t rtcpReceiverReport = 201;
+	// Report count field is 5 bits
+	constexpr size_t maxReportBlocks = 31;
+
+	struct RTCPSenderInfo {
+		uint64_t ntpTimestamp = 0;			// wallclock as NTP, seconds since 1900 in upper 32 bits
+		uint32_t rtpTimestamp = 0;			// same instant in stream clock
+		uint32_t packetCount = 0;
+		uint32_t octetCount = 0;			// payload bytes, headers and padding not counted
+	};
+
+	struct RTCPReportBlock {
+		uint32_t ssrc = 0;					// source this block is about
+		uint8_t fractionLost = 0;			// since previous report, in 1/256
+		int32_t cumulativeLost = 0;			// 24 bits, negative with duplicates
+		uint32_t highestSeqNum = 0;			// extended with wrap count in upper 16 bits
+		uint32_t jitter = 0;				// interarrival jitter in stream clock ticks
+		uint32_t lastSR = 0;				// middle 32 bits of NTP timestamp of last SR, 0 when none came yet
+		uint32_t delaySinceLastSR = 0;		// in 1/65536 s
+	};
+
+	// SR when 'hasSenderInfo' is set, RR otherwise
+	struct RTCPReport {
+		uint32_t ssrc = 0;
+		bool hasSenderInfo = false;
+		RTCPSenderInfo senderInfo;
+		std::vector<RTCPReportBlock> blocks;
+	};
+
+	// Writes report as its own datagram (RFC 5506 reduced size RTCP), blocks past 'maxReportBlocks' are left out.
+	// Returns datagram size.
+	int writeRTCPReport(const RTCPReport& report, std::vector<char>& out);
+	// Finds first SR or RR in compound packet, returns false when there is none or packet is malformed
+	bool readRTCPReport(const char* data, int size, RTCPReport& report);
+
+	// Receiver side statistics of one remote RTP source (RFC 3550, A.1 and A.8), source of report blocks.
+	// Sequence numbers are extended over wraps, sender restarting with new numbers is detected after two
+	// sequential packets.
+	class RTCPReceiverStats {
+	public:
+		RTCPReceiverStats(uint32_t ssrc, uint32_t clockRate);
+		void onPacket(const RTPHeader& header, uint64_t arrivalNs);
+		// Remembers SR arrival, next report block carries LSR and DLSR so sender can measure round trip
+		void onSenderReport(const RTCPReport& report, uint64_t arrivalNs);
+		// Fraction lost covers packets since previous call, so call once per report sent
+		RTCPReportBlock reportBlock(uint64_t nowNs);
+		uint32_t ssrc() const;
+		uint64_t packetsReceived() const;
+		int64_t packetsLost() const;
+		uint64_t jitterNs() const;
+	private:
+		void restart(uint16_t seqNum);
+		uint64_t expected() const;
+
+		uint32_t sourceSsrc;
+		uint32_t clockRate;
+		bool started = false;
+		uint16_t maxSeq = 0;
+		uint32_t cycles = 0;				// wraps times 65536
+		uint32_t baseSeq = 0;
+		uint32_t badSeq = UINT32_MAX;		// seqnum expected after large jump, beyond 16 bits when none
+		uint64_t received = 0;
+		uint64_t expectedPrior = 0;
+		uint64_t receivedPrior = 0;
+		uint32_t lastTimestamp = 0;
+		uint64_t lastArrivalNs = 0;
+		bool timingStarted = false;
+		double jitter = 0.0;				// stream clock ticks
+		uint32_t lastSR = 0;
+		uint64_t lastSRArrivalNs = 0;
+	};
+
+	// Sender side of one own RTP stream, counts what went out for SRs and reads receiver's report blocks.
+	// Round trip is measured from LSR and DLSR (RFC 3550, 6.4.1), so clocks of both sides need not agree.
+	class RTCPSenderStats {
+	public:
+		RTCPSenderStats(uint32_t ssrc, uint32_t clockRate);
+		// Thread safe, meant as sent observer of UDPConnection. Other SSRCs and RTCP are ignored.
+		void onPacketSent(const char* data, int size, uint64_t sentNs);
+		RTCPReport senderReport(uint64_t nowNs) const;
+		// Returns false when block is about other stream
+		bool onReportBlock(const RTCPReportBlock& block);
+		uint32_t ssrc() const;
+		// 0 until receiver answered an SR
+		uint64_t rttNs() const;
+		// Loss and jitter as seen by receiver in its last report
+		double fractionLost() const;
+		int64_t packetsLost() const;
+		uint64_t jitterNs() const;
+	private:
+		uint32_t streamSsrc;
+		uint32_t clockRate;
+		mutable std::mutex mutex;
+		uint32_t packetCount = 0;
+		uint32_t octetCount = 0;
+		uint32_t lastTimestamp = 0;
+		uint64_t lastSentNs = 0;
+		uint64_t rtt = 0;
+		RTCPReportBlock lastBlock;
+	};
+
+	// First payload byte of packetizer's packets, marks packet that starts a frame. Marker bit only tells where
+	// frame ends, without this receiver joining mid stream could not tell whether its first frame is whole.
+	constexpr int rtpPayloadHeaderSize = 1;
+	constexpr uint8_t rtpFrameStart = 0x80;
+
+	// Splits frames into RTP packets of 'packetSize' bytes (last one shorter), all packets of one frame share
+	// timestamp, the first one carries 'rtpFrameStart' and the last one has marker bit set. Packets are written
+	// back to back into one buffer, so whole frame can go out in one offloaded send.
+	class RTPPacketizer {
+	public:
+		RTPPacketizer(uint8_t payloadType, uint32_t ssrc);
+		// Returns number of packets written to 'out', 0 for empty frame or packet size not fitting header
+		int packetize(const char* data, int size, uint32_t timestamp, int packetSize, std::vector<char>& out);
+		uint16_t nextSeqNum() const;
+		uint32_t ssrc() const;
+	private:
+		RTPHeader header;
+	};
+
+	struct RTPFrameStats {
+		uint64_t framesCompleted = 0;
+		uint64_t framesLost = 0;			// at least one packet missing, frame is never returned
+		uint64_t packetsReceived = 0;
+		uint64_t packetsInvalid = 0;		// not RTP, from other SSRC or without payload header
+		uint64_t packetsLost = 0;			// seqnum gaps
+	};
+
+	// Reassembles frames of one RTP stream from packets in sequence order, reordering is left to jitter buffer.
+	// Frame with any packet missing is dropped as a whole, decoders handle skipped frame better than a corrupt one.
+	// Frame is whole when it runs without gap from packet with 'rtpFrameStart' to marker packet.
+	class RTPDepacketizer {
+	public:
+		explicit RTPDepacketizer(size_t maxFrameSize = 8 * 1024 * 1024);
+		// Returns true when packet completed a frame, it stays in frame() until next push
+		bool push(const char* data, int size);
+		const std::vector<char>& frame() const;
+		uint32_t frameTimestamp() const;
+		uint8_t payloadType() const;
+		const RTPFrameStats& stats() const;
+	private:
+		void dropFrame();
+
+		size_t maxFrameSize;
+		std::vector<char> assembled;
+		RTPHeader last;
+		bool started = false;				// any packet seen, 'last' is valid
+		bool inFrame = false;				// packets of unfinished frame are in 'assembled'
+		bool broken = false;				// current frame lost a packet or outgrew 'maxFrameSize'
+		bool complete = false;
+		RTPFrameStats counters;
+	};
+
+	struct JitterBufferSettings {
+		uint32_t clockRate = 90000;			// RTP timestamp ticks per second
+		size_t capacity = 2048;				// packets, rounded up to power of two, at most 32768
+		uint64_t minDelayNs = 5'000'000;
+		uint64_t maxDelayNs = 500'000'000;
+		double jitterMultiplier = 4.0;		// playout delay target as multiple of measured jitter
+	};
+
+	struct JitterBufferStats {
+		uint64_t packetsReceived = 0;
+		uint64_t packetsPlayed = 0;
+		uint64_t packetsInvalid = 0;
+		uint64_t duplicates = 0;
+		uint64_t late = 0;					// arrived after their slot was played or skipped
+		uint64_t lost = 0;					// skipped because they were still missing at playout time
+		uint64_t resets = 0;				// SSRC change or seqnum jump larger than capacity
+	};
+
+	// Reorders packets of one RTP stream and releases them in sequence order once their playout time comes.
+	// Playout time is sender timestamp mapped to local clock through the smallest transit time seen lately,
+	// plus delay that follows RFC 3550 interarrival jitter: it grows at once when jitter or late packets ask
+	// for it and shrinks slowly, so latency stays as low as network allows. Packets are kept in fixed ring
+	// indexed by seqnum modulo capacity, slot buffers are reused, so memory stays bounded.
+	class JitterBuffer {
+	public:
+		explicit JitterBuffer(const JitterBufferSettings& settings = {});
+		// Copies packet in, returns false when it was dropped (invalid, duplicate or late)
+		bool push(const char* data, int size, uint64_t arrivalNs);
+		// Swaps next due packet into 'packet', returns false when nothing is due at 'nowNs'
+		bool pop(std::vector<char>& packet, uint64_t nowNs);
+		size_t size() const;
+		uint64_t jitterNs() const;
+		uint64_t delayNs() const;
+		const JitterBufferStats& stats() const;
+	private:
+		struct Slot {
+			std::vector<char> data;
+			uint32_t timestamp = 0;
+			uint16_t seqNum = 0;
+			bool filled = false;
+		};
+
+		void reset(const RTPHeader& header);
+		int64_t mediaNs(uint32_t timestamp) const;
+		void updateTiming(uint32_t timestamp, uint64_t arrivalNs);
+		uint64_t playoutNs(uint32_t timestamp) const;
+
+		JitterBufferSettings settings;
+		std::vector<Slot> slots;
+		size_t mask = 0;
+		size_t buffered = 0;
+		bool started = false;
+		uint32_t ssrc = 0;
+		uint16_t head = 0;					// next seqnum to play
+		uint32_t referenceTimestamp = 0;
+		int64_t lastTransitNs = 0;
+		// Smallest transit of current and previous window, window restarts keep base following clock drift
+		int64_t windowMinTransitNs = 0;
+		int64_t previousMinTransitNs = 0;
+		uint64_t windowStartNs = 0;
+		uint64_t lastArrivalNs = 0;
+		double jitter = 0.0;
+		double delay = 0.0;
+		JitterBufferStats counters;
+	};
+
 	struct ConnectionSettings {
 		std::string ip;
 		uint16_t port = 0;
+		uint16_t segmentSize = 0;			// payload bytes per datagram, 0 uses 'defaultSegmentSize'
+		bool segmentationOffload = false;	// let the stack segment sends (USO) and coalesce receives (URO) when available
+		size_t sendQueueCapacity = 1024;	// datagrams parked while socket would block, newer ones are dropped
+		uint64_t pacingRate = 0;			// bits per second, 0 sends datagrams as soon as they are handed over
+		uint32_t pacingBurst = 15000;		// bytes that may go out back to back after pacer was idle
+		uint16_t receiveShards = 0;			// sharded receiver sockets on consecutive ports, 0 uses one per core
+		bool receiveTimestamps = false;		// ask the stack to stamp received datagrams (SIO_TIMESTAMPING)
+	};
+
+	struct RecvInfo {
+		uint64_t timestampNs = 0;			// steady clock receive time, taken by the stack when 'kernelTimestamp' is set
+		uint32_t drops = 0;					// datagrams dropped on full socket buffer, Winsock does not report them
+		bool kernelTimestamp = false;
+	};
+
+	struct PeerStats {
+		uint64_t packetsSent = 0;
+		uint64_t bytesSent = 0;
+		uint64_t packetsReceived = 0;
+		uint64_t bytesReceived = 0;
+		uint64_t sendErrors = 0;			// failed sends, would-block is not an error
+		uint64_t recvErrors = 0;			// includes ICMP port unreachable reported for earlier sends
+		std::chrono::steady_clock::time_point lastSend{};
+		std::chrono::steady_clock::time_point lastRecv{};
+	};
+
+	// Non-blocking UDP socket connected to one peer. Route and neighbour are resolved once at connect instead of
+	// on every sendto, datagrams from other senders are filtered by the stack, and ICMP errors for the peer surface
+	// on the next call. Counters are guarded by own mutex, pacer thread may send while others read them.
+	class PeerSession {
+	public:
+		PeerSession(const std::string& ip, uint16_t port);
+		~PeerSession();
+		PeerSession(const PeerSession&) = delete;
+		PeerSession& operator=(const PeerSession&) = delete;
+
+		bool open();
+		void close();
+		bool isOpen() const;
+		// Both return SOCKET_ERROR on failure, WSAGetLastError() tells why. Receive returns 0 when nothing is waiting.
+		int send(const char* data, int size);
+		int recv(char* data, int size);
+		// Datagram size the stack splits sends on when UDP send offload is set on the socket, 0 when every send
+		// is one datagram. Only counters use it, so packetsSent matches what goes on the wire.
+		void setSegmentSize(int size);
+		// Snapshot of counters
+		PeerStats stats() const;
+		SOCKET socket() const;
+		const sockaddr_in& peerAddress() const;
+		// Local port picked at connect, peer sends its datagrams there
+		sockaddr_in localAddress() const;
+	private:
+		SOCKET sock = INVALID_SOCKET;
+		sockaddr_in address{};
+		std::string ip;
+		uint16_t port = 0;
+		mutable std::mutex statsMutex;
+		PeerStats counters;
+		int segmentSize = 0;
+	};
+
+	// Called with every datagram right after it went out, 'sentNs' is steady clock time
+	using SentObserver = std::function<void(const char* data, int size, uint64_t sentNs)>;
+
+	// Token bucket between packetization and socket. Datagrams are queued and sent by own thread at target rate,
+	// bursts are limited to bucket size, so switch and NAT buffers on the path are not overrun. Thread sleeps
+	// on high resolution timer until bucket holds enough tokens and wakes at most once per millisecond, bucket
+	// is at least as large as what one millisecond of rate allows so long sleeps do not lower the rate.
+	class Pacer {
+	public:
+		Pacer(PeerSession& session, uint64_t bitsPerSecond, uint32_t burstBytes, size_t capacity);
+		~Pacer();
+		Pacer(const Pacer&) = delete;
+		Pacer& operator=(const Pacer&) = delete;
+
+		bool start();
+		void stop();
+		// Copies datagram into queue, returns false when queue is full and it was dropped
+		bool enqueue(const char* data, int size);
+		// Takes effect for next datagram, safe to call from any thread
+		void setRate(uint64_t bitsPerSecond);
+		// Runs on pacer thread, set before start()
+		void setSentObserver(SentObserver observer);
+		uint64_t rate() const;
+		size_t queueDepth() const;
+		size_t queuedBytes() const;
+		// Time sending what is queued takes at current rate
+		uint64_t backlogNs() const;
+		uint64_t dropped() const;
+	private:
+		void run();
+		void sleepFor(uint64_t ns);
+		bool sendOne(const std::vector<char>& datagram);
+
+		PeerSession& session;
+		SentObserver onSent;
+		std::atomic<uint64_t> bitsPerSecond;
+		uint32_t burstBytes;
+		size_t capacity;
+		mutable std::mutex mutex;
+		std::condition_variable ready;
+		std::deque<std::vector<char>> queue;
+		std::vector<std::vector<char>> spare;	// sent datagram buffers reused by enqueue
+		size_t bytes = 0;
+		std::atomic<uint64_t> droppedCount = 0;
+		std::atomic<bool> running = false;
+		std::thread worker;
+#ifdef _WIN32
+		HANDLE timer = nullptr;
+#endif
 	};
 
 	class UDPConnection {
 	public:
 		UDPConnection(const ConnectionSettings& settings);
 		bool connectServer();
-		void disconnect() const;
+		void disconnect();
+		// Returns bytes sent or parked in send queue. Datagrams that do not fit into the queue are dropped.
 		int sendData(const std::vector<unsigned char>& buffer);
 		int sendData(BYTE* data, DWORD size);
-		void recvData(std::vector<unsigned char>& buffer);
+		// Packetizes frame into datagrams of segment size and sends it like sendData, returns frame bytes accepted
+		int sendFrame(RTPPacketizer& packetizer, const BYTE* data, DWORD size, uint32_t timestamp);
+		// With 'pacingRate' set every datagram goes through pacer thread, returns false when pacing is off
+		bool setPacingRate(uint64_t bitsPerSecond);
+		bool isPacingEnabled() const;
+		// Reads datagram sent back by peer (feedback, reports), returns 0 when nothing is waiting
+		int recvData(std::vector<unsigned char>& buffer);
+		// Set before connectServer, with pacing on observer runs on pacer thread
+		void setSentObserver(SentObserver observer);
+		bool isOffloadEnabled() const;
+		// Sends parked datagrams, returns how many are still waiting for socket to become writable
+		size_t flushQueue();
+		// Waits until socket accepts more data, then flushes. Returns false on timeout.
+		bool waitWritable(int timeoutMs);
+		// Datagrams waiting in send queue or pacer
+		size_t queueDepth() const;
+		size_t queuedBytes() const;
+		// Time until pacer has sent what it holds, UINT64_MAX while datagrams wait for blocked socket without pacer
+		uint64_t sendBacklogNs() const;
+		uint64_t droppedDatagrams() const;
+		// Snapshot of session counters, safe to take while pacer thread sends
+		PeerStats stats() const;
 	private:
-		SOCKET sock = 0;
+		bool enableSendOffload();
+		int sendSegmented(const char* data, int size, bool& wouldBlock);
+		void enqueue(const char* data, int size);
+		void notifySent(const char* data, int size);
+
 		ConnectionSettings settings;
-		sockaddr_in address;
+		PeerSession session;
+		SOCKET sock = INVALID_SOCKET;
 		int maxPacketSize = 0;
+		int segmentSize = 0;
+		int segmentsPerSend = 1;
+		bool offloadEnabled = false;
+		std::deque<std::vector<char>> sendQueue;
+		size_t sendQueueBytes = 0;
+		SentObserver onSent;
+		uint64_t dropped = 0;
+		std::vector<char> frameBuffer;
+		std::unique_ptr<Pacer> pacer;		// destroyed before 'session', its thread sends through it
 	};
 
 	class UDPReceiver {
@@ -46,9 +435,69 @@ namespace net {
 		//SOCKET tryAccept();
 		void disconnect() const;
 		int recvData(std::vector<char>& buffer);
+		// With receive offload several datagrams from one sender arrive as one buffer. 'segmentSize' is set to
+		// size of each coalesced datagram (last one may be shorter), or to returned size when nothing was coalesced.
+		int recvData(std::vector<char>& buffer, int& segmentSize);
+		// Fills receive time for jitter and one-way delay measurements, see ConnectionSettings::receiveTimestamps
+		int recvData(std::vector<char>& buffer, RecvInfo& info);
+		// Address of sender of last received datagram, feedback goes back there
+		const sockaddr_in& lastSender() const;
+		int sendTo(const char* data, int size, const sockaddr_in& to);
+		bool isOffloadEnabled() const;
+		bool isTimestampingEnabled() const;
+		const PeerStats& stats() const;
 	private:
+		bool loadRecvMsg();
+		void countRecv(int received, int segmentSize);
+		bool enableRecvOffload();
+		bool enableRecvTimestamps();
+
 		SOCKET sock = 0;
 		ConnectionSettings settings;
 		int maxPacketSize;
+		bool offloadEnabled = false;
+		bool timestampsEnabled = false;
+		LPFN_WSARECVMSG recvMsg = nullptr;
+		sockaddr_in sender{};
+		PeerStats counters;
+	};
+
+	// Receiver that spreads socket reads and packet handling over several cores. Winsock has no SO_REUSEPORT to
+	// let the stack split one port between sockets, so every shard owns a socket on its own port ('port' + shard
+	// index) and its thread reads it directly, nothing is copied between threads. A flow is kept on one shard by
+	// the port its sender targets, senders spread streams over the port range. Each shard thread is pinned to its
+	// own core.
+	class ShardedUDPReceiver {
+	public:
+		using PacketHandler = std::function<void(unsigned shard, const char* data, int size, const sockaddr_in& from)>;
+		// Runs every 'shardTickMs' whether datagrams arrive or not, time driven work (playout, reports) goes here
+		using TickHandler = std::function<void(unsigned shard)>;
+
+		ShardedUDPReceiver(const ConnectionSettings& settings);
+		~ShardedUDPReceiver();
+		// Handlers run on shard threads, concurrently for different shards
+		bool start(PacketHandler handler, TickHandler tick = {});
+		void stop();
+		// Sends through shard's socket, so answer comes from the port sender targets. Safe to call from handlers.
+		int sendTo(unsigned shard, const char* data, int size, const sockaddr_in& to);
+		unsigned shardCount() const;
+		uint16_t shardPort(unsigned shard) const;
+		uint64_t packetsReceived(unsigned shard) const;
+	private:
+		struct Shard {
+			std::thread worker;
+			SOCKET sock = INVALID_SOCKET;
+			std::atomic<uint64_t> packets = 0;
+		};
+
+		SOCKET openSocket(uint16_t port) const;
+		void runShard(unsigned index);
+
+		ConnectionSettings settings;
+		std::vector<std::unique_ptr<Shard>> shards;
+		std::atomic<bool> running = false;
+		PacketHandler handler;
+		TickHandler tick;
+		int maxPacketSize = 0;
 	};
 }
\ No newline at end of file
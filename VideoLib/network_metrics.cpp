@@ -0,0 +1,52 @@
+#include "network_metrics.h"
+
+import std;
+import netlib;
+
+namespace net {
+	NetworkMetrics::NetworkMetrics(const std::string& prefix) :
+		prefix(prefix) {}
+
+	void NetworkMetrics::advance(const char* name, const char* help, const uint64_t value, uint64_t& last) {
+		// Registry keeps the counter, lookup once per publish is cheap next to the file write that follows
+		auto& counter = metrics_counter(prefix + name, help);
+		if (value > last) {
+			counter.add(value - last);
+		}
+		last = value;
+	}
+
+	void NetworkMetrics::publish(const PeerStats& stats) {
+		advance("_packets_sent_total", "Datagrams sent.", stats.packetsSent, lastStats.packetsSent);
+		advance("_bytes_sent_total", "Datagram bytes sent.", stats.bytesSent, lastStats.bytesSent);
+		advance("_packets_received_total", "Datagrams received.", stats.packetsReceived, lastStats.packetsReceived);
+		advance("_bytes_received_total", "Datagram bytes received.", stats.bytesReceived, lastStats.bytesReceived);
+		advance("_send_errors_total", "Failed sends, would-block excluded.", stats.sendErrors, lastStats.sendErrors);
+		advance("_recv_errors_total", "Failed receives, would-block excluded.", stats.recvErrors, lastStats.recvErrors);
+	}
+
+	void NetworkMetrics::publish(const UDPConnection& connection) {
+		publish(connection.stats());
+		advance("_dropped_datagrams_total", "Datagrams dropped by full send queue or pacer.", connection.droppedDatagrams(), lastDropped);
+		uint64_t backlogNs = connection.sendBacklogNs();
+		metrics_gauge(prefix + "_send_backlog_us", "Time pacer needs for what it holds, -1 while socket is blocked.")
+			.set((backlogNs == UINT64_MAX) ? -1 : static_cast<int64_t>(backlogNs / 1000));
+		metrics_gauge(prefix + "_queued_bytes", "Bytes waiting in send queue or pacer.").set(static_cast<int64_t>(connection.queuedBytes()));
+	}
+
+	void NetworkMetrics::publish(const ShardedUDPReceiver& receiver) {
+		lastShardPackets.resize(receiver.shardCount(), 0);
+		auto& counter = metrics_counter(prefix + "_packets_received_total", "Datagrams received.");
+		for (unsigned shard = 0; shard < receiver.shardCount(); shard++) {
+			uint64_t packets = receiver.packetsReceived(shard);
+			if (packets > lastShardPackets[shard]) {
+				counter.add(packets - lastShardPackets[shard]);
+			}
+			lastShardPackets[shard] = packets;
+		}
+	}
+
+	bool writeMetricsFile(const std::string& path) {
+		return metrics_write_file(path, MetricsFormat::PROMETHEUS);
+	}
+}
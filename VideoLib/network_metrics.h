@@ -0,0 +1,33 @@
+#pragma once
+
+#include "network.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace net {
+	// Copies VideoLib counters into netlib's metrics registry, so netlib's metrics file covers the media path next
+	// to its own sockets and STUN. VideoLib keeps cumulative counters, registry ones are advanced by what grew since
+	// the previous publish. Call from one thread, as often as the metrics file is written.
+	class NetworkMetrics {
+	public:
+		// Metric names start with 'prefix', e.g. "videolib_sender"
+		explicit NetworkMetrics(const std::string& prefix);
+		void publish(const PeerStats& stats);
+		// Session counters, datagrams dropped by send queue or pacer and pacer backlog
+		void publish(const UDPConnection& connection);
+		// Datagrams read by all shards
+		void publish(const ShardedUDPReceiver& receiver);
+	private:
+		void advance(const char* name, const char* help, uint64_t value, uint64_t& last);
+
+		std::string prefix;
+		PeerStats lastStats;
+		uint64_t lastDropped = 0;
+		std::vector<uint64_t> lastShardPackets;
+	};
+
+	// Writes netlib's registry in Prometheus text format, returns false when file could not be written
+	bool writeMetricsFile(const std::string& path);
+}
@@ -1,8 +1,115 @@
 ﻿#include "../VideoLib/network.h"
+#include "../VideoLib/congestion.h"
+#include "../VideoLib/network_metrics.h"
 #pragma comment (lib, "Ws2_32.lib")
 
 #include <iostream>
 #include <thread>
+#include <unordered_map>
+#include <random>
+#include <functional>
+#include <algorithm>
+
+static uint64_t steadyNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Everything one receive thread does with incoming media. Each RTP stream gets own jitter buffer, depacketizer and
+// RTCP statistics, audio and video come with different SSRCs. Arrival times go back to sender every 50 ms, its
+// congestion controller needs them. Receiver reports go once a second.
+class MediaSink {
+public:
+    using Send = std::function<void(const char* data, int size)>;
+
+    MediaSink(uint32_t ssrc, uint64_t nowNs) :
+        ssrc(ssrc), feedback(ssrc), feedbackTime(nowNs), reportTime(nowNs) {}
+
+    void onDatagram(const char* datagram, int size, uint64_t now) {
+        net::RTPHeader header;
+        int payloadSize = 0;
+        // RTCP shares port with RTP, it must not reach jitter buffer
+        if (net::isRTCPPacket(datagram, size)) {
+            if (net::readRTCPReport(datagram, size, senderReport)) {
+                auto stream = streams.find(senderReport.ssrc);
+                if (stream != streams.end()) {
+                    stream->second.rtcp.onSenderReport(senderReport, now);
+                }
+            }
+            return;
+        }
+        if (net::readRTPHeader(datagram, size, header, payloadSize) == 0) {
+            return;
+        }
+        auto stream = streams.find(header.ssrc);
+        if (stream == streams.end()) {
+            // Anyone can send to our port, unknown SSRCs beyond what one sender uses must not grow state
+            if (streams.size() >= maxStreams) {
+                return;
+            }
+            // Sender uses payload type 96 for video with 90 kHz clock, anything else is audio
+            net::JitterBufferSettings jitterSettings{ .clockRate = (header.payloadType == 96) ? 90000u : 48000u };
+            stream = streams.emplace(header.ssrc, Stream{ net::JitterBuffer{ jitterSettings }, net::RTPDepacketizer{},
+                net::RTCPReceiverStats{ header.ssrc, jitterSettings.clockRate } }).first;
+        }
+        feedback.onPacket(header.ssrc, header.seqNum, now);
+        stream->second.rtcp.onPacket(header, now);
+        stream->second.jitterBuffer.push(datagram, size, now);
+    }
+
+    // Plays packets due at 'now' and hands feedback and reports that are due to 'send'
+    void poll(uint64_t now, const Send& send) {
+        for (auto& [streamSsrc, stream] : streams) {
+            while (stream.jitterBuffer.pop(packet, now)) {
+                if (stream.depacketizer.push(packet.data(), static_cast<int>(packet.size()))) {
+                    frames++;
+                }
+            }
+        }
+        if (now - feedbackTime >= feedbackIntervalNs) {
+            feedbackTime = now;
+            while (feedback.build(report, now)) {
+                send(report.data(), static_cast<int>(report.size()));
+            }
+        }
+        if (now - reportTime >= 1'000'000'000) {
+            reportTime = now;
+            net::RTCPReport receiverReport{ .ssrc = ssrc };
+            for (auto& [streamSsrc, stream] : streams) {
+                const auto& jitterStats = stream.jitterBuffer.stats();
+                std::cout << "SSRC " << streamSsrc << ": jitter " << stream.rtcp.jitterNs() / 1000 << " us, delay "
+                    << stream.jitterBuffer.delayNs() / 1000 << " us, lost " << stream.rtcp.packetsLost() << ", late " << jitterStats.late
+                    << ", duplicates " << jitterStats.duplicates << ", frames lost " << stream.depacketizer.stats().framesLost << '\n';
+                receiverReport.blocks.push_back(stream.rtcp.reportBlock(now));
+            }
+            if (!receiverReport.blocks.empty()) {
+                int reportSize = net::writeRTCPReport(receiverReport, report);
+                send(report.data(), reportSize);
+            }
+            std::cout << "Recv " << frames << " frames/s\n";
+            frames = 0;
+        }
+    }
+private:
+    struct Stream {
+        net::JitterBuffer jitterBuffer;
+        net::RTPDepacketizer depacketizer;
+        net::RTCPReceiverStats rtcp;
+    };
+
+    static constexpr uint64_t feedbackIntervalNs = 50'000'000;
+    // Sender has one audio and one video stream, room is left for it restarting with new SSRCs
+    static constexpr size_t maxStreams = 4;
+
+    uint32_t ssrc;
+    net::CongestionFeedback feedback;
+    std::unordered_map<uint32_t, Stream> streams;
+    std::vector<char> packet;
+    std::vector<char> report;
+    net::RTCPReport senderReport;
+    uint64_t feedbackTime;
+    uint64_t reportTime;
+    uint64_t frames = 0;
+};
 
 int main()
 {
@@ -17,8 +124,46 @@ int main()
 
     net::ConnectionSettings settings{
         .ip = "127.0.0.1",
-        .port = 8080
+        .port = 8888,
+        .segmentationOffload = true
     };
+    uint32_t ssrc = std::random_device{}();
+    // Refreshed once a second, scraper reads receive counters from this file
+    net::NetworkMetrics receiverMetrics{ "videolib_receiver" };
+    constexpr const char* metricsPath = "videolib_receiver.prom";
+    if (settings.receiveShards != 1) {
+        // One socket and thread per core on ports 8888 and up, each port's streams always reach the same sink.
+        // Ticks keep playout and reports going while a shard gets no datagrams.
+        net::ShardedUDPReceiver shardedReceiver{ settings };
+        unsigned shardCount = (settings.receiveShards > 0) ? settings.receiveShards : (std::max)(1u, std::thread::hardware_concurrency());
+        std::vector<MediaSink> sinks(shardCount, MediaSink{ ssrc, steadyNs() });
+        std::vector<sockaddr_in> senders(shardCount);
+        auto poll = [&](unsigned shard, uint64_t now) {
+            if (senders[shard].sin_family == 0) {
+                return;
+            }
+            sinks[shard].poll(now, [&](const char* out, int outSize) {
+                shardedReceiver.sendTo(shard, out, outSize, senders[shard]);
+            });
+        };
+        bool started = shardedReceiver.start([&](unsigned shard, const char* data, int size, const sockaddr_in& from) {
+            uint64_t now = steadyNs();
+            senders[shard] = from;
+            sinks[shard].onDatagram(data, size, now);
+            poll(shard, now);
+        }, [&](unsigned shard) {
+            poll(shard, steadyNs());
+        });
+        if (!started) {
+            WSACleanup();
+            return -1;
+        }
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::seconds{ 1 });
+            receiverMetrics.publish(shardedReceiver);
+            net::writeMetricsFile(metricsPath);
+        }
+    }
     net::UDPReceiver receiver{ settings };
     receiver.startListening();
     /*SOCKET sock = 0;
@@ -32,8 +177,25 @@ int main()
     }*/
     std::vector<char> data;
     data.reserve(100000);
+    int segmentSize = 0;
+    MediaSink sink{ ssrc, steadyNs() };
+    uint64_t metricsTime = steadyNs();
+    auto sendBack = [&](const char* out, int outSize) {
+        receiver.sendTo(out, outSize, receiver.lastSender());
+    };
     while (true) {
-        int size = receiver.recvData(data);
+        int size = receiver.recvData(data, segmentSize);
+        uint64_t now = steadyNs();
+        // Coalesced buffer holds several RTP packets, each 'segmentSize' long
+        for (int offset = 0; size > 0 && offset < size; offset += segmentSize) {
+            sink.onDatagram(data.data() + offset, (std::min)(segmentSize, size - offset), now);
+        }
+        sink.poll(now, sendBack);
+        if (now - metricsTime >= 1'000'000'000) {
+            metricsTime = now;
+            receiverMetrics.publish(receiver.stats());
+            net::writeMetricsFile(metricsPath);
+        }
     }
 
     WSACleanup();
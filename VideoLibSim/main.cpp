@@ -0,0 +1,298 @@
+﻿#include "../VideoLib/network.h"
+#include "../VideoLib/congestion.h"
+#pragma comment (lib, "Ws2_32.lib")
+#pragma comment (lib, "winmm.lib")
+
+#include <WS2tcpip.h>
+#include <timeapi.h>
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <random>
+
+// Sender, bottleneck link and receiver over loopback. Link drains at capacity of current phase, keeps at most
+// 'maxQueueDelayNs' of data queued (drop tail), drops randomly on top of that and adds propagation delay.
+// Feedback goes back through the same link without shaping. Prints what congestion controller makes of it.
+
+struct LinkPhase {
+    int seconds;
+    uint64_t capacity;                  // bits per second
+    double lossRate;
+};
+
+struct LinkStats {
+    std::atomic<uint64_t> forwarded = 0;
+    std::atomic<uint64_t> dropped = 0;
+    std::atomic<uint64_t> capacity = 0;
+};
+
+constexpr uint16_t linkPort = 9100;
+constexpr uint16_t receiverPort = 9101;
+constexpr uint64_t propagationDelayNs = 20'000'000;
+constexpr uint64_t maxQueueDelayNs = 200'000'000;
+constexpr uint64_t feedbackIntervalNs = 50'000'000;
+constexpr int framesPerSecond = 30;
+// Pacer drains faster than target, so frames do not wait behind each other but bursts are still spread
+constexpr double pacingFactor = 1.5;
+
+static uint64_t steadyNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static sockaddr_in loopback(const uint16_t port) {
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    InetPton(AF_INET, L"127.0.0.1", &address.sin_addr.s_addr);
+    return address;
+}
+
+static const LinkPhase& currentPhase(const std::vector<LinkPhase>& phases, const uint64_t elapsedNs) {
+    uint64_t phaseEnd = 0;
+    for (const auto& phase : phases) {
+        phaseEnd += static_cast<uint64_t>(phase.seconds) * 1'000'000'000;
+        if (elapsedNs < phaseEnd) {
+            return phase;
+        }
+    }
+    return phases.back();
+}
+
+static void runLink(const std::vector<LinkPhase>& phases, const uint64_t startNs, const std::atomic<bool>& running, LinkStats& stats) {
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    sockaddr_in address = loopback(linkPort);
+    if (sock == INVALID_SOCKET || bind(sock, reinterpret_cast<SOCKADDR*>(&address), sizeof(address)) == SOCKET_ERROR) {
+        std::cout << "Binding link socket failed: " << WSAGetLastError() << '\n';
+        return;
+    }
+    u_long mode = 1;
+    ioctlsocket(sock, FIONBIO, &mode);
+
+    sockaddr_in receiver = loopback(receiverPort);
+    sockaddr_in sender{};
+    bool senderKnown = false;
+    std::deque<std::pair<uint64_t, std::vector<char>>> inFlight;
+    uint64_t linkFreeNs = 0;
+    std::mt19937 random{ 7 };
+    std::uniform_real_distribution<double> chance{ 0.0, 1.0 };
+    std::vector<char> buffer(65536);
+    while (running) {
+        uint64_t now = steadyNs();
+        while (!inFlight.empty() && inFlight.front().first <= now) {
+            const auto& datagram = inFlight.front().second;
+            sendto(sock, datagram.data(), static_cast<int>(datagram.size()), 0, reinterpret_cast<SOCKADDR*>(&receiver), sizeof(receiver));
+            inFlight.pop_front();
+        }
+        int timeoutMs = inFlight.empty() ? 10 : static_cast<int>((std::min)((inFlight.front().first - now) / 1'000'000, uint64_t(10)));
+        WSAPOLLFD fd{};
+        fd.fd = sock;
+        fd.events = POLLRDNORM;
+        if (WSAPoll(&fd, 1, timeoutMs) <= 0) {
+            continue;
+        }
+        sockaddr_in from{};
+        int fromLength = sizeof(from);
+        int received = 0;
+        while ((received = recvfrom(sock, buffer.data(), static_cast<int>(buffer.size()), 0, reinterpret_cast<SOCKADDR*>(&from), &fromLength)) > 0) {
+            now = steadyNs();
+            if (from.sin_port == receiver.sin_port) {
+                if (senderKnown) {
+                    sendto(sock, buffer.data(), received, 0, reinterpret_cast<SOCKADDR*>(&sender), sizeof(sender));
+                }
+            }
+            else {
+                sender = from;
+                senderKnown = true;
+                const auto& phase = currentPhase(phases, now - startNs);
+                stats.capacity = phase.capacity;
+                uint64_t departure = (std::max)(now, linkFreeNs);
+                if (departure - now > maxQueueDelayNs || chance(random) < phase.lossRate) {
+                    stats.dropped++;
+                }
+                else {
+                    linkFreeNs = departure + static_cast<uint64_t>(received * 8e9 / phase.capacity);
+                    inFlight.emplace_back(linkFreeNs + propagationDelayNs, std::vector<char>(buffer.data(), buffer.data() + received));
+                    stats.forwarded++;
+                }
+            }
+            fromLength = sizeof(from);
+        }
+    }
+    closesocket(sock);
+}
+
+static void runReceiver(const uint32_t ssrc, const std::atomic<bool>& running) {
+    net::ConnectionSettings settings{
+        .ip = "127.0.0.1",
+        .port = receiverPort,
+        .receiveTimestamps = true
+    };
+    net::UDPReceiver receiver{ settings };
+    if (!receiver.startListening()) {
+        return;
+    }
+    net::CongestionFeedback feedback{ ssrc };
+    std::vector<char> data;
+    std::vector<char> report;
+    uint64_t nextFeedback = steadyNs() + feedbackIntervalNs;
+    while (running) {
+        net::RecvInfo info;
+        int size = receiver.recvData(data, info);
+        net::RTPHeader header;
+        int payloadSize = 0;
+        if (size > 0 && !net::isRTCPPacket(data.data(), size) && net::readRTPHeader(data.data(), size, header, payloadSize) > 0) {
+            feedback.onPacket(header.ssrc, header.seqNum, info.timestampNs);
+        }
+        uint64_t now = steadyNs();
+        if (now >= nextFeedback) {
+            while (feedback.build(report, now)) {
+                receiver.sendTo(report.data(), static_cast<int>(report.size()), receiver.lastSender());
+            }
+            nextFeedback = now + feedbackIntervalNs;
+        }
+        if (size <= 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds{ 200 });
+        }
+    }
+    receiver.disconnect();
+}
+
+static const char* usageName(const net::BandwidthUsage usage) {
+    switch (usage) {
+    case net::BandwidthUsage::overusing:
+        return "overusing";
+    case net::BandwidthUsage::underusing:
+        return "underusing";
+    default:
+        return "normal";
+    }
+}
+
+int main()
+{
+    WSADATA wsaData;
+    WORD mVersionRequested = MAKEWORD(2, 2);
+    int wsaError = WSAStartup(mVersionRequested, &wsaData);
+    if (wsaError) {
+        std::cout << wsaError << " Error on WSA stratup\n";
+        WSACleanup();
+        return -1;
+    }
+#ifdef _WIN32
+    // Link delivers packets on 1 ms poll timeouts, default 15.6 ms timer would show up as jitter
+    timeBeginPeriod(1);
+#endif
+
+    std::vector<LinkPhase> phases{
+        { 15, 4'000'000, 0.0 },
+        { 15, 1'500'000, 0.0 },
+        { 15, 8'000'000, 0.0 },
+        { 15, 3'000'000, 0.03 }
+    };
+    int totalSeconds = 0;
+    for (const auto& phase : phases) {
+        totalSeconds += phase.seconds;
+    }
+
+    std::random_device randomDevice;
+    uint32_t ssrc = randomDevice();
+    std::atomic<bool> running = true;
+    LinkStats linkStats;
+    uint64_t startNs = steadyNs();
+    std::thread link(runLink, std::cref(phases), startNs, std::cref(running), std::ref(linkStats));
+    std::thread receiver(runReceiver, randomDevice(), std::cref(running));
+
+    net::CongestionSettings congestionSettings{
+        .startBitrate = 300'000,
+        .minBitrate = 100'000,
+        .maxBitrate = 20'000'000
+    };
+    net::CongestionController controller{ congestionSettings };
+    net::ConnectionSettings settings{
+        .ip = "127.0.0.1",
+        .port = linkPort,
+        .segmentSize = 1200,
+        .sendQueueCapacity = 4096,
+        .pacingRate = static_cast<uint64_t>(congestionSettings.startBitrate * pacingFactor)
+    };
+    net::UDPConnection connection{ settings };
+    connection.setSentObserver([&](const char* data, int size, uint64_t sentNs) {
+        controller.onPacketSent(data, size, sentNs);
+    });
+    if (!connection.connectServer()) {
+        running = false;
+        link.join();
+        receiver.join();
+        WSACleanup();
+        return -1;
+    }
+
+    net::RTPPacketizer packetizer{ 96, ssrc };
+    std::vector<unsigned char> frame;
+    std::vector<unsigned char> feedback;
+    uint64_t frameIntervalNs = 1'000'000'000 / framesPerSecond;
+    uint64_t endNs = startNs + static_cast<uint64_t>(totalSeconds) * 1'000'000'000;
+    uint64_t nextReport = startNs + 1'000'000'000;
+    uint32_t frameIndex = 0;
+    // Target at end of every phase, checked against link once the run is over
+    std::vector<uint64_t> phaseTargets(phases.size(), 0);
+    std::cout << std::fixed << std::setprecision(2);
+    for (uint64_t nextFrame = startNs; nextFrame < endNs; nextFrame += frameIntervalNs) {
+        // Encoder stand-in, every frame is as large as target bitrate allows
+        uint64_t target = controller.targetBitrate();
+        connection.setPacingRate(static_cast<uint64_t>(target * pacingFactor));
+        frame.resize(static_cast<size_t>(target / 8 / framesPerSecond));
+        connection.sendFrame(packetizer, frame.data(), static_cast<DWORD>(frame.size()), frameIndex++ * (90000 / framesPerSecond));
+
+        uint64_t now = steadyNs();
+        while (now < nextFrame + frameIntervalNs) {
+            int size = connection.recvData(feedback);
+            now = steadyNs();
+            if (size > 0) {
+                controller.onFeedback(reinterpret_cast<const char*>(feedback.data()), size, now);
+                continue;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds{ 500 });
+        }
+        uint64_t elapsed = 0;
+        for (size_t i = 0; i < phases.size(); i++) {
+            elapsed += static_cast<uint64_t>(phases[i].seconds) * 1'000'000'000;
+            if (now - startNs < elapsed) {
+                phaseTargets[i] = controller.targetBitrate();
+                break;
+            }
+        }
+        if (now >= nextReport) {
+            nextReport += 1'000'000'000;
+            std::cout << std::setw(3) << (now - startNs) / 1'000'000'000 << " s  link " << linkStats.capacity / 1e6
+                << " Mbps  target " << target / 1e6 << " Mbps  acked " << controller.acknowledgedBitrate() / 1e6
+                << " Mbps  rtt " << controller.rttNs() / 1'000'000 << " ms  loss " << controller.lossFraction() * 100
+                << "%  " << usageName(controller.usage()) << "  link drops " << linkStats.dropped << '\n';
+        }
+    }
+
+    connection.disconnect();
+    running = false;
+    link.join();
+    receiver.join();
+#ifdef _WIN32
+    timeEndPeriod(1);
+#endif
+    WSACleanup();
+
+    // Target must end every phase below link capacity, and grow again whenever link gets faster
+    int failures = 0;
+    for (size_t i = 0; i < phases.size(); i++) {
+        if (phaseTargets[i] == 0 || phaseTargets[i] > phases[i].capacity * 11 / 10) {
+            std::cout << "FAIL phase " << i << ": target " << phaseTargets[i] / 1e6 << " Mbps over link " << phases[i].capacity / 1e6 << " Mbps\n";
+            failures++;
+        }
+        if (i > 0 && phases[i].capacity > phases[i - 1].capacity && phaseTargets[i] <= phaseTargets[i - 1]) {
+            std::cout << "FAIL phase " << i << ": link went up but target stayed at " << phaseTargets[i] / 1e6 << " Mbps\n";
+            failures++;
+        }
+    }
+    std::cout << (failures == 0 ? "PASS\n" : "FAILED\n");
+    return failures == 0 ? 0 : 1;
+}
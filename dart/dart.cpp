@@ -13,8 +13,11 @@
 #include "dart.h"
 #include <fstream>
 #include <string>
-#include <sstream>
 #include <chrono>
+#include "trace.h"
+
+import std;
+import netlib;
 
 #pragma comment (lib, "ole32.lib")
 #pragma comment (lib, "mf.lib")
@@ -22,35 +25,6 @@
 #pragma comment (lib, "mfuuid.lib")
 #pragma comment (lib, "mfreadwrite.lib")
 
-class Logger {
-public:
-    Logger(const std::string& filepath) :
-        outstream(filepath, std::ios::out) {
-    }
-
-    void log(const std::string& msg, const char* file = __FILE__, int line = __LINE__) {
-        std::stringstream stream = getCurrentTime();
-        outstream << stream.str() << msg << "\n" << std::flush;
-    }
-private:
-    std::stringstream getCurrentTime() {
-        using namespace std::chrono;
-        auto highResNow = high_resolution_clock::now();
-        auto fractionalPart = duration_cast<microseconds>(highResNow.time_since_epoch()).count() % 1000000;
-        auto now = system_clock::now();
-        auto time = system_clock::to_time_t(now);
-        std::tm calendarTime;
-        localtime_s(&calendarTime, &time);
-        std::stringstream ss;
-        ss << std::put_time(&calendarTime, "[ %d-%m-%Y %H:%M:%S.") << fractionalPart << " ] ";
-        return ss;
-    }
-
-    std::ofstream outstream;
-};
-
-static Logger logger = Logger("log.log");
-
 static bool success(HRESULT result) {
     if (SUCCEEDED(result)) {
         return true;
@@ -297,6 +271,18 @@ void writeToBitmap(const std::vector<unsigned char>& rgb24Data, const FrameSize&
 static UniqueComPtr<IMFSourceReader> reader = nullptr;
 static FrameSize frameSize = FrameSize{};
 
+// Kept in netlib registry next to network counters, so one metrics file shows whole pipeline
+static net::MetricHistogram& convertHistogram() {
+    static auto& histogram = net::metrics_histogram("dart_frame_convert_us", "YUY2 to RGBA conversion time per frame in microseconds.");
+    return histogram;
+}
+
+static uint64_t markConvert(uint64_t stage) {
+    uint64_t now = trace::mark("convert", stage);
+    convertHistogram().record((now - stage) / 1000);
+    return now;
+}
+
 void init() {
     success(CoInitialize(nullptr));
     auto attributes = createAttributes();
@@ -309,54 +295,48 @@ void init() {
 }
 
 uint64_t readFrame(unsigned char** data) {
-    logger.log("Before reader check");
+    trace::Scope frameScope("readFrame");
     if (reader == nullptr) {
         return 0;
     }
-    logger.log("Before sample get");
+    uint64_t stage = trace::nowNs();
     auto sample = readSampleBlockingMode(reader);
-    logger.log("Before buffer get");
+    stage = trace::mark("capture", stage);
     auto buffer = getContignousBuffer(sample);
-    logger.log("Before rgb24 get");
     std::vector<unsigned char> rgb24(frameSize.width * frameSize.height * 24);
-    logger.log("Before runOnBuffer");
+    stage = trace::mark("buffer", stage);
     runOnBufferData(buffer, [&](BYTE* data, DWORD size) {
-        logger.log("Before convert");
         rgb24 = convertYUY2ToRGBA24(data, size);
         }
     );
-    logger.log("Before malloc");
+    stage = markConvert(stage);
     auto ptr = new unsigned char[rgb24.size()];
-    logger.log("Before memcpy");
     memcpy(ptr, rgb24.data(), rgb24.size() * sizeof(unsigned char));
-    logger.log("Before data");
+    trace::mark("copy", stage);
     data = &ptr;
-    logger.log("Before return");
     return rgb24.size();
 }
 
 Array readFrame2() {
-    logger.log("Before reader check");
+    trace::Scope frameScope("readFrame2");
     if (reader == nullptr) {
         return Array{};
     }
-    logger.log("Before sample get");
+    uint64_t stage = trace::nowNs();
     auto sample = readSampleBlockingMode(reader);
-    logger.log("Before buffer get");
+    stage = trace::mark("capture", stage);
     auto buffer = getContignousBuffer(sample);
-    logger.log("Before rgb24 get");
     std::vector<unsigned char> rgba24(frameSize.width * frameSize.height * 24);
-    logger.log("Before runOnBuffer");
+    stage = trace::mark("buffer", stage);
     runOnBufferData(buffer, [&](BYTE* data, DWORD size) {
-        logger.log("Before convert");
         rgba24 = convertYUY2ToRGBA24(data, size);
         }
     );
-    logger.log("Before malloc");
+    stage = markConvert(stage);
     Array arr{};
     arr.data = new unsigned char[rgba24.size()];
-    logger.log("Before memcpy");
     memcpy(arr.data, rgba24.data(), rgba24.size() * sizeof(unsigned char));
+    trace::mark("copy", stage);
     arr.size = rgba24.size();
     arr.frameSize = frameSize;
     return arr;
@@ -364,10 +344,13 @@ Array readFrame2() {
 
 
 Array readFrame3() {
+    trace::Scope frameScope("readFrame3");
     if (reader == nullptr) {
         return Array{};
     }
+    uint64_t stage = trace::nowNs();
     auto sample = readSampleBlockingMode(reader);
+    stage = trace::mark("capture", stage);
     auto buffer = getContignousBuffer(sample);
     Array arr{};
     runOnBufferData(buffer, [&](BYTE* data, DWORD size) {
@@ -376,10 +359,19 @@ Array readFrame3() {
             arr.size = 2 * size;
         }
     );
+    markConvert(stage);
     arr.frameSize = frameSize;
     return arr;
 }
 
+bool dumpTrace(const char* path) {
+    return trace::dump(path);
+}
+
+bool dumpMetrics(const char* path) {
+    return net::metrics_write_file(path, net::MetricsFormat::PROMETHEUS);
+}
+
 void freeFrame(unsigned char* data) {
     delete[] data;
 }
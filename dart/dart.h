@@ -23,4 +23,8 @@ EXPORT Array readFrame2();
 EXPORT Array readFrame3();
 EXPORT void freeFrame(unsigned char* data);
 EXPORT Array randomFunc();
-EXPORT void deinit();
\ No newline at end of file
+EXPORT void deinit();
+// Writes spans of recent frames as Chrome trace-event JSON, false when file cannot be written
+EXPORT bool dumpTrace(const char* path);
+// Writes netlib metrics registry in Prometheus text format, false when file cannot be written
+EXPORT bool dumpMetrics(const char* path);
\ No newline at end of file
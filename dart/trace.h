@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <string>
+
+// Scope spans kept in a fixed lock-free ring, so recording costs two clock reads and a few stores.
+// dump() writes the last TRACE_RING_SIZE spans as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+namespace trace {
+    constexpr size_t TRACE_RING_SIZE = 4096;  // power of two, slot is the running counter masked
+
+    struct Span {
+        const char* name;
+        uint64_t startNs;
+        uint64_t durationNs;
+        uint32_t threadId;
+    };
+
+    // Slot sequence is odd while span is written, dump() skips slots that change under it
+    struct Slot {
+        std::atomic<uint64_t> sequence{ 0 };
+        Span span{};
+    };
+
+    struct Ring {
+        std::array<Slot, TRACE_RING_SIZE> slots;
+        std::atomic<uint64_t> next{ 0 };
+    };
+
+    inline uint64_t nowNs() {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    inline Ring& ring() {
+        // Never destroyed, spans may still be recorded while statics are torn down
+        static Ring* instance = new Ring();
+        return *instance;
+    }
+
+    inline uint32_t threadId() {
+        static std::atomic<uint32_t> nextId{ 1 };
+        thread_local uint32_t id = nextId.fetch_add(1, std::memory_order_relaxed);
+        return id;
+    }
+
+    // Name must be a literal, only the pointer is stored
+    inline void record(const char* name, uint64_t startNs, uint64_t endNs) {
+        auto& traceRing = ring();
+        uint64_t index = traceRing.next.fetch_add(1, std::memory_order_relaxed);
+        auto& slot = traceRing.slots[index & (TRACE_RING_SIZE - 1)];
+        slot.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.span = Span{ name, startNs, endNs - startNs, threadId() };
+        slot.sequence.store(index * 2 + 2, std::memory_order_release);
+    }
+
+    // Records span from 'startNs' to now and returns now, so consecutive stages share clock reads
+    inline uint64_t mark(const char* name, uint64_t startNs) {
+        uint64_t now = nowNs();
+        record(name, startNs, now);
+        return now;
+    }
+
+    class Scope {
+    public:
+        explicit Scope(const char* name) :
+            name(name),
+            startNs(nowNs()) {
+        }
+
+        ~Scope() {
+            record(name, startNs, nowNs());
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        const char* name;
+        uint64_t startNs;
+    };
+
+    // Safe to call while other threads record, spans overwritten during dump are left out
+    inline bool dump(const std::string& path) {
+        std::ofstream out(path, std::ios::out | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+        auto& traceRing = ring();
+        uint64_t end = traceRing.next.load(std::memory_order_acquire);
+        uint64_t begin = (end > TRACE_RING_SIZE) ? end - TRACE_RING_SIZE : 0;
+        out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+        bool first = true;
+        for (uint64_t index = begin; index < end; index++) {
+            auto& slot = traceRing.slots[index & (TRACE_RING_SIZE - 1)];
+            if (slot.sequence.load(std::memory_order_acquire) != index * 2 + 2) {
+                continue;
+            }
+            Span span = slot.span;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) != index * 2 + 2) {
+                continue;
+            }
+            // Trace event times are microseconds, fractions keep sub-microsecond stages visible
+            out << (first ? "" : ",") << "\n{\"name\":\"" << span.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << span.threadId
+                << ",\"ts\":" << span.startNs / 1000.0 << ",\"dur\":" << span.durationNs / 1000.0 << "}";
+            first = false;
+        }
+        out << "\n]}\n";
+        return static_cast<bool>(out);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#include "benches.h"
+
+import std;
+import netlib;
+using namespace net;
+
+// Loopback throughput of single datagram calls against udp_ipv4_send_batch/udp_ipv4_recv_batch.
+// Every round sends 'batch' datagrams and receives them back before next round, so socket buffers never overflow.
+namespace {
+	struct BatchResult {
+		double seconds = 0.0;
+		uint64_t received = 0;
+	};
+
+	BatchResult run(const bool batched, const uint64_t packets, const size_t size, const size_t batch) {
+		auto sender = udp_ipv4_init_socket();
+		auto receiver = udp_ipv4_init_socket();
+		Ipv4Address destination{ 0x7F000001, sock_get_src_address(receiver).port };
+		std::vector<uint8_t> send_buffer(size, 0xAB);
+		std::vector<std::vector<uint8_t>> recv_buffers(batch, std::vector<uint8_t>(size));
+		std::vector<UdpSendDatagram> send_batch(batch, UdpSendDatagram{ send_buffer.data(), size, destination });
+		std::vector<UdpRecvDatagram> recv_batch;
+		for (auto& buffer : recv_buffers) {
+			recv_batch.emplace_back(UdpRecvDatagram{ buffer.data(), buffer.size(), 0, {} });
+		}
+
+		BatchResult result{};
+		std::vector<Socket> ready;
+		auto start = std::chrono::steady_clock::now();
+		for (uint64_t sent = 0; sent < packets; sent += batch) {
+			if (batched) {
+				udp_ipv4_send_batch(sender, send_batch);
+			}
+			else {
+				for (size_t i = 0; i < batch; i++) {
+					udp_ipv4_send_packet(sender, send_buffer.data(), size, destination);
+				}
+			}
+			size_t round_received = 0;
+			while (round_received < batch) {
+				if (sock_wait_readable(std::span<const Socket>(&receiver, 1), ready, 100'000) <= 0) {
+					break;
+				}
+				if (batched) {
+					int count = udp_ipv4_recv_batch(receiver, std::span<UdpRecvDatagram>(recv_batch).subspan(round_received));
+					round_received += (count > 0) ? count : 0;
+				}
+				else {
+					while (round_received < batch && udp_ipv4_recv_packet(receiver, recv_buffers[round_received].data(), size) > 0) {
+						round_received++;
+					}
+				}
+			}
+			result.received += round_received;
+		}
+		result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		sock_close(sender);
+		sock_close(receiver);
+		return result;
+	}
+}
+
+int bench_batch(const std::vector<std::string>& args) {
+	uint64_t packets = (args.size() > 0) ? std::stoull(args[0]) : 200'000;
+	size_t size = (args.size() > 1) ? std::stoul(args[1]) : 200;
+	size_t batch = (args.size() > 2) ? std::stoul(args[2]) : 32;
+
+	std::cout << std::format("{:<10}{:>12}{:>14}{:>12}\n", "mode", "received", "packets/s", "MB/s");
+	for (const bool batched : { false, true }) {
+		auto result = run(batched, packets, size, batch);
+		double pps = result.received / result.seconds;
+		std::cout << std::format("{:<10}{:>12}{:>14.0f}{:>12.1f}\n",
+			batched ? "batch" : "single", result.received, pps, pps * size / 1'000'000.0
+		);
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Each benchmark gets arguments following its name in the command line
+int bench_nat(const std::vector<std::string>& args);
+int bench_gather(const std::vector<std::string>& args);
+int bench_batch(const std::vector<std::string>& args);
@@ -0,0 +1,55 @@
+#include "benches.h"
+
+import std;
+import netlib;
+using namespace net;
+
+// Measures server candidate gathering with controlled DNS latency. STUN traffic runs in the network simulator
+// (virtual time), DNS answers come from fake resolver that really sleeps, so wall time shows resolver cost.
+namespace {
+	constexpr uint32_t stun_server_base_ip = (198u << 24) | (51u << 16) | (100u << 8);
+	constexpr uint32_t host_ip = (10u << 24) | 2u;
+	constexpr uint32_t host_nat_ip = (203u << 24) | (113u << 8) | 1u;
+	constexpr uint32_t gather_runs = 3;
+}
+
+int bench_gather(const std::vector<std::string>& args) {
+	auto dns_latency = std::chrono::milliseconds((args.size() > 0) ? std::stoul(args[0]) : 50);
+	NetSimLink link{};
+	link.latency_us = (args.size() > 1) ? std::stoul(args[1]) * 1000 : 20'000;
+	uint32_t server_count = (args.size() > 2) ? std::stoul(args[2]) : 7;
+
+	NetSim sim{};
+	DnsFakeResolver resolver{};
+	resolver.set_latency(dns_latency);
+	std::vector<std::string> names;
+	for (uint32_t i = 0; i < server_count; i++) {
+		Ipv4Address server{ stun_server_base_ip + i + 1, 3478 };
+		sim.add_stun_server(server, link);
+		names.emplace_back(std::format("stun{}.bench.test", i));
+		resolver.add_record(names.back(), { server });
+	}
+	sim.set_current_host(sim.add_host(host_ip, NatType::FULL_CONE, host_nat_ip, link));
+	std::vector<const char*> name_ptrs;
+	for (const auto& name : names) {
+		name_ptrs.push_back(name.c_str());
+	}
+
+	sock_set_backend(&sim);
+	dns_set_resolver(&resolver);
+	std::cout << std::format("{:<8}{:>12}{:>14}{:>12}{:>14}\n", "run", "wall ms", "network ms", "dns queries", "candidates");
+	for (uint32_t run = 0; run < gather_runs; run++) {
+		auto queries_before = resolver.query_count();
+		auto sim_start = sim.now_us();
+		auto start = std::chrono::steady_clock::now();
+		auto candidates = ice_discover_server_candidates(name_ptrs);
+		auto wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+		std::cout << std::format("{:<8}{:>12.1f}{:>14.1f}{:>12}{:>14}\n",
+			(run == 0) ? "cold" : "cached", wall.count(), (sim.now_us() - sim_start) / 1000.0,
+			resolver.query_count() - queries_before, candidates.size()
+		);
+	}
+	dns_set_resolver(nullptr);
+	sock_set_backend(nullptr);
+	return 0;
+}
\ No newline at end of file
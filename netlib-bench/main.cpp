@@ -0,0 +1,42 @@
+#include "benches.h"
+
+import std;
+import netlib;
+
+struct Benchmark {
+	const char* name;
+	const char* usage;
+	int (*run)(const std::vector<std::string>& args);
+};
+
+constexpr Benchmark benchmarks[] = {
+	{ "nat", "nat [latency_ms=20] [loss=0.0] [seed=1]", bench_nat },
+	{ "gather", "gather [dns_latency_ms=50] [stun_latency_ms=20] [servers=7]", bench_gather },
+	{ "batch", "batch [packets=200000] [size=200] [batch=32]", bench_batch },
+};
+
+static void print_usage() {
+	std::cout << "Usage: netlib-bench <benchmark> [args...]\n";
+	for (const auto& benchmark : benchmarks) {
+		std::cout << "  " << benchmark.usage << '\n';
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		print_usage();
+		return 1;
+	}
+	std::string name = argv[1];
+	std::vector<std::string> args(argv + 2, argv + argc);
+	for (const auto& benchmark : benchmarks) {
+		if (name == benchmark.name) {
+			net::netlib_init();
+			int result = benchmark.run(args);
+			net::netlib_clean();
+			return result;
+		}
+	}
+	print_usage();
+	return 1;
+}
\ No newline at end of file
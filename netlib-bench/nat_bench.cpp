@@ -0,0 +1,196 @@
+#include "benches.h"
+
+import std;
+import byte_common;
+import netlib;
+using namespace net;
+
+// Gathers candidates and runs connectivity checks between two peers for every NAT combination
+// in the network simulator. All times are virtual, so results do not depend on machine load.
+namespace {
+	constexpr uint32_t make_ip(const uint8_t a, const uint8_t b, const uint8_t c, const uint8_t d) {
+		return (static_cast<uint32_t>(a) << 24) | (static_cast<uint32_t>(b) << 16) | (static_cast<uint32_t>(c) << 8) | d;
+	}
+
+	constexpr Ipv4Address stun_server{ make_ip(198, 51, 100, 1), 3478 };
+	constexpr std::array<const char*, 1> stun_server_names = { "198.51.100.1" };
+	constexpr uint32_t check_interval_us = 50'000;
+	constexpr uint64_t connect_timeout_us = 5'000'000;
+	constexpr uint64_t stun_buffer_size = 92;
+	constexpr std::array<NatType, 5> nat_types = {
+		NatType::NONE, NatType::FULL_CONE, NatType::RESTRICTED, NatType::PORT_RESTRICTED, NatType::SYMMETRIC
+	};
+
+	const char* nat_type_to_str(const NatType type) {
+		switch (type) {
+		case NatType::NONE: return "none";
+		case NatType::FULL_CONE: return "full-cone";
+		case NatType::RESTRICTED: return "restricted";
+		case NatType::PORT_RESTRICTED: return "port-restricted";
+		case NatType::SYMMETRIC: return "symmetric";
+		}
+		return "unknown";
+	}
+
+	struct Peer {
+		NetSimHostId host = 0;
+		Socket socket = 0;
+		Ipv4Address reflexive{};
+		Ipv4Address remote{};
+		bool connected = false;
+		uint32_t checks = 0;
+	};
+
+	struct Result {
+		uint64_t gather_us = 0;
+		uint64_t connect_us = 0;
+		uint32_t checks = 0;
+		bool connected = false;
+	};
+
+	void send_binding(const Socket socket, const StunClass cls, const std::span<const uint8_t, 12> transaction_id, const Ipv4Address& to) {
+		Stun msg{};
+		msg.set_type(cls, StunMethod::BINDING);
+		msg.set_transaction_id(transaction_id);
+		if (cls == StunClass::SUCCESS_RESPONSE) {
+			auto attr = StunAttribute::create_attr_address_xor(StunAttributeType::XOR_MAPPED_ADDRESS);
+			attr->set_ip(to.ip);
+			attr->set_port(to.port);
+			msg.add_attribute(std::move(attr));
+		}
+		auto buffer = ByteNetworkWriter(stun_buffer_size);
+		uint64_t size = msg.write_into(buffer);
+		udp_ipv4_send_packet(socket, buffer.data().data(), size, to);
+	}
+
+	void send_request(const Socket socket, const Ipv4Address& to) {
+		Stun request{};
+		request.randomize_transaction_id();
+		send_binding(socket, StunClass::REQUEST, request.transact_id(), to);
+	}
+
+	std::optional<Stun> recv_stun(const Socket socket, Ipv4Address* from) {
+		std::array<uint8_t, stun_buffer_size> buffer{};
+		auto recv_bytes = udp_ipv4_recv_packet(socket, buffer.data(), buffer.size(), from);
+		if (recv_bytes <= 0) {
+			return {};
+		}
+		auto reader = ByteNetworkReader(std::span<const uint8_t>(buffer.data(), recv_bytes));
+		return Stun::read_from(reader);
+	}
+
+	std::optional<Ipv4Address> query_reflexive(const Socket socket) {
+		send_request(socket, stun_server);
+		std::vector<Socket> ready;
+		if (sock_wait_readable(std::span<const Socket>(&socket, 1), ready, 1'000'000) <= 0) {
+			return {};
+		}
+		Ipv4Address from{};
+		auto response = recv_stun(socket, &from);
+		if (!response.has_value() || response->cls() != StunClass::SUCCESS_RESPONSE) {
+			return {};
+		}
+		auto attr = response->get_xor_address_attribute(StunAttributeType::XOR_MAPPED_ADDRESS);
+		if (!attr) {
+			return {};
+		}
+		return attr->address();
+	}
+
+	void handle_check(Peer& peer) {
+		Ipv4Address from{};
+		auto msg = recv_stun(peer.socket, &from);
+		if (!msg.has_value() || msg->method() != StunMethod::BINDING) {
+			return;
+		}
+		if (msg->cls() == StunClass::REQUEST) {
+			send_binding(peer.socket, StunClass::SUCCESS_RESPONSE, msg->transact_id(), from);
+			// Triggered check towards peer reflexive address
+			peer.remote = from;
+		}
+		else if (msg->cls() == StunClass::SUCCESS_RESPONSE) {
+			peer.connected = true;
+		}
+	}
+
+	NetSimHostId add_peer_host(NetSim& sim, const NatType nat, const uint32_t private_ip, const uint32_t public_ip, const NetSimLink& link) {
+		if (nat == NatType::NONE) {
+			return sim.add_host(public_ip, NatType::NONE, 0, link);
+		}
+		return sim.add_host(private_ip, nat, public_ip, link);
+	}
+
+	Result run_pair(const NatType nat_a, const NatType nat_b, const NetSimLink& link, const uint32_t seed) {
+		Result result{};
+		NetSim sim(seed);
+		sock_set_backend(&sim);
+		sim.add_stun_server(stun_server, link);
+		Peer a{ add_peer_host(sim, nat_a, make_ip(10, 0, 0, 2), make_ip(203, 0, 113, 1), link) };
+		Peer b{ add_peer_host(sim, nat_b, make_ip(10, 0, 1, 2), make_ip(203, 0, 113, 2), link) };
+
+		uint64_t start = sim.now_us();
+		for (auto peer : { &a, &b }) {
+			sim.set_current_host(peer->host);
+			ice_discover_host_candidates();
+			ice_discover_server_candidates(stun_server_names);
+		}
+		result.gather_us = sim.now_us() - start;
+
+		for (auto peer : { &a, &b }) {
+			sim.set_current_host(peer->host);
+			peer->socket = udp_ipv4_init_socket();
+			peer->reflexive = query_reflexive(peer->socket).value_or(sock_get_src_address(peer->socket));
+		}
+		a.remote = b.reflexive;
+		b.remote = a.reflexive;
+
+		start = sim.now_us();
+		std::array<Socket, 2> sockets = { a.socket, b.socket };
+		std::vector<Socket> ready;
+		while (!(a.connected && b.connected) && sim.now_us() - start < connect_timeout_us) {
+			for (auto peer : { &a, &b }) {
+				if (!peer->connected) {
+					send_request(peer->socket, peer->remote);
+					peer->checks++;
+				}
+			}
+			uint64_t tick_end = sim.now_us() + check_interval_us;
+			while (sim.now_us() < tick_end) {
+				if (sock_wait_readable(sockets, ready, static_cast<uint32_t>(tick_end - sim.now_us())) <= 0) {
+					break;
+				}
+				for (const auto socket : ready) {
+					handle_check(socket == a.socket ? a : b);
+				}
+			}
+		}
+		result.connected = a.connected && b.connected;
+		result.connect_us = sim.now_us() - start;
+		result.checks = a.checks + b.checks;
+
+		sock_close(a.socket);
+		sock_close(b.socket);
+		sock_set_backend(nullptr);
+		return result;
+	}
+}
+
+int bench_nat(const std::vector<std::string>& args) {
+	NetSimLink link{};
+	link.latency_us = (args.size() > 0) ? std::stoul(args[0]) * 1000 : 20'000;
+	link.loss = (args.size() > 1) ? std::stod(args[1]) : 0.0;
+	uint32_t seed = (args.size() > 2) ? std::stoul(args[2]) : 1;
+
+	std::cout << std::format("{:<16}{:<16}{:>12}{:>12}{:>10}{:>8}\n", "peer A", "peer B", "gather ms", "connect ms", "checks", "result");
+	for (const auto nat_a : nat_types) {
+		for (const auto nat_b : nat_types) {
+			auto result = run_pair(nat_a, nat_b, link, seed);
+			std::cout << std::format("{:<16}{:<16}{:>12.1f}{:>12.1f}{:>10}{:>8}\n",
+				nat_type_to_str(nat_a), nat_type_to_str(nat_b),
+				result.gather_us / 1000.0, result.connect_us / 1000.0, result.checks,
+				result.connected ? "ok" : "failed"
+			);
+		}
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+import std;
+import netlib;
+
+// Turns binary log files written by net::log_set_binary_file() back into text
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::cout << "Usage: netlib-logdump <log.nlog> [out.txt]\n";
+		return 1;
+	}
+	std::ifstream in(argv[1], std::ios::binary);
+	if (!in) {
+		std::cerr << "Failed to open '" << argv[1] << "'.\n";
+		return 1;
+	}
+	std::ofstream file;
+	if (argc > 2) {
+		file.open(argv[2]);
+		if (!file) {
+			std::cerr << "Failed to open '" << argv[2] << "'.\n";
+			return 1;
+		}
+	}
+	if (!net::log_decode(in, (argc > 2) ? static_cast<std::ostream&>(file) : std::cout)) {
+		std::cerr << "'" << argv[1] << "' is not a log file or is cut short.\n";
+		return 1;
+	}
+	return 0;
+}
\ No newline at end of file
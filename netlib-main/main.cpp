@@ -1,17 +1,56 @@
 import std;
 import netlib;
 
-int main() {
+// '--fake-dns [latency_ms]' answers every lookup after given delay, so call setup can be timed without network.
+// Names point into network simulator, which answers STUN from stand-in servers and drops SIP, in virtual time.
+static void install_fake_network(net::DnsFakeResolver& resolver, net::NetSim& sim, const std::chrono::milliseconds latency) {
+	constexpr const char* sip_names[] = {
+		"sip2sip.info",
+		"proxy.sipthor.net",
+	};
+	constexpr const char* stun_names[] = {
+		"stun.12connect.com",
+		"stun.12voip.com",
+		"stun.1und1.de",
+		"stun.2talk.co.nz",
+		"stun.2talk.com",
+		"stun.3clogic.com",
+		"stun.3cx.com",
+	};
+	constexpr uint32_t sip_server_ip = (198u << 24) | (51u << 16) | (100u << 8) | 100u;
+	constexpr uint32_t stun_server_base_ip = (198u << 24) | (51u << 16) | (100u << 8);
+	constexpr uint32_t host_ip = (10u << 24) | 2u;
+	constexpr uint32_t host_nat_ip = (203u << 24) | (113u << 8) | 1u;
+	resolver.set_latency(latency);
+	for (const auto name : sip_names) {
+		resolver.add_record(name, { net::Ipv4Address{ sip_server_ip, 0 } });
+	}
+	uint32_t server_ip = stun_server_base_ip;
+	for (const auto name : stun_names) {
+		net::Ipv4Address server{ ++server_ip, 3478 };
+		sim.add_stun_server(server, net::NetSimLink{ .latency_us = 20'000 });
+		resolver.add_record(name, { server });
+	}
+	sim.set_current_host(sim.add_host(host_ip, net::NatType::FULL_CONE, host_nat_ip, net::NetSimLink{ .latency_us = 20'000 }));
+	net::sock_set_backend(&sim);
+	net::dns_set_resolver(&resolver);
+}
+
+int main(int argc, char** argv) {
 	net::netlib_init();
+
+	net::DnsFakeResolver fake_resolver{};
+	net::NetSim sim{};
+	if (argc > 1 && std::string_view(argv[1]) == "--fake-dns") {
+		install_fake_network(fake_resolver, sim, std::chrono::milliseconds((argc > 2) ? std::stoul(argv[2]) : 50));
+	}
+	auto start = std::chrono::steady_clock::now();
 	
 	//std::string dns = "sip2sip.info";
 	std::string dns = "proxy.sipthor.net";
 	auto ipss = net::dns_resolve_address("sip2sip.info", nullptr);
-	auto ips = net::dns_resolve_udp_address(dns.c_str(), "5060");
-	for (const auto& ip : ips) {
-		net::Ipv4Address address{};
-		address.ip = net::udp_ipv4_str_to_net(ip);
-		address.port = 5060;
+	auto addresses = net::dns_resolve_ipv4(dns.c_str(), 5060);
+	for (const auto& address : addresses) {
 		auto sock = net::udp_ipv4_init_socket();
 		auto sock_info = net::sock_get_src_address(sock);
 		std::string msg = std::format("OPTIONS sip:sip2sip.info SIP/2.0\r\nVia: SIP/2.0/UDP 127.0.1.1:{};branch=z9hG4bK.015bb32f;rport;alias\r\nFrom: sip:sipsak@127.0.1.1:{};tag=8f6c57f\r\nTo: sip:sip2sip.info\r\nCall-ID: 150326607@127.0.1.1\r\nCSeq: 1 OPTIONS\r\nContact: sip:sipsak@127.0.1.1:{}\r\nContent-Length: 0\r\nMax-Forwards: 70\r\nUser-Agent: sipsak 0.9.8.1\r\nAccept: text/plain\r\n\r\n", sock_info.port, sock_info.port, sock_info.port);
@@ -24,7 +63,10 @@ int main() {
 
 	auto host_candidates = net::ice_discover_host_candidates();
 	auto server_candidates = net::ice_discover_server_candidates();
+	std::cout << std::format("Setup took {} ms\n", std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
 
+	net::dns_set_resolver(nullptr);
+	net::sock_set_backend(nullptr);
 	net::netlib_clean();
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "pch.h"
+
+import std;
+import netlib;
+using namespace net;
+
+constexpr uint32_t make_ip(const uint8_t a, const uint8_t b, const uint8_t c, const uint8_t d) {
+	return (static_cast<uint32_t>(a) << 24) | (static_cast<uint32_t>(b) << 16) | (static_cast<uint32_t>(c) << 8) | d;
+}
+
+constexpr uint32_t test_host_ip = make_ip(203, 0, 113, 10);
+constexpr uint32_t test_peer_ip = make_ip(203, 0, 113, 20);
+constexpr std::array<uint8_t, 4> test_payload = { 0xde, 0xad, 0xbe, 0xef };
+
+class AsyncTests : public testing::Test {
+protected:
+	void SetUp() override {
+		netlib_init();
+		sock_set_backend(&sim);
+		host = sim.add_host(test_host_ip, NatType::NONE, 0, NetSimLink{ .latency_us = 10'000 });
+		peer = sim.add_host(test_peer_ip, NatType::NONE, 0, NetSimLink{ .latency_us = 10'000 });
+	}
+	void TearDown() override {
+		sock_set_backend(nullptr);
+		netlib_clean();
+	}
+
+	Socket open_socket(const NetSimHostId on_host) {
+		sim.set_current_host(on_host);
+		return udp_ipv4_init_socket();
+	}
+
+	NetSim sim{};
+	NetSimHostId host = 0;
+	NetSimHostId peer = 0;
+};
+
+static Task<int> add_after(Reactor& reactor, const int a, const int b, const uint32_t delay_us) {
+	co_await sleep_for(reactor, delay_us);
+	co_return a + b;
+}
+
+static Task<int> sum_twice(Reactor& reactor) {
+	int first = co_await add_after(reactor, 1, 2, 5'000);
+	int second = co_await add_after(reactor, first, 3, 5'000);
+	co_return second;
+}
+
+TEST_F(AsyncTests, NestedTasksRunInVirtualTime) {
+	Reactor reactor{};
+	EXPECT_EQ(async_run(reactor, sum_twice(reactor)), 6);
+	EXPECT_EQ(sim.now_us(), 10'000);
+}
+
+static Task<int> echo_once(Reactor& reactor, const Socket socket) {
+	auto buffer = packet_pool_default().acquire();
+	Ipv4Address from{};
+	int recv_bytes = co_await async_recv(reactor, socket, buffer, &from);
+	if (recv_bytes <= 0) {
+		co_return -1;
+	}
+	co_return co_await async_send(reactor, socket, buffer.data(), buffer.size(), from);
+}
+
+static Task<std::vector<uint8_t>> request(Reactor& reactor, const Socket socket, const Ipv4Address to) {
+	co_await async_send(reactor, socket, test_payload.data(), test_payload.size(), to);
+	std::array<uint8_t, 16> buffer{};
+	int recv_bytes = co_await async_recv(reactor, socket, buffer.data(), buffer.size());
+	co_return std::vector<uint8_t>(buffer.begin(), buffer.begin() + (std::max)(recv_bytes, 0));
+}
+
+TEST_F(AsyncTests, RequestAndEchoShareOneReactor) {
+	auto client = open_socket(host);
+	auto server = open_socket(peer);
+	Reactor reactor{};
+	int echoed = 0;
+	async_spawn([](Reactor& reactor, const Socket server, int& echoed) -> Task<void> {
+		echoed = co_await echo_once(reactor, server);
+	}(reactor, server, echoed));
+	auto response = async_run(reactor, request(reactor, client, sock_get_src_address(server)));
+	EXPECT_EQ(response, std::vector<uint8_t>(test_payload.begin(), test_payload.end()));
+	EXPECT_EQ(echoed, test_payload.size());
+	EXPECT_EQ(sim.now_us(), 40'000);
+	EXPECT_FALSE(reactor.has_socket(client));
+	EXPECT_FALSE(reactor.has_socket(server));
+}
+
+TEST_F(AsyncTests, TimeoutCancelsPendingReceive) {
+	auto socket = open_socket(host);
+	Reactor reactor{};
+	std::array<uint8_t, 16> buffer{};
+	auto result = async_run(reactor, with_timeout(reactor, async_recv(reactor, socket, buffer.data(), buffer.size()), 20'000));
+	EXPECT_FALSE(result.has_value());
+	EXPECT_EQ(sim.now_us(), 20'000);
+	EXPECT_FALSE(reactor.has_socket(socket));
+}
+
+static Task<void> sleep_until_cancelled(Reactor& reactor) {
+	for (;;) {
+		bool slept = co_await sleep_for(reactor, 1'000);
+		if (!slept) {
+			break;
+		}
+	}
+}
+
+TEST_F(AsyncTests, TimeoutPassesResultWhenInTime) {
+	Reactor reactor{};
+	auto result = async_run(reactor, with_timeout(reactor, add_after(reactor, 2, 2, 1'000), 20'000));
+	EXPECT_EQ(result, std::optional<int>(4));
+	auto finished = async_run(reactor, with_timeout(reactor, sleep_until_cancelled(reactor), 5'000));
+	EXPECT_FALSE(finished);
+}
+
+TEST_F(AsyncTests, SpawnedTaskCanBeCancelled) {
+	Reactor reactor{};
+	bool slept = true;
+	auto cancel = async_spawn([](Reactor& reactor, bool& slept) -> Task<void> {
+		slept = co_await sleep_for(reactor, 1'000'000);
+	}(reactor, slept));
+	reactor.add_timer(1'000, [&]() { cancel->cancel(); });
+	reactor.run_once();
+	reactor.run_once();
+	EXPECT_FALSE(slept);
+	EXPECT_EQ(sim.now_us(), 1'000);
+}
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include "pch.h"
+
+import std;
+import netlib;
+using namespace net;
+
+class DnsAsyncResolverTests : public testing::Test {
+protected:
+	void SetUp() override {
+		netlib_init();
+	}
+	void TearDown() override {
+		netlib_clean();
+	}
+};
+
+TEST_F(DnsAsyncResolverTests, FutureResolvesLiteralAddress) {
+	DnsAsyncResolver resolver{};
+	auto result = resolver.resolve("127.0.0.1", 3478);
+	const auto& ips = result.get();
+	EXPECT_EQ(ips.size(), 1);
+	if (ips.empty()) {
+		return;
+	}
+	EXPECT_EQ(std::get<Ipv4Address>(ips[0]), (Ipv4Address{ 0x7F000001, 3478 }));
+}
+
+TEST_F(DnsAsyncResolverTests, SecondRequestServedFromCache) {
+	DnsAsyncResolver resolver{};
+	resolver.resolve("127.0.0.1", 3478).wait();
+	auto ips = resolver.cached("127.0.0.1", 3478);
+	EXPECT_TRUE(ips.has_value());
+	resolver.resolve("127.0.0.1", 3478).wait();
+	auto stats = resolver.stats();
+	EXPECT_EQ(stats.lookups, 1);
+	EXPECT_EQ(stats.cache_hits, 2);
+}
+
+TEST_F(DnsAsyncResolverTests, ConcurrentRequestsShareLookup) {
+	DnsAsyncResolver resolver{ 1 };
+	std::counting_semaphore<8> answered{ 0 };
+	std::atomic<int> callbacks = 0;
+	for (int i = 0; i < 8; i++) {
+		resolver.resolve("127.0.0.1", 3478, DnsQueryType::UDP, [&](const std::vector<IpAddress>& ips) {
+			if (ips.size() == 1) {
+				callbacks++;
+			}
+			answered.release();
+		});
+	}
+	resolver.resolve("127.0.0.1", 3478).wait();
+	auto stats = resolver.stats();
+	EXPECT_EQ(stats.lookups, 1);
+	EXPECT_EQ(stats.merged + stats.cache_hits, 8);
+	// Callbacks registered on pending lookup run on worker after future is ready
+	for (int i = 0; i < 8; i++) {
+		ASSERT_TRUE(answered.try_acquire_for(std::chrono::seconds(5)));
+	}
+	EXPECT_EQ(callbacks, 8);
+}
+
+TEST_F(DnsAsyncResolverTests, QueryTypesAreCachedSeparately) {
+	DnsAsyncResolver resolver{};
+	resolver.resolve("127.0.0.1", 3478, DnsQueryType::UDP).wait();
+	EXPECT_FALSE(resolver.cached("127.0.0.1", 3478, DnsQueryType::TCP).has_value());
+	resolver.resolve("127.0.0.1", 3478, DnsQueryType::TCP).wait();
+	EXPECT_EQ(resolver.stats().lookups, 2);
+	resolver.clear_cache();
+	EXPECT_FALSE(resolver.cached("127.0.0.1", 3478, DnsQueryType::UDP).has_value());
+}
+
+TEST(DnsTests, ResolveIpv4LiteralWithoutStrings) {
+	auto addresses = dns_resolve_ipv4("192.0.2.7", 5060);
+	EXPECT_EQ(addresses.size(), 1);
+	if (addresses.empty()) {
+		return;
+	}
+	EXPECT_EQ(addresses[0], (Ipv4Address{ 0xC0000207, 5060 }));
+}
+
+TEST(DnsTests, ResolveIpv6Literal) {
+	auto addresses = dns_resolve_ip("2001:db8::1", 443, DnsQueryType::ANY);
+	EXPECT_EQ(addresses.size(), 1);
+	if (addresses.empty()) {
+		return;
+	}
+	auto address = std::get_if<Ipv6Address>(&addresses[0]);
+	EXPECT_TRUE(address != nullptr);
+	if (!address) {
+		return;
+	}
+	EXPECT_EQ(address->port, 443);
+	EXPECT_EQ(address->ip[0], 0x20);
+	EXPECT_EQ(address->ip[15], 0x01);
+}
+
+class DnsFakeResolverTests : public testing::Test {
+protected:
+	void SetUp() override {
+		netlib_init();
+		dns_set_resolver(&fake);
+	}
+	void TearDown() override {
+		dns_set_resolver(nullptr);
+		netlib_clean();
+	}
+
+	DnsFakeResolver fake{};
+};
+
+TEST_F(DnsFakeResolverTests, AnswersFromRecordsWithQueryPort) {
+	Ipv6Address ipv6{ { 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 }, 0, 0 };
+	fake.add_record("stun.example.org", { Ipv4Address{ 0xC0000201, 0 }, ipv6 });
+	auto ipv4s = dns_resolve_ipv4("stun.example.org", 3478);
+	EXPECT_EQ(ipv4s.size(), 1);
+	if (ipv4s.empty()) {
+		return;
+	}
+	EXPECT_EQ(ipv4s[0], (Ipv4Address{ 0xC0000201, 3478 }));
+	EXPECT_EQ(dns_resolve_ip("stun.example.org", 3478).size(), 2);
+	EXPECT_EQ(fake.query_count(), 2);
+}
+
+TEST_F(DnsFakeResolverTests, UnknownNameFails) {
+	EXPECT_TRUE(dns_resolve_ip("missing.example.org", 3478).empty());
+	EXPECT_TRUE(dns_resolve_udp_address("missing.example.org", "3478").empty());
+}
+
+TEST_F(DnsFakeResolverTests, StringApiFormatsRecords) {
+	fake.add_record("sip.example.org", { Ipv4Address{ 0xC0000202, 0 } });
+	auto ips = dns_resolve_udp_address("sip.example.org", "5060");
+	EXPECT_EQ(ips.size(), 1);
+	if (ips.empty()) {
+		return;
+	}
+	EXPECT_EQ(ips[0], "192.0.2.2");
+}
+
+TEST_F(DnsFakeResolverTests, LatencyDelaysLookup) {
+	fake.add_record("slow.example.org", { Ipv4Address{ 0xC0000203, 0 } }, std::chrono::milliseconds(20));
+	DnsAsyncResolver resolver{};
+	auto start = std::chrono::steady_clock::now();
+	auto result = resolver.resolve("slow.example.org", 3478);
+	EXPECT_EQ(result.get().size(), 1);
+	EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+
+	// Cached answer does not pay latency again
+	start = std::chrono::steady_clock::now();
+	EXPECT_EQ(resolver.resolve("slow.example.org", 3478).get().size(), 1);
+	EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+	EXPECT_EQ(fake.query_count(), 1);
+}
+
+TEST_F(DnsFakeResolverTests, DestroyedResolverCancelsQueuedLookups) {
+	fake.add_record("slow.example.org", { Ipv4Address{ 0xC0000203, 0 } }, std::chrono::milliseconds(20));
+	fake.add_record("queued.example.org", { Ipv4Address{ 0xC0000204, 0 } });
+	DnsResult slow;
+	DnsResult queued;
+	bool callback_result_empty = false;
+	{
+		DnsAsyncResolver resolver{ 1 };
+		slow = resolver.resolve("slow.example.org", 3478);
+		queued = resolver.resolve("queued.example.org", 3478);
+		resolver.resolve("queued.example.org", 3478, DnsQueryType::UDP, [&](const std::vector<IpAddress>& ips) {
+			callback_result_empty = ips.empty();
+		});
+	}
+	// Single worker is busy with slow name or not started yet, queued name never reaches it
+	ASSERT_EQ(queued.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+	try {
+		queued.get();
+		ADD_FAILURE() << "Queued lookup was not cancelled.";
+	}
+	catch (const std::system_error& error) {
+		EXPECT_EQ(error.code(), std::make_error_code(std::errc::operation_canceled));
+	}
+	EXPECT_TRUE(callback_result_empty);
+	ASSERT_EQ(slow.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+	EXPECT_LE(fake.query_count(), 1u);
+}
\ No newline at end of file
@@ -0,0 +1,162 @@
+#include "pch.h"
+
+import std;
+import netlib;
+using namespace net;
+
+// Converts to characters, so log stores it as std::string, while its own formatter takes integer specs
+struct LogTestTag {
+	operator std::string_view() const {
+		return "tag";
+	}
+};
+
+template<>
+struct std::formatter<LogTestTag> : std::formatter<int> {
+	auto format(const LogTestTag&, std::format_context& ctx) const {
+		return std::formatter<int>::format(7, ctx);
+	}
+};
+
+class LogTests : public testing::Test {
+protected:
+	void SetUp() override {
+		log_flush();
+		log_set_sink([this](const uint8_t level, const std::string_view line) {
+			lines.emplace_back(level, std::string(line));
+		});
+	}
+	void TearDown() override {
+		log_flush();
+		log_set_sink({});
+		log_set_rate_limit(1000);
+	}
+
+	std::vector<std::pair<uint8_t, std::string>> lines;
+};
+
+TEST_F(LogTests, ArgumentsAreFormattedOnFlush) {
+	{
+		// Characters are copied at call time, caller's buffer may be gone before formatting
+		std::string name = "stun.example.test";
+		log_warning("Resolving '{}' took {} ms.", name.c_str(), 42);
+		name.assign(name.size(), 'x');
+	}
+	log_error("Socket {} failed.", Ipv4Address{ 0x7F000001, 3478 });
+	log_flush();
+	ASSERT_EQ(lines.size(), 2);
+	EXPECT_EQ(lines[0].first, LOG_LEVEL_WARNING);
+	EXPECT_EQ(lines[0].second, "netlib: Resolving 'stun.example.test' took 42 ms.");
+	EXPECT_EQ(lines[1].first, LOG_LEVEL_ERROR);
+	EXPECT_EQ(lines[1].second, "netlib: Socket 127.0.0.1:3478 failed.");
+}
+
+TEST_F(LogTests, LevelsBelowCompiledLevelAreDropped) {
+	log_debug("Debug {}", 1);
+	log_info("Info {}", 2);
+	log_warning("Warning {}", 3);
+	log_error("Error {}", 4);
+	log_flush();
+	std::array<size_t, 4> counts{};
+	for (const auto& [level, line] : lines) {
+		ASSERT_LE(level, LOG_LEVEL_ERROR);
+		counts[level]++;
+	}
+	EXPECT_EQ(counts[LOG_LEVEL_DEBUG], (LOG_LEVEL_COMPILED <= LOG_LEVEL_DEBUG) ? 1 : 0);
+	EXPECT_EQ(counts[LOG_LEVEL_INFO], (LOG_LEVEL_COMPILED <= LOG_LEVEL_INFO) ? 1 : 0);
+	EXPECT_EQ(counts[LOG_LEVEL_WARNING], 1);
+	EXPECT_EQ(counts[LOG_LEVEL_ERROR], 1);
+}
+
+TEST_F(LogTests, RateLimitDropsExcessAndReportsIt) {
+	// Bucket starts full, so one second worth of records passes right away
+	log_set_rate_limit(10);
+	for (int i = 0; i < 100; i++) {
+		log_warning("Flood {}", i);
+	}
+	log_flush();
+	ASSERT_EQ(lines.size(), 11);
+	EXPECT_EQ(lines[9].second, "netlib: Flood 9");
+	EXPECT_EQ(lines[10].second, "netlib: 90 log messages dropped.");
+}
+
+TEST_F(LogTests, ErrorsBypassRateLimit) {
+	log_set_rate_limit(10);
+	for (int i = 0; i < 20; i++) {
+		log_warning("Flood {}", i);
+	}
+	for (int i = 0; i < 20; i++) {
+		log_error("Failure {}", i);
+	}
+	log_flush();
+	auto errors = std::count_if(lines.begin(), lines.end(), [](const auto& line) {
+		return line.first == LOG_LEVEL_ERROR;
+	});
+	EXPECT_EQ(errors, 20);
+	EXPECT_EQ(lines.back().second, "netlib: 10 log messages dropped.");
+}
+
+TEST_F(LogTests, UnformattableRecordKeepsWriterRunning) {
+	// Format is checked against LogTestTag, but writer gets its std::string copy, which has no hex presentation
+	log_warning("Tag {:x}", LogTestTag{});
+	log_warning("After {}", 1);
+	log_flush();
+	ASSERT_EQ(lines.size(), 2);
+	EXPECT_TRUE(lines[0].second.starts_with("netlib: [unformattable record 'Tag {:x}'"));
+	EXPECT_EQ(lines[1].second, "netlib: After 1");
+}
+
+TEST_F(LogTests, RecordsFromOtherThreadsAreWritten) {
+	std::thread([]() {
+		log_warning("From worker {}", 1);
+	}).join();
+	log_warning("From main {}", 2);
+	log_flush();
+	ASSERT_EQ(lines.size(), 2);
+	EXPECT_EQ(lines[0].second, "netlib: From worker 1");
+	EXPECT_EQ(lines[1].second, "netlib: From main 2");
+}
+
+TEST_F(LogTests, LargeArgumentsAreFormattedByCaller) {
+	std::array<uint64_t, 32> values{};
+	values.fill(7);
+	log_warning("Values {}", values);
+	log_flush();
+	ASSERT_EQ(lines.size(), 1);
+	EXPECT_TRUE(lines[0].second.starts_with("netlib: Values [7, 7"));
+}
+
+TEST_F(LogTests, BinaryFileDecodesToSameText) {
+	auto path = (std::filesystem::temp_directory_path() / "netlib_log_test.nlog").string();
+	ASSERT_TRUE(log_set_binary_file(path));
+	for (int i = 0; i < 3; i++) {
+		log_warning("Resolving '{}' took {} ms.", "stun.example.test", 40 + i);
+	}
+	log_error("Socket {} lost {:.1f}% packets, port 0x{:x}, {}.", Ipv4Address{ 0x7F000001, 3478 }, 12.5, 3478u, true);
+	log_wsa_error("Negative {} {{escaped}}", -5);
+	ASSERT_TRUE(log_set_binary_file(""));
+	EXPECT_TRUE(lines.empty());
+
+	std::ifstream file(path, std::ios::binary);
+	std::stringstream text;
+	EXPECT_TRUE(log_decode(file, text));
+	std::vector<std::string> decoded;
+	for (std::string line; std::getline(text, line);) {
+		// Timestamp first, then same text as sink would get
+		decoded.push_back(line.substr(line.find(' ', line.find(' ') + 1) + 1));
+	}
+	file.close();
+	std::filesystem::remove(path);
+	ASSERT_EQ(decoded.size(), 5);
+	EXPECT_EQ(decoded[0], "warning netlib: Resolving 'stun.example.test' took 40 ms.");
+	EXPECT_EQ(decoded[2], "warning netlib: Resolving 'stun.example.test' took 42 ms.");
+	EXPECT_EQ(decoded[3], "error netlib: Socket 127.0.0.1:3478 lost 12.5% packets, port 0xd96, true.");
+	EXPECT_TRUE(decoded[4].starts_with("error netlib: Negative -5 {escaped} WSAError("));
+}
+
+TEST_F(LogTests, DecodeRejectsOtherFiles) {
+	std::stringstream garbage("not a log file");
+	std::stringstream text;
+	EXPECT_FALSE(log_decode(garbage, text));
+	EXPECT_TRUE(text.str().empty());
+}
\ No newline at end of file
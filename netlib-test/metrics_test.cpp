@@ -0,0 +1,109 @@
+#include "pch.h"
+
+import std;
+import netlib;
+using namespace net;
+
+constexpr uint32_t test_private_ip = (10u << 24) | 2;
+constexpr Ipv4Address test_stun_server{ (198u << 24) | (51u << 16) | (100u << 8) | 1, 3478 };
+constexpr std::array<const char*, 1> test_stun_servers = { "198.51.100.1" };
+
+TEST(MetricsTests, CounterSumsAllThreads) {
+	auto& counter = metrics_counter("test_counter_threads_total");
+	uint64_t before = counter.value();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 4; i++) {
+		threads.emplace_back([&counter]() {
+			for (int j = 0; j < 10'000; j++) {
+				counter.add();
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	EXPECT_EQ(counter.value() - before, 40'000);
+	EXPECT_EQ(&metrics_counter("test_counter_threads_total"), &counter);
+}
+
+TEST(MetricsTests, HistogramBucketsKeepRelativePrecision) {
+	constexpr std::array<uint64_t, 7> values = { 0, 1, 63, 64, 1000, 123'456'789, UINT64_MAX };
+	for (const auto value : values) {
+		auto upper_bound = MetricHistogram::bucket_upper_bound(MetricHistogram::bucket_index(value));
+		EXPECT_GE(upper_bound, value);
+		EXPECT_LE(upper_bound - value, value / 32);
+	}
+	EXPECT_EQ(MetricHistogram::bucket_index(UINT64_MAX), METRICS_HISTOGRAM_BUCKETS - 1);
+}
+
+TEST(MetricsTests, HistogramQuantiles) {
+	MetricHistogram histogram{};
+	for (uint64_t value = 1; value <= 1000; value++) {
+		histogram.record(value);
+	}
+	auto snapshot = histogram.snapshot();
+	EXPECT_EQ(snapshot.count, 1000);
+	EXPECT_EQ(snapshot.sum, 500'500);
+	EXPECT_EQ(snapshot.max, 1000);
+	EXPECT_NEAR(static_cast<double>(snapshot.quantile(0.5)), 500.0, 500.0 / 32);
+	EXPECT_NEAR(static_cast<double>(snapshot.quantile(0.99)), 990.0, 990.0 / 32);
+	EXPECT_EQ(snapshot.quantile(1.0), 1000);
+}
+
+TEST(MetricsTests, PrometheusAndJsonExport) {
+	metrics_counter("test_export_total", "Exported counter.").add(3);
+	metrics_gauge("test_export_gauge").set(-7);
+	metrics_histogram("test_export_us").record(5);
+	auto snapshot = metrics_snapshot();
+	auto text = metrics_to_prometheus(snapshot);
+	EXPECT_NE(text.find("# HELP test_export_total Exported counter.\n# TYPE test_export_total counter\ntest_export_total 3\n"), std::string::npos);
+	EXPECT_NE(text.find("test_export_gauge -7\n"), std::string::npos);
+	EXPECT_NE(text.find("test_export_us_bucket{le=\"3\"} 0\ntest_export_us_bucket{le=\"7\"} 1\n"), std::string::npos);
+	EXPECT_NE(text.find("test_export_us_bucket{le=\"9223372036854775807\"} 1\ntest_export_us_bucket{le=\"+Inf\"} 1\ntest_export_us_sum 5\ntest_export_us_count 1\n"), std::string::npos);
+	auto json = metrics_to_json(snapshot);
+	EXPECT_NE(json.find("\"test_export_total\":3"), std::string::npos);
+	EXPECT_NE(json.find("\"test_export_us\":{\"count\":1,\"sum\":5,\"max\":5,\"p50\":5"), std::string::npos);
+
+	auto path = (std::filesystem::temp_directory_path() / "netlib_metrics_test.prom").string();
+	EXPECT_TRUE(metrics_write_file(path, MetricsFormat::PROMETHEUS));
+	std::ifstream file(path);
+	std::string written((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	file.close();
+	std::filesystem::remove(path);
+	EXPECT_NE(written.find("test_export_total 3\n"), std::string::npos);
+}
+
+TEST(MetricsTests, PrometheusHistogramKeepsBoundsWhenEmpty) {
+	metrics_histogram("test_empty_us");
+	auto text = metrics_to_prometheus(metrics_snapshot());
+	size_t bounds = 0;
+	for (size_t at = text.find("test_empty_us_bucket{le="); at != std::string::npos; at = text.find("test_empty_us_bucket{le=", at + 1)) {
+		bounds++;
+	}
+	EXPECT_EQ(bounds, 65);
+	EXPECT_NE(text.find("test_empty_us_bucket{le=\"0\"} 0\n"), std::string::npos);
+	EXPECT_NE(text.find("test_empty_us_bucket{le=\"+Inf\"} 0\ntest_empty_us_sum 0\ntest_empty_us_count 0\n"), std::string::npos);
+}
+
+TEST(MetricsTests, SocketsAndStunQueriesAreCounted) {
+	NetSim sim{};
+	sock_set_backend(&sim);
+	sim.add_stun_server(test_stun_server, NetSimLink{ .latency_us = 5'000 });
+	auto host = sim.add_host(test_private_ip, NatType::NONE, 0, NetSimLink{ .latency_us = 20'000 });
+	sim.set_current_host(host);
+	auto& sent_packets = metrics_counter("netlib_udp_sent_packets_total");
+	auto& received_packets = metrics_counter("netlib_udp_received_packets_total");
+	auto& rtt = metrics_histogram("netlib_stun_rtt_us");
+	uint64_t sent_before = sent_packets.value();
+	uint64_t received_before = received_packets.value();
+	uint64_t rtt_before = rtt.snapshot().count;
+
+	auto candidates = ice_discover_server_candidates(test_stun_servers);
+	sock_set_backend(nullptr);
+	EXPECT_EQ(candidates.size(), 1);
+	EXPECT_EQ(sent_packets.value() - sent_before, 1);
+	EXPECT_EQ(received_packets.value() - received_before, 1);
+	auto rtt_snapshot = rtt.snapshot();
+	EXPECT_EQ(rtt_snapshot.count - rtt_before, 1);
+	EXPECT_GE(rtt_snapshot.max, 50'000);
+}
\ No newline at end of file
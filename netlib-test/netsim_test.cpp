@@ -0,0 +1,170 @@
+#include "pch.h"
+
+import std;
+import byte_common;
+import netlib;
+using namespace net;
+
+constexpr uint32_t make_ip(const uint8_t a, const uint8_t b, const uint8_t c, const uint8_t d) {
+	return (static_cast<uint32_t>(a) << 24) | (static_cast<uint32_t>(b) << 16) | (static_cast<uint32_t>(c) << 8) | d;
+}
+
+constexpr uint32_t test_private_ip = make_ip(10, 0, 0, 2);
+constexpr uint32_t test_nat_ip = make_ip(203, 0, 113, 1);
+constexpr uint32_t test_public_ip = make_ip(203, 0, 113, 20);
+constexpr Ipv4Address test_stun_server_1{ make_ip(198, 51, 100, 1), 3478 };
+constexpr Ipv4Address test_stun_server_2{ make_ip(198, 51, 100, 2), 3478 };
+constexpr std::array<const char*, 2> test_stun_servers = { "198.51.100.1", "198.51.100.2" };
+constexpr std::array<uint8_t, 4> test_payload = { 0xde, 0xad, 0xbe, 0xef };
+
+class NetSimTests : public testing::Test {
+protected:
+	void SetUp() override {
+		netlib_init();
+		sock_set_backend(&sim);
+	}
+	void TearDown() override {
+		sock_set_backend(nullptr);
+		netlib_clean();
+	}
+
+	NetSim sim{};
+};
+
+TEST_F(NetSimTests, HostCandidatesComeFromCurrentHost) {
+	auto host = sim.add_host(test_private_ip, NatType::FULL_CONE, test_nat_ip);
+	sim.set_current_host(host);
+	auto candidates = ice_discover_host_candidates();
+	EXPECT_EQ(candidates.size(), 1);
+	if (candidates.empty()) {
+		return;
+	}
+	EXPECT_EQ(candidates[0].ip, test_private_ip);
+}
+
+TEST_F(NetSimTests, ServerCandidatesReportNatAddress) {
+	sim.add_stun_server(test_stun_server_1);
+	sim.add_stun_server(test_stun_server_2);
+	auto host = sim.add_host(test_private_ip, NatType::PORT_RESTRICTED, test_nat_ip);
+	sim.set_current_host(host);
+	auto candidates = ice_discover_server_candidates(test_stun_servers);
+	EXPECT_EQ(candidates.size(), 2);
+	EXPECT_EQ(sim.stats().stun_requests, 2);
+	for (const auto& candidate : candidates) {
+		EXPECT_EQ(candidate.ip, test_nat_ip);
+	}
+}
+
+TEST_F(NetSimTests, ConeNatReusesMappingForEveryDestination) {
+	sim.add_stun_server(test_stun_server_1);
+	sim.add_stun_server(test_stun_server_2);
+	auto host = sim.add_host(test_private_ip, NatType::PORT_RESTRICTED, test_nat_ip);
+	sim.set_current_host(host);
+	auto socket = udp_ipv4_init_socket();
+	std::vector<uint16_t> mapped_ports;
+	for (const auto& server : { test_stun_server_1, test_stun_server_2 }) {
+		Stun request{};
+		request.set_type(StunClass::REQUEST, StunMethod::BINDING);
+		request.randomize_transaction_id();
+		auto writer = ByteNetworkWriter(92);
+		uint64_t size = request.write_into(writer);
+		udp_ipv4_send_packet(socket, writer.data().data(), size, server);
+
+		std::array<uint8_t, 92> buffer{};
+		auto recv_bytes = udp_ipv4_recv_packet_block(socket, buffer.data(), buffer.size(), nullptr, 1'000'000);
+		if (recv_bytes <= 0) {
+			continue;
+		}
+		auto reader = ByteNetworkReader(std::span<const uint8_t>(buffer.data(), recv_bytes));
+		auto response = Stun::read_from(reader);
+		if (!response.has_value()) {
+			continue;
+		}
+		auto attr = response->get_xor_address_attribute(StunAttributeType::XOR_MAPPED_ADDRESS);
+		if (attr) {
+			mapped_ports.push_back(attr->address().port);
+		}
+	}
+	EXPECT_EQ(mapped_ports.size(), 2);
+	if (mapped_ports.size() != 2) {
+		return;
+	}
+	EXPECT_EQ(mapped_ports[0], mapped_ports[1]);
+}
+
+TEST_F(NetSimTests, SymmetricNatMapsEveryDestinationSeparately) {
+	sim.add_stun_server(test_stun_server_1);
+	sim.add_stun_server(test_stun_server_2);
+	auto host = sim.add_host(test_private_ip, NatType::SYMMETRIC, test_nat_ip);
+	auto public_host = sim.add_host(test_public_ip);
+	sim.set_current_host(host);
+	auto socket = udp_ipv4_init_socket();
+	for (const auto& server : { test_stun_server_1, test_stun_server_2 }) {
+		udp_ipv4_send_packet(socket, test_payload.data(), test_payload.size(), server);
+	}
+	sim.advance(0);
+
+	// Mapping created towards stun server does not accept packets from anyone else
+	sim.set_current_host(public_host);
+	auto public_socket = udp_ipv4_init_socket();
+	auto filtered_before = sim.stats().packets_filtered;
+	udp_ipv4_send_packet(public_socket, test_payload.data(), test_payload.size(), Ipv4Address{ test_nat_ip, 50000 });
+	udp_ipv4_send_packet(public_socket, test_payload.data(), test_payload.size(), Ipv4Address{ test_nat_ip, 50001 });
+	std::vector<Socket> ready;
+	EXPECT_EQ(sock_wait_readable(std::span<const Socket>(&socket, 1), ready, 100'000), 0);
+	EXPECT_EQ(sim.stats().packets_filtered - filtered_before, 2);
+
+	sim.set_current_host(host);
+	auto candidates = ice_discover_server_candidates(test_stun_servers);
+	EXPECT_EQ(candidates.size(), 2);
+	if (candidates.size() != 2) {
+		return;
+	}
+	EXPECT_NE(candidates[0].port, candidates[1].port);
+}
+
+TEST_F(NetSimTests, RestrictedNatFiltersUntilPermissionCreated) {
+	auto host = sim.add_host(test_private_ip, NatType::RESTRICTED, test_nat_ip);
+	auto public_host = sim.add_host(test_public_ip);
+	sim.set_current_host(host);
+	auto socket = udp_ipv4_init_socket();
+	sim.set_current_host(public_host);
+	auto public_socket = udp_ipv4_init_socket();
+	auto public_address = sock_get_src_address(public_socket);
+
+	// Mapping exists only after first outbound packet, peer is not permitted yet
+	udp_ipv4_send_packet(socket, test_payload.data(), test_payload.size(), test_stun_server_1);
+	auto mapping = Ipv4Address{ test_nat_ip, 50000 };
+	udp_ipv4_send_packet(public_socket, test_payload.data(), test_payload.size(), mapping);
+	std::vector<Socket> ready;
+	EXPECT_EQ(sock_wait_readable(std::span<const Socket>(&socket, 1), ready, 100'000), 0);
+
+	// Restricted NAT permits whole remote ip, even if remote port differs
+	udp_ipv4_send_packet(socket, test_payload.data(), test_payload.size(), Ipv4Address{ public_address.ip, 1 });
+	udp_ipv4_send_packet(public_socket, test_payload.data(), test_payload.size(), mapping);
+	EXPECT_EQ(sock_wait_readable(std::span<const Socket>(&socket, 1), ready, 100'000), 1);
+	std::array<uint8_t, 16> buffer{};
+	Ipv4Address sender{};
+	EXPECT_EQ(udp_ipv4_recv_packet(socket, buffer.data(), buffer.size(), &sender), test_payload.size());
+	EXPECT_EQ(sender.ip, public_address.ip);
+	EXPECT_EQ(sender.port, public_address.port);
+}
+
+TEST_F(NetSimTests, LatencyAdvancesVirtualClock) {
+	sim.add_stun_server(test_stun_server_1, NetSimLink{ .latency_us = 5'000 });
+	auto host = sim.add_host(test_private_ip, NatType::FULL_CONE, test_nat_ip, NetSimLink{ .latency_us = 20'000 });
+	sim.set_current_host(host);
+	auto candidates = ice_discover_server_candidates(std::span<const char* const>(test_stun_servers.data(), 1));
+	EXPECT_EQ(candidates.size(), 1);
+	EXPECT_EQ(sim.now_us(), 50'000);
+}
+
+TEST_F(NetSimTests, LossyLinkDropsPackets) {
+	sim.add_stun_server(test_stun_server_1);
+	auto host = sim.add_host(test_private_ip, NatType::NONE, 0, NetSimLink{ .loss = 1.0 });
+	sim.set_current_host(host);
+	auto candidates = ice_discover_server_candidates(std::span<const char* const>(test_stun_servers.data(), 1));
+	EXPECT_TRUE(candidates.empty());
+	EXPECT_EQ(sim.stats().packets_lost, 1);
+	EXPECT_EQ(sim.stats().stun_requests, 0);
+}
\ No newline at end of file
@@ -0,0 +1,83 @@
+#include "pch.h"
+
+import std;
+import netlib;
+using namespace net;
+
+constexpr uint32_t make_ip(const uint8_t a, const uint8_t b, const uint8_t c, const uint8_t d) {
+	return (static_cast<uint32_t>(a) << 24) | (static_cast<uint32_t>(b) << 16) | (static_cast<uint32_t>(c) << 8) | d;
+}
+
+constexpr uint32_t test_host_ip = make_ip(203, 0, 113, 10);
+constexpr uint32_t test_peer_ip = make_ip(203, 0, 113, 20);
+constexpr std::array<uint8_t, 6> test_payload = { 1, 2, 3, 4, 5, 6 };
+
+TEST(PacketPoolTests, ReleasedBufferReturnsToPool) {
+	PacketPool pool(2, 1);
+	EXPECT_EQ(pool.available(), 2);
+	{
+		auto first = pool.acquire();
+		auto second = pool.acquire(100);
+		EXPECT_TRUE(first);
+		EXPECT_TRUE(second);
+		EXPECT_EQ(first.size(), PacketPool::MTU_BUFFER_SIZE);
+		EXPECT_EQ(second.size(), 100);
+		EXPECT_NE(first.data(), second.data());
+		EXPECT_EQ(pool.available(), 0);
+		EXPECT_FALSE(pool.acquire());
+		EXPECT_EQ(pool.exhausted(), 1);
+	}
+	EXPECT_EQ(pool.available(), 2);
+}
+
+TEST(PacketPoolTests, LargeRequestsUseJumboBuffers) {
+	PacketPool pool(1, 1);
+	auto jumbo = pool.acquire(9000);
+	EXPECT_TRUE(jumbo);
+	EXPECT_EQ(jumbo.capacity(), PacketPool::JUMBO_BUFFER_SIZE);
+	EXPECT_EQ(pool.available(), 1);
+	EXPECT_EQ(pool.available(9000), 0);
+	EXPECT_FALSE(pool.acquire(PacketPool::JUMBO_BUFFER_SIZE + 1));
+}
+
+TEST(PacketPoolTests, SlicesShareSlotWithoutCopy) {
+	PacketPool pool(1, 0);
+	PacketBuffer payload;
+	{
+		auto buffer = pool.acquire(test_payload.size());
+		std::copy(test_payload.begin(), test_payload.end(), buffer.data());
+		payload = buffer.slice(2, 3);
+		EXPECT_EQ(buffer.use_count(), 2);
+		EXPECT_EQ(payload.data(), buffer.data() + 2);
+		EXPECT_EQ(buffer.slice(4).size(), 2);
+		EXPECT_EQ(buffer.slice(10).size(), 0);
+	}
+	// Slice keeps the slot alive after original handle is gone
+	EXPECT_EQ(pool.available(), 0);
+	EXPECT_EQ(payload.use_count(), 1);
+	EXPECT_EQ(std::vector<uint8_t>(payload.span().begin(), payload.span().end()), std::vector<uint8_t>({ 3, 4, 5 }));
+	payload = PacketBuffer{};
+	EXPECT_EQ(pool.available(), 1);
+}
+
+TEST(PacketPoolTests, ReceiveFillsPooledBuffer) {
+	netlib_init();
+	NetSim sim{};
+	sock_set_backend(&sim);
+	sim.set_current_host(sim.add_host(test_host_ip));
+	auto sender = udp_ipv4_init_socket();
+	sim.set_current_host(sim.add_host(test_peer_ip));
+	auto receiver = udp_ipv4_init_socket();
+	udp_ipv4_send_packet(sender, test_payload.data(), test_payload.size(), sock_get_src_address(receiver));
+	sim.advance(0);
+
+	PacketPool pool(1, 0);
+	auto buffer = pool.acquire();
+	Ipv4Address from{};
+	EXPECT_EQ(udp_ipv4_recv_packet(receiver, buffer, &from), test_payload.size());
+	EXPECT_EQ(buffer.size(), test_payload.size());
+	EXPECT_TRUE(std::equal(test_payload.begin(), test_payload.end(), buffer.data()));
+	EXPECT_EQ(from.ip, test_host_ip);
+	sock_set_backend(nullptr);
+	netlib_clean();
+}
\ No newline at end of file
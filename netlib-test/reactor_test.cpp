@@ -0,0 +1,133 @@
+#include "pch.h"
+
+import std;
+import netlib;
+using namespace net;
+
+constexpr uint32_t make_ip(const uint8_t a, const uint8_t b, const uint8_t c, const uint8_t d) {
+	return (static_cast<uint32_t>(a) << 24) | (static_cast<uint32_t>(b) << 16) | (static_cast<uint32_t>(c) << 8) | d;
+}
+
+constexpr uint32_t test_loopback_ip = make_ip(127, 0, 0, 1);
+constexpr uint32_t test_private_ip = make_ip(10, 0, 0, 2);
+constexpr uint32_t test_nat_ip = make_ip(203, 0, 113, 1);
+constexpr Ipv4Address test_stun_server{ make_ip(198, 51, 100, 1), 3478 };
+constexpr std::array<const char*, 1> test_stun_servers = { "198.51.100.1" };
+constexpr std::array<uint8_t, 4> test_payload = { 0xde, 0xad, 0xbe, 0xef };
+
+class ReactorTests : public testing::Test {
+protected:
+	void SetUp() override {
+		netlib_init();
+	}
+	void TearDown() override {
+		sock_set_backend(nullptr);
+		netlib_clean();
+	}
+};
+
+TEST_F(ReactorTests, TimersFireInDueOrderInVirtualTime) {
+	NetSim sim{};
+	sock_set_backend(&sim);
+	Reactor reactor{};
+	std::vector<int> fired;
+	std::vector<uint64_t> fired_at;
+	reactor.add_timer(30'000, [&]() { fired.push_back(3); fired_at.push_back(sim.now_us()); reactor.stop(); });
+	reactor.add_timer(10'000, [&]() { fired.push_back(1); fired_at.push_back(sim.now_us()); });
+	auto cancelled = reactor.add_timer(20'000, [&]() { fired.push_back(2); });
+	EXPECT_TRUE(reactor.cancel_timer(cancelled));
+	reactor.run();
+	EXPECT_EQ(fired, std::vector<int>({ 1, 3 }));
+	EXPECT_EQ(fired_at, std::vector<uint64_t>({ 10'000, 30'000 }));
+	EXPECT_FALSE(reactor.cancel_timer(cancelled));
+}
+
+TEST_F(ReactorTests, PeriodicTimerRepeatsUntilCancelled) {
+	NetSim sim{};
+	sock_set_backend(&sim);
+	Reactor reactor{};
+	int ticks = 0;
+	ReactorTimerId periodic = 0;
+	periodic = reactor.add_timer(5'000, [&]() {
+		if (++ticks == 4) {
+			reactor.cancel_timer(periodic);
+			reactor.stop();
+		}
+	}, 5'000);
+	reactor.run();
+	EXPECT_EQ(ticks, 4);
+	EXPECT_EQ(sim.now_us(), 20'000);
+}
+
+TEST_F(ReactorTests, ReadCallbackRunsForLoopbackPacket) {
+	Reactor reactor{};
+	auto receiver = udp_ipv4_init_socket();
+	auto sender = udp_ipv4_init_socket();
+	auto address = Ipv4Address{ test_loopback_ip, sock_get_src_address(receiver).port };
+	std::vector<uint8_t> received;
+	reactor.add_socket(receiver, [&](const Socket socket) {
+		std::array<uint8_t, 16> buffer{};
+		auto recv_bytes = udp_ipv4_recv_packet(socket, buffer.data(), buffer.size());
+		if (recv_bytes > 0) {
+			received.assign(buffer.begin(), buffer.begin() + recv_bytes);
+		}
+		reactor.stop();
+	});
+	auto timeout = reactor.add_timer(1'000'000, [&]() { reactor.stop(); });
+	udp_ipv4_send_packet(sender, test_payload.data(), test_payload.size(), address);
+	reactor.run();
+	EXPECT_EQ(received, std::vector<uint8_t>(test_payload.begin(), test_payload.end()));
+	EXPECT_TRUE(reactor.cancel_timer(timeout));
+	EXPECT_TRUE(reactor.remove_socket(receiver));
+	sock_close(sender);
+	sock_close(receiver);
+}
+
+TEST_F(ReactorTests, StopFromOtherThreadWakesLoop) {
+	Reactor reactor{};
+	auto start = std::chrono::steady_clock::now();
+	std::thread stopper([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		reactor.stop();
+	});
+	reactor.run();
+	stopper.join();
+	EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+}
+
+TEST_F(ReactorTests, PostedCallbackRunsOnLoopThread) {
+	Reactor reactor{};
+	std::thread::id loop_thread{};
+	std::thread poster([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		reactor.post([&]() {
+			loop_thread = std::this_thread::get_id();
+			reactor.stop();
+		});
+	});
+	reactor.run();
+	poster.join();
+	EXPECT_EQ(loop_thread, std::this_thread::get_id());
+}
+
+TEST_F(ReactorTests, ServerCandidatesGatherOnSharedReactor) {
+	NetSim sim{};
+	sock_set_backend(&sim);
+	sim.add_stun_server(test_stun_server, NetSimLink{ .latency_us = 5'000 });
+	sim.set_current_host(sim.add_host(test_private_ip, NatType::FULL_CONE, test_nat_ip));
+	Reactor reactor{};
+	std::vector<Ipv4Address> candidates;
+	bool timer_fired = false;
+	ice_discover_server_candidates(reactor, test_stun_servers, [&](std::vector<Ipv4Address> result) {
+		candidates = std::move(result);
+		reactor.stop();
+	});
+	reactor.add_timer(1'000, [&]() { timer_fired = true; });
+	reactor.run();
+	EXPECT_TRUE(timer_fired);
+	EXPECT_EQ(candidates.size(), 1);
+	if (candidates.empty()) {
+		return;
+	}
+	EXPECT_EQ(candidates[0].ip, test_nat_ip);
+}
\ No newline at end of file
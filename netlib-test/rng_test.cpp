@@ -0,0 +1,81 @@
+#include "pch.h"
+
+import std;
+import rng;
+import netlib;
+using namespace net;
+
+TEST(RngTests, ChaCha20MatchesRfc8439Block) {
+	// RFC 8439 section 2.3.2, 32-bit counter 1 and 96-bit nonce map onto 64-bit counter and stream words
+	std::array<uint8_t, 32> key{};
+	for (size_t i = 0; i < key.size(); i++) {
+		key[i] = static_cast<uint8_t>(i);
+	}
+	rng::ChaCha20Rng engine(key, 0x4A000000, (uint64_t(0x09000000) << 32) | 1);
+	std::array<uint8_t, 64> block{};
+	engine.fill(block);
+	constexpr std::array<uint8_t, 64> expected = {
+		0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15, 0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+		0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03, 0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+		0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09, 0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+		0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9, 0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e,
+	};
+	EXPECT_EQ(block, expected);
+}
+
+TEST(RngTests, ChaCha20FillIsSplitIndependent) {
+	std::array<uint8_t, 32> key{};
+	key.fill(7);
+	rng::ChaCha20Rng bulk(key);
+	rng::ChaCha20Rng piecewise(key);
+	std::vector<uint8_t> expected(1000);
+	bulk.fill(expected);
+	std::vector<uint8_t> pieces(1000);
+	for (size_t offset = 0; offset < pieces.size(); offset += 12) {
+		piecewise.fill(std::span<uint8_t>(pieces).subspan(offset, (std::min)(size_t(12), pieces.size() - offset)));
+	}
+	EXPECT_EQ(pieces, expected);
+}
+
+TEST(RngTests, XoshiroIsDeterministicPerSeed) {
+	rng::Xoshiro256 a(42);
+	rng::Xoshiro256 b(42);
+	rng::Xoshiro256 c(43);
+	for (int i = 0; i < 100; i++) {
+		auto value = a();
+		EXPECT_EQ(value, b());
+		EXPECT_NE(value, c());
+	}
+}
+
+TEST(RngTests, ThreadsGetOwnSecureStreams) {
+	std::array<uint8_t, 32> main_bytes{};
+	std::array<uint8_t, 32> worker_bytes{};
+	rng::fill_secure(main_bytes);
+	std::thread([&worker_bytes]() {
+		rng::fill_secure(worker_bytes);
+	}).join();
+	EXPECT_NE(main_bytes, worker_bytes);
+}
+
+TEST(RngTests, TransactionIdsAreUnique) {
+	std::set<std::array<uint8_t, 12>> ids;
+	Stun msg{};
+	for (int i = 0; i < 10'000; i++) {
+		msg.randomize_transaction_id();
+		ids.insert(msg.transact_id());
+	}
+	EXPECT_EQ(ids.size(), 10'000);
+}
+
+TEST(RngTests, DrawCoversNarrowTypes) {
+	std::set<uint8_t> bytes;
+	std::set<int8_t> signed_bytes;
+	for (int i = 0; i < 10'000; i++) {
+		bytes.insert(rng::draw_secure<uint8_t>(250, 255));
+		signed_bytes.insert(rng::draw_random<int8_t>(-128, -126));
+	}
+	EXPECT_EQ(bytes, (std::set<uint8_t>{ 250, 251, 252, 253, 254, 255 }));
+	EXPECT_EQ(signed_bytes, (std::set<int8_t>{ -128, -127, -126 }));
+	EXPECT_EQ(rng::draw_secure<char>('a', 'a'), 'a');
+}
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "pch.h"
+
+import std;
+import netlib;
+using namespace net;
+
+constexpr uint32_t make_ip(const uint8_t a, const uint8_t b, const uint8_t c, const uint8_t d) {
+	return (static_cast<uint32_t>(a) << 24) | (static_cast<uint32_t>(b) << 16) | (static_cast<uint32_t>(c) << 8) | d;
+}
+
+constexpr uint32_t test_loopback_ip = make_ip(127, 0, 0, 1);
+constexpr uint32_t test_host_ip = make_ip(203, 0, 113, 10);
+constexpr uint32_t test_peer_ip = make_ip(203, 0, 113, 20);
+
+// Simulated network whose sockets refuse sends while choked, like a full socket buffer
+class ChokedNetSim : public NetSim {
+public:
+	int udp_ipv4_send_packet(const Socket socket, const void* data, const size_t size, const Ipv4Address& address) override {
+		if (choked) {
+			return 0;
+		}
+		return NetSim::udp_ipv4_send_packet(socket, data, size, address);
+	}
+
+	bool choked = false;
+};
+
+class UdpSendQueueTests : public testing::Test {
+protected:
+	void SetUp() override {
+		netlib_init();
+	}
+	void TearDown() override {
+		sock_set_backend(nullptr);
+		netlib_clean();
+	}
+};
+
+TEST_F(UdpSendQueueTests, SendsDirectlyWhileSocketAccepts) {
+	NetSim sim{};
+	sock_set_backend(&sim);
+	sim.set_current_host(sim.add_host(test_host_ip));
+	Reactor reactor{};
+	auto sender = udp_ipv4_init_socket();
+	sim.set_current_host(sim.add_host(test_peer_ip));
+	auto receiver = udp_ipv4_init_socket();
+	auto address = sock_get_src_address(receiver);
+
+	UdpSendQueue queue(reactor, sender, 4);
+	for (uint8_t i = 0; i < 8; i++) {
+		EXPECT_TRUE(queue.send(&i, sizeof(i), address));
+	}
+	EXPECT_EQ(queue.depth(), 0);
+	EXPECT_EQ(queue.queued_bytes(), 0);
+	EXPECT_EQ(queue.dropped(), 0);
+	EXPECT_FALSE(reactor.has_socket(sender));
+
+	sim.advance(0);
+	for (uint8_t i = 0; i < 8; i++) {
+		uint8_t value = 0xFF;
+		EXPECT_EQ(udp_ipv4_recv_packet(receiver, &value, sizeof(value)), 1);
+		EXPECT_EQ(value, i);
+	}
+}
+
+TEST_F(UdpSendQueueTests, ParksPacketsWhileSocketWouldBlock) {
+	ChokedNetSim sim{};
+	sock_set_backend(&sim);
+	sim.set_current_host(sim.add_host(test_host_ip));
+	Reactor reactor{};
+	auto sender = udp_ipv4_init_socket();
+	sim.set_current_host(sim.add_host(test_peer_ip));
+	auto receiver = udp_ipv4_init_socket();
+	auto address = sock_get_src_address(receiver);
+
+	UdpSendQueue queue(reactor, sender, 4);
+	int drains = 0;
+	queue.set_drain_callback([&]() { drains++; });
+	sim.choked = true;
+	for (uint8_t i = 0; i < 6; i++) {
+		EXPECT_EQ(queue.send(&i, sizeof(i), address), i < 4);
+	}
+	EXPECT_EQ(queue.depth(), 4);
+	EXPECT_EQ(queue.queued_bytes(), 4);
+	EXPECT_EQ(queue.dropped(), 2);
+	EXPECT_TRUE(reactor.has_socket(sender));
+
+	// Still blocked, writable event must not lose anything
+	reactor.run_once(1'000);
+	EXPECT_EQ(queue.depth(), 4);
+
+	sim.choked = false;
+	reactor.run_once(1'000);
+	EXPECT_EQ(queue.depth(), 0);
+	EXPECT_EQ(drains, 1);
+	EXPECT_FALSE(reactor.has_socket(sender));
+
+	sim.advance(0);
+	for (uint8_t i = 0; i < 4; i++) {
+		uint8_t value = 0xFF;
+		EXPECT_EQ(udp_ipv4_recv_packet(receiver, &value, sizeof(value)), 1);
+		EXPECT_EQ(value, i);
+	}
+}
+
+TEST_F(UdpSendQueueTests, FloodedSocketDrainsThroughReactor) {
+	Reactor reactor{};
+	auto sender = udp_ipv4_init_socket();
+	auto receiver = udp_ipv4_init_socket();
+	auto address = Ipv4Address{ test_loopback_ip, sock_get_src_address(receiver).port };
+	constexpr size_t packet_count = 2048;
+	std::vector<uint8_t> payload(8192);
+
+	// Whether the socket buffer fills depends on the OS, queue must hold the invariants either way
+	UdpSendQueue queue(reactor, sender, packet_count);
+	for (size_t i = 0; i < packet_count; i++) {
+		EXPECT_TRUE(queue.send(payload.data(), payload.size(), address));
+	}
+	EXPECT_EQ(queue.queued_bytes(), queue.depth() * payload.size());
+	EXPECT_EQ(queue.dropped(), 0);
+
+	bool drained = (queue.depth() == 0);
+	bool timed_out = false;
+	queue.set_drain_callback([&]() { drained = true; });
+	reactor.add_timer(5'000'000, [&]() { timed_out = true; });
+	reactor.add_socket(receiver, [&](const Socket socket) {
+		std::array<uint8_t, 16> buffer{};
+		udp_ipv4_recv_packet(socket, buffer.data(), buffer.size());
+	});
+	while (!drained && !timed_out) {
+		if (reactor.run_once() < 0) {
+			break;
+		}
+	}
+	EXPECT_TRUE(drained);
+	EXPECT_EQ(queue.depth(), 0);
+	EXPECT_FALSE(reactor.has_socket(sender));
+	reactor.remove_socket(receiver);
+	sock_close(sender);
+	sock_close(receiver);
+}
\ No newline at end of file
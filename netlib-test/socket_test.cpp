@@ -0,0 +1,220 @@
+#include "pch.h"
+
+import std;
+import netlib;
+using namespace net;
+
+TEST(SocketTests, FormatIpv4Address) {
+	EXPECT_EQ(std::format("{}", Ipv4Address{ 0xC0A80001, 0 }), "192.168.0.1");
+	EXPECT_EQ(std::format("{}", Ipv4Address{ 0x0A000002, 3478 }), "10.0.0.2:3478");
+	EXPECT_EQ(std::format("{}", IpAddress{ Ipv4Address{ 0x7F000001, 1 } }), "127.0.0.1:1");
+	EXPECT_EQ(udp_ipv4_net_to_str(0xFFFFFFFF), "255.255.255.255");
+}
+
+TEST(SocketTests, FormatIpv6Address) {
+	Ipv6Address address{ { 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 }, 443, 0 };
+	EXPECT_EQ(std::format("{}", address), "[2001:db8::1]:443");
+	address.port = 0;
+	EXPECT_EQ(std::format("{}", IpAddress{ address }), "2001:db8::1");
+}
+
+class SocketLoopbackTests : public testing::Test {
+protected:
+	void SetUp() override {
+		netlib_init();
+	}
+	void TearDown() override {
+		for (const auto socket : sockets) {
+			sock_close(socket);
+		}
+		netlib_clean();
+	}
+
+	Socket open_socket() {
+		auto socket = udp_ipv4_init_socket();
+		sockets.push_back(socket);
+		return socket;
+	}
+
+	static Ipv4Address loopback_address(const Socket socket) {
+		return Ipv4Address{ 0x7F000001, sock_get_src_address(socket).port };
+	}
+
+	std::vector<Socket> sockets;
+};
+
+TEST_F(SocketLoopbackTests, PollerReportsOnlyReadySockets) {
+	constexpr uint32_t socket_count = 100;
+	SocketPoller poller{};
+	for (uint32_t i = 0; i < socket_count; i++) {
+		EXPECT_TRUE(poller.add(open_socket()));
+	}
+	EXPECT_EQ(poller.size(), socket_count);
+	auto sender = open_socket();
+	const std::array<uint8_t, 4> payload = { 1, 2, 3, 4 };
+	udp_ipv4_send_packet(sender, payload.data(), payload.size(), loopback_address(sockets[socket_count - 1]));
+
+	std::vector<SocketPollEvent> ready;
+	EXPECT_EQ(poller.wait(ready, 1'000'000), 1);
+	if (ready.size() != 1) {
+		return;
+	}
+	EXPECT_EQ(ready[0].socket, sockets[socket_count - 1]);
+	EXPECT_EQ(ready[0].events, SOCK_POLL_READ);
+}
+
+TEST_F(SocketLoopbackTests, PollerReportsWritableAfterModify) {
+	SocketPoller poller{};
+	auto socket = open_socket();
+	EXPECT_TRUE(poller.add(socket));
+	EXPECT_TRUE(poller.modify(socket, SOCK_POLL_READ | SOCK_POLL_WRITE));
+	std::vector<SocketPollEvent> ready;
+	EXPECT_EQ(poller.wait(ready, 1'000), 1);
+	if (ready.empty()) {
+		return;
+	}
+	EXPECT_EQ(ready[0].events, SOCK_POLL_WRITE);
+	EXPECT_TRUE(poller.remove(socket));
+	EXPECT_FALSE(poller.remove(socket));
+}
+
+TEST_F(SocketLoopbackTests, BlockingReceiveReturnsQueuedPackets) {
+	auto sender = open_socket();
+	auto receiver = open_socket();
+	const std::array<uint8_t, 4> payload = { 1, 2, 3, 4 };
+	for (int i = 0; i < 3; i++) {
+		udp_ipv4_send_packet(sender, payload.data(), payload.size(), loopback_address(receiver));
+	}
+	std::array<uint8_t, 16> buffer{};
+	Ipv4Address from{};
+	for (int i = 0; i < 3; i++) {
+		EXPECT_EQ(udp_ipv4_recv_packet_block(receiver, buffer.data(), buffer.size(), &from, 1'000'000), payload.size());
+		EXPECT_EQ(from.port, sock_get_src_address(sender).port);
+	}
+	EXPECT_EQ(udp_ipv4_recv_packet_block(receiver, buffer.data(), buffer.size(), nullptr, 1'000), 0);
+}
+
+TEST_F(SocketLoopbackTests, DrainedReceiveIsNotAnError) {
+	auto receiver = open_socket();
+	auto& recv_errors = metrics_counter("netlib_udp_recv_errors_total");
+	uint64_t errors_before = recv_errors.value();
+	std::array<uint8_t, 16> buffer{};
+	for (int i = 0; i < 3; i++) {
+		EXPECT_LT(udp_ipv4_recv_packet(receiver, buffer.data(), buffer.size(), nullptr), 0);
+	}
+	EXPECT_EQ(recv_errors.value(), errors_before);
+}
+
+TEST_F(SocketLoopbackTests, BatchSendAndReceive) {
+	constexpr size_t datagram_count = 100;
+	auto sender = open_socket();
+	auto receiver = open_socket();
+	std::array<uint32_t, datagram_count> payloads{};
+	std::vector<UdpSendDatagram> send_batch;
+	for (size_t i = 0; i < datagram_count; i++) {
+		payloads[i] = static_cast<uint32_t>(i);
+		send_batch.emplace_back(UdpSendDatagram{ &payloads[i], sizeof(uint32_t), loopback_address(receiver) });
+	}
+	EXPECT_EQ(udp_ipv4_send_batch(sender, send_batch), datagram_count);
+
+	std::array<uint32_t, datagram_count> buffers{};
+	std::vector<UdpRecvDatagram> recv_batch;
+	for (auto& buffer : buffers) {
+		recv_batch.emplace_back(UdpRecvDatagram{ &buffer, sizeof(uint32_t), 0, {} });
+	}
+	size_t received = 0;
+	std::vector<Socket> ready;
+	while (received < datagram_count && sock_wait_readable(std::span<const Socket>(&receiver, 1), ready, 1'000'000) > 0) {
+		int count = udp_ipv4_recv_batch(receiver, std::span<UdpRecvDatagram>(recv_batch).subspan(received));
+		if (count <= 0) {
+			break;
+		}
+		received += count;
+	}
+	EXPECT_EQ(received, datagram_count);
+	for (size_t i = 0; i < received; i++) {
+		EXPECT_EQ(recv_batch[i].size, sizeof(uint32_t));
+		EXPECT_EQ(buffers[i], i);
+		EXPECT_EQ(recv_batch[i].address.port, sock_get_src_address(sender).port);
+	}
+}
+
+TEST_F(SocketLoopbackTests, BatchReceiveReturnsTruncatedDatagram) {
+	auto sender = open_socket();
+	auto receiver = open_socket();
+	const std::array<uint8_t, 8> long_payload = { 1, 2, 3, 4, 5, 6, 7, 8 };
+	const std::array<uint8_t, 4> short_payload = { 9, 10, 11, 12 };
+	udp_ipv4_send_packet(sender, long_payload.data(), long_payload.size(), loopback_address(receiver));
+	udp_ipv4_send_packet(sender, short_payload.data(), short_payload.size(), loopback_address(receiver));
+
+	std::array<std::array<uint8_t, 4>, 2> buffers{};
+	std::array<UdpRecvDatagram, 2> recv_batch = {
+		UdpRecvDatagram{ buffers[0].data(), buffers[0].size(), 0, {}, false },
+		UdpRecvDatagram{ buffers[1].data(), buffers[1].size(), 0, {}, false },
+	};
+	size_t received = 0;
+	std::vector<Socket> ready;
+	while (received < recv_batch.size() && sock_wait_readable(std::span<const Socket>(&receiver, 1), ready, 1'000'000) > 0) {
+		int count = udp_ipv4_recv_batch(receiver, std::span<UdpRecvDatagram>(recv_batch).subspan(received));
+		ASSERT_GT(count, 0);
+		received += count;
+	}
+	ASSERT_EQ(received, 2);
+	EXPECT_TRUE(recv_batch[0].truncated);
+	EXPECT_EQ(recv_batch[0].size, 4);
+	EXPECT_EQ(buffers[0], (std::array<uint8_t, 4>{ 1, 2, 3, 4 }));
+	EXPECT_FALSE(recv_batch[1].truncated);
+	EXPECT_EQ(buffers[1], short_payload);
+}
+
+static uint64_t test_wall_clock_ns() {
+	auto now = std::chrono::system_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+TEST_F(SocketLoopbackTests, RecvInfoReportsReceiveTime) {
+	auto sender = open_socket();
+	auto receiver = open_socket();
+	EXPECT_TRUE(udp_enable_recv_info(receiver, 0));
+	EXPECT_FALSE(udp_enable_recv_info(receiver, UDP_RECV_TIMESTAMP | UDP_RECV_DROPS));
+	uint32_t payload = 7;
+	udp_ipv4_send_packet(sender, &payload, sizeof(payload), loopback_address(receiver));
+	std::vector<Socket> ready;
+	ASSERT_EQ(sock_wait_readable(std::span<const Socket>(&receiver, 1), ready, 1'000'000), 1);
+
+	uint32_t received = 0;
+	UdpRecvInfo info{};
+	uint64_t before = test_wall_clock_ns();
+	EXPECT_EQ(udp_ipv4_recv_packet(receiver, &received, sizeof(received), nullptr, &info), sizeof(received));
+	uint64_t after = test_wall_clock_ns();
+	EXPECT_EQ(received, payload);
+	// Stamped in user space right after recvfrom
+	EXPECT_FALSE(info.kernel_timestamp);
+	EXPECT_GE(info.timestamp_ns, before);
+	EXPECT_LE(info.timestamp_ns, after);
+	EXPECT_EQ(info.drops, 0);
+}
+
+TEST_F(SocketLoopbackTests, RecvInfoFollowsBackendClock) {
+	NetSim sim{};
+	sock_set_backend(&sim);
+	sim.set_current_host(sim.add_host(0x0A000002));
+	auto sender = udp_ipv4_init_socket();
+	auto receiver = udp_ipv4_init_socket();
+	uint32_t payload = 7;
+	udp_ipv4_send_packet(sender, &payload, sizeof(payload), sock_get_src_address(receiver));
+	sim.advance(2'500);
+
+	uint32_t received = 0;
+	UdpRecvInfo info{};
+	int recv_bytes = udp_ipv4_recv_packet(receiver, &received, sizeof(received), nullptr, &info);
+	uint64_t now_us = sock_now_us();
+	sock_close(sender);
+	sock_close(receiver);
+	sock_set_backend(nullptr);
+	EXPECT_EQ(recv_bytes, sizeof(received));
+	EXPECT_EQ(received, payload);
+	EXPECT_EQ(info.timestamp_ns, now_us * 1000);
+	EXPECT_GE(info.timestamp_ns, 2'500'000u);
+	EXPECT_FALSE(info.kernel_timestamp);
+}
\ No newline at end of file
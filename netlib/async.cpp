@@ -0,0 +1,195 @@
+module;
+
+#include <cstdint>
+
+module netlib:async;
+import :log;
+import std;
+
+namespace net {
+	bool SocketWaitAwaiter::suspend(std::coroutine_handle<> handle, AsyncCancelState* cancel) {
+		if (cancel && cancel->cancelled) {
+			return false;
+		}
+		cancel_state = cancel;
+		auto on_ready = [this, handle](const Socket) {
+			finish(true);
+			handle.resume();
+		};
+		bool registered = false;
+		if (reactor.has_socket(socket)) {
+			registered = write ? reactor.set_write_callback(socket, std::move(on_ready)) : reactor.set_read_callback(socket, std::move(on_ready));
+		}
+		else {
+			registered = write ? reactor.add_socket(socket, {}, std::move(on_ready)) : reactor.add_socket(socket, std::move(on_ready));
+		}
+		if (!registered) {
+			log_error("Waiting for socket in coroutine failed.");
+			return false;
+		}
+		if (cancel) {
+			cancel->on_cancel = [this, handle]() {
+				finish(false);
+				handle.resume();
+			};
+		}
+		return true;
+	}
+
+	void SocketWaitAwaiter::finish(const bool result) {
+		ready = result;
+		if (write) {
+			reactor.set_write_callback(socket, {});
+		}
+		else {
+			reactor.set_read_callback(socket, {});
+		}
+		if (cancel_state) {
+			cancel_state->on_cancel = {};
+		}
+	}
+
+	bool SleepAwaiter::suspend(std::coroutine_handle<> handle, AsyncCancelState* cancel) {
+		if (cancel && cancel->cancelled) {
+			return false;
+		}
+		timer = reactor.add_timer(delay_us, [this, handle, cancel]() {
+			if (cancel) {
+				cancel->on_cancel = {};
+			}
+			slept = true;
+			handle.resume();
+		});
+		if (cancel) {
+			cancel->on_cancel = [this, handle]() {
+				reactor.cancel_timer(timer);
+				handle.resume();
+			};
+		}
+		return true;
+	}
+
+	DnsResolveAwaiter::~DnsResolveAwaiter() {
+		detach();
+	}
+
+	bool DnsResolveAwaiter::await_ready() {
+		auto cached = dns_default_resolver().cached(domain_address, port);
+		if (!cached) {
+			return false;
+		}
+		addresses = std::move(*cached);
+		return true;
+	}
+
+	bool DnsResolveAwaiter::suspend(std::coroutine_handle<> handle, AsyncCancelState* cancel) {
+		if (cancel && cancel->cancelled) {
+			return false;
+		}
+		waiting = handle;
+		cancel_state = cancel;
+		lookup = std::make_shared<Lookup>();
+		lookup->awaiter = this;
+		if (cancel) {
+			cancel->on_cancel = [this]() { finish({}); };
+		}
+		// Callback runs on resolver worker (or right here when name got cached meanwhile), answer is always
+		// delivered on reactor thread. Reactor is only touched while awaiter is attached, lock keeps it so.
+		dns_default_resolver().resolve(domain_address, port, DnsQueryType::UDP, [lookup = lookup](const std::vector<IpAddress>& result) {
+			std::lock_guard lock(lookup->mutex);
+			if (!lookup->awaiter) {
+				return;
+			}
+			lookup->awaiter->reactor.post([lookup, result]() {
+				DnsResolveAwaiter* awaiter = nullptr;
+				{
+					std::lock_guard lock(lookup->mutex);
+					awaiter = lookup->awaiter;
+				}
+				if (awaiter) {
+					awaiter->finish(result);
+				}
+			});
+		});
+		return true;
+	}
+
+	void DnsResolveAwaiter::finish(std::vector<IpAddress> result) {
+		detach();
+		if (cancel_state) {
+			cancel_state->on_cancel = {};
+		}
+		addresses = std::move(result);
+		std::exchange(waiting, {}).resume();
+	}
+
+	void DnsResolveAwaiter::detach() {
+		if (!lookup) {
+			return;
+		}
+		std::lock_guard lock(lookup->mutex);
+		lookup->awaiter = nullptr;
+	}
+
+	Task<int> async_recv(Reactor& reactor, const Socket socket, void* data, const size_t size, Ipv4Address* address) {
+		for (;;) {
+			// Datagram may already be queued, socket is waited for only when it would block
+			UdpRecvDatagram datagram{ data, size, 0, {} };
+			int count = udp_ipv4_recv_batch(socket, std::span<UdpRecvDatagram>(&datagram, 1));
+			if (count < 0) {
+				co_return -1;
+			}
+			if (count == 1) {
+				if (address) {
+					*address = datagram.address;
+				}
+				co_return static_cast<int>(datagram.size);
+			}
+			if (!co_await SocketWaitAwaiter(reactor, socket, false)) {
+				co_return -1;
+			}
+		}
+	}
+
+	Task<int> async_recv(Reactor& reactor, const Socket socket, PacketBuffer& buffer, Ipv4Address* address) {
+		int recv_bytes = co_await async_recv(reactor, socket, buffer.data(), buffer.capacity(), address);
+		buffer.resize((recv_bytes > 0) ? recv_bytes : 0);
+		co_return recv_bytes;
+	}
+
+	Task<int> async_send(Reactor& reactor, const Socket socket, const void* data, const size_t size, const Ipv4Address& address) {
+		for (;;) {
+			UdpSendDatagram datagram{ data, size, address };
+			int count = udp_ipv4_send_batch(socket, std::span<const UdpSendDatagram>(&datagram, 1));
+			if (count < 0) {
+				co_return -1;
+			}
+			if (count == 1) {
+				co_return static_cast<int>(size);
+			}
+			if (!co_await SocketWaitAwaiter(reactor, socket, true)) {
+				co_return -1;
+			}
+		}
+	}
+
+	SleepAwaiter sleep_for(Reactor& reactor, const uint32_t delay_us) {
+		return SleepAwaiter(reactor, delay_us);
+	}
+
+	DnsResolveAwaiter async_resolve(Reactor& reactor, std::string domain_address, const uint16_t port) {
+		return DnsResolveAwaiter(reactor, std::move(domain_address), port);
+	}
+
+	std::shared_ptr<AsyncCancelState> async_spawn(Task<void> task) {
+		auto handle = task.release();
+		if (!handle) {
+			return {};
+		}
+		auto cancel = std::make_shared<AsyncCancelState>();
+		handle.promise().cancel = cancel;
+		handle.promise().detached = true;
+		handle.resume();
+		return cancel;
+	}
+}
\ No newline at end of file
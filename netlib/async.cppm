@@ -0,0 +1,312 @@
+module;
+
+#include <cstdint>
+
+export module netlib:async;
+import :socket;
+import :reactor;
+import :packet_pool;
+import :dns;
+import :log;
+import std;
+
+export namespace net {
+	// Cancellation shared by a chain of tasks awaiting each other. The operation a chain is suspended in
+	// registers how to abort itself, cancelling resumes it with a failure result and fails every later
+	// operation right away, so the chain unwinds on its own.
+	struct AsyncCancelState {
+		bool cancelled = false;
+		std::function<void()> on_cancel;
+
+		void cancel() {
+			if (cancelled) {
+				return;
+			}
+			cancelled = true;
+			if (on_cancel) {
+				auto abort = std::move(on_cancel);
+				on_cancel = {};
+				abort();
+			}
+		}
+	};
+
+	template<typename T>
+	class Task;
+
+	struct AsyncPromiseBase {
+		struct FinalAwaiter {
+			bool await_ready() noexcept { return false; }
+			template<typename P>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept {
+				auto& promise = handle.promise();
+				if (promise.continuation) {
+					return promise.continuation;
+				}
+				if (promise.detached) {
+					handle.destroy();
+				}
+				return std::noop_coroutine();
+			}
+			void await_resume() noexcept {}
+		};
+
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		FinalAwaiter final_suspend() noexcept { return {}; }
+		// netlib reports errors through return values, exception escaping a task is a bug
+		void unhandled_exception() { std::terminate(); }
+
+		std::coroutine_handle<> continuation;
+		std::shared_ptr<AsyncCancelState> cancel;
+		bool detached = false;
+	};
+
+	template<typename T>
+	struct TaskPromise : AsyncPromiseBase {
+		Task<T> get_return_object();
+		void return_value(T result) { value = std::move(result); }
+
+		std::optional<T> value;
+	};
+
+	template<>
+	struct TaskPromise<void> : AsyncPromiseBase {
+		Task<void> get_return_object();
+		void return_void() {}
+	};
+
+	// Lazily started coroutine. Awaiting it starts it on the awaiting thread and shares the caller's
+	// cancellation; top level tasks are started with async_spawn() or async_run().
+	template<typename T>
+	class [[nodiscard]] Task {
+	public:
+		using promise_type = TaskPromise<T>;
+
+		struct Awaiter {
+			bool await_ready() const noexcept { return !handle || handle.done(); }
+			template<typename P>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<P> caller) noexcept {
+				handle.promise().continuation = caller;
+				handle.promise().cancel = caller.promise().cancel;
+				return handle;
+			}
+			T await_resume() {
+				if constexpr (!std::is_void_v<T>) {
+					return std::move(*handle.promise().value);
+				}
+			}
+
+			std::coroutine_handle<promise_type> handle;
+		};
+
+		Task() = default;
+		explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+		Task(Task&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+		Task& operator=(Task&& other) noexcept {
+			if (this != &other) {
+				if (handle) {
+					handle.destroy();
+				}
+				handle = std::exchange(other.handle, {});
+			}
+			return *this;
+		}
+		~Task() {
+			if (handle) {
+				handle.destroy();
+			}
+		}
+
+		Awaiter operator co_await() && noexcept { return Awaiter{ handle }; }
+		std::coroutine_handle<promise_type> release() { return std::exchange(handle, {}); }
+		std::coroutine_handle<promise_type> get() const { return handle; }
+	private:
+		std::coroutine_handle<promise_type> handle;
+	};
+
+	template<typename T>
+	Task<T> TaskPromise<T>::get_return_object() {
+		return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+	}
+
+	inline Task<void> TaskPromise<void>::get_return_object() {
+		return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+	}
+
+	// Suspends until reactor reports socket ready. Resumes with false when chain was cancelled.
+	class SocketWaitAwaiter {
+	public:
+		SocketWaitAwaiter(Reactor& reactor, const Socket socket, const bool write) :
+			reactor(reactor), socket(socket), write(write) {}
+
+		bool await_ready() const noexcept { return false; }
+		template<typename P>
+		bool await_suspend(std::coroutine_handle<P> handle) {
+			return suspend(handle, handle.promise().cancel.get());
+		}
+		bool await_resume() const noexcept { return ready; }
+	private:
+		bool suspend(std::coroutine_handle<> handle, AsyncCancelState* cancel);
+		void finish(const bool result);
+
+		Reactor& reactor;
+		Socket socket;
+		bool write;
+		bool ready = false;
+		AsyncCancelState* cancel_state = nullptr;
+	};
+
+	// Suspends for given time. Resumes with false when chain was cancelled.
+	class SleepAwaiter {
+	public:
+		SleepAwaiter(Reactor& reactor, const uint32_t delay_us) :
+			reactor(reactor), delay_us(delay_us) {}
+
+		bool await_ready() const noexcept { return false; }
+		template<typename P>
+		bool await_suspend(std::coroutine_handle<P> handle) {
+			return suspend(handle, handle.promise().cancel.get());
+		}
+		bool await_resume() const noexcept { return slept; }
+	private:
+		bool suspend(std::coroutine_handle<> handle, AsyncCancelState* cancel);
+
+		Reactor& reactor;
+		uint32_t delay_us;
+		ReactorTimerId timer = 0;
+		bool slept = false;
+	};
+
+	// Suspends until dns_default_resolver() answers, cached names do not suspend. Resolver worker hands the answer
+	// over through reactor.post(), so reactor has to outlive the awaiting task. Resumes with empty result when
+	// lookup failed or chain was cancelled.
+	class DnsResolveAwaiter {
+	public:
+		DnsResolveAwaiter(Reactor& reactor, std::string domain_address, const uint16_t port) :
+			reactor(reactor), domain_address(std::move(domain_address)), port(port) {}
+		DnsResolveAwaiter(const DnsResolveAwaiter&) = delete;
+		DnsResolveAwaiter& operator=(const DnsResolveAwaiter&) = delete;
+		~DnsResolveAwaiter();
+
+		bool await_ready();
+		template<typename P>
+		bool await_suspend(std::coroutine_handle<P> handle) {
+			return suspend(handle, handle.promise().cancel.get());
+		}
+		std::vector<IpAddress> await_resume() { return std::move(addresses); }
+	private:
+		// Shared with resolver callback, which may run after the awaiter is gone
+		struct Lookup {
+			std::mutex mutex;
+			DnsResolveAwaiter* awaiter = nullptr;
+		};
+
+		bool suspend(std::coroutine_handle<> handle, AsyncCancelState* cancel);
+		void finish(std::vector<IpAddress> result);
+		void detach();
+
+		Reactor& reactor;
+		std::string domain_address;
+		uint16_t port;
+		std::vector<IpAddress> addresses;
+		std::coroutine_handle<> waiting;
+		AsyncCancelState* cancel_state = nullptr;
+		std::shared_ptr<Lookup> lookup;
+	};
+
+	// Runs task with fresh cancellation that fires after 'timeout_us' or when caller is cancelled
+	template<typename T>
+	class TimeoutAwaiter {
+	public:
+		using Result = std::conditional_t<std::is_void_v<T>, bool, std::optional<T>>;
+
+		TimeoutAwaiter(Reactor& reactor, Task<T>&& task, const uint32_t timeout_us) :
+			reactor(reactor), task(std::move(task)), timeout_us(timeout_us) {}
+
+		bool await_ready() const noexcept { return false; }
+		template<typename P>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> caller) {
+			outer_cancel = caller.promise().cancel;
+			inner_cancel = std::make_shared<AsyncCancelState>();
+			inner_cancel->cancelled = outer_cancel && outer_cancel->cancelled;
+			auto& promise = task.get().promise();
+			promise.continuation = caller;
+			promise.cancel = inner_cancel;
+			timer = reactor.add_timer(timeout_us, [this]() {
+				timed_out = true;
+				inner_cancel->cancel();
+			});
+			if (outer_cancel) {
+				outer_cancel->on_cancel = [this]() { inner_cancel->cancel(); };
+			}
+			return task.get();
+		}
+		Result await_resume() {
+			reactor.cancel_timer(timer);
+			if (outer_cancel) {
+				outer_cancel->on_cancel = {};
+			}
+			if constexpr (std::is_void_v<T>) {
+				return !timed_out;
+			}
+			else {
+				if (timed_out) {
+					return std::nullopt;
+				}
+				return std::move(*task.get().promise().value);
+			}
+		}
+	private:
+		Reactor& reactor;
+		Task<T> task;
+		uint32_t timeout_us;
+		ReactorTimerId timer = 0;
+		bool timed_out = false;
+		std::shared_ptr<AsyncCancelState> outer_cancel;
+		std::shared_ptr<AsyncCancelState> inner_cancel;
+	};
+
+	// Socket operations return the same values as their blocking counterparts, -1 also when cancelled
+	Task<int>	async_recv(Reactor& reactor, const Socket socket, void* data, const size_t size, Ipv4Address* address = nullptr);
+	Task<int>	async_recv(Reactor& reactor, const Socket socket, PacketBuffer& buffer, Ipv4Address* address = nullptr);
+	Task<int>	async_send(Reactor& reactor, const Socket socket, const void* data, const size_t size, const Ipv4Address& address);
+	SleepAwaiter sleep_for(Reactor& reactor, const uint32_t delay_us);
+	DnsResolveAwaiter async_resolve(Reactor& reactor, std::string domain_address, const uint16_t port);
+
+	// Result is empty (false for void task) when task did not finish in time. Task is cancelled then, so
+	// pending operation inside it is aborted and its socket registration removed.
+	template<typename T>
+	Task<typename TimeoutAwaiter<T>::Result> with_timeout(Reactor& reactor, Task<T> task, const uint32_t timeout_us) {
+		co_return co_await TimeoutAwaiter<T>(reactor, std::move(task), timeout_us);
+	}
+
+	// Starts task that owns itself, returned state cancels it
+	std::shared_ptr<AsyncCancelState> async_spawn(Task<void> task);
+
+	// Drives reactor until task finishes, for blocking callers and tests. When reactor fails error is logged and
+	// task cancelled, result is then the failure value task unwound with, or default value if it did not finish.
+	template<typename T>
+	T async_run(Reactor& reactor, Task<T> task) {
+		// Result is shared with the task frame, which may outlive this call when reactor failed
+		auto result = std::make_shared<std::optional<std::conditional_t<std::is_void_v<T>, bool, T>>>();
+		auto cancel = async_spawn([](Task<T> task, auto result) -> Task<void> {
+			if constexpr (std::is_void_v<T>) {
+				co_await std::move(task);
+				*result = true;
+			}
+			else {
+				*result = co_await std::move(task);
+			}
+		}(std::move(task), result));
+		while (!result->has_value()) {
+			if (reactor.run_once() < 0) {
+				log_error("Reactor failed while running task, task cancelled.");
+				cancel->cancel();
+				break;
+			}
+		}
+		if constexpr (!std::is_void_v<T>) {
+			return result->has_value() ? std::move(**result) : T{};
+		}
+	}
+}
\ No newline at end of file
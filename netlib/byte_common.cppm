@@ -4,7 +4,7 @@ module;
 #include <assert.h>
 #include <type_traits>
 #include <stdlib.h>
-#include <Winsock2.h>
+#include "socket_platform.h"
 
 export module byte_common;
 import std;
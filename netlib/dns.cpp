@@ -1,18 +1,56 @@
 module;
 
-#include "WinSock2.h"
-#include "WS2tcpip.h"
+#include "socket_platform.h"
 
 module netlib:dns;
+import :socket;
 import :log;
 import std;
 
 namespace net {
+	static DnsSystemResolver system_resolver{};
+	// Resolver workers read it while tests and tools swap it, every lookup loads it once
+	static std::atomic<DnsResolver*> dns_resolver = nullptr;
+
+	// Created on first use and destroyed by dns_shutdown(), so workers never outlive WSACleanup()
+	static std::mutex default_resolver_mutex;
+	static std::unique_ptr<DnsAsyncResolver> default_resolver;
+
+	void dns_set_resolver(DnsResolver* resolver) {
+		dns_resolver.store(resolver, std::memory_order_release);
+		// Nothing is cached before default resolver exists, so it is not created just to be cleared
+		std::lock_guard lock(default_resolver_mutex);
+		if (default_resolver) {
+			default_resolver->clear_cache();
+		}
+	}
+
+	DnsResolver* dns_get_resolver() {
+		auto resolver = dns_resolver.load(std::memory_order_acquire);
+		return resolver ? resolver : &system_resolver;
+	}
+
+	// Answers string lookups from installed resolver, numeric service is kept as port of the query
+	static std::vector<std::string> dns_resolver_resolve_address(DnsResolver& resolver, const char* domain_address, const char* service_name, const DnsQueryType type, const bool ipv4_only) {
+		uint16_t port = 0;
+		if (service_name) {
+			std::from_chars(service_name, service_name + std::strlen(service_name), port);
+		}
+		std::vector<std::string> ips;
+		for (const auto& address : resolver.resolve(domain_address, port, type, ipv4_only)) {
+			std::visit([&ips](auto addr) {
+				addr.port = 0;
+				ips.emplace_back(std::format("{}", addr));
+			}, address);
+		}
+		return ips;
+	}
+
 	static std::vector<std::string> dns_internal_resolve_address(const addrinfo& hint, const char* domain_address, const char* service_name) {
 		struct addrinfo* addresses = nullptr;
 		int ret = getaddrinfo(domain_address, service_name, &hint, &addresses);
 		if (ret != 0) {
-			log_wsa_error(std::string{ "Resolving domain name for '" } + domain_address + "' dns failed.");
+			log_wsa_error("Resolving domain name for '{}' dns failed.", domain_address);
 			return {};
 		}
 		std::vector<std::string> ips;
@@ -30,17 +68,20 @@ namespace net {
 			log_error("Compatibile IPv4 address not found.");
 		}
 		else {
-			log_debug("Found " + std::to_string(ips.size()) + " IPv4 addresses for '" + domain_address + "' dns.");
+			log_debug("Found {} IPv4 addresses for '{}' dns.", ips.size(), domain_address);
 		}
 		
 		return ips;
 	}
 
 	std::vector<std::string> dns_resolve_address(const char* domain_address, const char* service_name) {
+		if (auto resolver = dns_resolver.load(std::memory_order_acquire)) {
+			return dns_resolver_resolve_address(*resolver, domain_address, service_name, DnsQueryType::ANY, false);
+		}
 		struct addrinfo* addresses = nullptr;
 		int ret = getaddrinfo(domain_address, service_name, nullptr, &addresses);
 		if (ret != 0) {
-			log_wsa_error(std::string{ "Resolving domain name for '" } + domain_address + "' dns failed.");
+			log_wsa_error("Resolving domain name for '{}' dns failed.", domain_address);
 			return {};
 		}
 		std::vector<std::string> ips;
@@ -54,13 +95,16 @@ namespace net {
 			log_error("Compatibile IPv4 address not found.");
 		}
 		else {
-			log_debug("Found " + std::to_string(ips.size()) + " IPv4 addresses for '" + domain_address + "' dns.");
+			log_debug("Found {} IPv4 addresses for '{}' dns.", ips.size(), domain_address);
 		}
 
 		return ips;
 	}
 
 	std::vector<std::string> dns_resolve_tcp_address(const char* domain_address, const char* service_name) {
+		if (auto resolver = dns_resolver.load(std::memory_order_acquire)) {
+			return dns_resolver_resolve_address(*resolver, domain_address, service_name, DnsQueryType::TCP, true);
+		}
 		struct addrinfo hint = { 0 };
 		hint.ai_family = AF_INET;
 		hint.ai_socktype = SOCK_STREAM;
@@ -70,6 +114,9 @@ namespace net {
 	}
 
 	std::vector<std::string> dns_resolve_udp_address(const char* domain_address, const char* service_name) {
+		if (auto resolver = dns_resolver.load(std::memory_order_acquire)) {
+			return dns_resolver_resolve_address(*resolver, domain_address, service_name, DnsQueryType::UDP, true);
+		}
 		struct addrinfo hint = { 0 };
 		hint.ai_family = AF_INET;
 		hint.ai_socktype = SOCK_DGRAM;
@@ -77,4 +124,262 @@ namespace net {
 		auto result = dns_internal_resolve_address(hint, domain_address, service_name);
 		return result;
 	}
+
+	std::vector<IpAddress> DnsSystemResolver::resolve(const char* domain_address, const uint16_t port, const DnsQueryType type, const bool ipv4_only) {
+		struct addrinfo hint = { 0 };
+		hint.ai_family = ipv4_only ? AF_INET : AF_UNSPEC;
+		if (type == DnsQueryType::UDP) {
+			hint.ai_socktype = SOCK_DGRAM;
+			hint.ai_protocol = IPPROTO_UDP;
+		}
+		else if (type == DnsQueryType::TCP) {
+			hint.ai_socktype = SOCK_STREAM;
+			hint.ai_protocol = IPPROTO_TCP;
+		}
+		struct addrinfo* addresses = nullptr;
+		if (getaddrinfo(domain_address, nullptr, &hint, &addresses) != 0) {
+			log_wsa_error("Resolving domain name for '{}' dns failed.", domain_address);
+			return {};
+		}
+		std::vector<IpAddress> ips;
+		for (auto addr = addresses; addr != nullptr; addr = addr->ai_next) {
+			IpAddress address;
+			if (addr->ai_family == AF_INET) {
+				auto resolved_addr = reinterpret_cast<const sockaddr_in*>(addr->ai_addr);
+				address = Ipv4Address{ ntohl(resolved_addr->sin_addr.s_addr), port };
+			}
+			else if (addr->ai_family == AF_INET6) {
+				auto resolved_addr = reinterpret_cast<const sockaddr_in6*>(addr->ai_addr);
+				Ipv6Address ipv6{ {}, port, resolved_addr->sin6_scope_id };
+				std::memcpy(ipv6.ip.data(), &resolved_addr->sin6_addr, ipv6.ip.size());
+				address = ipv6;
+			}
+			else {
+				continue;
+			}
+			// Without socket type hint every address is reported once per socket type
+			if (std::ranges::find(ips, address) == ips.end()) {
+				ips.emplace_back(address);
+			}
+		}
+		freeaddrinfo(addresses);
+		log_debug("Found {} addresses for '{}' dns.", ips.size(), domain_address);
+		return ips;
+	}
+
+	void DnsFakeResolver::add_record(const std::string& domain_address, const std::vector<IpAddress>& addresses, const std::optional<std::chrono::microseconds> latency) {
+		std::lock_guard lock(mutex);
+		records[domain_address] = Record{ addresses, latency };
+	}
+
+	void DnsFakeResolver::remove_record(const std::string& domain_address) {
+		std::lock_guard lock(mutex);
+		records.erase(domain_address);
+	}
+
+	void DnsFakeResolver::set_latency(const std::chrono::microseconds latency) {
+		std::lock_guard lock(mutex);
+		default_latency = latency;
+	}
+
+	uint64_t DnsFakeResolver::query_count() const {
+		std::lock_guard lock(mutex);
+		return queries;
+	}
+
+	std::vector<IpAddress> DnsFakeResolver::resolve(const char* domain_address, const uint16_t port, const DnsQueryType type, const bool ipv4_only) {
+		std::vector<IpAddress> ips;
+		std::chrono::microseconds latency{};
+		{
+			std::lock_guard lock(mutex);
+			queries++;
+			latency = default_latency;
+			auto record = records.find(domain_address);
+			if (record != records.end()) {
+				latency = record->second.latency.value_or(default_latency);
+				for (auto address : record->second.addresses) {
+					if (ipv4_only && !std::holds_alternative<Ipv4Address>(address)) {
+						continue;
+					}
+					std::visit([port](auto& addr) { addr.port = port; }, address);
+					ips.emplace_back(address);
+				}
+			}
+		}
+		if (latency.count() > 0) {
+			std::this_thread::sleep_for(latency);
+		}
+		if (ips.empty()) {
+			log_error("Resolving domain name for '{}' dns failed. No fake record.", domain_address);
+		}
+		return ips;
+	}
+
+	std::vector<Ipv4Address> dns_resolve_ipv4(const char* domain_address, const uint16_t port, const DnsQueryType type) {
+		auto ips = dns_get_resolver()->resolve(domain_address, port, type, true);
+		std::vector<Ipv4Address> ipv4s;
+		ipv4s.reserve(ips.size());
+		for (const auto& ip : ips) {
+			if (auto ipv4 = std::get_if<Ipv4Address>(&ip)) {
+				ipv4s.emplace_back(*ipv4);
+			}
+		}
+		return ipv4s;
+	}
+
+	std::vector<IpAddress> dns_resolve_ip(const char* domain_address, const uint16_t port, const DnsQueryType type) {
+		return dns_get_resolver()->resolve(domain_address, port, type, false);
+	}
+
+	static std::string dns_cache_key(const std::string& domain_address, const uint16_t port, const DnsQueryType type) {
+		return std::to_string(static_cast<uint8_t>(type)) + "|" + domain_address + "|" + std::to_string(port);
+	}
+
+	DnsAsyncResolver::DnsAsyncResolver(const uint32_t worker_count, const std::chrono::seconds positive_ttl, const std::chrono::seconds negative_ttl) :
+		positive_ttl(positive_ttl), negative_ttl(negative_ttl) {
+		for (uint32_t i = 0; i < (std::max)(worker_count, 1u); i++) {
+			workers.emplace_back([this](std::stop_token stop) { worker_loop(stop); });
+		}
+	}
+
+	DnsAsyncResolver::~DnsAsyncResolver() {
+		for (auto& worker : workers) {
+			worker.request_stop();
+		}
+		jobs_cv.notify_all();
+		workers.clear();
+
+		// Lookups nobody started are answered here, waiters see cancellation instead of broken promise
+		std::vector<DnsCallback> callbacks;
+		for (auto& job : jobs) {
+			auto entry = cache.find(job.key);
+			if (entry != cache.end()) {
+				std::ranges::move(entry->second.callbacks, std::back_inserter(callbacks));
+			}
+			job.promise.set_exception(std::make_exception_ptr(
+				std::system_error(std::make_error_code(std::errc::operation_canceled), "DNS resolver shut down")
+			));
+		}
+		jobs.clear();
+		for (auto& callback : callbacks) {
+			callback({});
+		}
+	}
+
+	DnsResult DnsAsyncResolver::resolve(const std::string& domain_address, const uint16_t port, const DnsQueryType type) {
+		return resolve_internal(domain_address, port, type, nullptr);
+	}
+
+	void DnsAsyncResolver::resolve(const std::string& domain_address, const uint16_t port, const DnsQueryType type, DnsCallback callback) {
+		resolve_internal(domain_address, port, type, &callback);
+	}
+
+	std::optional<std::vector<IpAddress>> DnsAsyncResolver::cached(const std::string& domain_address, const uint16_t port, const DnsQueryType type) {
+		std::lock_guard lock(mutex);
+		auto entry = cache.find(dns_cache_key(domain_address, port, type));
+		if (entry == cache.end() || entry->second.pending || entry->second.expires_at <= std::chrono::steady_clock::now()) {
+			return {};
+		}
+		counters.cache_hits++;
+		return entry->second.result.get();
+	}
+
+	void DnsAsyncResolver::clear_cache() {
+		std::lock_guard lock(mutex);
+		std::erase_if(cache, [](const auto& entry) { return !entry.second.pending; });
+	}
+
+	DnsResolverStats DnsAsyncResolver::stats() const {
+		std::lock_guard lock(mutex);
+		return counters;
+	}
+
+	DnsResult DnsAsyncResolver::resolve_internal(const std::string& domain_address, const uint16_t port, const DnsQueryType type, DnsCallback* callback) {
+		auto key = dns_cache_key(domain_address, port, type);
+		std::unique_lock lock(mutex);
+		auto entry = cache.find(key);
+		if (entry != cache.end()) {
+			auto& cached_entry = entry->second;
+			if (cached_entry.pending) {
+				counters.merged++;
+				if (callback) {
+					cached_entry.callbacks.emplace_back(std::move(*callback));
+				}
+				return cached_entry.result;
+			}
+			if (cached_entry.expires_at > std::chrono::steady_clock::now()) {
+				counters.cache_hits++;
+				auto result = cached_entry.result;
+				lock.unlock();
+				if (callback) {
+					(*callback)(result.get());
+				}
+				return result;
+			}
+		}
+
+		Job job{ key, domain_address, port, type, {} };
+		Entry new_entry{};
+		new_entry.result = job.promise.get_future().share();
+		if (callback) {
+			new_entry.callbacks.emplace_back(std::move(*callback));
+		}
+		auto result = new_entry.result;
+		cache[key] = std::move(new_entry);
+		jobs.emplace_back(std::move(job));
+		lock.unlock();
+		jobs_cv.notify_one();
+		return result;
+	}
+
+	void DnsAsyncResolver::worker_loop(std::stop_token stop) {
+		for (;;) {
+			std::unique_lock lock(mutex);
+			// Stop wins over queued jobs, destructor cancels whatever is left
+			jobs_cv.wait(lock, stop, [this] { return !jobs.empty(); });
+			if (stop.stop_requested()) {
+				return;
+			}
+			Job job = std::move(jobs.front());
+			jobs.pop_front();
+			counters.lookups++;
+			lock.unlock();
+
+			auto ips = dns_resolve_ip(job.domain_address.c_str(), job.port, job.type);
+
+			lock.lock();
+			std::vector<DnsCallback> callbacks;
+			auto entry = cache.find(job.key);
+			if (entry != cache.end()) {
+				entry->second.pending = false;
+				entry->second.expires_at = std::chrono::steady_clock::now() + (ips.empty() ? negative_ttl : positive_ttl);
+				callbacks = std::move(entry->second.callbacks);
+				entry->second.callbacks.clear();
+			}
+			job.promise.set_value(ips);
+			lock.unlock();
+
+			for (auto& callback : callbacks) {
+				callback(ips);
+			}
+		}
+	}
+
+	DnsAsyncResolver& dns_default_resolver() {
+		std::lock_guard lock(default_resolver_mutex);
+		if (!default_resolver) {
+			default_resolver = std::make_unique<DnsAsyncResolver>();
+		}
+		return *default_resolver;
+	}
+
+	void dns_shutdown() {
+		std::unique_ptr<DnsAsyncResolver> resolver;
+		{
+			std::lock_guard lock(default_resolver_mutex);
+			resolver = std::move(default_resolver);
+		}
+		// Joined outside the lock, worker callbacks may still ask for the default resolver
+		resolver.reset();
+	}
 }
\ No newline at end of file
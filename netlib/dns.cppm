@@ -1,6 +1,9 @@
 module;
 
+#include <cstdint>
+
 export module netlib:dns;
+import :socket;
 import std;
 
 // DNS
@@ -8,4 +11,122 @@ export namespace net {
 	std::vector<std::string> dns_resolve_udp_address(const char* domain_address, const char* service_name);
 	std::vector<std::string> dns_resolve_tcp_address(const char* domain_address, const char* service_name);
 	std::vector<std::string> dns_resolve_address(const char* domain_address, const char* service_name);
-}
+
+	enum class DnsQueryType : uint8_t {
+		ANY,
+		UDP,
+		TCP,
+	};
+
+	// Binary lookups, 'port' is set on every returned address and duplicates are removed
+	std::vector<Ipv4Address> dns_resolve_ipv4(const char* domain_address, const uint16_t port, const DnsQueryType type = DnsQueryType::UDP);
+	std::vector<IpAddress> dns_resolve_ip(const char* domain_address, const uint16_t port, const DnsQueryType type = DnsQueryType::UDP);
+
+	// Source of dns_resolve_* answers. Results from all families are expected unless 'ipv4_only' is set,
+	// 'port' is copied into every returned address.
+	class DnsResolver {
+	public:
+		virtual ~DnsResolver() = default;
+		virtual std::vector<IpAddress> resolve(const char* domain_address, const uint16_t port, const DnsQueryType type, const bool ipv4_only) = 0;
+	};
+
+	// Default resolver, blocks on getaddrinfo
+	class DnsSystemResolver : public DnsResolver {
+	public:
+		std::vector<IpAddress> resolve(const char* domain_address, const uint16_t port, const DnsQueryType type, const bool ipv4_only) override;
+	};
+
+	// In-memory resolver for tests and benchmarks without network. Names without record fail like NXDOMAIN.
+	// Every query sleeps for record latency (or default latency), so lookup cost can be controlled.
+	class DnsFakeResolver : public DnsResolver {
+	public:
+		void add_record(const std::string& domain_address, const std::vector<IpAddress>& addresses, const std::optional<std::chrono::microseconds> latency = {});
+		void remove_record(const std::string& domain_address);
+		void set_latency(const std::chrono::microseconds latency);
+		uint64_t query_count() const;
+
+		std::vector<IpAddress> resolve(const char* domain_address, const uint16_t port, const DnsQueryType type, const bool ipv4_only) override;
+	private:
+		struct Record {
+			std::vector<IpAddress> addresses;
+			std::optional<std::chrono::microseconds> latency;
+		};
+
+		mutable std::mutex mutex;
+		std::unordered_map<std::string, Record> records;
+		std::chrono::microseconds default_latency{ 0 };
+		uint64_t queries = 0;
+	};
+
+	// Lookups started after the call use new resolver, 'resolver' must outlive lookups in flight.
+	// nullptr restores system resolver. Switching resolver drops finished entries from dns_default_resolver() cache.
+	void			dns_set_resolver(DnsResolver* resolver);
+	DnsResolver*	dns_get_resolver();
+
+	using DnsResult = std::shared_future<std::vector<IpAddress>>;
+	using DnsCallback = std::function<void(const std::vector<IpAddress>& addresses)>;
+
+	struct DnsResolverStats {
+		uint64_t lookups = 0;		// getaddrinfo calls made by workers
+		uint64_t cache_hits = 0;
+		uint64_t merged = 0;		// requests attached to lookup already in flight
+	};
+
+	// Resolves names with dns_resolve_ip() on worker threads and caches results, empty (failed) results included.
+	// Concurrent requests for the same name share one lookup. getaddrinfo does not expose record TTL,
+	// so positive and negative entries expire after fixed times. Destructor waits for lookups in progress;
+	// queued ones fail with std::errc::operation_canceled and their callbacks get an empty result.
+	class DnsAsyncResolver {
+	public:
+		DnsAsyncResolver(
+			const uint32_t worker_count = 2,
+			const std::chrono::seconds positive_ttl = std::chrono::seconds(300),
+			const std::chrono::seconds negative_ttl = std::chrono::seconds(30)
+		);
+		~DnsAsyncResolver();
+		DnsAsyncResolver(const DnsAsyncResolver&) = delete;
+		DnsAsyncResolver& operator=(const DnsAsyncResolver&) = delete;
+
+		DnsResult resolve(const std::string& domain_address, const uint16_t port, const DnsQueryType type = DnsQueryType::UDP);
+		// Callback runs on worker thread, or on caller thread before return when result is already cached
+		void resolve(const std::string& domain_address, const uint16_t port, const DnsQueryType type, DnsCallback callback);
+		// Non blocking lookup, empty when name is not cached or still resolving
+		std::optional<std::vector<IpAddress>> cached(const std::string& domain_address, const uint16_t port, const DnsQueryType type = DnsQueryType::UDP);
+		// Drops finished entries, lookups in flight are kept
+		void clear_cache();
+		DnsResolverStats stats() const;
+	private:
+		struct Entry {
+			DnsResult result;
+			std::vector<DnsCallback> callbacks;
+			std::chrono::steady_clock::time_point expires_at;
+			bool pending = true;
+		};
+
+		struct Job {
+			std::string key;
+			std::string domain_address;
+			uint16_t port;
+			DnsQueryType type;
+			std::promise<std::vector<IpAddress>> promise;
+		};
+
+		DnsResult resolve_internal(const std::string& domain_address, const uint16_t port, const DnsQueryType type, DnsCallback* callback);
+		void worker_loop(std::stop_token stop);
+
+		std::chrono::seconds positive_ttl;
+		std::chrono::seconds negative_ttl;
+		mutable std::mutex mutex;
+		std::condition_variable_any jobs_cv;
+		std::deque<Job> jobs;
+		std::unordered_map<std::string, Entry> cache;
+		DnsResolverStats counters;
+		std::vector<std::jthread> workers;
+	};
+
+	// Process wide resolver shared by netlib components, created on first use
+	DnsAsyncResolver& dns_default_resolver();
+	// Destroys default resolver and joins its workers, netlib_clean() calls it before WSACleanup().
+	// References from dns_default_resolver() are invalid afterwards, next call creates new resolver.
+	void			dns_shutdown();
+}
\ No newline at end of file
@@ -1,45 +1,20 @@
 module;
 
-#include "WinSock2.h"
-#include "WS2tcpip.h"
+#include <cstdint>
 
 module netlib:ice;
 import :stun;
 import :log;
 import :dns;
+import :reactor;
+import :packet_pool;
+import :async;
+import :metrics;
 import std;
 
 namespace net {
 	std::vector<Ipv4Address> ice_discover_host_candidates() {
-		char host_name[128];
-		if (gethostname(host_name, sizeof(host_name)) == SOCKET_ERROR) {
-			log_wsa_error("Getting hostname failed.");
-			return {};
-		}
-		addrinfo hints{};
-		hints.ai_family = AF_INET;
-		hints.ai_socktype = SOCK_DGRAM;
-		hints.ai_protocol = IPPROTO_UDP;
-		addrinfo* host_infos{};
-
-		if (getaddrinfo(host_name, nullptr, &hints, &host_infos) != S_OK) {
-			log_wsa_error("Getting hostinfo failed.");
-			return {};
-		}
-
-		std::vector<Ipv4Address> candidates;
-		for (addrinfo* addr = host_infos; addr != nullptr; addr = addr->ai_next) {
-			if (addr->ai_family != AF_INET || addr->ai_socktype != SOCK_DGRAM) {
-				log_info("Incompatibile address. Looking for next one.");
-				continue;
-			}
-			sockaddr_in* resolved_addr = reinterpret_cast<sockaddr_in*>(addr->ai_addr);
-			if (resolved_addr->sin_addr.s_addr == INADDR_LOOPBACK) {
-				continue;
-			}
-			candidates.emplace_back(Ipv4Address{ resolved_addr->sin_addr.s_addr, 0 });
-		}
-		return candidates;
+		return sock_get_host_addresses();
 	}
 
 	static bool handle_address_attribute(const Stun& msg, const StunAttributeType type) {
@@ -48,7 +23,7 @@ namespace net {
 			return false;
 		}
 		auto& addr = attr_addr_mapped->address();
-		log_info(std::format("Got {} attribute: ip: {} port: {}", stun_attr_type_to_str(type), udp_ipv4_net_to_str(addr.ip), addr.port));
+		log_debug("Got {} attribute: address: {}", stun_attr_type_to_str(type), addr);
 		return true;
 	}
 
@@ -58,7 +33,7 @@ namespace net {
 			return false;
 		}
 		auto& addr = attr_addr_mapped->address();
-		log_info(std::format("Got {} attribute: ip: {} port: {}", stun_attr_type_to_str(type), udp_ipv4_net_to_str(addr.ip), addr.port));
+		log_debug("Got {} attribute: address: {}", stun_attr_type_to_str(type), addr);
 		candidates.emplace_back(addr);
 		return true;
 	}
@@ -69,7 +44,7 @@ namespace net {
 			return false;
 		}
 		auto& addr = attr_addr_mapped->address();
-		log_info(std::format("Got {} attribute: ip: {} port: {}", stun_attr_type_to_str(type), udp_ipv4_net_to_str(addr.ip), addr.port));
+		log_debug("Got {} attribute: address: {}", stun_attr_type_to_str(type), addr);
 		candidates.emplace_back(addr);
 		return true;
 	}
@@ -80,7 +55,7 @@ namespace net {
 			return false;
 		}
 		auto& text = attr_string->str();
-		log_info(std::format("Got {} attribute: value: {}", stun_attr_type_to_str(type), text));
+		log_debug("Got {} attribute: value: {}", stun_attr_type_to_str(type), text);
 		return true;
 	}
 
@@ -91,7 +66,7 @@ namespace net {
 		}
 		auto code = attr->code();
 		auto& reason = attr->reason();
-		log_info(std::format("Got {} attribute (code={}, reason={})", stun_attr_type_to_str(type), code, reason));
+		log_debug("Got {} attribute (code={}, reason={})", stun_attr_type_to_str(type), code, reason);
 		return true;
 	}
 
@@ -100,12 +75,7 @@ namespace net {
 		if (!attr) {
 			return false;
 		}
-		std::string msg_str = "[";
-		for (const auto val : attr->values()) {
-			msg_str += std::to_string(val) + ", ";
-		}
-		msg_str += "]";
-		log_info(std::format("Got {} attribute, values: ", stun_attr_type_to_str(type), msg_str));
+		log_debug("Got {} attribute, values: {}", stun_attr_type_to_str(type), attr->values());
 		return true;
 	}
 
@@ -119,165 +89,256 @@ namespace net {
 			"stun.3clogic.com",
 			"stun.3cx.com",
 		};
-		std::vector<Ipv4Address> candidates;
-
-		Stun request{};
-		request.set_type(StunClass::REQUEST, StunMethod::BINDING);
-		auto buffer = ByteNetworkWriter(92);
-		Ipv4Address address{};
-		address.port = 3478;
+		return ice_discover_server_candidates(stun_servers);
+	}
 
-		FD_SET connections{};
-		for (const auto& server : stun_servers) {
-			auto ips = dns_resolve_udp_address(server, "3478");
-			if (ips.empty()) {
+	// Returns false when datagram is not response to request with 'transaction_id', caller then keeps waiting
+	static bool handle_server_response(const PacketBuffer& buffer, const Ipv4Address& recv_server_address,
+		const std::array<uint8_t, 12>& transaction_id, std::vector<Ipv4Address>& candidates) {
+		auto buff_reader = ByteNetworkReader(buffer.span());
+		auto recv_msg = Stun::read_from(buff_reader);
+		if (!recv_msg.has_value()) {
+			return false;
+		}
+		if (recv_msg->transact_id() != transaction_id) {
+			log_warning("Dropping stun response from ip '{}' with unknown transaction id.", recv_server_address);
+			return false;
+		}
+		auto msg_class = recv_msg->cls();
+		auto msg_method = recv_msg->method();
+		if (msg_method == StunMethod::BINDING && msg_class == StunClass::SUCCESS_RESPONSE) {
+			log_info("Successful stun request to ip '{}'", recv_server_address);
+		}
+		else {
+			log_info(
+				"Failed stun request to ip '{}'. Stun method: {}, stun class: {}", 
+				recv_server_address, static_cast<uint16_t>(msg_method), static_cast<uint8_t>(msg_class)
+			);
+			return true;
+		}
+		for (const auto& attribute : recv_msg->get_all_attributes()) {
+			auto type = attribute->get_type();
+			switch (type) {
+			case StunAttributeType::ALTERNATE_SERVER:
+				handle_address_attribute(recv_msg.value(), type);
+				continue;
+			case StunAttributeType::ERROR_CODE:
+				handle_error_attribute(recv_msg.value(), type);
+				continue;
+			case StunAttributeType::MAPPED_ADDRESS:
+				handle_address_attribute(recv_msg.value(), type, candidates);
+				continue;
+			case StunAttributeType::XOR_MAPPED_ADDRESS:
+				handle_xor_address_attribute(recv_msg.value(), type, candidates);
+				continue;
+			case StunAttributeType::MESSAGE_INTEGRITY:
+				handle_string_attribute(recv_msg.value(), type);
+				continue;
+			case StunAttributeType::NONCE:
+				handle_string_attribute(recv_msg.value(), type);
+				continue;
+			case StunAttributeType::REALM:
+				handle_string_attribute(recv_msg.value(), type);
+				continue;
+			case StunAttributeType::SOFTWARE:
+				handle_string_attribute(recv_msg.value(), type);
+				continue;
+			case StunAttributeType::UNKNOWN_ATTRIBUTES:
+				handle_unknown_attribute(recv_msg.value(), type);
+				continue;
+			case StunAttributeType::USERNAME:
+				handle_string_attribute(recv_msg.value(), type);
+				continue;
+			case StunAttributeType::FINGERPRINT:
+				log_debug("Got FINGERPRINT attribute: {}", 0);
+				continue;
+			case StunAttributeType::MESSAGE_INTEGRITY_SHA256:
+				log_debug("Got MESSAGE_INTEGRITY_SHA256 attribute: {}", 0);
+				continue;
+			case StunAttributeType::PASSWORD_ALGORITHM:
+				log_debug("Got PASSWORD_ALGORITHM attribute: {}", 0);
+				continue;
+			case StunAttributeType::USERHASH:
+				log_debug("Got USERHASH attribute: {}", 0);
+				continue;
+			case StunAttributeType::DEPR_RESPONSE_ADDRESS:
+				handle_address_attribute(recv_msg.value(), type);
+				continue;
+			case StunAttributeType::DEPR_CHANGE_REQUEST:
+				log_debug("Got DEPR_CHANGE_REQUEST attribute: {}", 0);
+				continue;
+			case StunAttributeType::DEPR_SOURCE_ADDRESS:
+				handle_address_attribute(recv_msg.value(), type);
+				continue;
+			case StunAttributeType::DEPR_CHANGED_ADDRESS:
+				handle_address_attribute(recv_msg.value(), type);
+				continue;
+			case StunAttributeType::DEPR_PASSWORD:
+				handle_string_attribute(recv_msg.value(), type);
+				continue;
+			case StunAttributeType::DEPR_REFLECTED_FROM:
+				log_debug("Got DEPR_REFLECTED_FROM attribute: {}", 0);
+				continue;
+			case StunAttributeType::ICE_PRIORITY:
+				log_debug("Got PRIORITY attribute: {}", 0);
+				continue;
+			case StunAttributeType::ICE_USE_CANDIDATE:
+				log_debug("Got USE_CANDIDATE attribute: {}", 0);
+				continue;
+			case StunAttributeType::ICE_CONTROLLED:
+				log_debug("Got ICE_CONTROLLED attribute: {}", 0);
 				continue;
+			case StunAttributeType::ICE_CONTROLLING:
+				log_debug("Got ICE_CONTROLLING attribute: {}", 0);
+				continue;
+			default:
+				log_error("Unknown attribute type: {}", attribute->get_type_raw());
 			}
-			for (const auto& ip : ips) {
-				buffer.reset();
-				auto connection = udp_ipv4_init_socket();
-				request.clear_transaction_id();
-				uint64_t size = request.write_into(buffer);
-				if (size == 0) {
-					log_error("Cannot serialize stun message into buffer");
-					continue;
-				}
-				address.ip = udp_ipv4_str_to_net(ip);
-				auto send_bytes = udp_ipv4_send_packet(connection, reinterpret_cast<const void*>(buffer.data().data()), size, address);
-				if (send_bytes <= 0) {
-					closesocket(connection);
-					continue;
+		}
+		for (const auto attr_type : recv_msg->get_unknown_attribute_types()) {
+			log_warning("Unknown attribute type: {}", attr_type);
+		}
+		return true;
+	}
+
+	struct ServerGathering {
+		std::vector<Ipv4Address> candidates;
+		size_t pending = 0;
+		std::function<void(std::vector<Ipv4Address>)> on_done;
+		// Every spawned lookup and query, so a caller tearing its reactor down can abort them first
+		std::vector<std::shared_ptr<AsyncCancelState>> tasks;
+
+		void spawn(Task<void> task) {
+			tasks.push_back(async_spawn(std::move(task)));
+		}
+
+		void cancel() {
+			// Cancelled operations resume right away and unwind, none of them spawns new tasks
+			for (size_t i = 0; i < tasks.size(); i++) {
+				if (tasks[i]) {
+					tasks[i]->cancel();
 				}
-				log_info(std::format("Sending to server '{}' with ip '{}' successful.", server, ip));
-				FD_SET(connection, &connections);
 			}
 		}
+	};
 
-		timeval timeout{ .tv_usec = 1'000'000 };
-		while (connections.fd_count > 0) {
-			FD_SET listen_connections = connections;
-			int socket_count = select(0, &listen_connections, nullptr, nullptr, &timeout);
-			if (socket_count == 0) {
-				log_info("Timeout occured.");
-				break;
-			}
-			else if (socket_count < 0) {
-				log_wsa_error("Waiting for sockets ready to be read failed.");
-				break;
-			}
-			for (int i = 0; i < socket_count; i++) {
-				Socket connection = connections.fd_array[i];
-				std::vector<uint8_t> buff_vec(92);
-				Ipv4Address recv_server_address{};
-				auto recv_bytes = udp_ipv4_recv_packet(connection, buff_vec.data(), buff_vec.size(), &recv_server_address);
-				if (recv_bytes <= 0) {
-					closesocket(connection);
-					FD_CLR(connection, &connections);
-					continue;
-				}
-				auto buff_reader = ByteNetworkReader(std::span<uint8_t>(buff_vec.data(), recv_bytes));
-				auto recv_msg = Stun::read_from(buff_reader);
-				if (!recv_msg.has_value()) {
-					continue;
-				}
-				auto msg_class = recv_msg->cls();
-				auto msg_method = recv_msg->method();
-				auto ip_str = udp_ipv4_net_to_str(recv_server_address.ip);
-				if (msg_method == StunMethod::BINDING && msg_class == StunClass::SUCCESS_RESPONSE) {
-					log_info(std::format("Successful stun request to ip '{}'", ip_str));
+	static void finish_server_query(ServerGathering& gathering) {
+		if (--gathering.pending > 0) {
+			return;
+		}
+		auto on_done = std::move(gathering.on_done);
+		on_done(std::move(gathering.candidates));
+	}
+
+	struct StunMetrics {
+		MetricHistogram& rtt_us = metrics_histogram("netlib_stun_rtt_us", "Binding request round trip time in microseconds.");
+		MetricCounter& timeouts = metrics_counter("netlib_stun_timeouts_total", "Binding requests left without response.");
+	};
+
+	static StunMetrics& stun_metrics() {
+		static StunMetrics metrics{};
+		return metrics;
+	}
+
+	static Task<void> query_server(Reactor& reactor, const char* server, const Ipv4Address address, std::shared_ptr<ServerGathering> gathering) {
+		Stun request{};
+		request.set_type(StunClass::REQUEST, StunMethod::BINDING);
+		// Random id ties response to this request, anyone on path could otherwise answer with forged address
+		request.randomize_transaction_id();
+		auto writer = ByteNetworkWriter(92);
+		uint64_t size = request.write_into(writer);
+		if (size == 0) {
+			log_error("Cannot serialize stun message into buffer");
+			finish_server_query(*gathering);
+			co_return;
+		}
+		// Buffer is taken before sending, so response is never requested without place to receive it
+		auto buffer = packet_pool_default().acquire();
+		if (!buffer) {
+			log_error("No free packet buffer for stun response.");
+			finish_server_query(*gathering);
+			co_return;
+		}
+		auto connection = udp_ipv4_init_socket();
+		if (connection == 0) {
+			finish_server_query(*gathering);
+			co_return;
+		}
+		uint64_t sent_us = sock_now_us();
+		if (co_await async_send(reactor, connection, writer.data().data(), size, address) > 0) {
+			log_info("Sending to server '{}' with ip '{}' successful.", server, address);
+			Ipv4Address recv_server_address{};
+			// Datagrams with other transaction id are dropped and do not extend the deadline
+			uint64_t deadline_us = sent_us + 1'000'000;
+			while (true) {
+				uint64_t now_us = sock_now_us();
+				std::optional<int> recv_bytes{};
+				if (now_us < deadline_us) {
+					recv_bytes = co_await with_timeout(reactor, async_recv(reactor, connection, buffer, &recv_server_address), static_cast<uint32_t>(deadline_us - now_us));
 				}
-				else {
-					log_info(std::format(
-						"Failed stun request to ip '{}'. Stun method: {}, stun class: {}", 
-						ip_str, static_cast<uint16_t>(msg_method), static_cast<uint8_t>(msg_class))
-					);
-					continue;
+				if (!recv_bytes.has_value()) {
+					log_info("Timeout occured.");
+					stun_metrics().timeouts.add();
+					break;
 				}
-				for (const auto& attribute : recv_msg->get_all_attributes()) {
-					auto type = attribute->get_type();
-					switch (type) {
-					case StunAttributeType::ALTERNATE_SERVER:
-						handle_address_attribute(recv_msg.value(), type);
-						continue;
-					case StunAttributeType::ERROR_CODE:
-						handle_error_attribute(recv_msg.value(), type);
-						continue;
-					case StunAttributeType::MAPPED_ADDRESS:
-						handle_address_attribute(recv_msg.value(), type, candidates);
-						continue;
-					case StunAttributeType::XOR_MAPPED_ADDRESS:
-						handle_xor_address_attribute(recv_msg.value(), type, candidates);
-						continue;
-					case StunAttributeType::MESSAGE_INTEGRITY:
-						handle_string_attribute(recv_msg.value(), type);
-						continue;
-					case StunAttributeType::NONCE:
-						handle_string_attribute(recv_msg.value(), type);
-						continue;
-					case StunAttributeType::REALM:
-						handle_string_attribute(recv_msg.value(), type);
-						continue;
-					case StunAttributeType::SOFTWARE:
-						handle_string_attribute(recv_msg.value(), type);
-						continue;
-					case StunAttributeType::UNKNOWN_ATTRIBUTES:
-						handle_unknown_attribute(recv_msg.value(), type);
-						continue;
-					case StunAttributeType::USERNAME:
-						handle_string_attribute(recv_msg.value(), type);
-						continue;
-					case StunAttributeType::FINGERPRINT:
-						log_info(std::format("Got FINGERPRINT attribute: {}", 0));
-						continue;
-					case StunAttributeType::MESSAGE_INTEGRITY_SHA256:
-						log_info(std::format("Got MESSAGE_INTEGRITY_SHA256 attribute: {}", 0));
-						continue;
-					case StunAttributeType::PASSWORD_ALGORITHM:
-						log_info(std::format("Got PASSWORD_ALGORITHM attribute: {}", 0));
-						continue;
-					case StunAttributeType::USERHASH:
-						log_info(std::format("Got USERHASH attribute: {}", 0));
-						continue;
-					case StunAttributeType::DEPR_RESPONSE_ADDRESS:
-						handle_address_attribute(recv_msg.value(), type);
-						continue;
-					case StunAttributeType::DEPR_CHANGE_REQUEST:
-						log_info(std::format("Got DEPR_CHANGE_REQUEST attribute: {}", 0));
-						continue;
-					case StunAttributeType::DEPR_SOURCE_ADDRESS:
-						handle_address_attribute(recv_msg.value(), type);
-						continue;
-					case StunAttributeType::DEPR_CHANGED_ADDRESS:
-						handle_address_attribute(recv_msg.value(), type);
-						continue;
-					case StunAttributeType::DEPR_PASSWORD:
-						handle_string_attribute(recv_msg.value(), type);
-						continue;
-					case StunAttributeType::DEPR_REFLECTED_FROM:
-						log_info(std::format("Got DEPR_REFLECTED_FROM attribute: {}", 0));
-						continue;
-					case StunAttributeType::ICE_PRIORITY:
-						log_info(std::format("Got PRIORITY attribute: {}", 0));
-						continue;
-					case StunAttributeType::ICE_USE_CANDIDATE:
-						log_info(std::format("Got USE_CANDIDATE attribute: {}", 0));
-						continue;
-					case StunAttributeType::ICE_CONTROLLED:
-						log_info(std::format("Got ICE_CONTROLLED attribute: {}", 0));
-						continue;
-					case StunAttributeType::ICE_CONTROLLING:
-						log_info(std::format("Got ICE_CONTROLLING attribute: {}", 0));
-						continue;
-					default:
-						log_error(std::format("Unknown attribute type: {}", attribute->get_type_raw()));
-					}
+				if (*recv_bytes <= 0) {
+					break;
 				}
-				for (const auto attr_type : recv_msg->get_unknown_attribute_types()) {
-					log_warning(std::format("Unknown attribute type: {}", attr_type));
+				if (handle_server_response(buffer, recv_server_address, request.transact_id(), gathering->candidates)) {
+					stun_metrics().rtt_us.record(sock_now_us() - sent_us);
+					break;
 				}
 			}
 		}
+		sock_close(connection);
+		finish_server_query(*gathering);
+	}
+
+	static Task<void> query_server_addresses(Reactor& reactor, const char* server, std::shared_ptr<ServerGathering> gathering) {
+		auto addresses = co_await async_resolve(reactor, server, 3478);
+		for (const auto& ip : addresses) {
+			if (auto address = std::get_if<Ipv4Address>(&ip)) {
+				gathering->pending++;
+				gathering->spawn(query_server(reactor, server, *address, gathering));
+			}
+		}
+		finish_server_query(*gathering);
+	}
+
+	static std::shared_ptr<ServerGathering> start_gathering(Reactor& reactor, const std::span<const char* const> stun_servers, std::function<void(std::vector<Ipv4Address>)> on_done) {
+		auto gathering = std::make_shared<ServerGathering>();
+		gathering->on_done = std::move(on_done);
+
+		// Every server is one straight-line coroutine, all of them share the reactor thread. Lookups start up front,
+		// so servers are resolved in parallel, and each one queries its addresses as soon as its own answer comes.
+		gathering->pending = stun_servers.size() + 1;
+		for (const auto& server : stun_servers) {
+			gathering->spawn(query_server_addresses(reactor, server, gathering));
+		}
+		finish_server_query(*gathering);
+		return gathering;
+	}
+
+	void ice_discover_server_candidates(Reactor& reactor, const std::span<const char* const> stun_servers, std::function<void(std::vector<Ipv4Address>)> on_done) {
+		start_gathering(reactor, stun_servers, std::move(on_done));
+	}
+
+	std::vector<Ipv4Address> ice_discover_server_candidates(const std::span<const char* const> stun_servers) {
+		Reactor reactor{};
+		std::vector<Ipv4Address> candidates;
+		bool done = false;
+		auto gathering = start_gathering(reactor, stun_servers, [&](std::vector<Ipv4Address> result) {
+			candidates = std::move(result);
+			done = true;
+		});
+		while (!done) {
+			if (reactor.run_once() < 0) {
+				// Queries and lookups still point at the local reactor, abort them before it goes away
+				log_error("Reactor failed during server candidate gathering, queries cancelled.");
+				gathering->cancel();
+				break;
+			}
+		}
 		return candidates;
-		return {};
 	}
 }
\ No newline at end of file
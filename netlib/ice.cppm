@@ -2,9 +2,14 @@ module;
 
 export module netlib:ice;
 import :socket;
+import :reactor;
 import std;
 
 export namespace net {
 	std::vector<Ipv4Address> ice_discover_host_candidates();
 	std::vector<Ipv4Address> ice_discover_server_candidates();
+	std::vector<Ipv4Address> ice_discover_server_candidates(const std::span<const char* const> stun_servers);
+	// Returns immediately, lookups and binding requests run on the reactor. 'on_done' runs on reactor thread
+	// once every server answered or its one second timeout ran out, server names have to stay valid until then.
+	void ice_discover_server_candidates(Reactor& reactor, const std::span<const char* const> stun_servers, std::function<void(std::vector<Ipv4Address>)> on_done);
 }
\ No newline at end of file
@@ -1,27 +1,465 @@
 module;
 
-#include "WinSock2.h"
+#include <cstdint>
+#include "socket_platform.h"
 
 module netlib:log;
 
 namespace net {
-	void log_wsa_error(const std::string& msg, const char* FILE, const int LINE) {
-		std::cerr << libname << ": " << msg << " WSAError(" << WSAGetLastError() << ")\n";
+	// Power of two, so ring slot is the running counter masked
+	constexpr uint64_t LOG_RING_SIZE = 1024;
+	constexpr auto LOG_WRITE_INTERVAL = std::chrono::milliseconds(5);
+	constexpr uint32_t LOG_DEFAULT_RATE = 1000;
+	constexpr std::string_view LOG_FILE_MAGIC = "NLOG";
+	constexpr uint8_t LOG_FILE_VERSION = 1;
+	// Binary log entries, each starts with its tag byte
+	constexpr char LOG_ENTRY_FORMAT = 'F';	// id, format string
+	constexpr char LOG_ENTRY_RECORD = 'R';	// level, format id, time delta, arguments, WSA error
+	constexpr char LOG_ENTRY_DROPPED = 'D';	// count
+	constexpr uint8_t LOG_LEVEL_HAS_WSA_ERROR = 0x80;
+
+	// Records of one thread, single producer (owning thread) and single consumer (writer)
+	struct LogRing {
+		std::array<LogRecord, LOG_RING_SIZE> records;
+		alignas(64) std::atomic<uint64_t> head = 0;
+		alignas(64) std::atomic<uint64_t> tail = 0;
+		std::atomic<uint64_t> dropped = 0;
+		std::atomic<bool> retired = false;
+		// Token bucket, touched only by owning thread. Refilled to full whenever rate is changed.
+		double tokens = 0.0;
+		uint64_t refill_ns = 0;
+		uint32_t rate_generation = 0;
+	};
+
+	// Format strings are interned by address, every log call site keeps its literal for the whole run
+	struct LogBinaryFile {
+		std::ofstream stream;
+		std::unordered_map<const char*, uint32_t> format_ids;
+		uint64_t last_time_ns = 0;
+		std::string buffer;
+	};
+
+	struct LogBackend {
+		std::mutex rings_mutex;
+		std::vector<std::shared_ptr<LogRing>> rings;
+		// Held while draining, so log_flush() and writer thread never format the same record
+		std::mutex drain_mutex;
+		LogSink sink;
+		std::unique_ptr<LogBinaryFile> binary;
+		std::atomic<uint32_t> rate = LOG_DEFAULT_RATE;
+		std::atomic<uint32_t> rate_generation = 0;
+	};
+
+	// Marks ring retired when its thread exits, writer frees it once drained
+	struct LogRingOwner {
+		std::shared_ptr<LogRing> ring;
+
+		~LogRingOwner() {
+			if (ring) {
+				ring->retired.store(true, std::memory_order_release);
+			}
+		}
+	};
+
+	static void log_drain(LogBackend& backend);
+
+	static uint64_t log_clock_ns() {
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+	}
+
+	// Never destroyed, threads may still log while statics are torn down
+	static LogBackend& log_backend() {
+		static LogBackend* backend = [] {
+			auto created = new LogBackend();
+			std::thread([created]() {
+				for (;;) {
+					std::this_thread::sleep_for(LOG_WRITE_INTERVAL);
+					log_drain(*created);
+				}
+			}).detach();
+			std::atexit(log_flush);
+			return created;
+		}();
+		return *backend;
+	}
+
+	static LogRing& log_thread_ring() {
+		thread_local LogRingOwner owner;
+		if (!owner.ring) {
+			owner.ring = std::make_shared<LogRing>();
+			auto& backend = log_backend();
+			owner.ring->rate_generation = backend.rate_generation.load(std::memory_order_relaxed) - 1;
+			std::lock_guard lock(backend.rings_mutex);
+			backend.rings.push_back(owner.ring);
+		}
+		return *owner.ring;
 	}
 
-	void log_error(const std::string& msg, const char* FILE, const int LINE) {
-		std::cerr << libname << ": " << msg << '\n';
+	static void log_write(const LogBackend& backend, const uint8_t level, const std::string_view line) {
+		if (backend.sink) {
+			backend.sink(level, line);
+			return;
+		}
+		auto& stream = (level >= LOG_LEVEL_ERROR) ? std::cerr : std::cout;
+		stream << line << '\n';
 	}
 
-	void log_warning(const std::string& msg, const char* FILE, const int LINE) {
-		std::cout << libname << ": " << msg << '\n';
+	static void log_put_fixed64(std::string& out, const uint64_t value) {
+		for (int i = 0; i < 8; i++) {
+			out.push_back(static_cast<char>(value >> (i * 8)));
+		}
 	}
 
-	void log_info(const std::string& msg, const char* FILE, const int LINE) {
-		std::cout << libname << ": " << msg << '\n';
+	static uint64_t log_zigzag(const int64_t value) {
+		return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
 	}
 
-	void log_debug(const std::string& msg, const char* FILE, const int LINE) {
-		std::cout << libname << ": " << msg << '\n';
+	static void log_encode_record(LogBinaryFile& file, const LogRecord& record) {
+		auto& out = file.buffer;
+		auto [it, inserted] = file.format_ids.try_emplace(record.fmt.data(), static_cast<uint32_t>(file.format_ids.size()));
+		if (inserted) {
+			out.push_back(LOG_ENTRY_FORMAT);
+			log_put_varint(out, it->second);
+			log_put_varint(out, record.fmt.size());
+			out += record.fmt;
+		}
+		out.push_back(LOG_ENTRY_RECORD);
+		out.push_back(static_cast<char>(record.level | (record.has_wsa_error ? LOG_LEVEL_HAS_WSA_ERROR : 0)));
+		log_put_varint(out, it->second);
+		log_put_varint(out, log_zigzag(static_cast<int64_t>(record.time_ns - file.last_time_ns)));
+		file.last_time_ns = record.time_ns;
+		record.ops->encode(record.args.data(), out);
+		if (record.has_wsa_error) {
+			log_put_varint(out, log_zigzag(record.wsa_error));
+		}
+	}
+
+	static void log_drain(LogBackend& backend) {
+		std::lock_guard drain_lock(backend.drain_mutex);
+		std::vector<std::shared_ptr<LogRing>> rings;
+		{
+			std::lock_guard lock(backend.rings_mutex);
+			rings = backend.rings;
+		}
+		// Records of all threads are written in time order, at least within one drain
+		std::vector<LogRecord*> pending;
+		std::vector<uint64_t> heads;
+		uint64_t dropped = 0;
+		for (const auto& ring : rings) {
+			uint64_t head = ring->head.load(std::memory_order_acquire);
+			for (uint64_t i = ring->tail.load(std::memory_order_relaxed); i < head; i++) {
+				pending.push_back(&ring->records[i & (LOG_RING_SIZE - 1)]);
+			}
+			heads.push_back(head);
+			dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+		}
+		std::stable_sort(pending.begin(), pending.end(), [](const LogRecord* a, const LogRecord* b) {
+			return a->time_ns < b->time_ns;
+		});
+
+		std::string line;
+		for (auto record : pending) {
+			if (backend.binary) {
+				log_encode_record(*backend.binary, *record);
+			}
+			else {
+				line.assign(libname);
+				line += ": ";
+				try {
+					record->ops->format(record->fmt, record->args.data(), line);
+				}
+				catch (const std::format_error& error) {
+					// Format string was checked against caller's argument types, stored copies may not fit it
+					// (e.g. {:p} on a string). Writer thread must survive, so record keeps its format string.
+					line.assign(std::format("{}: [unformattable record '{}': {}]", libname, record->fmt, error.what()));
+				}
+				if (record->has_wsa_error) {
+					std::format_to(std::back_inserter(line), " WSAError({})", record->wsa_error);
+				}
+				log_write(backend, record->level, line);
+			}
+			record->ops->destroy(record->args.data());
+		}
+		for (size_t i = 0; i < rings.size(); i++) {
+			rings[i]->tail.store(heads[i], std::memory_order_release);
+		}
+		if (backend.binary) {
+			auto& file = *backend.binary;
+			if (dropped > 0) {
+				file.buffer.push_back(LOG_ENTRY_DROPPED);
+				log_put_varint(file.buffer, dropped);
+			}
+			if (!file.buffer.empty()) {
+				file.stream.write(file.buffer.data(), file.buffer.size());
+				file.stream.flush();
+				file.buffer.clear();
+			}
+		}
+		else if (dropped > 0) {
+			log_write(backend, LOG_LEVEL_WARNING, std::format("{}: {} log messages dropped.", libname, dropped));
+		}
+
+		std::lock_guard lock(backend.rings_mutex);
+		std::erase_if(backend.rings, [](const auto& ring) {
+			return ring->retired.load(std::memory_order_acquire) &&
+				ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire);
+		});
+	}
+
+	LogRecord* log_reserve(const uint8_t level) {
+		auto& ring = log_thread_ring();
+		auto& backend = log_backend();
+		uint32_t rate = backend.rate.load(std::memory_order_relaxed);
+		uint32_t generation = backend.rate_generation.load(std::memory_order_acquire);
+		if (ring.rate_generation != generation) {
+			ring.rate_generation = generation;
+			ring.tokens = rate;
+			ring.refill_ns = log_clock_ns();
+		}
+		// Errors are rare and the ones that matter, a flood of warnings must not hide them
+		bool limited = rate > 0 && level < LOG_LEVEL_ERROR;
+		if (limited) {
+			uint64_t now = log_clock_ns();
+			ring.tokens = (std::min)(static_cast<double>(rate), ring.tokens + (now - ring.refill_ns) * rate / 1e9);
+			ring.refill_ns = now;
+			if (ring.tokens < 1.0) {
+				ring.dropped.fetch_add(1, std::memory_order_relaxed);
+				return nullptr;
+			}
+			ring.tokens -= 1.0;
+		}
+		uint64_t head = ring.head.load(std::memory_order_relaxed);
+		if (head - ring.tail.load(std::memory_order_acquire) >= LOG_RING_SIZE) {
+			ring.dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		auto& record = ring.records[head & (LOG_RING_SIZE - 1)];
+		record.level = level;
+		record.time_ns = limited ? ring.refill_ns : log_clock_ns();
+		return &record;
+	}
+
+	void log_commit(LogRecord* record) {
+		// Record is always the one log_reserve() returned on this thread, publish it to the writer
+		auto& ring = log_thread_ring();
+		ring.head.store(ring.head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	int32_t log_last_wsa_error() {
+		return WSAGetLastError();
+	}
+
+	void log_set_sink(LogSink sink) {
+		auto& backend = log_backend();
+		std::lock_guard drain_lock(backend.drain_mutex);
+		backend.sink = std::move(sink);
+	}
+
+	void log_set_rate_limit(const uint32_t records_per_second) {
+		auto& backend = log_backend();
+		backend.rate.store(records_per_second, std::memory_order_relaxed);
+		backend.rate_generation.fetch_add(1, std::memory_order_release);
+	}
+
+	void log_flush() {
+		log_drain(log_backend());
+	}
+
+	bool log_set_binary_file(const std::string& path) {
+		auto& backend = log_backend();
+		// Records logged so far still go to the old destination
+		log_drain(backend);
+		std::lock_guard drain_lock(backend.drain_mutex);
+		backend.binary.reset();
+		if (path.empty()) {
+			return true;
+		}
+		auto file = std::make_unique<LogBinaryFile>();
+		file->stream.open(path, std::ios::binary | std::ios::trunc);
+		if (!file->stream) {
+			log_write(backend, LOG_LEVEL_ERROR, std::format("{}: Failed to open log file '{}'.", libname, path));
+			return false;
+		}
+		auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch());
+		file->last_time_ns = log_clock_ns();
+		std::string header(LOG_FILE_MAGIC);
+		header.push_back(static_cast<char>(LOG_FILE_VERSION));
+		log_put_varint(header, std::string_view(libname).size());
+		header += libname;
+		log_put_fixed64(header, wall.count());
+		log_put_fixed64(header, file->last_time_ns);
+		file->stream.write(header.data(), header.size());
+		backend.binary = std::move(file);
+		return true;
+	}
+
+	using LogDecodedArg = std::variant<bool, int64_t, uint64_t, double, std::string>;
+
+	// Sticky failure, once input runs out every read returns zero
+	struct LogFileReader {
+		std::istream& in;
+		bool ok = true;
+
+		uint8_t byte() {
+			char value = 0;
+			if (ok && !in.get(value)) {
+				ok = false;
+			}
+			return ok ? static_cast<uint8_t>(value) : 0;
+		}
+
+		uint64_t varint() {
+			uint64_t value = 0;
+			for (int shift = 0; ok && shift < 64; shift += 7) {
+				uint8_t next = byte();
+				value |= static_cast<uint64_t>(next & 0x7F) << shift;
+				if ((next & 0x80) == 0) {
+					return value;
+				}
+			}
+			ok = false;
+			return 0;
+		}
+
+		int64_t zigzag() {
+			uint64_t value = varint();
+			return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+		}
+
+		uint64_t fixed64() {
+			uint64_t value = 0;
+			for (int i = 0; i < 8; i++) {
+				value |= static_cast<uint64_t>(byte()) << (i * 8);
+			}
+			return value;
+		}
+
+		std::string string() {
+			uint64_t size = varint();
+			std::string value;
+			// Length comes from the file, read in chunks instead of trusting it with one allocation
+			while (ok && value.size() < size) {
+				char chunk[4096];
+				auto count = static_cast<std::streamsize>((std::min)(size - value.size(), sizeof(chunk)));
+				if (!in.read(chunk, count)) {
+					ok = false;
+					break;
+				}
+				value.append(chunk, count);
+			}
+			return value;
+		}
+	};
+
+	// Fields of netlib format strings are auto numbered, so each one formats next argument with its own spec
+	static void log_decode_format(const std::string_view fmt, const std::vector<LogDecodedArg>& args, std::string& out) {
+		size_t next_arg = 0;
+		for (size_t i = 0; i < fmt.size(); i++) {
+			char c = fmt[i];
+			if ((c == '{' || c == '}') && i + 1 < fmt.size() && fmt[i + 1] == c) {
+				out.push_back(c);
+				i++;
+				continue;
+			}
+			size_t end = (c == '{') ? fmt.find('}', i) : std::string_view::npos;
+			if (end == std::string_view::npos) {
+				out.push_back(c);
+				continue;
+			}
+			auto field = fmt.substr(i, end - i + 1);
+			auto colon = field.find(':');
+			std::string spec = (colon == std::string_view::npos) ? "{}" : "{" + std::string(field.substr(colon));
+			if (next_arg < args.size()) {
+				std::visit([&](const auto& value) {
+					try {
+						std::vformat_to(std::back_inserter(out), spec, std::make_format_args(value));
+					}
+					catch (const std::format_error&) {
+						// Argument was stored formatted (e.g. address) and spec no longer applies
+						std::format_to(std::back_inserter(out), "{}", value);
+					}
+				}, args[next_arg++]);
+			}
+			i = end;
+		}
+	}
+
+	static std::string log_decode_time(const uint64_t wall_ns) {
+		using namespace std::chrono;
+		auto time = sys_time<microseconds>(duration_cast<microseconds>(nanoseconds(wall_ns)));
+		auto day = floor<days>(time);
+		year_month_day date(day);
+		hh_mm_ss clock(time - day);
+		return std::format("{:04}-{:02}-{:02} {:02}:{:02}:{:02}.{:06}",
+			static_cast<int>(date.year()), static_cast<unsigned>(date.month()), static_cast<unsigned>(date.day()),
+			clock.hours().count(), clock.minutes().count(), clock.seconds().count(), clock.subseconds().count()
+		);
+	}
+
+	bool log_decode(std::istream& in, std::ostream& out) {
+		constexpr std::array<const char*, 4> level_names = { "debug", "info", "warning", "error" };
+		LogFileReader reader{ in };
+		std::string magic(LOG_FILE_MAGIC.size(), '\0');
+		if (!in.read(magic.data(), magic.size()) || magic != LOG_FILE_MAGIC || reader.byte() != LOG_FILE_VERSION) {
+			return false;
+		}
+		std::string name = reader.string();
+		uint64_t wall_base = reader.fixed64();
+		uint64_t time = reader.fixed64();
+		uint64_t steady_base = time;
+		if (!reader.ok) {
+			return false;
+		}
+
+		std::unordered_map<uint64_t, std::string> formats;
+		std::vector<LogDecodedArg> args;
+		std::string line;
+		while (in.peek() != std::char_traits<char>::eof()) {
+			char tag = static_cast<char>(reader.byte());
+			if (tag == LOG_ENTRY_FORMAT) {
+				uint64_t id = reader.varint();
+				formats[id] = reader.string();
+			}
+			else if (tag == LOG_ENTRY_DROPPED) {
+				out << std::format("{} warning {}: {} log messages dropped.\n", log_decode_time(wall_base + (time - steady_base)), name, reader.varint());
+			}
+			else if (tag == LOG_ENTRY_RECORD) {
+				uint8_t level = reader.byte();
+				auto format = formats.find(reader.varint());
+				time += reader.zigzag();
+				args.clear();
+				uint64_t argc = reader.varint();
+				for (uint64_t i = 0; reader.ok && i < argc; i++) {
+					uint8_t type = reader.byte();
+					switch (type) {
+					case LOG_ARG_BOOL: args.emplace_back(reader.byte() != 0); break;
+					case LOG_ARG_INT: args.emplace_back(reader.zigzag()); break;
+					case LOG_ARG_UINT: args.emplace_back(reader.varint()); break;
+					case LOG_ARG_DOUBLE: args.emplace_back(std::bit_cast<double>(reader.fixed64())); break;
+					case LOG_ARG_STRING: args.emplace_back(reader.string()); break;
+					default: reader.ok = false; break;
+					}
+				}
+				int64_t wsa_error = (level & LOG_LEVEL_HAS_WSA_ERROR) ? reader.zigzag() : 0;
+				if (!reader.ok || format == formats.end()) {
+					return false;
+				}
+				uint8_t level_index = (std::min)(static_cast<uint8_t>(level & ~LOG_LEVEL_HAS_WSA_ERROR), LOG_LEVEL_ERROR);
+				line = std::format("{} {} {}: ", log_decode_time(wall_base + (time - steady_base)), level_names[level_index], name);
+				log_decode_format(format->second, args, line);
+				if (level & LOG_LEVEL_HAS_WSA_ERROR) {
+					std::format_to(std::back_inserter(line), " WSAError({})", wsa_error);
+				}
+				out << line << '\n';
+			}
+			else {
+				return false;
+			}
+			if (!reader.ok) {
+				return false;
+			}
+		}
+		return true;
 	}
 }
\ No newline at end of file
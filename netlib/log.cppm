@@ -1,15 +1,201 @@
 module;
 
+#include <cstdint>
+
+// Calls below this level compile to nothing, define NETLIB_LOG_LEVEL in project settings to change it
+#ifndef NETLIB_LOG_LEVEL
+#ifdef NDEBUG
+#define NETLIB_LOG_LEVEL 1
+#else
+#define NETLIB_LOG_LEVEL 0
+#endif
+#endif
+
 export module netlib:log;
 import std;
 
 export namespace net {
 	constexpr const char* libname = "netlib";
 
-	// Logging
-	void log_wsa_error(const std::string& msg, const char* FILE = __FILE__, const int LINE = __LINE__);
-	void log_error(const std::string& msg, const char* FILE = __FILE__, const int LINE = __LINE__);
-	void log_warning(const std::string& msg, const char* FILE = __FILE__, const int LINE = __LINE__);
-	void log_info(const std::string& msg, const char* FILE = __FILE__, const int LINE = __LINE__);
-	void log_debug(const std::string& msg, const char* FILE = __FILE__, const int LINE = __LINE__);
+	constexpr uint8_t LOG_LEVEL_DEBUG = 0;
+	constexpr uint8_t LOG_LEVEL_INFO = 1;
+	constexpr uint8_t LOG_LEVEL_WARNING = 2;
+	constexpr uint8_t LOG_LEVEL_ERROR = 3;
+	constexpr uint8_t LOG_LEVEL_COMPILED = NETLIB_LOG_LEVEL;
+
+	// Bytes of arguments one record holds inline, larger argument sets are formatted by the caller
+	constexpr size_t LOG_ARGS_CAPACITY = 96;
+
+	// Type tags of raw arguments in binary log files
+	constexpr uint8_t LOG_ARG_BOOL = 1;
+	constexpr uint8_t LOG_ARG_INT = 2;		// zigzag varint
+	constexpr uint8_t LOG_ARG_UINT = 3;		// varint
+	constexpr uint8_t LOG_ARG_DOUBLE = 4;	// 8 bytes little endian
+	constexpr uint8_t LOG_ARG_STRING = 5;	// varint length and bytes
+
+	// Stored argument tuple of one record, instantiated per argument types
+	struct LogArgsOps {
+		void (*format)(const std::string_view fmt, const std::byte* args, std::string& out);
+		void (*encode)(const std::byte* args, std::string& out);
+		void (*destroy)(std::byte* args);
+	};
+
+	// One log call waiting in calling thread's ring. Only log templates and the background writer touch it.
+	struct LogRecord {
+		const LogArgsOps* ops;
+		std::string_view fmt;
+		uint64_t time_ns;
+		int32_t wsa_error;
+		uint8_t level;
+		bool has_wsa_error;
+		alignas(std::max_align_t) std::array<std::byte, LOG_ARGS_CAPACITY> args;
+	};
+
+	// Used by log templates. Reserves next record of calling thread's ring, nullptr when ring is full or
+	// thread is over its rate limit; the call is then counted as dropped and reported by the writer.
+	LogRecord*	log_reserve(const uint8_t level);
+	void		log_commit(LogRecord* record);
+	int32_t		log_last_wsa_error();
+
+	// Pointers to characters are copied, caller's buffer may be gone by the time record is formatted
+	template<typename T>
+	using LogStored = std::conditional_t<
+		std::is_convertible_v<std::decay_t<T>, std::string_view> && !std::is_same_v<std::decay_t<T>, std::string>,
+		std::string,
+		std::decay_t<T>
+	>;
+
+	inline void log_put_varint(std::string& out, uint64_t value) {
+		while (value >= 0x80) {
+			out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<char>(value));
+	}
+
+	// Numbers and strings are stored raw, anything else (addresses, ranges) is formatted on the writer thread
+	template<typename T>
+	void log_encode_value(const T& value, std::string& out) {
+		if constexpr (std::is_same_v<T, bool>) {
+			out.push_back(static_cast<char>(LOG_ARG_BOOL));
+			out.push_back(value ? 1 : 0);
+		}
+		else if constexpr (std::is_integral_v<T> && std::is_signed_v<T> && !std::is_same_v<T, char>) {
+			auto wide = static_cast<int64_t>(value);
+			out.push_back(static_cast<char>(LOG_ARG_INT));
+			log_put_varint(out, (static_cast<uint64_t>(wide) << 1) ^ static_cast<uint64_t>(wide >> 63));
+		}
+		else if constexpr (std::is_integral_v<T> && std::is_unsigned_v<T> && !std::is_same_v<T, char>) {
+			out.push_back(static_cast<char>(LOG_ARG_UINT));
+			log_put_varint(out, value);
+		}
+		else if constexpr (std::is_floating_point_v<T>) {
+			auto bits = std::bit_cast<uint64_t>(static_cast<double>(value));
+			out.push_back(static_cast<char>(LOG_ARG_DOUBLE));
+			for (int i = 0; i < 8; i++) {
+				out.push_back(static_cast<char>(bits >> (i * 8)));
+			}
+		}
+		else if constexpr (std::is_same_v<T, std::string>) {
+			out.push_back(static_cast<char>(LOG_ARG_STRING));
+			log_put_varint(out, value.size());
+			out += value;
+		}
+		else {
+			log_encode_value(std::format("{}", value), out);
+		}
+	}
+
+	template<typename Tuple>
+	void log_format_stored(const std::string_view fmt, const std::byte* args, std::string& out) {
+		auto stored = std::launder(reinterpret_cast<const Tuple*>(args));
+		std::apply([&](const auto&... values) {
+			std::vformat_to(std::back_inserter(out), fmt, std::make_format_args(values...));
+		}, *stored);
+	}
+
+	template<typename Tuple>
+	void log_encode_stored(const std::byte* args, std::string& out) {
+		auto stored = std::launder(reinterpret_cast<const Tuple*>(args));
+		log_put_varint(out, std::tuple_size_v<Tuple>);
+		std::apply([&](const auto&... values) {
+			(log_encode_value(values, out), ...);
+		}, *stored);
+	}
+
+	template<typename Tuple>
+	void log_destroy_stored(std::byte* args) {
+		std::launder(reinterpret_cast<Tuple*>(args))->~Tuple();
+	}
+
+	template<typename Tuple>
+	constexpr LogArgsOps log_args_ops{ &log_format_stored<Tuple>, &log_encode_stored<Tuple>, &log_destroy_stored<Tuple> };
+
+	template<uint8_t LEVEL, typename... Args>
+	void log_push(const std::format_string<Args...> fmt, const bool wsa_error, Args&&... args) {
+		if constexpr (LEVEL >= LOG_LEVEL_COMPILED) {
+			int32_t error = wsa_error ? log_last_wsa_error() : 0;
+			auto record = log_reserve(LEVEL);
+			if (!record) {
+				return;
+			}
+			using Stored = std::tuple<LogStored<Args>...>;
+			if constexpr (sizeof(Stored) <= LOG_ARGS_CAPACITY && alignof(Stored) <= alignof(std::max_align_t)) {
+				new (record->args.data()) Stored(std::forward<Args>(args)...);
+				record->ops = &log_args_ops<Stored>;
+				record->fmt = fmt.get();
+			}
+			else {
+				new (record->args.data()) std::tuple<std::string>(std::format(fmt, std::forward<Args>(args)...));
+				record->ops = &log_args_ops<std::tuple<std::string>>;
+				record->fmt = "{}";
+			}
+			record->wsa_error = error;
+			record->has_wsa_error = wsa_error;
+			log_commit(record);
+		}
+	}
+
+	// Logging never blocks and never formats on calling thread. Arguments are copied into a per-thread
+	// lock-free ring and formatted by a background writer; when ring is full the message is dropped.
+	template<typename... Args>
+	void log_wsa_error(const std::format_string<Args...> fmt, Args&&... args) {
+		log_push<LOG_LEVEL_ERROR>(fmt, true, std::forward<Args>(args)...);
+	}
+
+	template<typename... Args>
+	void log_error(const std::format_string<Args...> fmt, Args&&... args) {
+		log_push<LOG_LEVEL_ERROR>(fmt, false, std::forward<Args>(args)...);
+	}
+
+	template<typename... Args>
+	void log_warning(const std::format_string<Args...> fmt, Args&&... args) {
+		log_push<LOG_LEVEL_WARNING>(fmt, false, std::forward<Args>(args)...);
+	}
+
+	template<typename... Args>
+	void log_info(const std::format_string<Args...> fmt, Args&&... args) {
+		log_push<LOG_LEVEL_INFO>(fmt, false, std::forward<Args>(args)...);
+	}
+
+	template<typename... Args>
+	void log_debug(const std::format_string<Args...> fmt, Args&&... args) {
+		log_push<LOG_LEVEL_DEBUG>(fmt, false, std::forward<Args>(args)...);
+	}
+
+	// Receives every formatted line on writer thread, default sink prints errors to std::cerr and rest to std::cout
+	using LogSink = std::function<void(const uint8_t level, const std::string_view line)>;
+	void		log_set_sink(LogSink sink);
+	// Records per second each thread may log, bursts up to one second worth. 0 disables the limit.
+	// Errors are never rate limited, they are dropped only when thread's ring is full.
+	void		log_set_rate_limit(const uint32_t records_per_second);
+	// Writes everything logged so far before returning
+	void		log_flush();
+	// Writes records into binary file instead of the sink, empty path closes it and returns to text output.
+	// Every format string is stored once, records keep only its id, timestamp and raw arguments, so nothing
+	// is formatted while logging. netlib-logdump or log_decode() turn the file back into text.
+	bool		log_set_binary_file(const std::string& path);
+	// Writes text of binary log file into 'out', one line per record. Returns false when input is not a log
+	// file or is cut short, lines decoded until then are written anyway.
+	bool		log_decode(std::istream& in, std::ostream& out);
 }
\ No newline at end of file
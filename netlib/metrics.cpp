@@ -0,0 +1,261 @@
+module;
+
+#include <cstdint>
+
+module netlib:metrics;
+import :log;
+
+namespace net {
+	struct MetricsRegistry {
+		std::mutex mutex;
+		// Maps own their metrics, node based so references handed out stay valid as metrics are added
+		std::map<std::string, std::pair<std::string, std::unique_ptr<MetricCounter>>, std::less<>> counters;
+		std::map<std::string, std::pair<std::string, std::unique_ptr<MetricGauge>>, std::less<>> gauges;
+		std::map<std::string, std::pair<std::string, std::unique_ptr<MetricHistogram>>, std::less<>> histograms;
+	};
+
+	// Never destroyed, metrics may still be updated while statics are torn down
+	static MetricsRegistry& metrics_registry() {
+		static MetricsRegistry* registry = new MetricsRegistry();
+		return *registry;
+	}
+
+	static size_t metrics_thread_shard() {
+		static std::atomic<size_t> next_shard = 0;
+		thread_local size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed);
+		return shard;
+	}
+
+	void MetricCounter::add(const uint64_t value) {
+		shards[metrics_thread_shard() % METRICS_SHARDS].value.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	uint64_t MetricCounter::value() const {
+		uint64_t total = 0;
+		for (const auto& shard : shards) {
+			total += shard.value.load(std::memory_order_relaxed);
+		}
+		return total;
+	}
+
+	void MetricGauge::set(const int64_t value) {
+		current.store(value, std::memory_order_relaxed);
+	}
+
+	void MetricGauge::add(const int64_t delta) {
+		current.fetch_add(delta, std::memory_order_relaxed);
+	}
+
+	int64_t MetricGauge::value() const {
+		return current.load(std::memory_order_relaxed);
+	}
+
+	uint64_t MetricHistogramSnapshot::quantile(const double q) const {
+		if (count == 0) {
+			return 0;
+		}
+		auto rank = static_cast<uint64_t>(std::ceil(std::clamp(q, 0.0, 1.0) * count));
+		uint64_t seen = 0;
+		for (const auto& [upper_bound, bucket_count] : buckets) {
+			seen += bucket_count;
+			if (seen >= rank) {
+				return (std::min)(upper_bound, max);
+			}
+		}
+		return max;
+	}
+
+	// Values below 2^(SUB_BITS + 1) get a bucket each, above that every power of two is split into 2^SUB_BITS
+	size_t MetricHistogram::bucket_index(const uint64_t value) {
+		auto bits = static_cast<uint32_t>(std::bit_width(value));
+		if (bits <= METRICS_HISTOGRAM_SUB_BITS + 1) {
+			return static_cast<size_t>(value);
+		}
+		uint32_t shift = bits - METRICS_HISTOGRAM_SUB_BITS - 1;
+		return (static_cast<size_t>(shift) << METRICS_HISTOGRAM_SUB_BITS) + static_cast<size_t>(value >> shift);
+	}
+
+	uint64_t MetricHistogram::bucket_upper_bound(const size_t index) {
+		constexpr size_t sub_buckets = size_t(1) << METRICS_HISTOGRAM_SUB_BITS;
+		if (index < 2 * sub_buckets) {
+			return index;
+		}
+		if (index >= METRICS_HISTOGRAM_BUCKETS - 1) {
+			return UINT64_MAX;
+		}
+		size_t shift = (index >> METRICS_HISTOGRAM_SUB_BITS) - 1;
+		uint64_t top = index - (shift << METRICS_HISTOGRAM_SUB_BITS);
+		return ((top + 1) << shift) - 1;
+	}
+
+	void MetricHistogram::record(const uint64_t value) {
+		auto& shard = shards[metrics_thread_shard() % METRICS_HISTOGRAM_SHARDS];
+		shard.counts[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+		shard.sum.fetch_add(value, std::memory_order_relaxed);
+		uint64_t max = shard.max.load(std::memory_order_relaxed);
+		while (value > max && !shard.max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+	}
+
+	MetricHistogramSnapshot MetricHistogram::snapshot() const {
+		MetricHistogramSnapshot result{};
+		for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++) {
+			uint64_t count = 0;
+			for (const auto& shard : shards) {
+				count += shard.counts[i].load(std::memory_order_relaxed);
+			}
+			if (count > 0) {
+				result.buckets.emplace_back(bucket_upper_bound(i), count);
+				result.count += count;
+			}
+		}
+		for (const auto& shard : shards) {
+			result.sum += shard.sum.load(std::memory_order_relaxed);
+			result.max = (std::max)(result.max, shard.max.load(std::memory_order_relaxed));
+		}
+		return result;
+	}
+
+	template<typename T>
+	static T& metrics_register(std::map<std::string, std::pair<std::string, std::unique_ptr<T>>, std::less<>>& metrics, const std::string_view name, const std::string_view help) {
+		std::lock_guard lock(metrics_registry().mutex);
+		auto it = metrics.find(name);
+		if (it == metrics.end()) {
+			it = metrics.emplace(std::string(name), std::make_pair(std::string(help), std::make_unique<T>())).first;
+		}
+		return *it->second.second;
+	}
+
+	MetricCounter& metrics_counter(const std::string_view name, const std::string_view help) {
+		return metrics_register(metrics_registry().counters, name, help);
+	}
+
+	MetricGauge& metrics_gauge(const std::string_view name, const std::string_view help) {
+		return metrics_register(metrics_registry().gauges, name, help);
+	}
+
+	MetricHistogram& metrics_histogram(const std::string_view name, const std::string_view help) {
+		return metrics_register(metrics_registry().histograms, name, help);
+	}
+
+	MetricsSnapshot metrics_snapshot() {
+		auto& registry = metrics_registry();
+		std::lock_guard lock(registry.mutex);
+		MetricsSnapshot snapshot{};
+		for (const auto& [name, metric] : registry.counters) {
+			snapshot.counters.push_back({ name, metric.first, metric.second->value() });
+		}
+		for (const auto& [name, metric] : registry.gauges) {
+			snapshot.gauges.push_back({ name, metric.first, metric.second->value() });
+		}
+		for (const auto& [name, metric] : registry.histograms) {
+			snapshot.histograms.push_back({ name, metric.first, metric.second->snapshot() });
+		}
+		return snapshot;
+	}
+
+	static void metrics_prometheus_header(std::string& out, const std::string& name, const std::string& help, const std::string_view type) {
+		if (!help.empty()) {
+			std::format_to(std::back_inserter(out), "# HELP {} {}\n", name, help);
+		}
+		std::format_to(std::back_inserter(out), "# TYPE {} {}\n", name, type);
+	}
+
+	std::string metrics_to_prometheus(const MetricsSnapshot& snapshot) {
+		std::string out;
+		for (const auto& counter : snapshot.counters) {
+			metrics_prometheus_header(out, counter.name, counter.help, "counter");
+			std::format_to(std::back_inserter(out), "{} {}\n", counter.name, counter.value);
+		}
+		for (const auto& gauge : snapshot.gauges) {
+			metrics_prometheus_header(out, gauge.name, gauge.help, "gauge");
+			std::format_to(std::back_inserter(out), "{} {}\n", gauge.name, gauge.value);
+		}
+		for (const auto& histogram : snapshot.histograms) {
+			metrics_prometheus_header(out, histogram.name, histogram.help, "histogram");
+			// Prometheus buckets are cumulative and every scrape must carry the same series, so bounds are fixed at
+			// 2^k - 1 which always end a histogram bucket; finer resolution is in JSON export
+			uint64_t cumulative = 0;
+			auto bucket = histogram.value.buckets.begin();
+			for (uint32_t bits = 0; bits < 64; bits++) {
+				uint64_t le = (uint64_t{ 1 } << bits) - 1;
+				for (; bucket != histogram.value.buckets.end() && bucket->first <= le; bucket++) {
+					cumulative += bucket->second;
+				}
+				std::format_to(std::back_inserter(out), "{}_bucket{{le=\"{}\"}} {}\n", histogram.name, le, cumulative);
+			}
+			std::format_to(std::back_inserter(out), "{}_bucket{{le=\"+Inf\"}} {}\n", histogram.name, histogram.value.count);
+			std::format_to(std::back_inserter(out), "{}_sum {}\n", histogram.name, histogram.value.sum);
+			std::format_to(std::back_inserter(out), "{}_count {}\n", histogram.name, histogram.value.count);
+		}
+		return out;
+	}
+
+	// Prometheus names need no escaping, this keeps JSON valid for any name registered anyway
+	static void metrics_json_string(std::string& out, const std::string_view value) {
+		out.push_back('"');
+		for (const char c : value) {
+			if (c == '"' || c == '\\') {
+				out.push_back('\\');
+				out.push_back(c);
+			}
+			else if (static_cast<unsigned char>(c) < 0x20) {
+				std::format_to(std::back_inserter(out), "\\u{:04x}", static_cast<unsigned>(c));
+			}
+			else {
+				out.push_back(c);
+			}
+		}
+		out.push_back('"');
+	}
+
+	std::string metrics_to_json(const MetricsSnapshot& snapshot) {
+		std::string out = "{\"counters\":{";
+		for (size_t i = 0; i < snapshot.counters.size(); i++) {
+			out += (i > 0) ? "," : "";
+			metrics_json_string(out, snapshot.counters[i].name);
+			std::format_to(std::back_inserter(out), ":{}", snapshot.counters[i].value);
+		}
+		out += "},\"gauges\":{";
+		for (size_t i = 0; i < snapshot.gauges.size(); i++) {
+			out += (i > 0) ? "," : "";
+			metrics_json_string(out, snapshot.gauges[i].name);
+			std::format_to(std::back_inserter(out), ":{}", snapshot.gauges[i].value);
+		}
+		out += "},\"histograms\":{";
+		for (size_t i = 0; i < snapshot.histograms.size(); i++) {
+			const auto& histogram = snapshot.histograms[i].value;
+			out += (i > 0) ? "," : "";
+			metrics_json_string(out, snapshot.histograms[i].name);
+			std::format_to(std::back_inserter(out), ":{{\"count\":{},\"sum\":{},\"max\":{},\"p50\":{},\"p90\":{},\"p99\":{},\"p999\":{},\"buckets\":[",
+				histogram.count, histogram.sum, histogram.max,
+				histogram.quantile(0.5), histogram.quantile(0.9), histogram.quantile(0.99), histogram.quantile(0.999)
+			);
+			for (size_t j = 0; j < histogram.buckets.size(); j++) {
+				std::format_to(std::back_inserter(out), "{}[{},{}]", (j > 0) ? "," : "", histogram.buckets[j].first, histogram.buckets[j].second);
+			}
+			out += "]}";
+		}
+		out += "}}\n";
+		return out;
+	}
+
+	bool metrics_write_file(const std::string& path, const MetricsFormat format) {
+		auto snapshot = metrics_snapshot();
+		auto text = (format == MetricsFormat::JSON) ? metrics_to_json(snapshot) : metrics_to_prometheus(snapshot);
+		auto temp_path = path + ".tmp";
+		{
+			std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+			if (!file.write(text.data(), text.size())) {
+				log_error("Writing metrics to '{}' failed.", temp_path);
+				return false;
+			}
+		}
+		std::error_code error;
+		std::filesystem::rename(temp_path, path, error);
+		if (error) {
+			log_error("Renaming metrics file to '{}' failed: {}", path, error.message());
+			return false;
+		}
+		return true;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,94 @@
+module;
+
+#include <cstdint>
+
+export module netlib:metrics;
+import std;
+
+export namespace net {
+	// Counters are split into this many cache lines, threads pick one round robin on first use
+	constexpr size_t METRICS_SHARDS = 16;
+	constexpr size_t METRICS_HISTOGRAM_SHARDS = 4;
+	// Histogram keeps 2^5 linear buckets per power of two, so recorded values are off by at most 1/32
+	constexpr uint32_t METRICS_HISTOGRAM_SUB_BITS = 5;
+	constexpr size_t METRICS_HISTOGRAM_BUCKETS = (65 - METRICS_HISTOGRAM_SUB_BITS) << METRICS_HISTOGRAM_SUB_BITS;
+
+	// Monotonic, adding is one relaxed atomic add on the calling thread's own cache line
+	class MetricCounter {
+	public:
+		void		add(const uint64_t value = 1);
+		uint64_t	value() const;
+	private:
+		struct alignas(64) Shard {
+			std::atomic<uint64_t> value = 0;
+		};
+		std::array<Shard, METRICS_SHARDS> shards;
+	};
+
+	class MetricGauge {
+	public:
+		void		set(const int64_t value);
+		void		add(const int64_t delta);
+		int64_t		value() const;
+	private:
+		std::atomic<int64_t> current = 0;
+	};
+
+	struct MetricHistogramSnapshot {
+		uint64_t count = 0;
+		uint64_t sum = 0;
+		uint64_t max = 0;
+		// Non-empty buckets in ascending order as inclusive upper bound and count
+		std::vector<std::pair<uint64_t, uint64_t>> buckets;
+
+		// Upper bound of bucket holding given quantile (0.0 - 1.0), 0 when empty
+		uint64_t	quantile(const double q) const;
+	};
+
+	// HDR style log-linear histogram of non-negative integers (latencies in us, sizes in bytes)
+	class MetricHistogram {
+	public:
+		void		record(const uint64_t value);
+		MetricHistogramSnapshot snapshot() const;
+
+		static size_t	bucket_index(const uint64_t value);
+		static uint64_t	bucket_upper_bound(const size_t index);
+	private:
+		struct alignas(64) Shard {
+			std::array<std::atomic<uint64_t>, METRICS_HISTOGRAM_BUCKETS> counts{};
+			std::atomic<uint64_t> sum = 0;
+			std::atomic<uint64_t> max = 0;
+		};
+		std::array<Shard, METRICS_HISTOGRAM_SHARDS> shards;
+	};
+
+	struct MetricsSnapshot {
+		template<typename T>
+		struct Entry {
+			std::string name;
+			std::string help;
+			T value;
+		};
+		std::vector<Entry<uint64_t>> counters;
+		std::vector<Entry<int64_t>> gauges;
+		std::vector<Entry<MetricHistogramSnapshot>> histograms;
+	};
+
+	enum class MetricsFormat {
+		PROMETHEUS,
+		JSON
+	};
+
+	// Metrics live until process exit, so callers keep the reference. Registering a name again returns the
+	// existing metric, names must be valid Prometheus metric names (netlib ones start with 'netlib_').
+	MetricCounter&		metrics_counter(const std::string_view name, const std::string_view help = {});
+	MetricGauge&		metrics_gauge(const std::string_view name, const std::string_view help = {});
+	MetricHistogram&	metrics_histogram(const std::string_view name, const std::string_view help = {});
+
+	// Values are read one by one while threads keep updating them, so snapshot is not one point in time
+	MetricsSnapshot		metrics_snapshot();
+	std::string			metrics_to_prometheus(const MetricsSnapshot& snapshot);
+	std::string			metrics_to_json(const MetricsSnapshot& snapshot);
+	// Writes snapshot to temporary file next to 'path' and renames it, so scrapers never read half a file
+	bool				metrics_write_file(const std::string& path, const MetricsFormat format);
+}
\ No newline at end of file
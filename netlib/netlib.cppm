@@ -1,12 +1,19 @@
 module;
 
-#include <WinSock2.h>
+#include "socket_platform.h"
 
 export module netlib;
+export import :log;
+export import :metrics;
+export import :packet_pool;
 export import :socket;
 export import :stun;
 export import :dns;
 export import :ice;
+export import :netsim;
+export import :reactor;
+export import :send_queue;
+export import :async;
 
 export namespace net {
 	bool netlib_init() {
@@ -18,6 +25,8 @@ export namespace net {
 	}
 
 	bool netlib_clean() {
+		dns_shutdown();
+		log_flush();
 		WSACleanup();
 		return true;
 	}
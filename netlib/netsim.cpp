@@ -0,0 +1,312 @@
+module;
+
+#include <cstdint>
+
+module netlib:netsim;
+import :stun;
+import :log;
+import byte_common;
+import std;
+
+namespace net {
+	constexpr uint16_t STUN_RESPONSE_CAPACITY = 64;
+
+	static uint64_t address_key(const Ipv4Address& address) {
+		return (static_cast<uint64_t>(address.ip) << 16) | address.port;
+	}
+
+	static uint64_t port_key(const NetSimHostId host, const uint16_t port) {
+		return (static_cast<uint64_t>(host) << 16) | port;
+	}
+
+	NetSim::NetSim(const uint32_t seed) :
+		engine(seed) {}
+
+	NetSimHostId NetSim::add_host(const uint32_t ip, const NatType nat, const uint32_t nat_ip, const NetSimLink& link) {
+		std::lock_guard lock(mutex);
+		Host host{};
+		host.ip = ip;
+		host.nat = nat;
+		host.nat_ip = nat_ip;
+		host.link = link;
+		hosts.emplace_back(std::move(host));
+		NetSimHostId id = static_cast<NetSimHostId>(hosts.size());
+		public_ips[nat == NatType::NONE ? ip : nat_ip] = id;
+		return id;
+	}
+
+	void NetSim::add_stun_server(const Ipv4Address& address, const NetSimLink& link) {
+		std::lock_guard lock(mutex);
+		stun_servers[address_key(address)] = link;
+	}
+
+	void NetSim::set_current_host(const NetSimHostId host) {
+		std::lock_guard lock(mutex);
+		current_host = host;
+	}
+
+	void NetSim::advance(const uint64_t duration_us) {
+		std::lock_guard lock(mutex);
+		now += duration_us;
+		deliver_due();
+	}
+
+	uint64_t NetSim::now_us() const {
+		std::lock_guard lock(mutex);
+		return now;
+	}
+
+	NetSimStats NetSim::stats() const {
+		std::lock_guard lock(mutex);
+		return counters;
+	}
+
+	Socket NetSim::udp_ipv4_init_socket() {
+		std::lock_guard lock(mutex);
+		if (current_host == 0 || current_host > hosts.size()) {
+			log_error("Creating simulated socket failed. No current host set.");
+			return 0;
+		}
+		auto& host = hosts[current_host - 1];
+		Socket socket = next_socket++;
+		uint16_t port = host.next_port++;
+		sockets[socket] = SimSocket{ current_host, port, {} };
+		bound_ports[port_key(current_host, port)] = socket;
+		return socket;
+	}
+
+	void NetSim::close_socket(const Socket socket) {
+		std::lock_guard lock(mutex);
+		auto sock = sockets.find(socket);
+		if (sock == sockets.end()) {
+			return;
+		}
+		bound_ports.erase(port_key(sock->second.host, sock->second.port));
+		sockets.erase(sock);
+	}
+
+	int NetSim::udp_ipv4_send_packet(const Socket socket, const void* data, const size_t size, const Ipv4Address& address) {
+		std::lock_guard lock(mutex);
+		auto sock = find_socket(socket);
+		if (!sock) {
+			log_error("Sending simulated packet failed. Unknown socket.");
+			return -1;
+		}
+		auto& host = hosts[sock->host - 1];
+		counters.packets_sent++;
+		Ipv4Address src{ host.ip, sock->port };
+		if (host.nat != NatType::NONE) {
+			src = nat_outbound(host, sock->port, address);
+		}
+		auto bytes = reinterpret_cast<const uint8_t*>(data);
+		schedule(src, address, std::vector<uint8_t>(bytes, bytes + size), host.link);
+		return static_cast<int>(size);
+	}
+
+	int NetSim::udp_ipv4_recv_packet(const Socket socket, void* data, const size_t size, Ipv4Address* address) {
+		std::lock_guard lock(mutex);
+		deliver_due();
+		auto sock = find_socket(socket);
+		if (!sock || sock->inbox.empty()) {
+			return -1;
+		}
+		auto& packet = sock->inbox.front();
+		size_t copied = (std::min)(size, packet.payload.size());
+		std::memcpy(data, packet.payload.data(), copied);
+		if (address) {
+			*address = packet.src;
+		}
+		sock->inbox.pop_front();
+		return static_cast<int>(copied);
+	}
+
+	int NetSim::wait_readable(const std::span<const Socket> sockets_to_wait, std::vector<Socket>& ready, const uint32_t timeout_us) {
+		std::lock_guard lock(mutex);
+		ready.clear();
+		const uint64_t deadline = (timeout_us == 0) ? UINT64_MAX : now + timeout_us;
+		for (;;) {
+			deliver_due();
+			for (const auto socket : sockets_to_wait) {
+				auto sock = find_socket(socket);
+				if (sock && !sock->inbox.empty()) {
+					ready.push_back(socket);
+				}
+			}
+			if (!ready.empty()) {
+				return static_cast<int>(ready.size());
+			}
+			if (events.empty() || events.top().deliver_at > deadline) {
+				if (deadline != UINT64_MAX) {
+					now = (std::max)(now, deadline);
+				}
+				return 0;
+			}
+			now = events.top().deliver_at;
+		}
+	}
+
+	Ipv4Address NetSim::get_src_address(const Socket socket) {
+		std::lock_guard lock(mutex);
+		auto sock = find_socket(socket);
+		if (!sock) {
+			return {};
+		}
+		return Ipv4Address{ hosts[sock->host - 1].ip, sock->port };
+	}
+
+	std::vector<Ipv4Address> NetSim::get_host_addresses() {
+		std::lock_guard lock(mutex);
+		if (current_host == 0 || current_host > hosts.size()) {
+			return {};
+		}
+		return { Ipv4Address{ hosts[current_host - 1].ip, 0 } };
+	}
+
+	Ipv4Address NetSim::nat_outbound(Host& host, const uint16_t internal_port, const Ipv4Address& remote) {
+		// Symmetric NAT allocates new mapping for every remote endpoint, other types reuse one per internal port
+		auto mapping_key = std::make_pair(internal_port, (host.nat == NatType::SYMMETRIC) ? address_key(remote) : 0);
+		auto mapping = host.nat_mappings.find(mapping_key);
+		uint16_t public_port = 0;
+		if (mapping == host.nat_mappings.end()) {
+			public_port = host.next_nat_port++;
+			host.nat_mappings[mapping_key] = public_port;
+			host.nat_bindings[public_port] = NatBinding{ internal_port, {} };
+		}
+		else {
+			public_port = mapping->second;
+		}
+		auto& binding = host.nat_bindings[public_port];
+		switch (host.nat) {
+		case NatType::RESTRICTED:
+			binding.permissions.insert(address_key(Ipv4Address{ remote.ip, 0 }));
+			break;
+		case NatType::PORT_RESTRICTED:
+		case NatType::SYMMETRIC:
+			binding.permissions.insert(address_key(remote));
+			break;
+		default:
+			break;
+		}
+		return Ipv4Address{ host.nat_ip, public_port };
+	}
+
+	void NetSim::schedule(const Ipv4Address& src, const Ipv4Address& dst, std::vector<uint8_t>&& payload, const NetSimLink& src_link) {
+		NetSimLink dst_link{};
+		if (auto link = find_link(dst.ip)) {
+			dst_link = *link;
+		}
+		std::uniform_real_distribution<double> loss_dist(0.0, 1.0);
+		if (loss_dist(engine) < src_link.loss || loss_dist(engine) < dst_link.loss) {
+			counters.packets_lost++;
+			return;
+		}
+		uint64_t delay = static_cast<uint64_t>(src_link.latency_us) + dst_link.latency_us;
+		uint32_t jitter = src_link.jitter_us + dst_link.jitter_us;
+		if (jitter > 0) {
+			delay += std::uniform_int_distribution<uint32_t>(0, jitter)(engine);
+		}
+		events.push(Event{ now + delay, event_counter++, src, dst, std::move(payload) });
+	}
+
+	void NetSim::deliver_due() {
+		while (!events.empty() && events.top().deliver_at <= now) {
+			Event event = std::move(const_cast<Event&>(events.top()));
+			events.pop();
+			deliver(event);
+		}
+	}
+
+	void NetSim::deliver(Event& event) {
+		if (stun_servers.contains(address_key(event.dst))) {
+			handle_stun_request(event);
+			return;
+		}
+		auto public_ip = public_ips.find(event.dst.ip);
+		if (public_ip == public_ips.end()) {
+			counters.packets_filtered++;
+			return;
+		}
+		NetSimHostId host_id = public_ip->second;
+		auto& host = hosts[host_id - 1];
+		uint16_t internal_port = event.dst.port;
+		if (host.nat != NatType::NONE) {
+			auto binding = host.nat_bindings.find(event.dst.port);
+			if (binding == host.nat_bindings.end()) {
+				counters.packets_filtered++;
+				return;
+			}
+			auto& permissions = binding->second.permissions;
+			bool allowed = false;
+			switch (host.nat) {
+			case NatType::FULL_CONE:
+				allowed = true;
+				break;
+			case NatType::RESTRICTED:
+				allowed = permissions.contains(address_key(Ipv4Address{ event.src.ip, 0 }));
+				break;
+			default:
+				allowed = permissions.contains(address_key(event.src));
+				break;
+			}
+			if (!allowed) {
+				counters.packets_filtered++;
+				return;
+			}
+			internal_port = binding->second.internal_port;
+		}
+		auto bound = bound_ports.find(port_key(host_id, internal_port));
+		if (bound == bound_ports.end()) {
+			counters.packets_filtered++;
+			return;
+		}
+		sockets[bound->second].inbox.emplace_back(Packet{ event.src, std::move(event.payload) });
+		counters.packets_delivered++;
+	}
+
+	void NetSim::handle_stun_request(const Event& event) {
+		auto reader = ByteNetworkReader(event.payload);
+		auto request = Stun::read_from(reader);
+		if (!request.has_value() || request->cls() != StunClass::REQUEST || request->method() != StunMethod::BINDING) {
+			counters.packets_filtered++;
+			return;
+		}
+		counters.packets_delivered++;
+		counters.stun_requests++;
+
+		Stun response{};
+		response.set_type(StunClass::SUCCESS_RESPONSE, StunMethod::BINDING);
+		response.set_transaction_id(request->transact_id());
+		auto attr = StunAttribute::create_attr_address_xor(StunAttributeType::XOR_MAPPED_ADDRESS);
+		attr->set_ip(event.src.ip);
+		attr->set_port(event.src.port);
+		response.add_attribute(std::move(attr));
+		auto writer = ByteNetworkWriter(STUN_RESPONSE_CAPACITY);
+		uint64_t size = response.write_into(writer);
+		if (size == 0) {
+			log_error("Cannot serialize simulated stun response.");
+			return;
+		}
+		std::vector<uint8_t> payload(writer.data().begin(), writer.data().begin() + size);
+		schedule(event.dst, event.src, std::move(payload), stun_servers[address_key(event.dst)]);
+	}
+
+	const NetSimLink* NetSim::find_link(const uint32_t ip) const {
+		auto public_ip = public_ips.find(ip);
+		if (public_ip != public_ips.end()) {
+			return &hosts[public_ip->second - 1].link;
+		}
+		auto server = stun_servers.lower_bound(address_key(Ipv4Address{ ip, 0 }));
+		if (server != stun_servers.end() && (server->first >> 16) == ip) {
+			return &server->second;
+		}
+		return nullptr;
+	}
+
+	NetSim::SimSocket* NetSim::find_socket(const Socket socket) {
+		auto sock = sockets.find(socket);
+		if (sock == sockets.end()) {
+			return nullptr;
+		}
+		return &sock->second;
+	}
+}
\ No newline at end of file
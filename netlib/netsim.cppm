@@ -0,0 +1,118 @@
+module;
+
+#include <cstdint>
+
+export module netlib:netsim;
+import :socket;
+import std;
+
+export namespace net {
+	// In-process network simulator. Installed with sock_set_backend() it takes over udp_ipv4_* and sock_* calls,
+	// so ICE/STUN code runs unchanged against simulated hosts, NATs and stand-in STUN servers.
+	// Time is virtual: waiting on sockets moves the clock to the next packet delivery instead of sleeping.
+	enum class NatType : uint8_t {
+		NONE,
+		FULL_CONE,			// endpoint independent mapping and filtering
+		RESTRICTED,			// endpoint independent mapping, address dependent filtering
+		PORT_RESTRICTED,	// endpoint independent mapping, address and port dependent filtering
+		SYMMETRIC,			// address and port dependent mapping and filtering
+	};
+
+	struct NetSimLink {
+		uint32_t latency_us = 0;	// one-way delay between endpoint and the core network
+		uint32_t jitter_us = 0;		// extra uniformly distributed delay
+		double loss = 0.0;			// probability of dropping packet on this link
+	};
+
+	struct NetSimStats {
+		uint64_t packets_sent = 0;
+		uint64_t packets_delivered = 0;
+		uint64_t packets_lost = 0;
+		uint64_t packets_filtered = 0;		// dropped by NAT filtering or unroutable
+		uint64_t stun_requests = 0;
+	};
+
+	using NetSimHostId = uint32_t;
+
+	class NetSim : public SocketBackend {
+	public:
+		NetSim(const uint32_t seed = 1);
+
+		// Host behind NAT is reachable from outside only through 'nat_ip'
+		NetSimHostId add_host(const uint32_t ip, const NatType nat = NatType::NONE, const uint32_t nat_ip = 0, const NetSimLink& link = {});
+		void add_stun_server(const Ipv4Address& address, const NetSimLink& link = {});
+		// Sockets created by udp_ipv4_init_socket() belong to the current host
+		void set_current_host(const NetSimHostId host);
+		void advance(const uint64_t duration_us);
+		uint64_t now_us() const override;
+		NetSimStats stats() const;
+
+		Socket		udp_ipv4_init_socket() override;
+		void		close_socket(const Socket socket) override;
+		int			udp_ipv4_send_packet(const Socket socket, const void* data, const size_t size, const Ipv4Address& address) override;
+		int			udp_ipv4_recv_packet(const Socket socket, void* data, const size_t size, Ipv4Address* address) override;
+		int			wait_readable(const std::span<const Socket> sockets, std::vector<Socket>& ready, const uint32_t timeout_us) override;
+		Ipv4Address	get_src_address(const Socket socket) override;
+		std::vector<Ipv4Address> get_host_addresses() override;
+	private:
+		struct Packet {
+			Ipv4Address src;
+			std::vector<uint8_t> payload;
+		};
+
+		struct Event {
+			uint64_t deliver_at;
+			uint64_t order;
+			Ipv4Address src;
+			Ipv4Address dst;
+			std::vector<uint8_t> payload;
+			bool operator>(const Event& other) const {
+				return std::tie(deliver_at, order) > std::tie(other.deliver_at, other.order);
+			}
+		};
+
+		struct NatBinding {
+			uint16_t internal_port;
+			std::set<uint64_t> permissions;
+		};
+
+		struct Host {
+			uint32_t ip;
+			NatType nat;
+			uint32_t nat_ip;
+			NetSimLink link;
+			uint16_t next_port = 40000;
+			uint16_t next_nat_port = 50000;
+			std::map<std::pair<uint16_t, uint64_t>, uint16_t> nat_mappings;	// (internal port, remote) -> public port
+			std::map<uint16_t, NatBinding> nat_bindings;						// public port -> binding
+		};
+
+		struct SimSocket {
+			NetSimHostId host;
+			uint16_t port;
+			std::deque<Packet> inbox;
+		};
+
+		Ipv4Address nat_outbound(Host& host, const uint16_t internal_port, const Ipv4Address& remote);
+		void schedule(const Ipv4Address& src, const Ipv4Address& dst, std::vector<uint8_t>&& payload, const NetSimLink& src_link);
+		void deliver_due();
+		void deliver(Event& event);
+		void handle_stun_request(const Event& event);
+		const NetSimLink* find_link(const uint32_t ip) const;
+		SimSocket* find_socket(const Socket socket);
+
+		mutable std::mutex mutex;
+		std::mt19937 engine;
+		uint64_t now = 0;
+		uint64_t event_counter = 0;
+		Socket next_socket = 1;
+		NetSimHostId current_host = 0;
+		NetSimStats counters;
+		std::vector<Host> hosts;
+		std::map<Socket, SimSocket> sockets;
+		std::map<uint64_t, Socket> bound_ports;			// (host, port) -> socket
+		std::map<uint32_t, NetSimHostId> public_ips;	// ip visible in the core network -> host
+		std::map<uint64_t, NetSimLink> stun_servers;
+		std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+	};
+}
\ No newline at end of file
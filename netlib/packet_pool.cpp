@@ -0,0 +1,175 @@
+module;
+
+#include <cstdint>
+
+module netlib:packet_pool;
+import std;
+
+namespace net {
+	constexpr size_t DEFAULT_POOL_MTU_BUFFERS = 256;
+	constexpr size_t DEFAULT_POOL_JUMBO_BUFFERS = 4;
+
+	struct PacketSlab {
+		PacketSlab(const size_t slot_size, const size_t slot_count) :
+			memory(std::make_unique<uint8_t[]>(slot_size * slot_count)),
+			refs(std::make_unique<std::atomic<uint32_t>[]>(slot_count)),
+			slot_size(slot_size) {
+			free_slots.reserve(slot_count);
+			// Lowest slots are handed out first
+			for (size_t i = slot_count; i > 0; i--) {
+				free_slots.push_back(static_cast<uint32_t>(i - 1));
+			}
+		}
+
+		std::optional<uint32_t> pop() {
+			std::lock_guard lock(mutex);
+			if (free_slots.empty()) {
+				return {};
+			}
+			uint32_t slot = free_slots.back();
+			free_slots.pop_back();
+			refs[slot].store(1, std::memory_order_relaxed);
+			return slot;
+		}
+
+		void push(const uint32_t slot) {
+			std::lock_guard lock(mutex);
+			free_slots.push_back(slot);
+		}
+
+		size_t available() {
+			std::lock_guard lock(mutex);
+			return free_slots.size();
+		}
+
+		std::unique_ptr<uint8_t[]> memory;
+		std::unique_ptr<std::atomic<uint32_t>[]> refs;
+		size_t slot_size;
+		std::mutex mutex;
+		std::vector<uint32_t> free_slots;
+	};
+
+	PacketBuffer::PacketBuffer(PacketSlab* slab, const uint32_t slot, const uint32_t offset, const uint32_t length) :
+		slab(slab), slot(slot), offset(offset), length(length) {}
+
+	PacketBuffer::PacketBuffer(const PacketBuffer& other) :
+		slab(other.slab), slot(other.slot), offset(other.offset), length(other.length) {
+		if (slab) {
+			slab->refs[slot].fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	PacketBuffer::PacketBuffer(PacketBuffer&& other) noexcept :
+		slab(std::exchange(other.slab, nullptr)), slot(other.slot), offset(other.offset), length(other.length) {}
+
+	PacketBuffer& PacketBuffer::operator=(const PacketBuffer& other) {
+		if (this != &other) {
+			PacketBuffer copy(other);
+			*this = std::move(copy);
+		}
+		return *this;
+	}
+
+	PacketBuffer& PacketBuffer::operator=(PacketBuffer&& other) noexcept {
+		if (this != &other) {
+			release();
+			slab = std::exchange(other.slab, nullptr);
+			slot = other.slot;
+			offset = other.offset;
+			length = other.length;
+		}
+		return *this;
+	}
+
+	PacketBuffer::~PacketBuffer() {
+		release();
+	}
+
+	void PacketBuffer::release() {
+		if (!slab) {
+			return;
+		}
+		// Last handle returns the slot, acquire ordering makes writes through other handles visible to next owner
+		if (slab->refs[slot].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			slab->push(slot);
+		}
+		slab = nullptr;
+	}
+
+	uint8_t* PacketBuffer::data() const {
+		return slab ? slab->memory.get() + slot * slab->slot_size + offset : nullptr;
+	}
+
+	size_t PacketBuffer::size() const {
+		return slab ? length : 0;
+	}
+
+	size_t PacketBuffer::capacity() const {
+		return slab ? slab->slot_size - offset : 0;
+	}
+
+	bool PacketBuffer::resize(const size_t size) {
+		if (size > capacity()) {
+			return false;
+		}
+		length = static_cast<uint32_t>(size);
+		return true;
+	}
+
+	std::span<uint8_t> PacketBuffer::span() const {
+		return std::span<uint8_t>(data(), size());
+	}
+
+	PacketBuffer PacketBuffer::slice(const size_t offset, const size_t length) const {
+		if (!slab) {
+			return {};
+		}
+		size_t start = (std::min)(offset, static_cast<size_t>(this->length));
+		size_t count = (std::min)(length, this->length - start);
+		slab->refs[slot].fetch_add(1, std::memory_order_relaxed);
+		return PacketBuffer(slab, slot, this->offset + static_cast<uint32_t>(start), static_cast<uint32_t>(count));
+	}
+
+	uint32_t PacketBuffer::use_count() const {
+		return slab ? slab->refs[slot].load(std::memory_order_relaxed) : 0;
+	}
+
+	PacketBuffer::operator bool() const {
+		return slab != nullptr;
+	}
+
+	PacketPool::PacketPool(const size_t mtu_buffers, const size_t jumbo_buffers) :
+		mtu_slab(std::make_unique<PacketSlab>(MTU_BUFFER_SIZE, mtu_buffers)),
+		jumbo_slab(std::make_unique<PacketSlab>(JUMBO_BUFFER_SIZE, jumbo_buffers)) {}
+
+	PacketPool::~PacketPool() = default;
+
+	PacketBuffer PacketPool::acquire(const size_t size) {
+		PacketSlab* slab = (size <= MTU_BUFFER_SIZE) ? mtu_slab.get() : (size <= JUMBO_BUFFER_SIZE) ? jumbo_slab.get() : nullptr;
+		std::optional<uint32_t> slot;
+		if (slab) {
+			slot = slab->pop();
+		}
+		if (!slot.has_value()) {
+			exhausted_count++;
+			return {};
+		}
+		return PacketBuffer(slab, *slot, 0, static_cast<uint32_t>(size));
+	}
+
+	size_t PacketPool::available(const size_t size) const {
+		if (size <= MTU_BUFFER_SIZE) {
+			return mtu_slab->available();
+		}
+		return (size <= JUMBO_BUFFER_SIZE) ? jumbo_slab->available() : 0;
+	}
+
+	uint64_t PacketPool::exhausted() const {
+		return exhausted_count;
+	}
+
+	PacketPool& packet_pool_default() {
+		static PacketPool pool(DEFAULT_POOL_MTU_BUFFERS, DEFAULT_POOL_JUMBO_BUFFERS);
+		return pool;
+	}
+}
\ No newline at end of file
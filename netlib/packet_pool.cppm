@@ -0,0 +1,70 @@
+module;
+
+#include <cstdint>
+
+export module netlib:packet_pool;
+import std;
+
+namespace net {
+	struct PacketSlab;
+}
+
+export namespace net {
+	// Handle to a pooled packet buffer. Copies and slices share one slot, which goes back to the pool when the
+	// last handle is released, so parsed views can keep pointing into received data without copying it.
+	// Handles may move between threads, the pool must outlive all of them.
+	class PacketBuffer {
+	public:
+		PacketBuffer() = default;
+		PacketBuffer(const PacketBuffer& other);
+		PacketBuffer(PacketBuffer&& other) noexcept;
+		PacketBuffer& operator=(const PacketBuffer& other);
+		PacketBuffer& operator=(PacketBuffer&& other) noexcept;
+		~PacketBuffer();
+
+		uint8_t*	data() const;
+		size_t		size() const;
+		// Bytes from data() to end of slot
+		size_t		capacity() const;
+		bool		resize(const size_t size);
+		std::span<uint8_t> span() const;
+		// View of 'length' bytes starting at 'offset', both clamped to this buffer
+		PacketBuffer slice(const size_t offset, const size_t length = SIZE_MAX) const;
+		uint32_t	use_count() const;
+		explicit operator bool() const;
+	private:
+		friend class PacketPool;
+		PacketBuffer(PacketSlab* slab, const uint32_t slot, const uint32_t offset, const uint32_t length);
+		void release();
+
+		PacketSlab* slab = nullptr;
+		uint32_t slot = 0;
+		uint32_t offset = 0;
+		uint32_t length = 0;
+	};
+
+	// Fixed number of MTU and jumbo sized buffers carved out of two slabs up front. Acquiring and releasing
+	// never allocates. Jumbo buffers hold coalesced (GRO/URO) receives and reassembled frames.
+	class PacketPool {
+	public:
+		static constexpr size_t MTU_BUFFER_SIZE = 2048;
+		static constexpr size_t JUMBO_BUFFER_SIZE = 65536;
+
+		PacketPool(const size_t mtu_buffers = 1024, const size_t jumbo_buffers = 16);
+		~PacketPool();
+		PacketPool(const PacketPool&) = delete;
+		PacketPool& operator=(const PacketPool&) = delete;
+
+		// Smallest free buffer holding 'size' bytes, with size() set to 'size'. Empty handle when exhausted.
+		PacketBuffer acquire(const size_t size = MTU_BUFFER_SIZE);
+		size_t		available(const size_t size = MTU_BUFFER_SIZE) const;
+		uint64_t	exhausted() const;
+	private:
+		std::unique_ptr<PacketSlab> mtu_slab;
+		std::unique_ptr<PacketSlab> jumbo_slab;
+		std::atomic<uint64_t> exhausted_count = 0;
+	};
+
+	// Shared pool used by netlib itself, sized for a handful of concurrent receives
+	PacketPool& packet_pool_default();
+}
\ No newline at end of file
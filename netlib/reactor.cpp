@@ -0,0 +1,222 @@
+module;
+
+#include <cstdint>
+
+module netlib:reactor;
+import :log;
+import std;
+
+namespace net {
+	constexpr uint32_t WAKE_PACKET_SIZE = 1;
+
+	Reactor::Reactor() {
+		// Simulated backends never block on real time, so they need no wake socket
+		if (sock_get_backend()) {
+			return;
+		}
+		wake_socket = udp_ipv4_init_socket();
+		if (wake_socket == 0) {
+			log_error("Creating reactor wake socket failed. Cross thread wake is disabled.");
+			return;
+		}
+		wake_address = Ipv4Address{ 0x7F000001, sock_get_src_address(wake_socket).port };
+		poller.add(wake_socket);
+	}
+
+	Reactor::~Reactor() {
+		if (wake_socket != 0) {
+			poller.remove(wake_socket);
+			sock_close(wake_socket);
+		}
+	}
+
+	bool Reactor::add_socket(const Socket socket, SocketCallback on_read, SocketCallback on_write) {
+		uint8_t events = (on_read ? SOCK_POLL_READ : 0) | (on_write ? SOCK_POLL_WRITE : 0);
+		if (!poller.add(socket, events)) {
+			return false;
+		}
+		sockets[socket] = std::make_shared<SocketHandlers>(SocketHandlers{ std::move(on_read), std::move(on_write) });
+		return true;
+	}
+
+	bool Reactor::set_read_callback(const Socket socket, SocketCallback on_read) {
+		return set_callback(socket, std::move(on_read), false);
+	}
+
+	bool Reactor::set_write_callback(const Socket socket, SocketCallback on_write) {
+		return set_callback(socket, std::move(on_write), true);
+	}
+
+	bool Reactor::set_callback(const Socket socket, SocketCallback callback, const bool write) {
+		auto found = sockets.find(socket);
+		if (found == sockets.end()) {
+			log_error("Setting callback for socket not registered in reactor.");
+			return false;
+		}
+		auto& handlers = *found->second;
+		const auto& on_read = write ? handlers.on_read : callback;
+		const auto& on_write = write ? callback : handlers.on_write;
+		if (!on_read && !on_write) {
+			return remove_socket(socket);
+		}
+		uint8_t events = (on_read ? SOCK_POLL_READ : 0) | (on_write ? SOCK_POLL_WRITE : 0);
+		if (!poller.modify(socket, events)) {
+			return false;
+		}
+		(write ? handlers.on_write : handlers.on_read) = std::move(callback);
+		return true;
+	}
+
+	bool Reactor::remove_socket(const Socket socket) {
+		if (sockets.erase(socket) == 0) {
+			return false;
+		}
+		return poller.remove(socket);
+	}
+
+	bool Reactor::has_socket(const Socket socket) const {
+		return sockets.contains(socket);
+	}
+
+	ReactorTimerId Reactor::add_timer(const uint32_t delay_us, TimerCallback callback, const uint32_t interval_us) {
+		ReactorTimerId id = next_timer_id++;
+		timers[id] = std::make_shared<Timer>(Timer{ std::move(callback), interval_us });
+		timer_queue.push(TimerEntry{ now_us() + delay_us, id });
+		return id;
+	}
+
+	bool Reactor::cancel_timer(const ReactorTimerId id) {
+		// Queue entry is dropped lazily when it comes due
+		return timers.erase(id) > 0;
+	}
+
+	int Reactor::run_once(const uint32_t timeout_us) {
+		int dispatched = run_posted() + run_due_timers();
+
+		uint32_t wait_us = timeout_us;
+		while (!timer_queue.empty() && !timers.contains(timer_queue.top().id)) {
+			timer_queue.pop();
+		}
+		if (!timer_queue.empty()) {
+			uint64_t now = now_us();
+			uint64_t due = timer_queue.top().due_us;
+			// Poller treats 0 as infinite wait, so due timer still waits the shortest possible time
+			uint64_t until_due = (due > now) ? due - now : 1;
+			if (wait_us == 0 || until_due < wait_us) {
+				wait_us = static_cast<uint32_t>((std::min<uint64_t>)(until_due, UINT32_MAX));
+			}
+		}
+		if (dispatched > 0 || stop_requested) {
+			wait_us = 1;
+		}
+
+		if (poller.wait(ready, wait_us) < 0) {
+			return -1;
+		}
+		for (const auto& event : ready) {
+			if (event.socket == wake_socket && wake_socket != 0) {
+				drain_wake_socket();
+				continue;
+			}
+			// Earlier callback in this batch may have removed the socket, handlers are kept alive while running
+			auto found = sockets.find(event.socket);
+			if (found == sockets.end()) {
+				continue;
+			}
+			auto handlers = found->second;
+			// Callbacks may replace themselves through set_*_callback() (e.g. send queue that drained), so run copies
+			if ((event.events & SOCK_POLL_READ) && handlers->on_read) {
+				auto on_read = handlers->on_read;
+				on_read(event.socket);
+				dispatched++;
+			}
+			if ((event.events & SOCK_POLL_WRITE) && handlers->on_write && sockets.contains(event.socket)) {
+				auto on_write = handlers->on_write;
+				on_write(event.socket);
+				dispatched++;
+			}
+		}
+		return dispatched + run_posted() + run_due_timers();
+	}
+
+	void Reactor::run() {
+		while (!stop_requested) {
+			if (run_once() < 0) {
+				break;
+			}
+		}
+		stop_requested = false;
+	}
+
+	void Reactor::stop() {
+		stop_requested = true;
+		wake();
+	}
+
+	void Reactor::wake() {
+		if (wake_socket == 0 || wake_pending.exchange(true)) {
+			return;
+		}
+		const uint8_t payload[WAKE_PACKET_SIZE] = { 0 };
+		udp_ipv4_send_packet(wake_socket, payload, sizeof(payload), wake_address);
+	}
+
+	void Reactor::post(TimerCallback callback) {
+		{
+			std::lock_guard lock(posted_mutex);
+			posted.push_back(std::move(callback));
+		}
+		wake();
+	}
+
+	uint64_t Reactor::now_us() const {
+		return sock_now_us();
+	}
+
+	int Reactor::run_due_timers() {
+		int dispatched = 0;
+		uint64_t now = now_us();
+		while (!timer_queue.empty() && timer_queue.top().due_us <= now) {
+			auto entry = timer_queue.top();
+			timer_queue.pop();
+			auto found = timers.find(entry.id);
+			if (found == timers.end()) {
+				continue;
+			}
+			auto timer = found->second;
+			if (timer->interval_us > 0) {
+				timer_queue.push(TimerEntry{ entry.due_us + timer->interval_us, entry.id });
+			}
+			else {
+				timers.erase(found);
+			}
+			timer->callback();
+			dispatched++;
+		}
+		return dispatched;
+	}
+
+	int Reactor::run_posted() {
+		{
+			std::lock_guard lock(posted_mutex);
+			if (posted.empty()) {
+				return 0;
+			}
+			// Callbacks run outside the lock, so they and other threads can post again meanwhile
+			posted.swap(posted_running);
+		}
+		int dispatched = static_cast<int>(posted_running.size());
+		for (auto& callback : posted_running) {
+			callback();
+		}
+		posted_running.clear();
+		return dispatched;
+	}
+
+	void Reactor::drain_wake_socket() {
+		// Flag is cleared before reading, so wake() racing with this sends new packet instead of being lost
+		wake_pending = false;
+		uint8_t payload[WAKE_PACKET_SIZE];
+		udp_ipv4_recv_packet(wake_socket, payload, sizeof(payload));
+	}
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+module;
+
+#include <cstdint>
+
+export module netlib:reactor;
+import :socket;
+import std;
+
+export namespace net {
+	using ReactorTimerId = uint64_t;
+	using SocketCallback = std::function<void(const Socket socket)>;
+	using TimerCallback = std::function<void()>;
+
+	// Single threaded event loop for socket readiness and timers. Registration and callbacks happen on the loop
+	// thread (or before run()), only post(), wake() and stop() may be called from other threads. Waking the loop
+	// does not allocate: it is one datagram sent to an internal socket. Time follows sock_now_us(), so under NetSim
+	// timers fire in virtual time.
+	class Reactor {
+	public:
+		Reactor();
+		~Reactor();
+		Reactor(const Reactor&) = delete;
+		Reactor& operator=(const Reactor&) = delete;
+
+		bool add_socket(const Socket socket, SocketCallback on_read, SocketCallback on_write = {});
+		// Empty callback stops watching socket for that event, socket left without callbacks is removed
+		bool set_read_callback(const Socket socket, SocketCallback on_read);
+		bool set_write_callback(const Socket socket, SocketCallback on_write);
+		bool remove_socket(const Socket socket);
+		bool has_socket(const Socket socket) const;
+
+		// Interval 0 creates one shot timer
+		ReactorTimerId add_timer(const uint32_t delay_us, TimerCallback callback, const uint32_t interval_us = 0);
+		bool cancel_timer(const ReactorTimerId id);
+
+		// Waits at most 'timeout_us' (0 = until something happens) and dispatches ready sockets and due timers.
+		// Returns number of callbacks run or -1 on error.
+		int run_once(const uint32_t timeout_us = 0);
+		// Runs until stop() is called
+		void run();
+		void stop();
+		void wake();
+		// Runs callback on loop thread during next run_once(), hands results of other threads over to the loop
+		void post(TimerCallback callback);
+		uint64_t now_us() const;
+	private:
+		struct SocketHandlers {
+			SocketCallback on_read;
+			SocketCallback on_write;
+		};
+
+		struct Timer {
+			TimerCallback callback;
+			uint32_t interval_us;
+		};
+
+		struct TimerEntry {
+			uint64_t due_us;
+			ReactorTimerId id;
+			bool operator>(const TimerEntry& other) const {
+				return std::tie(due_us, id) > std::tie(other.due_us, other.id);
+			}
+		};
+
+		bool set_callback(const Socket socket, SocketCallback callback, const bool write);
+		int run_due_timers();
+		int run_posted();
+		void drain_wake_socket();
+
+		SocketPoller poller;
+		std::unordered_map<Socket, std::shared_ptr<SocketHandlers>> sockets;
+		std::unordered_map<ReactorTimerId, std::shared_ptr<Timer>> timers;
+		std::priority_queue<TimerEntry, std::vector<TimerEntry>, std::greater<TimerEntry>> timer_queue;
+		std::vector<SocketPollEvent> ready;
+		ReactorTimerId next_timer_id = 1;
+		Socket wake_socket = 0;
+		Ipv4Address wake_address{};
+		std::atomic<bool> wake_pending = false;
+		std::atomic<bool> stop_requested = false;
+		std::mutex posted_mutex;
+		std::vector<TimerCallback> posted;
+		std::vector<TimerCallback> posted_running;
+	};
+}
\ No newline at end of file
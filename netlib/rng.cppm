@@ -1,24 +1,201 @@
 module;
 
+#include <cstdint>
+
 export module rng;
 import std;
 
-namespace rng {
-	static auto rng_init(const unsigned int seed = 0) {
-		if (seed != 0) {
-			return std::mt19937(seed);
+export namespace rng {
+	// xoshiro256** by Blackman and Vigna. Fast and statistically solid, but output is predictable from a few
+	// samples, so it is only for jitter, sampling and simulation. Anything a peer must not guess uses ChaCha20Rng.
+	class Xoshiro256 {
+	public:
+		using result_type = uint64_t;
+
+		// Seed is expanded with splitmix64, so nearby seeds still give unrelated streams
+		explicit Xoshiro256(uint64_t seed) {
+			for (auto& word : state) {
+				seed += 0x9E3779B97F4A7C15;
+				uint64_t z = seed;
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+				word = z ^ (z >> 31);
+			}
+		}
+
+		static constexpr result_type min() {
+			return 0;
+		}
+
+		static constexpr result_type max() {
+			return UINT64_MAX;
+		}
+
+		result_type operator()() {
+			uint64_t result = std::rotl(state[1] * 5, 7) * 9;
+			uint64_t t = state[1] << 17;
+			state[2] ^= state[0];
+			state[3] ^= state[1];
+			state[1] ^= state[2];
+			state[0] ^= state[3];
+			state[2] ^= t;
+			state[3] = std::rotl(state[3], 45);
+			return result;
+		}
+
+		void fill(const std::span<uint8_t> out) {
+			size_t i = 0;
+			for (; i + 8 <= out.size(); i += 8) {
+				uint64_t value = (*this)();
+				std::memcpy(out.data() + i, &value, 8);
+			}
+			if (i < out.size()) {
+				uint64_t value = (*this)();
+				std::memcpy(out.data() + i, &value, out.size() - i);
+			}
+		}
+	private:
+		std::array<uint64_t, 4> state{};
+	};
+
+	// ChaCha20 keystream (RFC 8439 block function, 64-bit counter and 64-bit stream id) used as CSPRNG.
+	// Four blocks are generated at once and handed out from a buffer, so small draws like 12 byte
+	// transaction ids cost a copy most of the time. Keystream bytes are wiped once handed out.
+	class ChaCha20Rng {
+	public:
+		using result_type = uint64_t;
+		static constexpr size_t BLOCK_SIZE = 64;
+		static constexpr size_t BUFFER_BLOCKS = 4;
+
+		// Key comes from std::random_device (OS entropy on Windows and Linux)
+		ChaCha20Rng() {
+			std::random_device device;
+			for (auto& word : key) {
+				word = device();
+			}
+		}
+
+		explicit ChaCha20Rng(const std::array<uint8_t, 32>& key_bytes, const uint64_t stream = 0, const uint64_t counter = 0) :
+			counter(counter),
+			stream(stream) {
+			for (size_t i = 0; i < key.size(); i++) {
+				key[i] = load_le32(key_bytes.data() + i * 4);
+			}
+		}
+
+		static constexpr result_type min() {
+			return 0;
+		}
+
+		static constexpr result_type max() {
+			return UINT64_MAX;
+		}
+
+		result_type operator()() {
+			uint64_t value = 0;
+			fill(std::span<uint8_t>(reinterpret_cast<uint8_t*>(&value), sizeof(value)));
+			return value;
+		}
+
+		void fill(std::span<uint8_t> out) {
+			while (!out.empty()) {
+				if (used == buffer.size()) {
+					refill();
+				}
+				size_t count = (std::min)(out.size(), buffer.size() - used);
+				std::memcpy(out.data(), buffer.data() + used, count);
+				std::fill_n(buffer.data() + used, count, uint8_t(0));
+				used += count;
+				out = out.subspan(count);
+			}
+		}
+	private:
+		static uint32_t load_le32(const uint8_t* src) {
+			return static_cast<uint32_t>(src[0]) | (static_cast<uint32_t>(src[1]) << 8) |
+				(static_cast<uint32_t>(src[2]) << 16) | (static_cast<uint32_t>(src[3]) << 24);
+		}
+
+		static void quarter_round(std::array<uint32_t, 16>& x, const int a, const int b, const int c, const int d) {
+			x[a] += x[b]; x[d] = std::rotl(x[d] ^ x[a], 16);
+			x[c] += x[d]; x[b] = std::rotl(x[b] ^ x[c], 12);
+			x[a] += x[b]; x[d] = std::rotl(x[d] ^ x[a], 8);
+			x[c] += x[d]; x[b] = std::rotl(x[b] ^ x[c], 7);
+		}
+
+		void refill() {
+			for (size_t block = 0; block < BUFFER_BLOCKS; block++) {
+				std::array<uint32_t, 16> input = {
+					0x61707865, 0x3320646E, 0x79622D32, 0x6B206574,
+					key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+					static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32),
+					static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32)
+				};
+				auto x = input;
+				for (int round = 0; round < 10; round++) {
+					quarter_round(x, 0, 4, 8, 12);
+					quarter_round(x, 1, 5, 9, 13);
+					quarter_round(x, 2, 6, 10, 14);
+					quarter_round(x, 3, 7, 11, 15);
+					quarter_round(x, 0, 5, 10, 15);
+					quarter_round(x, 1, 6, 11, 12);
+					quarter_round(x, 2, 7, 8, 13);
+					quarter_round(x, 3, 4, 9, 14);
+				}
+				auto dst = buffer.data() + block * BLOCK_SIZE;
+				for (size_t i = 0; i < x.size(); i++) {
+					uint32_t word = x[i] + input[i];
+					dst[i * 4] = static_cast<uint8_t>(word);
+					dst[i * 4 + 1] = static_cast<uint8_t>(word >> 8);
+					dst[i * 4 + 2] = static_cast<uint8_t>(word >> 16);
+					dst[i * 4 + 3] = static_cast<uint8_t>(word >> 24);
+				}
+				counter++;
+			}
+			used = 0;
 		}
-		std::random_device device;
-		std::random_device::result_type data[(std::mt19937::state_size - 1) / sizeof(device()) + 1];
-		std::generate(std::begin(data), std::end(data), std::ref(device));
-		std::seed_seq seed_seq{ std::begin(data), std::end(data) };
-		return std::mt19937(seed_seq);
+
+		std::array<uint32_t, 8> key{};
+		uint64_t counter = 0;
+		uint64_t stream = 0;
+		std::array<uint8_t, BLOCK_SIZE * BUFFER_BLOCKS> buffer{};
+		size_t used = BLOCK_SIZE * BUFFER_BLOCKS;
+	};
+
+	// Engines are per thread and seeded from std::random_device on first use, so no locking is needed
+	inline Xoshiro256& fast_engine() {
+		thread_local Xoshiro256 engine((static_cast<uint64_t>(std::random_device{}()) << 32) | std::random_device{}());
+		return engine;
 	}
-	static auto rng_engine = rng_init(-1);
 
-	export template<std::integral T>
+	inline ChaCha20Rng& secure_engine() {
+		thread_local ChaCha20Rng engine{};
+		return engine;
+	}
+
+	// Protocol identifiers (transaction ids, tie-breakers, SSRCs), one call can fill thousands at once
+	inline void fill_secure(const std::span<uint8_t> out) {
+		secure_engine().fill(out);
+	}
+
+	inline void fill(const std::span<uint8_t> out) {
+		fast_engine().fill(out);
+	}
+
+	// uniform_int_distribution is undefined for char types and bool, so every integer is drawn as 64-bit and
+	// narrowed back, which is exact since result lies between 'min' and 'max'
+	template<typename T>
+	concept DrawableInteger = std::integral<T> && !std::same_as<std::remove_cv_t<T>, bool>;
+
+	template<typename T>
+	using DrawWide = std::conditional_t<std::is_signed_v<T>, int64_t, uint64_t>;
+
+	template<DrawableInteger T>
 	T draw_random(const T min, const T max) {
-		auto dist = std::uniform_int_distribution<T>(min, max);
-		return dist(rng_engine);
+		return static_cast<T>(std::uniform_int_distribution<DrawWide<T>>(min, max)(fast_engine()));
+	}
+
+	template<DrawableInteger T>
+	T draw_secure(const T min, const T max) {
+		return static_cast<T>(std::uniform_int_distribution<DrawWide<T>>(min, max)(secure_engine()));
 	}
 }
\ No newline at end of file
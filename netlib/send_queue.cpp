@@ -0,0 +1,112 @@
+module;
+
+#include <cstdint>
+
+module netlib:send_queue;
+import :log;
+import std;
+
+namespace net {
+	constexpr size_t SEND_QUEUE_BATCH = 64;
+
+	UdpSendQueue::UdpSendQueue(Reactor& reactor, const Socket socket, const size_t max_depth) :
+		reactor(reactor), socket(socket), max_depth(max_depth) {}
+
+	UdpSendQueue::~UdpSendQueue() {
+		watch_writable(false);
+	}
+
+	bool UdpSendQueue::send(const void* data, const size_t size, const Ipv4Address& address) {
+		// Anything parked must leave first, otherwise datagrams would be reordered
+		if (queue.empty()) {
+			UdpSendDatagram datagram{ data, size, address };
+			int sent = udp_ipv4_send_batch(socket, std::span<const UdpSendDatagram>(&datagram, 1));
+			if (sent == 1) {
+				return true;
+			}
+			if (sent < 0) {
+				drop_count++;
+				return false;
+			}
+		}
+		if (queue.size() >= max_depth) {
+			drop_count++;
+			return false;
+		}
+		auto bytes_ptr = reinterpret_cast<const uint8_t*>(data);
+		queue.emplace_back(Packet{ std::vector<uint8_t>(bytes_ptr, bytes_ptr + size), address });
+		bytes += size;
+		watch_writable(true);
+		return true;
+	}
+
+	size_t UdpSendQueue::depth() const {
+		return queue.size();
+	}
+
+	size_t UdpSendQueue::queued_bytes() const {
+		return bytes;
+	}
+
+	uint64_t UdpSendQueue::dropped() const {
+		return drop_count;
+	}
+
+	void UdpSendQueue::set_drain_callback(std::function<void()> on_drain) {
+		this->on_drain = std::move(on_drain);
+	}
+
+	void UdpSendQueue::flush() {
+		while (!queue.empty()) {
+			size_t count = (std::min)(queue.size(), SEND_QUEUE_BATCH);
+			batch.clear();
+			for (size_t i = 0; i < count; i++) {
+				batch.emplace_back(UdpSendDatagram{ queue[i].payload.data(), queue[i].payload.size(), queue[i].address });
+			}
+			int sent = udp_ipv4_send_batch(socket, batch);
+			if (sent < 0) {
+				// Front packet cannot be sent at all, drop it so the rest is not stuck behind it
+				log_error("Sending queued datagram failed, dropping it.");
+				sent = 1;
+				drop_count++;
+			}
+			for (int i = 0; i < sent; i++) {
+				bytes -= queue.front().payload.size();
+				queue.pop_front();
+			}
+			if (static_cast<size_t>(sent) < count) {
+				return;
+			}
+		}
+		watch_writable(false);
+		if (on_drain) {
+			on_drain();
+		}
+	}
+
+	void UdpSendQueue::watch_writable(const bool watch) {
+		if (watch == watching) {
+			return;
+		}
+		watching = watch;
+		auto on_write = watch ? SocketCallback([this](const Socket) { flush(); }) : SocketCallback{};
+		bool watched = false;
+		if (watch && !reactor.has_socket(socket)) {
+			registered_socket = reactor.add_socket(socket, {}, std::move(on_write));
+			watched = registered_socket;
+		}
+		else if (!watch && registered_socket) {
+			reactor.remove_socket(socket);
+			registered_socket = false;
+			return;
+		}
+		else {
+			watched = reactor.set_write_callback(socket, std::move(on_write));
+		}
+		if (watch && !watched) {
+			// Nothing will flush the queue, next parked packet tries to register again
+			log_error("Watching socket for writability failed, queued datagrams wait for next send.");
+			watching = false;
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+module;
+
+#include <cstdint>
+
+export module netlib:send_queue;
+import :socket;
+import :reactor;
+import std;
+
+export namespace net {
+	// Outgoing datagrams for one non-blocking socket. Packets go straight to the socket while it accepts them;
+	// when it would block they are copied into the queue and flushed in order once reactor reports the socket
+	// writable. Queue is bounded, callers watch depth() and drop or degrade before it fills.
+	class UdpSendQueue {
+	public:
+		UdpSendQueue(Reactor& reactor, const Socket socket, const size_t max_depth = 1024);
+		~UdpSendQueue();
+		UdpSendQueue(const UdpSendQueue&) = delete;
+		UdpSendQueue& operator=(const UdpSendQueue&) = delete;
+
+		// Returns false when packet was dropped because queue is full or socket failed
+		bool		send(const void* data, const size_t size, const Ipv4Address& address);
+		size_t		depth() const;
+		size_t		queued_bytes() const;
+		uint64_t	dropped() const;
+		// Runs on reactor thread every time queue becomes empty again
+		void		set_drain_callback(std::function<void()> on_drain);
+	private:
+		struct Packet {
+			std::vector<uint8_t> payload;
+			Ipv4Address address;
+		};
+
+		void flush();
+		void watch_writable(const bool watch);
+
+		Reactor& reactor;
+		Socket socket;
+		size_t max_depth;
+		std::deque<Packet> queue;
+		std::vector<UdpSendDatagram> batch;
+		size_t bytes = 0;
+		uint64_t drop_count = 0;
+		bool watching = false;
+		bool registered_socket = false;
+		std::function<void()> on_drain;
+	};
+}
\ No newline at end of file
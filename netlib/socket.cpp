@@ -1,15 +1,68 @@
 module;
 
-#include <WinSock2.h>
-#include <WS2tcpip.h>
-#include <Windows.h>
+#include <cstdint>
+#include "socket_platform.h"
 
 module netlib:socket;
 import :log;
+import :metrics;
 
 namespace net {
+	static SocketBackend* socket_backend = nullptr;
+
+	// Every send and receive path counts here, simulated backend included, would-block is not an error
+	struct SocketMetrics {
+		MetricCounter& sent_packets = metrics_counter("netlib_udp_sent_packets_total", "UDP datagrams sent.");
+		MetricCounter& sent_bytes = metrics_counter("netlib_udp_sent_bytes_total", "UDP payload bytes sent.");
+		MetricCounter& received_packets = metrics_counter("netlib_udp_received_packets_total", "UDP datagrams received.");
+		MetricCounter& received_bytes = metrics_counter("netlib_udp_received_bytes_total", "UDP payload bytes received.");
+		MetricCounter& send_errors = metrics_counter("netlib_udp_send_errors_total", "Failed UDP sends.");
+		MetricCounter& recv_errors = metrics_counter("netlib_udp_recv_errors_total", "Failed UDP receives.");
+	};
+
+	static SocketMetrics& socket_metrics() {
+		static SocketMetrics metrics{};
+		return metrics;
+	}
+
+	static void socket_count_sent(const uint64_t packets, const uint64_t bytes) {
+		auto& metrics = socket_metrics();
+		metrics.sent_packets.add(packets);
+		metrics.sent_bytes.add(bytes);
+	}
+
+	static void socket_count_received(const uint64_t packets, const uint64_t bytes) {
+		auto& metrics = socket_metrics();
+		metrics.received_packets.add(packets);
+		metrics.received_bytes.add(bytes);
+	}
+
+	void sock_set_backend(SocketBackend* backend) {
+		socket_backend = backend;
+	}
+
+	SocketBackend* sock_get_backend() {
+		return socket_backend;
+	}
+
+	uint64_t SocketBackend::now_us() const {
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+	}
+
+	uint64_t sock_now_us() {
+		if (socket_backend) {
+			return socket_backend->now_us();
+		}
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+	}
+
 	Socket udp_ipv4_init_socket() {
-		auto sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (socket_backend) {
+			return socket_backend->udp_ipv4_init_socket();
+		}
+		SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 		if (sock == INVALID_SOCKET) {
 			log_wsa_error("Creating socket failed.");
 			return 0;
@@ -48,31 +101,60 @@ namespace net {
 	}
 
 	std::string udp_ipv4_net_to_str(const uint32_t ip_net) {
-		sockaddr_in address{};
-		address.sin_family = AF_INET;
-		address.sin_addr.s_addr = htonl(ip_net);
-		address.sin_port = 0;
-		char ip[16];
-		inet_ntop(AF_INET, &address.sin_addr, ip, 16);
-		return std::string(ip);
+		std::array<char, IPV4_STR_CAPACITY> ip{};
+		return std::string(ip.data(), ipv4_to_chars(ip_net, ip));
 	}
 
-	int udp_ipv4_send_packet(const Socket socket, const void* data, const size_t size, const Ipv4Address& address) {
+	static int udp_ipv4_send_to(const Socket socket, const void* data, const size_t size, const Ipv4Address& address, bool* would_block) {
 		struct sockaddr_in addr {};
 		addr.sin_family = AF_INET;
 		addr.sin_port = htons(address.port);
 		addr.sin_addr.s_addr = htonl(address.ip);
 		auto send_bytes = sendto(socket, reinterpret_cast<const char*>(data), static_cast<int>(size), 0, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+		if (send_bytes < 0 && would_block && WSAGetLastError() == WSAEWOULDBLOCK) {
+			*would_block = true;
+			return send_bytes;
+		}
 		if (send_bytes <= 0) {
 			log_wsa_error("Sending data to stun server failed.");
 		}
+		if (send_bytes < 0) {
+			socket_metrics().send_errors.add();
+		}
+		else {
+			socket_count_sent(1, send_bytes);
+		}
 		return send_bytes;
 	}
 
-	int udp_ipv4_recv_packet(const Socket socket, void* data, const size_t size, Ipv4Address* address) {
+	int udp_ipv4_send_packet(const Socket socket, const void* data, const size_t size, const Ipv4Address& address) {
+		if (socket_backend) {
+			int send_bytes = socket_backend->udp_ipv4_send_packet(socket, data, size, address);
+			// 0 for non-empty datagram means backend would block and nothing left, same as in batch send
+			if (send_bytes > 0 || (send_bytes == 0 && size == 0)) {
+				socket_count_sent(1, send_bytes);
+			}
+			return send_bytes;
+		}
+		return udp_ipv4_send_to(socket, data, size, address, nullptr);
+	}
+
+	static int udp_ipv4_recv_from(const Socket socket, void* data, const size_t size, Ipv4Address* address, bool* would_block, bool* truncated = nullptr) {
 		struct sockaddr_in recv_addr {};
-		int recv_addr_length = sizeof(recv_addr);
+		socklen_t recv_addr_length = sizeof(recv_addr);
 		int recv_bytes = recvfrom(socket, reinterpret_cast<char*>(data), static_cast<int>(size), 0, reinterpret_cast<sockaddr*>(&recv_addr), &recv_addr_length);
+		if (recv_bytes < 0 && truncated && WSAGetLastError() == WSAEMSGSIZE) {
+			// Winsock fills buffer with start of longer datagram and reports error, rest of it is already discarded
+			*truncated = true;
+			recv_bytes = static_cast<int>(size);
+		}
+		if (recv_bytes < 0 && WSAGetLastError() == WSAEWOULDBLOCK) {
+			// Drained non-blocking socket, callers poll until this happens so it is neither logged nor counted
+			if (would_block) {
+				*would_block = true;
+			}
+			return recv_bytes;
+		}
 		if (recv_bytes <= 0) {
 			log_wsa_error("Receiving bytes failed.");
 		}
@@ -80,15 +162,79 @@ namespace net {
 			address->port = ntohs(recv_addr.sin_port);
 			address->ip = ntohl(recv_addr.sin_addr.s_addr);
 		}
+		if (recv_bytes < 0) {
+			socket_metrics().recv_errors.add();
+		}
+		else {
+			socket_count_received(1, recv_bytes);
+		}
+		return recv_bytes;
+	}
+
+	static int udp_ipv4_backend_recv(const Socket socket, void* data, const size_t size, Ipv4Address* address) {
+		int recv_bytes = socket_backend->udp_ipv4_recv_packet(socket, data, size, address);
+		if (recv_bytes >= 0) {
+			socket_count_received(1, recv_bytes);
+		}
+		return recv_bytes;
+	}
+
+	int udp_ipv4_recv_packet(const Socket socket, void* data, const size_t size, Ipv4Address* address) {
+		if (socket_backend) {
+			return udp_ipv4_backend_recv(socket, data, size, address);
+		}
+		return udp_ipv4_recv_from(socket, data, size, address, nullptr);
+	}
+
+	static uint64_t wall_clock_ns() {
+		auto now = std::chrono::system_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+	}
+
+	bool udp_enable_recv_info(const Socket socket, const uint8_t flags) {
+		if (flags == 0) {
+			return true;
+		}
+		if (!socket_backend) {
+			log_warning("Stack receive timestamps and drop counters are not available from Winsock.");
+		}
+		return false;
+	}
+
+	static int udp_ipv4_recv_msg(const Socket socket, void* data, const size_t size, Ipv4Address* address, UdpRecvInfo* info) {
+		int recv_bytes = udp_ipv4_recv_from(socket, data, size, address, nullptr);
+		*info = UdpRecvInfo{ wall_clock_ns(), 0, false };
+		return recv_bytes;
+	}
+
+	int udp_ipv4_recv_packet(const Socket socket, void* data, const size_t size, Ipv4Address* address, UdpRecvInfo* info) {
+		if (!info) {
+			return udp_ipv4_recv_packet(socket, data, size, address);
+		}
+		if (socket_backend) {
+			*info = UdpRecvInfo{ socket_backend->now_us() * 1000, 0, false };
+			return udp_ipv4_backend_recv(socket, data, size, address);
+		}
+		return udp_ipv4_recv_msg(socket, data, size, address, info);
+	}
+
+	int udp_ipv4_recv_packet(const Socket socket, PacketBuffer& buffer, Ipv4Address* address, UdpRecvInfo* info) {
+		int recv_bytes = udp_ipv4_recv_packet(socket, buffer.data(), buffer.capacity(), address, info);
+		buffer.resize((recv_bytes > 0) ? recv_bytes : 0);
 		return recv_bytes;
 	}
 
 	int udp_ipv4_recv_packet_block(const Socket socket, void* data, const size_t size, Ipv4Address* address, const uint32_t timeout_us) {
-		FD_SET set{};
-		FD_SET(socket, &set);
-		timeval timeout{};
-		timeout.tv_usec = timeout_us;
-		auto socket_count = select(0, &set, nullptr, nullptr, (timeout_us == 0) ? nullptr : &timeout);
+		// Queued packet is taken right away, waiting is needed only when socket is drained
+		if (!socket_backend) {
+			bool would_block = false;
+			auto recv_bytes = udp_ipv4_recv_from(socket, data, size, address, &would_block);
+			if (!would_block) {
+				return recv_bytes;
+			}
+		}
+		std::vector<Socket> ready;
+		auto socket_count = sock_wait_readable(std::span<const Socket>(&socket, 1), ready, timeout_us);
 		if (socket_count <= 0) {
 			log_error("Waiting for packet timed out.");
 			return 0;
@@ -96,7 +242,218 @@ namespace net {
 		return udp_ipv4_recv_packet(socket, data, size, address);
 	}
 
+	static int udp_ipv4_send_batch_loop(const Socket socket, const std::span<const UdpSendDatagram> datagrams) {
+		int sent = 0;
+		for (const auto& datagram : datagrams) {
+			int send_bytes = 0;
+			if (socket_backend) {
+				send_bytes = socket_backend->udp_ipv4_send_packet(socket, datagram.data, datagram.size, datagram.address);
+				if (send_bytes == 0 && datagram.size > 0) {
+					break;
+				}
+				if (send_bytes >= 0) {
+					socket_count_sent(1, send_bytes);
+				}
+			}
+			else {
+				bool would_block = false;
+				send_bytes = udp_ipv4_send_to(socket, datagram.data, datagram.size, datagram.address, &would_block);
+				if (would_block) {
+					break;
+				}
+			}
+			if (send_bytes < 0) {
+				return (sent > 0) ? sent : -1;
+			}
+			sent++;
+		}
+		return sent;
+	}
+
+	static int udp_ipv4_recv_batch_loop(const Socket socket, const std::span<UdpRecvDatagram> datagrams) {
+		int received = 0;
+		for (auto& datagram : datagrams) {
+			int recv_bytes = 0;
+			datagram.truncated = false;
+			if (socket_backend) {
+				recv_bytes = udp_ipv4_backend_recv(socket, datagram.data, datagram.capacity, &datagram.address);
+				if (recv_bytes < 0) {
+					break;
+				}
+			}
+			else {
+				bool would_block = false;
+				recv_bytes = udp_ipv4_recv_from(socket, datagram.data, datagram.capacity, &datagram.address, &would_block, &datagram.truncated);
+				if (would_block) {
+					break;
+				}
+				if (recv_bytes < 0) {
+					return (received > 0) ? received : -1;
+				}
+			}
+			datagram.size = recv_bytes;
+			received++;
+		}
+		return received;
+	}
+
+	int udp_ipv4_send_batch(const Socket socket, const std::span<const UdpSendDatagram> datagrams) {
+		return udp_ipv4_send_batch_loop(socket, datagrams);
+	}
+
+	int udp_ipv4_recv_batch(const Socket socket, const std::span<UdpRecvDatagram> datagrams) {
+		return udp_ipv4_recv_batch_loop(socket, datagrams);
+	}
+
+	static int sock_timeout_to_ms(const uint32_t timeout_us) {
+		return (timeout_us == 0) ? -1 : static_cast<int>((timeout_us + 999) / 1000);
+	}
+
+	int sock_wait_readable(const std::span<const Socket> sockets, std::vector<Socket>& ready, const uint32_t timeout_us) {
+		if (socket_backend) {
+			return socket_backend->wait_readable(sockets, ready, timeout_us);
+		}
+		ready.clear();
+		std::vector<WSAPOLLFD> fds(sockets.size());
+		for (size_t i = 0; i < sockets.size(); i++) {
+			fds[i].fd = static_cast<SOCKET>(sockets[i]);
+			fds[i].events = POLLIN;
+		}
+		auto socket_count = WSAPoll(fds.data(), static_cast<unsigned long>(fds.size()), sock_timeout_to_ms(timeout_us));
+		if (socket_count < 0) {
+			log_wsa_error("Waiting for sockets ready to be read failed.");
+			return socket_count;
+		}
+		for (size_t i = 0; i < fds.size(); i++) {
+			if (fds[i].revents & (POLLIN | POLLERR | POLLHUP)) {
+				ready.push_back(sockets[i]);
+			}
+		}
+		return socket_count;
+	}
+
+	struct SocketPoller::State {
+		std::unordered_map<Socket, uint8_t> registered;
+		std::vector<WSAPOLLFD> fds;
+		std::vector<Socket> backend_sockets;
+		std::vector<Socket> backend_ready;
+	};
+
+	static short sock_poll_to_wsapoll(const uint8_t events) {
+		return ((events & SOCK_POLL_READ) ? POLLIN : 0) | ((events & SOCK_POLL_WRITE) ? POLLOUT : 0);
+	}
+
+	SocketPoller::SocketPoller() :
+		state(std::make_unique<State>()) {
+	}
+
+	SocketPoller::~SocketPoller() {
+	}
+
+	bool SocketPoller::add(const Socket socket, const uint8_t events) {
+		if (state->registered.contains(socket)) {
+			log_error("Socket is already registered in poller.");
+			return false;
+		}
+		if (!socket_backend) {
+			WSAPOLLFD fd{};
+			fd.fd = static_cast<SOCKET>(socket);
+			fd.events = sock_poll_to_wsapoll(events);
+			state->fds.push_back(fd);
+		}
+		state->registered[socket] = events;
+		return true;
+	}
+
+	bool SocketPoller::modify(const Socket socket, const uint8_t events) {
+		auto registered = state->registered.find(socket);
+		if (registered == state->registered.end()) {
+			log_error("Modifying socket not registered in poller.");
+			return false;
+		}
+		if (!socket_backend) {
+			for (auto& fd : state->fds) {
+				if (fd.fd == static_cast<SOCKET>(socket)) {
+					fd.events = sock_poll_to_wsapoll(events);
+				}
+			}
+		}
+		registered->second = events;
+		return true;
+	}
+
+	bool SocketPoller::remove(const Socket socket) {
+		if (state->registered.erase(socket) == 0) {
+			return false;
+		}
+		if (!socket_backend) {
+			std::erase_if(state->fds, [socket](const WSAPOLLFD& fd) { return fd.fd == static_cast<SOCKET>(socket); });
+		}
+		return true;
+	}
+
+	size_t SocketPoller::size() const {
+		return state->registered.size();
+	}
+
+	int SocketPoller::wait(std::vector<SocketPollEvent>& ready, const uint32_t timeout_us) {
+		ready.clear();
+		if (socket_backend) {
+			state->backend_sockets.clear();
+			for (const auto& [socket, events] : state->registered) {
+				if (events & SOCK_POLL_WRITE) {
+					ready.emplace_back(SocketPollEvent{ socket, SOCK_POLL_WRITE });
+				}
+				if (events & SOCK_POLL_READ) {
+					state->backend_sockets.push_back(socket);
+				}
+			}
+			// Simulated sends never block, do not wait for reads when something is writable. Waiting with no
+			// sockets still lets simulated clock run to the timeout.
+			if (!ready.empty()) {
+				return static_cast<int>(ready.size());
+			}
+			int socket_count = socket_backend->wait_readable(state->backend_sockets, state->backend_ready, timeout_us);
+			for (const auto socket : state->backend_ready) {
+				ready.emplace_back(SocketPollEvent{ socket, SOCK_POLL_READ });
+			}
+			return (socket_count < 0) ? socket_count : static_cast<int>(ready.size());
+		}
+		if (state->fds.empty()) {
+			return 0;
+		}
+		int count = WSAPoll(state->fds.data(), static_cast<unsigned long>(state->fds.size()), sock_timeout_to_ms(timeout_us));
+		if (count < 0) {
+			log_wsa_error("Waiting on WSAPoll failed.");
+			return count;
+		}
+		for (const auto& fd : state->fds) {
+			uint8_t events = 0;
+			if (fd.revents & (POLLIN | POLLERR | POLLHUP)) {
+				events |= SOCK_POLL_READ;
+			}
+			if (fd.revents & POLLOUT) {
+				events |= SOCK_POLL_WRITE;
+			}
+			if (events) {
+				ready.emplace_back(SocketPollEvent{ static_cast<Socket>(fd.fd), events });
+			}
+		}
+		return static_cast<int>(ready.size());
+	}
+
+	void sock_close(const Socket socket) {
+		if (socket_backend) {
+			socket_backend->close_socket(socket);
+			return;
+		}
+		closesocket(socket);
+	}
+
 	Ipv4Address sock_get_src_address(const Socket socket) {
+		if (socket_backend) {
+			return socket_backend->get_src_address(socket);
+		}
 		struct sockaddr_in sin {};
 		socklen_t len = sizeof(sin);
 		if (getsockname(socket, reinterpret_cast<sockaddr*>(&sin), &len) != SOCKET_ERROR) {
@@ -111,6 +468,42 @@ namespace net {
 		return {};
 	}
 
+	std::vector<Ipv4Address> sock_get_host_addresses() {
+		if (socket_backend) {
+			return socket_backend->get_host_addresses();
+		}
+		char host_name[128];
+		if (gethostname(host_name, sizeof(host_name)) == SOCKET_ERROR) {
+			log_wsa_error("Getting hostname failed.");
+			return {};
+		}
+		addrinfo hints{};
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_protocol = IPPROTO_UDP;
+		addrinfo* host_infos{};
+
+		if (getaddrinfo(host_name, nullptr, &hints, &host_infos) != 0) {
+			log_wsa_error("Getting hostinfo failed.");
+			return {};
+		}
+
+		std::vector<Ipv4Address> addresses;
+		for (addrinfo* addr = host_infos; addr != nullptr; addr = addr->ai_next) {
+			if (addr->ai_family != AF_INET || addr->ai_socktype != SOCK_DGRAM) {
+				log_info("Incompatibile address. Looking for next one.");
+				continue;
+			}
+			sockaddr_in* resolved_addr = reinterpret_cast<sockaddr_in*>(addr->ai_addr);
+			if (ntohl(resolved_addr->sin_addr.s_addr) == INADDR_LOOPBACK) {
+				continue;
+			}
+			addresses.emplace_back(Ipv4Address{ ntohl(resolved_addr->sin_addr.s_addr), 0 });
+		}
+		freeaddrinfo(host_infos);
+		return addresses;
+	}
+
 	std::string ipv4_net_to_str(const std::span<const uint8_t, 4> src) {
 		std::string ret;
 		ret.reserve(16);
@@ -131,4 +524,106 @@ namespace net {
 		ret.erase(ret.size() - 1);
 		return ret;
 	}
+
+	size_t ipv4_to_chars(const uint32_t ip, const std::span<char, IPV4_STR_CAPACITY> out) {
+		char* pos = out.data();
+		char* end = out.data() + out.size();
+		for (int shift = 24; shift >= 0; shift -= 8) {
+			pos = std::to_chars(pos, end, (ip >> shift) & 0xFF).ptr;
+			if (shift != 0) {
+				*pos++ = '.';
+			}
+		}
+		return pos - out.data();
+	}
+
+	size_t ipv6_to_chars(const std::array<uint8_t, 16>& ip, const std::span<char, IPV6_STR_CAPACITY> out) {
+		in6_addr addr{};
+		std::memcpy(&addr, ip.data(), ip.size());
+		if (inet_ntop(AF_INET6, &addr, out.data(), out.size()) == nullptr) {
+			log_wsa_error("Converting IPv6 address to text failed.");
+			return 0;
+		}
+		return std::strlen(out.data());
+	}
+
+	Socket udp_ipv6_init_socket() {
+		if (socket_backend) {
+			log_error("Socket backend does not support IPv6.");
+			return 0;
+		}
+		SOCKET sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+		if (sock == INVALID_SOCKET) {
+			log_wsa_error("Creating IPv6 socket failed.");
+			return 0;
+		}
+		u_long mode = 1;
+		if (ioctlsocket(sock, FIONBIO, &mode) != NO_ERROR) {
+			log_wsa_error("Setting socket as non-blocking failed.");
+			closesocket(sock);
+			return 0;
+		}
+
+		struct sockaddr_in6 addr {};
+		addr.sin6_family = AF_INET6;
+		addr.sin6_port = htons(0);
+		addr.sin6_addr = in6addr_any;
+		if (bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR) {
+			log_wsa_error("Binding IPv6 socket failed.");
+			closesocket(sock);
+			return 0;
+		}
+		return static_cast<Socket>(sock);
+	}
+
+	int udp_ipv6_send_packet(const Socket socket, const void* data, const size_t size, const Ipv6Address& address) {
+		if (socket_backend) {
+			log_error("Socket backend does not support IPv6.");
+			return -1;
+		}
+		struct sockaddr_in6 addr {};
+		addr.sin6_family = AF_INET6;
+		addr.sin6_port = htons(address.port);
+		addr.sin6_scope_id = address.scope_id;
+		std::memcpy(&addr.sin6_addr, address.ip.data(), address.ip.size());
+		auto send_bytes = sendto(socket, reinterpret_cast<const char*>(data), static_cast<int>(size), 0, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+		if (send_bytes <= 0) {
+			log_wsa_error("Sending IPv6 packet failed.");
+		}
+		if (send_bytes < 0) {
+			socket_metrics().send_errors.add();
+		}
+		else {
+			socket_count_sent(1, send_bytes);
+		}
+		return send_bytes;
+	}
+
+	int udp_ipv6_recv_packet(const Socket socket, void* data, const size_t size, Ipv6Address* address) {
+		if (socket_backend) {
+			log_error("Socket backend does not support IPv6.");
+			return -1;
+		}
+		struct sockaddr_in6 recv_addr {};
+		socklen_t recv_addr_length = sizeof(recv_addr);
+		int recv_bytes = recvfrom(socket, reinterpret_cast<char*>(data), static_cast<int>(size), 0, reinterpret_cast<sockaddr*>(&recv_addr), &recv_addr_length);
+		if (recv_bytes < 0 && WSAGetLastError() == WSAEWOULDBLOCK) {
+			return recv_bytes;
+		}
+		if (recv_bytes <= 0) {
+			log_wsa_error("Receiving bytes failed.");
+		}
+		else if (address) {
+			std::memcpy(address->ip.data(), &recv_addr.sin6_addr, address->ip.size());
+			address->port = ntohs(recv_addr.sin6_port);
+			address->scope_id = recv_addr.sin6_scope_id;
+		}
+		if (recv_bytes < 0) {
+			socket_metrics().recv_errors.add();
+		}
+		else {
+			socket_count_received(1, recv_bytes);
+		}
+		return recv_bytes;
+	}
 }
\ No newline at end of file
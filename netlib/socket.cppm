@@ -3,6 +3,7 @@ module;
 #include <cstdint>
 
 export module netlib:socket;
+import :packet_pool;
 import std;
 
 export namespace net {
@@ -11,9 +12,103 @@ export namespace net {
 	struct Ipv4Address {
 		uint32_t ip;
 		uint16_t port;
+		bool operator==(const Ipv4Address&) const = default;
 	};
 
+	// Address bytes are kept in network order
+	struct Ipv6Address {
+		std::array<uint8_t, 16> ip;
+		uint16_t port;
+		uint32_t scope_id;
+		bool operator==(const Ipv6Address&) const = default;
+	};
+
+	using IpAddress = std::variant<Ipv4Address, Ipv6Address>;
+
+	struct UdpSendDatagram {
+		const void* data;
+		size_t size;
+		Ipv4Address address;
+	};
+
+	struct UdpRecvDatagram {
+		void* data;
+		size_t capacity;
+		size_t size;			// set on receive, datagrams longer than capacity are truncated
+		Ipv4Address address;
+		bool truncated;			// set when datagram did not fit and its tail was discarded (Winsock WSAEMSGSIZE)
+	};
+
+	// Winsock stamps nothing for plain UDP sockets, so receive time is system_clock in nanoseconds read right after
+	// recvfrom returns and 'kernel_timestamp' stays false. With socket backend it is backend time, sock_now_us() * 1000.
+	struct UdpRecvInfo {
+		uint64_t timestamp_ns;
+		uint32_t drops;			// datagrams socket dropped on full receive buffer, Winsock does not report it so always 0
+		bool kernel_timestamp;
+	};
+
+	// Requests for stack receive timestamps and drop counter, neither is available from Winsock recvfrom
+	constexpr uint8_t UDP_RECV_TIMESTAMP = 0x01;
+	constexpr uint8_t UDP_RECV_DROPS = 0x02;
+
+	constexpr size_t IPV4_STR_CAPACITY = 16;
+	constexpr size_t IPV6_STR_CAPACITY = 46;
+
+	// Replaces OS calls made by udp_ipv4_* and sock_* functions (e.g. with in-process network simulator)
+	class SocketBackend {
+	public:
+		virtual ~SocketBackend() = default;
+		virtual Socket		udp_ipv4_init_socket() = 0;
+		virtual void		close_socket(const Socket socket) = 0;
+		// Returning 0 for non-empty packet means socket would block
+		virtual int			udp_ipv4_send_packet(const Socket socket, const void* data, const size_t size, const Ipv4Address& address) = 0;
+		virtual int			udp_ipv4_recv_packet(const Socket socket, void* data, const size_t size, Ipv4Address* address) = 0;
+		virtual int			wait_readable(const std::span<const Socket> sockets, std::vector<Socket>& ready, const uint32_t timeout_us) = 0;
+		virtual Ipv4Address	get_src_address(const Socket socket) = 0;
+		virtual std::vector<Ipv4Address> get_host_addresses() = 0;
+		// Monotonic time seen by code waiting on this backend's sockets, steady clock by default
+		virtual uint64_t	now_us() const;
+	};
+
+	// Backend is not synchronized, set it before any socket is created
+	void			sock_set_backend(SocketBackend* backend);
+	SocketBackend*	sock_get_backend();
+
+	constexpr uint8_t SOCK_POLL_READ = 0x01;
+	constexpr uint8_t SOCK_POLL_WRITE = 0x02;
+
+	struct SocketPollEvent {
+		Socket socket;
+		uint8_t events;		// SOCK_POLL_* flags, errors are reported as readable
+	};
+
+	// Readiness notification for many sockets over WSAPoll, so there is no FD_SETSIZE limit. One wait still
+	// scans every registered socket. With socket backend installed read readiness comes from the backend and
+	// sockets registered for writing are always reported writable.
+	class SocketPoller {
+	public:
+		SocketPoller();
+		~SocketPoller();
+		SocketPoller(const SocketPoller&) = delete;
+		SocketPoller& operator=(const SocketPoller&) = delete;
+
+		bool	add(const Socket socket, const uint8_t events = SOCK_POLL_READ);
+		bool	modify(const Socket socket, const uint8_t events);
+		bool	remove(const Socket socket);
+		size_t	size() const;
+		// Timeout 0 waits without limit, like sock_wait_readable(). Returns number of ready sockets, -1 on error.
+		int		wait(std::vector<SocketPollEvent>& ready, const uint32_t timeout_us = 0);
+	private:
+		struct State;
+		std::unique_ptr<State> state;
+	};
+
+	// Monotonic clock for socket timeouts, follows backend time when backend is installed
+	uint64_t	sock_now_us();
 	Ipv4Address sock_get_src_address(const Socket socket);
+	std::vector<Ipv4Address> sock_get_host_addresses();
+	void		sock_close(const Socket socket);
+	int			sock_wait_readable(const std::span<const Socket> sockets, std::vector<Socket>& ready, const uint32_t timeout_us = 0);
 
 	// UDP
 	Socket		udp_ipv4_init_socket();
@@ -21,6 +116,72 @@ export namespace net {
 	std::string udp_ipv4_net_to_str(const uint32_t ip_net);
 	int			udp_ipv4_send_packet(const Socket socket, const void* data, const size_t size, const Ipv4Address& address);
 	int			udp_ipv4_recv_packet(const Socket socket, void* data, const size_t size, Ipv4Address* address = nullptr);
+	// Receives into the whole capacity of pooled buffer and sets its size to received bytes
+	int			udp_ipv4_recv_packet(const Socket socket, PacketBuffer& buffer, Ipv4Address* address = nullptr, UdpRecvInfo* info = nullptr);
+	// Returns false when any flag is requested, UdpRecvInfo then carries user-space timestamp and no drops
+	bool		udp_enable_recv_info(const Socket socket, const uint8_t flags);
+	int			udp_ipv4_recv_packet(const Socket socket, void* data, const size_t size, Ipv4Address* address, UdpRecvInfo* info);
 	int			udp_ipv4_recv_packet_block(const Socket socket, void* data, const size_t size, Ipv4Address* address = nullptr, const uint32_t timeout_us = 0);
+	// Batch variants take many datagrams per call, but Winsock has no sendmmsg/recvmmsg, so each datagram is still
+	// one sendto/recvfrom. They save caller's loop and error handling, not syscalls.
+	// Return number of datagrams processed, which is less than requested when socket would block, or -1 on error.
+	// Datagram longer than its buffer is returned cut to capacity with 'truncated' set, not as an error.
+	int			udp_ipv4_send_batch(const Socket socket, const std::span<const UdpSendDatagram> datagrams);
+	int			udp_ipv4_recv_batch(const Socket socket, const std::span<UdpRecvDatagram> datagrams);
 	std::string ipv4_net_to_str(const std::span<const uint8_t, 4> src);
-}
\ No newline at end of file
+	// Write address text (without port) into 'out', return number of characters written
+	size_t		ipv4_to_chars(const uint32_t ip, const std::span<char, IPV4_STR_CAPACITY> out);
+	size_t		ipv6_to_chars(const std::array<uint8_t, 16>& ip, const std::span<char, IPV6_STR_CAPACITY> out);
+
+	Socket		udp_ipv6_init_socket();
+	int			udp_ipv6_send_packet(const Socket socket, const void* data, const size_t size, const Ipv6Address& address);
+	int			udp_ipv6_recv_packet(const Socket socket, void* data, const size_t size, Ipv6Address* address = nullptr);
+}
+
+// Addresses are formatted as 'ip:port', or just 'ip' when port is 0. IPv6 with port is written as '[ip]:port'.
+template<>
+struct std::formatter<net::Ipv4Address> {
+	constexpr auto parse(std::format_parse_context& ctx) {
+		return ctx.begin();
+	}
+
+	template<class FormatContext>
+	auto format(const net::Ipv4Address& address, FormatContext& ctx) const {
+		std::array<char, net::IPV4_STR_CAPACITY> ip{};
+		auto size = net::ipv4_to_chars(address.ip, ip);
+		auto out = std::copy_n(ip.data(), size, ctx.out());
+		if (address.port != 0) {
+			out = std::format_to(out, ":{}", address.port);
+		}
+		return out;
+	}
+};
+
+template<>
+struct std::formatter<net::Ipv6Address> {
+	constexpr auto parse(std::format_parse_context& ctx) {
+		return ctx.begin();
+	}
+
+	template<class FormatContext>
+	auto format(const net::Ipv6Address& address, FormatContext& ctx) const {
+		std::array<char, net::IPV6_STR_CAPACITY> ip{};
+		auto size = net::ipv6_to_chars(address.ip, ip);
+		if (address.port == 0) {
+			return std::copy_n(ip.data(), size, ctx.out());
+		}
+		return std::format_to(ctx.out(), "[{}]:{}", std::string_view(ip.data(), size), address.port);
+	}
+};
+
+template<>
+struct std::formatter<net::IpAddress> {
+	constexpr auto parse(std::format_parse_context& ctx) {
+		return ctx.begin();
+	}
+
+	template<class FormatContext>
+	auto format(const net::IpAddress& address, FormatContext& ctx) const {
+		return std::visit([&ctx](const auto& addr) { return std::format_to(ctx.out(), "{}", addr); }, address);
+	}
+};
\ No newline at end of file
@@ -0,0 +1,6 @@
+#pragma once
+
+// Winsock headers shared by netlib sources. netlib targets Windows only: the solution builds nothing else, so
+// there are no POSIX code paths to keep in sync.
+#include <WinSock2.h>
+#include <WS2tcpip.h>
@@ -1,7 +1,6 @@
 module;
 
-#include "WinSock2.h"
-#include "WS2tcpip.h"
+#include "socket_platform.h"
 
 #include <assert.h>
 #include <cstdint>
@@ -313,10 +312,8 @@ namespace net {
 	}
 
 	void Stun::randomize_transaction_id() {
-		uint64_t t1 = rng::draw_random<uint64_t>(0, UINT64_MAX);
-		uint32_t t2 = rng::draw_random<uint32_t>(0, UINT32_MAX);
-		std::memcpy(transaction_id.data(), &t1, sizeof(t1));
-		std::memcpy(transaction_id.data() + sizeof(t1), &t2, sizeof(t2));
+		// Off-path attackers must not guess ids to spoof responses (RFC 8489 section 6)
+		rng::fill_secure(transaction_id);
 	}
 
 	std::optional<Stun> Stun::read_from(ByteNetworkReader& src) {